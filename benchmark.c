@@ -1,315 +1,942 @@
-/* Performance benchmark tests for multipart parser
- * Measures throughput and efficiency
+/* Performance benchmark harness for multipart parser
+ * Times realistic corpora over a sweep of chunk sizes with a monotonic
+ * clock and, where the kernel allows it, hardware counters. Results are
+ * printed as a table or as JSON, and can be compared against a saved JSON
+ * baseline to fail a build when throughput regresses. --worst-case times
+ * adversarial corpora instead, at two sizes, and fails if the time per byte
+ * grows with the input.
+ *
+ * Usage: benchmark [--json] [--quick] [--baseline FILE] [--threshold PCT]
+ *        benchmark --worst-case [--json] [--quick] [--growth-limit X]
+ *                  [FUZZ_INPUT...]
  */
+/* clock_gettime(), plus syscall() for perf_event_open() on Linux */
+#define _POSIX_C_SOURCE 199309L
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "multipart_parser.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 
-/* Simple callback that just counts */
+#if defined(__linux__) && !defined(BENCH_NO_PERF)
+#define BENCH_HAVE_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_BOUNDARY "----bench7MA4YWxkTrZu0gW"
+
+/* Chunk sizes of the sweep; 0 parses each body in one call */
+static const size_t bench_chunks[] = {16, 1460, 16384, 0};
+#define BENCH_CHUNK_COUNT (sizeof(bench_chunks) / sizeof(bench_chunks[0]))
+
+/* Worst-case mode: one-byte feeds and one call per body */
+static const size_t worst_chunks[] = {1, 0};
+#define WORST_CHUNK_COUNT (sizeof(worst_chunks) / sizeof(worst_chunks[0]))
+
+/* Worst-case corpora are timed at a size and at WORST_GROWTH_FACTOR times
+ * that size; a linear parser takes the same time per byte for both */
+#define WORST_GROWTH_FACTOR 4
+
+/* Simple callbacks that just count */
 typedef struct {
     size_t total_bytes;
     int part_count;
     int callback_count;  /* Track number of callbacks for granularity metrics */
 } perf_data;
 
-int on_part_data_perf(multipart_parser* p, const char *at, size_t length) {
+static int on_part_data_perf(multipart_parser* p, const char *at, size_t length) {
     perf_data *data = (perf_data*)multipart_parser_get_data(p);
+    (void)at;
     data->total_bytes += length;
     data->callback_count++;  /* Track callback frequency */
     return 0;
 }
 
-int on_part_begin_perf(multipart_parser* p) {
+static int on_header_perf(multipart_parser* p, const char *at, size_t length) {
+    perf_data *data = (perf_data*)multipart_parser_get_data(p);
+    (void)at;
+    (void)length;
+    data->callback_count++;
+    return 0;
+}
+
+static int on_part_begin_perf(multipart_parser* p) {
     perf_data *data = (perf_data*)multipart_parser_get_data(p);
     data->part_count++;
     return 0;
 }
 
-/* Helper to build multipart data */
-size_t build_multipart_data(char *buffer, const char *boundary,
-                            const char *content, size_t content_len,
-                            int num_parts) {
-    size_t pos = 0;
-    int i;
+/* ---- Corpora ---- */
 
-    for (i = 0; i < num_parts; i++) {
-        /* Boundary */
-        memcpy(buffer + pos, boundary, strlen(boundary));
-        pos += strlen(boundary);
+typedef struct {
+    const char *name;
+    const char *boundary;       /* NULL for BENCH_BOUNDARY */
+    char *body;
+    size_t length;
+    int parts;                  /* < 0: any parts, parse errors allowed */
+} corpus;
+
+/* Deterministic byte generator, so every run parses the same corpus */
+static unsigned long bench_seed = 12345;
+
+static unsigned char bench_random(void) {
+    bench_seed = (bench_seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+    return (unsigned char)(bench_seed >> 16);
+}
+
+/* Append a delimiter line and part headers; the first part has no CRLF
+ * in front of its delimiter */
+static size_t put_part_start(char *buffer, size_t pos, int first,
+                             const char *headers) {
+    if (!first) {
         buffer[pos++] = '\r';
         buffer[pos++] = '\n';
+    }
+    pos += sprintf(buffer + pos, "--%s\r\n%s\r\n", BENCH_BOUNDARY, headers);
+    return pos;
+}
 
-        /* Headers */
-        memcpy(buffer + pos, "Content-Type: text/plain\r\n\r\n", 28);
-        pos += 28;
+static size_t put_body_end(char *buffer, size_t pos) {
+    pos += sprintf(buffer + pos, "\r\n--%s--\r\n", BENCH_BOUNDARY);
+    return pos;
+}
 
-        /* Content */
-        memcpy(buffer + pos, content, content_len);
-        pos += content_len;
+/* Text parts, as timed by the original benchmark */
+static int build_text(corpus *c, size_t part_size, int parts) {
+    size_t pos = 0;
+    size_t i;
+    int k;
 
-        if (i < num_parts - 1) {
-            /* Part separator */
-            buffer[pos++] = '\r';
-            buffer[pos++] = '\n';
-            buffer[pos++] = '-';
-            buffer[pos++] = '-';
+    c->body = (char*)malloc((part_size + 256) * parts + 256);
+    if (c->body == NULL) {
+        return -1;
+    }
+    for (k = 0; k < parts; k++) {
+        pos = put_part_start(c->body, pos, k == 0,
+                             "Content-Disposition: form-data; name=\"text\"\r\n"
+                             "Content-Type: text/plain\r\n");
+        for (i = 0; i < part_size; i++) {
+            c->body[pos++] = (i % 64 == 63) ? '\n' : (char)('A' + (i % 26));
         }
     }
-
-    return pos;
+    c->length = put_body_end(c->body, pos);
+    c->parts = parts;
+    return 0;
 }
 
-/* Benchmark 1: Small message throughput */
-void benchmark_small_messages(void) {
-    const char *boundary = "bound";
-    const char *content = "Hello World";
-    char data[1000];
-    size_t data_len;
-    multipart_parser_settings callbacks;
-    perf_data pdata;
-    clock_t start, end;
-    double cpu_time;
-    int iterations = 10000;
-    int i;
-
-    printf("\n=== Benchmark 1: Small Messages (10KB content) ===\n");
+/* Binary parts where one byte in eight is a CR, and every 512 bytes a
+ * near-miss of the delimiter ("\r\n--" plus a wrong boundary byte) */
+static int build_binary_cr(corpus *c, size_t part_size, int parts) {
+    static const char near_miss[] = "\r\n------bench7MA4YWxkTrZu0gX";
+    size_t pos = 0;
+    size_t i;
+    int k;
 
-    data_len = build_multipart_data(data, boundary, content, strlen(content), 1);
+    c->body = (char*)malloc((part_size + 256) * parts + 256);
+    if (c->body == NULL) {
+        return -1;
+    }
+    for (k = 0; k < parts; k++) {
+        pos = put_part_start(c->body, pos, k == 0,
+                             "Content-Disposition: form-data; name=\"blob\"; "
+                             "filename=\"blob.bin\"\r\n"
+                             "Content-Type: application/octet-stream\r\n");
+        for (i = 0; i < part_size; i++) {
+            if (i % 512 == 511 && part_size - i > sizeof(near_miss)) {
+                memcpy(c->body + pos, near_miss, sizeof(near_miss) - 1);
+                pos += sizeof(near_miss) - 1;
+                i += sizeof(near_miss) - 2;
+            } else if ((bench_random() & 7) == 0) {
+                c->body[pos++] = '\r';
+            } else {
+                c->body[pos++] = (char)bench_random();
+            }
+        }
+    }
+    c->length = put_body_end(c->body, pos);
+    c->parts = parts;
+    return 0;
+}
 
-    memset(&callbacks, 0, sizeof(multipart_parser_settings));
-    callbacks.on_part_data = on_part_data_perf;
-    callbacks.on_part_data_begin = on_part_begin_perf;
+/* Many form fields of 1 to 16 bytes, where headers dominate */
+static int build_tiny_fields(corpus *c, int parts) {
+    char headers[80];
+    size_t pos = 0;
+    size_t n;
+    int k;
 
-    memset(&pdata, 0, sizeof(perf_data));
+    c->body = (char*)malloc(128 * (size_t)parts + 256);
+    if (c->body == NULL) {
+        return -1;
+    }
+    for (k = 0; k < parts; k++) {
+        sprintf(headers, "Content-Disposition: form-data; name=\"f%d\"\r\n", k);
+        pos = put_part_start(c->body, pos, k == 0, headers);
+        for (n = 1 + (size_t)k % 16; n > 0; n--) {
+            c->body[pos++] = (char)('a' + (k + (int)n) % 26);
+        }
+    }
+    c->length = put_body_end(c->body, pos);
+    c->parts = parts;
+    return 0;
+}
 
-    start = clock();
+/* One huge file of random bytes */
+static int build_large_file(corpus *c, size_t size) {
+    size_t pos = 0;
+    size_t i;
 
-    for (i = 0; i < iterations; i++) {
-        multipart_parser* parser = multipart_parser_init(boundary, &callbacks);
-        if (parser == NULL) continue;
+    c->body = (char*)malloc(size + 512);
+    if (c->body == NULL) {
+        return -1;
+    }
+    pos = put_part_start(c->body, pos, 1,
+                         "Content-Disposition: form-data; name=\"upload\"; "
+                         "filename=\"video.mp4\"\r\n"
+                         "Content-Type: video/mp4\r\n");
+    for (i = 0; i < size; i++) {
+        c->body[pos++] = (char)bench_random();
+    }
+    c->length = put_body_end(c->body, pos);
+    c->parts = 1;
+    return 0;
+}
 
-        multipart_parser_set_data(parser, &pdata);
-        multipart_parser_execute(parser, data, data_len);
-        multipart_parser_free(parser);
+/* Worst-case corpora: one part whose data repeats an adversarial pattern
+ * up to size bytes, delimited by the given boundary. No pattern contains
+ * the delimiter, so each is data up to the closing delimiter. */
+static int build_pattern(corpus *c, const char *boundary, const char *pattern,
+                         size_t size) {
+    size_t pattern_len = strlen(pattern);
+    size_t pos, i;
+
+    c->body = (char*)malloc(size + 2 * strlen(boundary) + 16);
+    if (c->body == NULL) {
+        return -1;
+    }
+    pos = (size_t)sprintf(c->body, "--%s\r\n\r\n", boundary);
+    for (i = 0; i < size; i++) {
+        c->body[pos++] = pattern[i % pattern_len];
     }
+    pos += (size_t)sprintf(c->body + pos, "\r\n--%s--\r\n", boundary);
+    c->boundary = boundary;
+    c->length = pos;
+    c->parts = 1;
+    return 0;
+}
 
-    end = clock();
-    cpu_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+/* Worst-case pattern: "\r\n--" followed by all but the last byte of the
+ * boundary and a wrong byte, repeated */
+static const char *near_miss_pattern(const char *boundary, char *out) {
+    size_t n = strlen(boundary);
 
-    printf("Iterations: %d\n", iterations);
-    printf("Time: %.3f seconds\n", cpu_time);
-    printf("Messages/sec: %.0f\n", iterations / cpu_time);
-    printf("Throughput: %.2f MB/s\n",
-           (iterations * data_len) / (cpu_time * 1024 * 1024));
-    printf("Avg callbacks/msg: %.1f\n", (double)pdata.callback_count / iterations);
-    printf("Avg callback size: %.1f bytes\n",
-           pdata.total_bytes > 0 ? (double)pdata.total_bytes / pdata.callback_count : 0);
+    sprintf(out, "\r\n--%.*s%c", (int)(n - 1), boundary,
+            boundary[n - 1] == 'X' ? 'Y' : 'X');
+    return out;
 }
 
-/* Benchmark 2: Large message parsing */
-void benchmark_large_message(void) {
-    const char *boundary = "boundary123";
-    char *data;
-    char *content;
-    size_t content_len = 1024 * 100; /* 100KB content */
-    size_t data_len;
-    multipart_parser_settings callbacks;
-    multipart_parser* parser;
-    perf_data pdata;
-    clock_t start, end;
-    double cpu_time;
-    size_t i;
+/* A boundary made of one repeating character */
+#define REPEAT_BOUNDARY_LENGTH 40
+
+static int build_worst_case(corpus *c, size_t size) {
+    static char near_miss[MULTIPART_MAX_BOUNDARY_LENGTH + 8];
+    static char repeat_a[REPEAT_BOUNDARY_LENGTH + 1];
+    static char repeat_dash[REPEAT_BOUNDARY_LENGTH + 1];
+    static char repeat_a_miss[REPEAT_BOUNDARY_LENGTH + 8];
+    static char repeat_dash_miss[REPEAT_BOUNDARY_LENGTH + 8];
+
+    memset(repeat_a, 'a', REPEAT_BOUNDARY_LENGTH);
+    memset(repeat_dash, '-', REPEAT_BOUNDARY_LENGTH);
+    if (strcmp(c->name, "crlf_dash") == 0) {
+        return build_pattern(c, BENCH_BOUNDARY, "\r\n-", size);
+    } else if (strcmp(c->name, "near_miss") == 0) {
+        return build_pattern(c, BENCH_BOUNDARY,
+                             near_miss_pattern(BENCH_BOUNDARY, near_miss),
+                             size);
+    } else if (strcmp(c->name, "cr_run") == 0) {
+        return build_pattern(c, BENCH_BOUNDARY, "\r", size);
+    } else if (strcmp(c->name, "repeat_a") == 0) {
+        /* Runs of the boundary character after every "\r\n--" */
+        return build_pattern(c, repeat_a,
+                             near_miss_pattern(repeat_a, repeat_a_miss), size);
+    } else if (strcmp(c->name, "repeat_dash") == 0) {
+        /* The boundary continues the "--" of the delimiter */
+        return build_pattern(c, repeat_dash,
+                             near_miss_pattern(repeat_dash, repeat_dash_miss),
+                             size);
+    }
+    return -1;
+}
 
-    printf("\n=== Benchmark 2: Large Message (100KB content) ===\n");
+static const char *const worst_case_names[] = {
+    "crlf_dash", "near_miss", "cr_run", "repeat_a", "repeat_dash"
+};
+#define WORST_CASE_COUNT (sizeof(worst_case_names) / sizeof(worst_case_names[0]))
+
+/* A saved fuzzer input, e.g. a slow unit from "make fuzz-slow", framed the
+ * way fuzz.c reads it: the boundary is the first min(70, size / 2) bytes,
+ * NUL bytes replaced by 'X', and the rest is the body */
+static int build_fuzz_input(corpus *c, const char *path) {
+    static char boundaries[16][MULTIPART_MAX_BOUNDARY_LENGTH + 1];
+    static int used = 0;
+    char *boundary;
+    char *data;
+    size_t size = 0, n, k;
+    FILE *f = fopen(path, "rb");
 
-    /* Allocate buffers */
-    content = (char*)malloc(content_len);
-    if (content == NULL) {
-        printf("Memory allocation failed\n");
-        return;
+    if (f == NULL || used == 16) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        return -1;
     }
-
-    /* Fill with test data */
-    for (i = 0; i < content_len; i++) {
-        content[i] = (char)('A' + (i % 26));
+    data = (char*)malloc(100000 + 1);
+    if (data != NULL) {
+        size = fread(data, 1, 100000 + 1, f);
+    }
+    fclose(f);
+    if (data == NULL || size < 2 || size > 100000) {
+        free(data);
+        return -1;
+    }
+    n = size > MULTIPART_MAX_BOUNDARY_LENGTH ? MULTIPART_MAX_BOUNDARY_LENGTH
+                                             : size;
+    if (n > size / 2) {
+        n = size / 2;
     }
+    boundary = boundaries[used++];
+    for (k = 0; k < n; k++) {
+        boundary[k] = data[k] == '\0' ? 'X' : data[k];
+    }
+    boundary[n] = '\0';
+    memmove(data, data + n, size - n);
+
+    c->name = path;
+    c->boundary = boundary;
+    c->body = data;
+    c->length = size - n;
+    c->parts = -1;
+    return 0;
+}
 
-    /* Allocate data buffer (content + overhead) */
-    data = (char*)malloc(content_len + 1000);
-    if (data == NULL) {
-        free(content);
-        printf("Memory allocation failed\n");
-        return;
+/* ---- Clock and hardware counters ---- */
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return (double)clock() / CLOCKS_PER_SEC;
     }
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-    data_len = build_multipart_data(data, boundary, content, content_len, 1);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BENCH_HAVE_TSC
+#endif
 
-    memset(&callbacks, 0, sizeof(multipart_parser_settings));
-    callbacks.on_part_data = on_part_data_perf;
-    callbacks.on_part_data_begin = on_part_begin_perf;
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_COUNT
+};
 
-    memset(&pdata, 0, sizeof(perf_data));
+typedef struct {
+    int fd[COUNTER_COUNT];      /* -1 where the counter is unavailable */
+    double value[COUNTER_COUNT];
+    double tsc;                 /* Time stamp counter ticks, if no perf cycles */
+} counters;
+
+#ifdef BENCH_HAVE_PERF
+static int perf_open(unsigned int type, unsigned long config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
 
-    parser = multipart_parser_init(boundary, &callbacks);
-    if (parser == NULL) {
-        free(content);
-        free(data);
-        printf("Parser initialization failed\n");
-        return;
+static void counters_open(counters *c) {
+    int k;
+
+    for (k = 0; k < COUNTER_COUNT; k++) {
+        c->fd[k] = -1;
     }
+#ifdef BENCH_HAVE_PERF
+    c->fd[COUNTER_CYCLES] = perf_open(PERF_TYPE_HARDWARE,
+                                      PERF_COUNT_HW_CPU_CYCLES);
+    c->fd[COUNTER_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE,
+                                            PERF_COUNT_HW_INSTRUCTIONS);
+    c->fd[COUNTER_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE,
+                                             PERF_COUNT_HW_BRANCH_MISSES);
+    c->fd[COUNTER_L1D_MISSES] =
+        perf_open(PERF_TYPE_HW_CACHE,
+                  PERF_COUNT_HW_CACHE_L1D |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+}
 
-    multipart_parser_set_data(parser, &pdata);
+static void counters_close(counters *c) {
+#ifdef BENCH_HAVE_PERF
+    int k;
 
-    start = clock();
-    multipart_parser_execute(parser, data, data_len);
-    end = clock();
+    for (k = 0; k < COUNTER_COUNT; k++) {
+        if (c->fd[k] >= 0) {
+            close(c->fd[k]);
+        }
+    }
+#else
+    (void)c;
+#endif
+}
 
-    cpu_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+static void counters_start(counters *c) {
+#ifdef BENCH_HAVE_PERF
+    int k;
 
-    printf("Message size: %zu bytes\n", data_len);
-    printf("Parse time: %.6f seconds\n", cpu_time);
-    printf("Throughput: %.2f MB/s\n",
-           data_len / (cpu_time * 1024 * 1024));
-    printf("Total callbacks: %d\n", pdata.callback_count);
-    printf("Avg callback size: %.1f bytes\n",
-           pdata.callback_count > 0 ? (double)pdata.total_bytes / pdata.callback_count : 0);
+    for (k = 0; k < COUNTER_COUNT; k++) {
+        if (c->fd[k] >= 0) {
+            ioctl(c->fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+#ifdef BENCH_HAVE_TSC
+    c->tsc = (double)__builtin_ia32_rdtsc();
+#else
+    c->tsc = 0;
+#endif
+}
 
-    multipart_parser_free(parser);
-    free(content);
-    free(data);
+static void counters_stop(counters *c) {
+    int k;
+
+#ifdef BENCH_HAVE_TSC
+    c->tsc = (double)__builtin_ia32_rdtsc() - c->tsc;
+#endif
+    for (k = 0; k < COUNTER_COUNT; k++) {
+        c->value[k] = -1;
+#ifdef BENCH_HAVE_PERF
+        if (c->fd[k] >= 0) {
+            __u64 v;
+
+            ioctl(c->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(c->fd[k], &v, sizeof(v)) == (ssize_t)sizeof(v)) {
+                c->value[k] = (double)v;
+            }
+        }
+#endif
+    }
 }
 
-/* Benchmark 3: Chunked parsing efficiency */
-void benchmark_chunked_parsing(void) {
-    const char *boundary = "chunk";
-    const char *content = "Test data for chunked parsing benchmark.";
-    char data[500];
-    size_t data_len;
-    multipart_parser_settings callbacks;
+/* ---- Measurement ---- */
+
+typedef struct {
+    const char *corpus;
+    size_t chunk;
+    size_t bytes;
+    int runs;
+    double seconds;             /* Fastest run */
+    double mb_per_s;
+    double ns_per_byte;
+    double cycles_per_byte;     /* < 0 if unknown */
+    const char *cycles_source;  /* "perf", "tsc" or "none" */
+    double ipc;                 /* < 0 if unknown */
+    double branch_misses_per_kb;
+    double l1d_misses_per_kb;
+} result;
+
+/* Parse a corpus once in chunks; returns 0 if all of it parsed and every
+ * part was seen */
+static int parse_corpus(const corpus *c, size_t chunk,
+                        const multipart_parser_settings *callbacks) {
     multipart_parser* parser;
     perf_data pdata;
-    clock_t start, end;
-    double cpu_time;
-    size_t chunk_sizes[] = {1, 4, 16, 64, 256};
-    size_t num_chunk_sizes = sizeof(chunk_sizes) / sizeof(chunk_sizes[0]);
-    size_t i;
-    size_t offset;
+    size_t offset, n;
 
-    printf("\n=== Benchmark 3: Chunked Parsing Efficiency ===\n");
+    memset(&pdata, 0, sizeof(perf_data));
+    parser = multipart_parser_init(c->boundary != NULL ? c->boundary
+                                                       : BENCH_BOUNDARY,
+                                   callbacks);
+    if (parser == NULL) {
+        return -1;
+    }
+    multipart_parser_set_data(parser, &pdata);
+    if (chunk == 0) {
+        chunk = c->length;
+    }
+    for (offset = 0; offset < c->length; offset += n) {
+        n = c->length - offset < chunk ? c->length - offset : chunk;
+        if (multipart_parser_execute(parser, c->body + offset, n) != n) {
+            break;
+        }
+    }
+    multipart_parser_free(parser);
+    if (c->parts < 0) {
+        return 0;
+    }
+    return offset == c->length && pdata.part_count == c->parts ? 0 : -1;
+}
 
-    data_len = build_multipart_data(data, boundary, content, strlen(content), 1);
+static double per_kb(double count, size_t bytes) {
+    return count < 0 ? -1 : count * 1024.0 / (double)bytes;
+}
+
+/* Time a corpus at one chunk size: repeat for at least min_seconds and
+ * three runs, and report the fastest run with its counters */
+static int measure(const corpus *c, size_t chunk, double min_seconds,
+                   result *r) {
+    multipart_parser_settings callbacks;
+    counters cnt;
+    double best[COUNTER_COUNT];
+    double best_tsc = 0;
+    double start, elapsed, total = 0;
+    int k;
 
     memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = on_header_perf;
+    callbacks.on_header_value = on_header_perf;
     callbacks.on_part_data = on_part_data_perf;
     callbacks.on_part_data_begin = on_part_begin_perf;
 
-    for (i = 0; i < num_chunk_sizes; i++) {
-        size_t chunk_size = chunk_sizes[i];
-        int iterations = 5000;
-        int iter;
+    memset(r, 0, sizeof(result));
+    r->corpus = c->name;
+    r->chunk = chunk;
+    r->bytes = c->length;
+    r->seconds = -1;
+
+    /* Warm-up run, which also checks the corpus parses */
+    if (parse_corpus(c, chunk, &callbacks) != 0) {
+        return -1;
+    }
+
+    for (k = 0; k < COUNTER_COUNT; k++) {
+        best[k] = -1;
+    }
+    counters_open(&cnt);
+    while (r->runs < 3 || total < min_seconds) {
+        counters_start(&cnt);
+        start = bench_now();
+        parse_corpus(c, chunk, &callbacks);
+        elapsed = bench_now() - start;
+        counters_stop(&cnt);
+        total += elapsed;
+        r->runs++;
+        if (r->seconds < 0 || elapsed < r->seconds) {
+            r->seconds = elapsed;
+            best_tsc = cnt.tsc;
+            for (k = 0; k < COUNTER_COUNT; k++) {
+                best[k] = cnt.value[k];
+            }
+        }
+    }
+    counters_close(&cnt);
 
-        memset(&pdata, 0, sizeof(perf_data));
+    if (r->seconds <= 0) {
+        r->seconds = 1e-9;
+    }
+    r->mb_per_s = (double)c->length / (r->seconds * 1024 * 1024);
+    r->ns_per_byte = r->seconds * 1e9 / (double)c->length;
+    if (best[COUNTER_CYCLES] > 0) {
+        r->cycles_per_byte = best[COUNTER_CYCLES] / (double)c->length;
+        r->cycles_source = "perf";
+    } else if (best_tsc > 0) {
+        r->cycles_per_byte = best_tsc / (double)c->length;
+        r->cycles_source = "tsc";
+    } else {
+        r->cycles_per_byte = -1;
+        r->cycles_source = "none";
+    }
+    r->ipc = best[COUNTER_CYCLES] > 0 && best[COUNTER_INSTRUCTIONS] >= 0 ?
+        best[COUNTER_INSTRUCTIONS] / best[COUNTER_CYCLES] : -1;
+    r->branch_misses_per_kb = per_kb(best[COUNTER_BRANCH_MISSES], c->length);
+    r->l1d_misses_per_kb = per_kb(best[COUNTER_L1D_MISSES], c->length);
+    return 0;
+}
 
-        start = clock();
+/* ---- Output ---- */
 
-        for (iter = 0; iter < iterations; iter++) {
-            parser = multipart_parser_init(boundary, &callbacks);
-            if (parser == NULL) continue;
+static void print_table_header(void) {
+    printf("%-12s %6s %10s %9s %8s %9s %5s %9s %10s\n",
+           "corpus", "chunk", "bytes", "MB/s", "ns/B", "cycles/B",
+           "IPC", "brmiss/KB", "L1dmiss/KB");
+}
 
-            multipart_parser_set_data(parser, &pdata);
+/* An optional counter column; "-" if the counter is unavailable */
+static void print_optional(int width, int precision, double value) {
+    if (value < 0) {
+        printf(" %*s", width, "-");
+    } else {
+        printf(" %*.*f", width, precision, value);
+    }
+}
 
-            /* Parse in chunks */
-            offset = 0;
-            while (offset < data_len) {
-                size_t to_parse = chunk_size;
-                if (offset + to_parse > data_len) {
-                    to_parse = data_len - offset;
-                }
-                multipart_parser_execute(parser, data + offset, to_parse);
-                offset += to_parse;
-            }
+static void print_table_row(const result *r) {
+    printf("%-12s %6lu %10lu %9.1f %8.3f", r->corpus, (unsigned long)r->chunk,
+           (unsigned long)r->bytes, r->mb_per_s, r->ns_per_byte);
+    print_optional(9, 3, r->cycles_per_byte);
+    print_optional(5, 2, r->ipc);
+    print_optional(9, 2, r->branch_misses_per_kb);
+    print_optional(10, 2, r->l1d_misses_per_kb);
+    printf("\n");
+}
+
+static void print_json_number(const char *key, double value, const char *sep) {
+    if (value < 0) {
+        printf("\"%s\": null%s", key, sep);
+    } else {
+        printf("\"%s\": %.6g%s", key, value, sep);
+    }
+}
 
-            multipart_parser_free(parser);
+/* One result per line, which is what read_baseline() expects */
+static void print_json_row(const result *r, int last) {
+    printf("    {\"corpus\": \"%s\", \"chunk\": %lu, \"bytes\": %lu, "
+           "\"runs\": %d, \"seconds\": %.9f, \"mb_per_s\": %.3f, "
+           "\"ns_per_byte\": %.4f, ",
+           r->corpus, (unsigned long)r->chunk, (unsigned long)r->bytes,
+           r->runs, r->seconds, r->mb_per_s, r->ns_per_byte);
+    print_json_number("cycles_per_byte", r->cycles_per_byte, ", ");
+    printf("\"cycles_source\": \"%s\", ", r->cycles_source);
+    print_json_number("ipc", r->ipc, ", ");
+    print_json_number("branch_misses_per_kb", r->branch_misses_per_kb, ", ");
+    print_json_number("l1d_misses_per_kb", r->l1d_misses_per_kb, "");
+    printf("}%s\n", last ? "" : ",");
+}
+
+/* ---- Baseline comparison ---- */
+
+/* Compare results with the mb_per_s of a JSON file written by --json.
+ * Returns the number of results slower than the baseline by more than
+ * threshold percent, or -1 if the file cannot be read. */
+static int compare_baseline(const char *path, const result *results,
+                            size_t count, double threshold) {
+    char line[1024];
+    char name[64];
+    unsigned long chunk;
+    double base;
+    const char *at;
+    size_t k;
+    int matched = 0;
+    int regressions = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        fprintf(stderr, "Cannot read baseline %s\n", path);
+        return -1;
+    }
+    fprintf(stderr, "\nComparison with %s (threshold %.1f%%):\n", path,
+            threshold);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        at = strstr(line, "\"corpus\": \"");
+        if (at == NULL ||
+            sscanf(at, "\"corpus\": \"%63[^\"]\", \"chunk\": %lu",
+                   name, &chunk) != 2 ||
+            (at = strstr(line, "\"mb_per_s\": ")) == NULL ||
+            sscanf(at, "\"mb_per_s\": %lf", &base) != 1 || base <= 0) {
+            continue;
+        }
+        for (k = 0; k < count; k++) {
+            double change;
+
+            if (strcmp(results[k].corpus, name) != 0 ||
+                results[k].chunk != chunk) {
+                continue;
+            }
+            matched++;
+            change = (results[k].mb_per_s - base) * 100.0 / base;
+            fprintf(stderr, "  %-12s %6lu %9.1f -> %9.1f MB/s %+6.1f%%%s\n",
+                    name, chunk, base, results[k].mb_per_s, change,
+                    change < -threshold ? "  REGRESSION" : "");
+            if (change < -threshold) {
+                regressions++;
+            }
         }
+    }
+    fclose(f);
+    if (matched == 0) {
+        fprintf(stderr, "  No results in common with the baseline\n");
+    }
+    return regressions;
+}
+
+/* ---- Worst-case inputs ---- */
 
-        end = clock();
-        cpu_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+static void print_results(const result *results, size_t count) {
+    size_t k;
 
-        printf("Chunk size: %4zu bytes - Time: %.3f sec - Rate: %.0f parses/sec - Callbacks: %d\n",
-               chunk_size, cpu_time, iterations / cpu_time, pdata.callback_count);
+    for (k = 0; k < count; k++) {
+        print_json_row(&results[k], k + 1 == count);
     }
+    printf("  ]\n}\n");
 }
 
-/* Benchmark 4: Multiple parts parsing */
-void benchmark_multiple_parts(void) {
-    const char *boundary = "multipart";
-    const char *content = "Part content data.";
-    char *data;
-    size_t data_len;
-    multipart_parser_settings callbacks;
-    multipart_parser* parser;
-    perf_data pdata;
-    clock_t start, end;
-    double cpu_time;
-    int num_parts_array[] = {1, 5, 10, 20, 50};
-    size_t num_tests = sizeof(num_parts_array) / sizeof(num_parts_array[0]);
-    size_t i;
+/* Time the adversarial corpora at two sizes and any fuzzer inputs, with
+ * one-byte feeds and in one call. Returns 1 if a corpus failed or its time
+ * per byte grew by more than growth_limit between the sizes. */
+static int run_worst_case(int json, int quick, double min_seconds,
+                          double growth_limit, char **inputs,
+                          size_t input_count) {
+    size_t size = quick ? 64 * 1024 : 256 * 1024;
+    size_t max_results = (WORST_CASE_COUNT + input_count) * WORST_CHUNK_COUNT;
+    result *results = (result*)malloc(sizeof(result) * max_results);
+    double *growth = (double*)malloc(sizeof(double) * max_results);
+    result small;
+    corpus c, large;
+    size_t count = 0, patterns, k, j;
+    int failed = 0;
+
+    if (results == NULL || growth == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(results);
+        free(growth);
+        return 1;
+    }
 
-    printf("\n=== Benchmark 4: Multiple Parts Performance ===\n");
+    if (json) {
+        printf("{\n  \"benchmark\": \"multipart-parser-c\",\n"
+               "  \"format\": 1,\n  \"quick\": %s,\n  \"worst_case\": true,\n"
+               "  \"results\": [\n", quick ? "true" : "false");
+    } else {
+        printf("=== Multipart Parser Worst-Case Benchmarks ===\n");
+        printf("Note: Adversarial bodies at %lu bytes; chunk 1 feeds one "
+               "byte per call\n\n",
+               (unsigned long)(size * WORST_GROWTH_FACTOR));
+        print_table_header();
+    }
 
-    /* Allocate buffer for large multipart message */
-    data = (char*)malloc(100000);
-    if (data == NULL) {
-        printf("Memory allocation failed\n");
-        return;
+    for (k = 0; k < WORST_CASE_COUNT; k++) {
+        memset(&c, 0, sizeof(corpus));
+        memset(&large, 0, sizeof(corpus));
+        c.name = large.name = worst_case_names[k];
+        if (build_worst_case(&c, size) != 0 ||
+            build_worst_case(&large, size * WORST_GROWTH_FACTOR) != 0) {
+            fprintf(stderr, "Memory allocation failed\n");
+            free(c.body);
+            free(large.body);
+            failed = 1;
+            continue;
+        }
+        for (j = 0; j < WORST_CHUNK_COUNT; j++) {
+            if (measure(&c, worst_chunks[j], min_seconds, &small) != 0 ||
+                measure(&large, worst_chunks[j], min_seconds,
+                        &results[count]) != 0) {
+                fprintf(stderr, "Corpus %s failed to parse at chunk size %lu\n",
+                        c.name, (unsigned long)worst_chunks[j]);
+                failed = 1;
+                continue;
+            }
+            growth[count] = results[count].ns_per_byte / small.ns_per_byte;
+            if (!json) {
+                print_table_row(&results[count]);
+                fflush(stdout);
+            }
+            count++;
+        }
+        free(c.body);
+        free(large.body);
+    }
+    patterns = count;
+
+    for (k = 0; k < input_count; k++) {
+        memset(&c, 0, sizeof(corpus));
+        if (build_fuzz_input(&c, inputs[k]) != 0) {
+            fprintf(stderr, "Cannot read fuzzer input %s\n", inputs[k]);
+            failed = 1;
+            continue;
+        }
+        for (j = 0; j < WORST_CHUNK_COUNT; j++) {
+            measure(&c, worst_chunks[j], min_seconds, &results[count]);
+            if (!json) {
+                print_table_row(&results[count]);
+                fflush(stdout);
+            }
+            count++;
+        }
+        free(c.body);
     }
 
-    memset(&callbacks, 0, sizeof(multipart_parser_settings));
-    callbacks.on_part_data = on_part_data_perf;
-    callbacks.on_part_data_begin = on_part_begin_perf;
+    if (json) {
+        print_results(results, count);
+    } else {
+        printf("\n=== Benchmarks Complete ===\n");
+    }
 
-    for (i = 0; i < num_tests; i++) {
-        int num_parts = num_parts_array[i];
-        int iterations = 1000;
-        int iter;
+    fprintf(stderr, "\nGrowth of ns/B from %lu to %lu bytes (limit %.2fx):\n",
+            (unsigned long)size, (unsigned long)(size * WORST_GROWTH_FACTOR),
+            growth_limit);
+    for (k = 0; k < patterns; k++) {
+        fprintf(stderr, "  %-12s %6lu %6.2fx%s\n", results[k].corpus,
+                (unsigned long)results[k].chunk, growth[k],
+                growth[k] > growth_limit ? "  SUPERLINEAR" : "");
+        if (growth[k] > growth_limit) {
+            failed = 1;
+        }
+    }
 
-        data_len = build_multipart_data(data, boundary, content,
-                                       strlen(content), num_parts);
+    free(results);
+    free(growth);
+    return failed;
+}
 
-        memset(&pdata, 0, sizeof(perf_data));
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--json] [--quick] [--baseline FILE] [--threshold PCT]\n"
+            "       %s --worst-case [--json] [--quick] [--growth-limit X] "
+            "[FUZZ_INPUT...]\n"
+            "  --json           print results as JSON\n"
+            "  --quick          smaller corpora and shorter runs\n"
+            "  --baseline FILE  compare MB/s with a saved --json output and\n"
+            "                   exit 1 on a regression\n"
+            "  --threshold PCT  allowed slowdown against the baseline "
+            "(default 10)\n", prog, prog);
+    fprintf(stderr,
+            "  --worst-case     time adversarial bodies and fuzzer inputs\n"
+            "                   instead, fed one byte per call and in one call\n"
+            "  --growth-limit X exit 1 if ns/B grows by more than X times\n"
+            "                   when a worst-case body is made %d times\n"
+            "                   longer (default 2)\n", WORST_GROWTH_FACTOR);
+}
 
-        start = clock();
+int main(int argc, char **argv) {
+    corpus corpora[4];
+    result *results;
+    size_t corpus_count = sizeof(corpora) / sizeof(corpora[0]);
+    size_t count = 0;
+    size_t k, j;
+    int json = 0;
+    int quick = 0;
+    const char *baseline = NULL;
+    double threshold = 10;
+    double min_seconds;
+    int worst_case = 0;
+    double growth_limit = 2;
+    char **inputs;
+    size_t input_count = 0;
+    int failed = 0;
+    int i;
 
-        for (iter = 0; iter < iterations; iter++) {
-            parser = multipart_parser_init(boundary, &callbacks);
-            if (parser == NULL) continue;
+    inputs = (char**)malloc(sizeof(char*) * (size_t)argc);
+    if (inputs == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
 
-            multipart_parser_set_data(parser, &pdata);
-            multipart_parser_execute(parser, data, data_len);
-            multipart_parser_free(parser);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--worst-case") == 0) {
+            worst_case = 1;
+        } else if (strcmp(argv[i], "--growth-limit") == 0 && i + 1 < argc) {
+            growth_limit = atof(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            inputs[input_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            free(inputs);
+            return 2;
         }
+    }
+    if (input_count > 0 && !worst_case) {
+        usage(argv[0]);
+        free(inputs);
+        return 2;
+    }
+    min_seconds = quick ? 0.02 : 0.25;
 
-        end = clock();
-        cpu_time = ((double)(end - start)) / CLOCKS_PER_SEC;
+    if (worst_case) {
+        failed = run_worst_case(json, quick, min_seconds, growth_limit,
+                                inputs, input_count);
+        free(inputs);
+        return failed;
+    }
+    free(inputs);
+
+    memset(corpora, 0, sizeof(corpora));
+    corpora[0].name = "text";
+    corpora[1].name = "binary_cr";
+    corpora[2].name = "tiny_fields";
+    corpora[3].name = "large_file";
+    if (build_text(&corpora[0], quick ? 16 * 1024 : 100 * 1024, 4) != 0 ||
+        build_binary_cr(&corpora[1], quick ? 64 * 1024 : 256 * 1024, 8) != 0 ||
+        build_tiny_fields(&corpora[2], quick ? 500 : 5000) != 0 ||
+        build_large_file(&corpora[3], quick ? 4 * 1024 * 1024
+                                            : 64 * 1024 * 1024) != 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
 
-        printf("Parts: %2d - Size: %5zu bytes - Time: %.3f sec - Rate: %.0f parses/sec\n",
-               num_parts, data_len, cpu_time, iterations / cpu_time);
+    results = (result*)malloc(sizeof(result) * corpus_count * BENCH_CHUNK_COUNT);
+    if (results == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
     }
 
-    free(data);
-}
+    if (json) {
+        printf("{\n  \"benchmark\": \"multipart-parser-c\",\n"
+               "  \"format\": 1,\n  \"quick\": %s,\n  \"results\": [\n",
+               quick ? "true" : "false");
+    } else {
+        printf("=== Multipart Parser Performance Benchmarks ===\n");
+        printf("Note: Results depend on system performance and load; "
+               "chunk 0 is one call per body\n\n");
+        print_table_header();
+    }
 
-int main(void) {
-    printf("=== Multipart Parser Performance Benchmarks ===\n");
-    printf("Note: Results depend on system performance and load\n");
+    for (k = 0; k < corpus_count; k++) {
+        for (j = 0; j < BENCH_CHUNK_COUNT; j++) {
+            if (measure(&corpora[k], bench_chunks[j], min_seconds,
+                        &results[count]) != 0) {
+                fprintf(stderr, "Corpus %s failed to parse at chunk size %lu\n",
+                        corpora[k].name, (unsigned long)bench_chunks[j]);
+                failed = 1;
+                continue;
+            }
+            if (!json) {
+                print_table_row(&results[count]);
+                fflush(stdout);
+            }
+            count++;
+        }
+    }
 
-    benchmark_small_messages();
-    benchmark_large_message();
-    benchmark_chunked_parsing();
-    benchmark_multiple_parts();
+    if (json) {
+        print_results(results, count);
+    } else {
+        printf("\n=== Benchmarks Complete ===\n");
+    }
 
-    printf("\n=== Benchmarks Complete ===\n");
-    return 0;
+    if (baseline != NULL) {
+        int regressions = compare_baseline(baseline, results, count, threshold);
+        if (regressions != 0) {
+            failed = 1;
+        }
+    }
+
+    for (k = 0; k < corpus_count; k++) {
+        free(corpora[k].body);
+    }
+    free(results);
+    return failed;
 }
@@ -12,8 +12,10 @@
 #include "multipart_parser.h"
 
 #define MULTIPART_PARSER_MT "multipart_parser"
+#define MULTIPART_SLICE_MT "multipart_parser.slice"
 #define LMP_ERROR_BUFFER_SIZE 256
 #define LMP_MAX_CALLBACK_NAME_LENGTH 30  /* Max length for callback names in error messages */
+#define LMP_EVENT_BATCH 64  /* Events fetched per multipart_parser_execute_events() call */
 
 /* Lua 5.1 compatibility - only for non-LuaJIT Lua 5.1 */
 #if defined(LUA_VERSION_NUM) && LUA_VERSION_NUM == 501 && \
@@ -31,32 +33,42 @@
 
 #endif
 
+/* Callbacks of the callbacks table, resolved once by lmp_new() */
+enum {
+  LMP_ON_HEADER_FIELD,
+  LMP_ON_HEADER_VALUE,
+  LMP_ON_PART_DATA,
+  LMP_ON_PART_DATA_BEGIN,
+  LMP_ON_HEADERS_COMPLETE,
+  LMP_ON_PART_DATA_END,
+  LMP_ON_BODY_END,
+  LMP_CALLBACK_COUNT
+};
+
+static char const* const callback_names[LMP_CALLBACK_COUNT] = {
+  "on_header_field", "on_header_value", "on_part_data",
+  "on_part_data_begin", "on_headers_complete", "on_part_data_end",
+  "on_body_end"
+};
+
+/* Part data handed to on_part_data without a copy (options.slice). One
+ * slice per parser is reused for every call; at is NULL outside it. */
+typedef struct {
+  char const* at;
+  size_t length;
+} lua_multipart_slice;
+
 /* Structure to hold parser and Lua state */
 typedef struct {
   multipart_parser* parser;
   lua_State* L;
-  int callbacks_ref;
+  int callback_refs[LMP_CALLBACK_COUNT];  /* Registry refs, or LUA_NOREF */
+  lua_multipart_slice* slice;             /* NULL unless options.slice */
+  int slice_ref;
   multipart_parser_settings settings;
   char last_error[LMP_ERROR_BUFFER_SIZE];  /* Store last Lua callback error */
 } lua_multipart_parser;
 
-/* Helper to get callback function from table */
-static int get_callback(lua_State* L, int ref, char const* name) {
-  if (ref == LUA_NOREF || ref == LUA_REFNIL)
-    return 0;
-
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-  assert(lua_istable(L, -1));
-  lua_pushstring(L, name);
-  lua_rawget(L, -2);
-  if (lua_isfunction(L, -1)) {
-    lua_remove(L, -2);
-    return 1;
-  }
-  lua_pop(L, 2);
-  return 0;
-}
-
 /* Helper function to store Lua callback error
  * Note: snprintf is safe and will not overflow the buffer - it automatically
  * truncates if the formatted string exceeds the buffer size.
@@ -75,24 +87,28 @@ static void store_callback_error(lua_multipart_parser* lmp, lua_State* L, char c
   }
 }
 
-/* Callback implementations */
-static int on_header_field_cb(multipart_parser* p, char const* at,
-                              size_t length) {
+/* Helper to push a callback resolved by lmp_new(). Only the C callbacks of
+ * Lua functions that exist are installed, so this is a single registry
+ * lookup per event. */
+static lua_multipart_parser* push_callback(multipart_parser* p, int which) {
   lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
 
   lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
   assert(lmp && lmp->L);
+  assert(lmp->callback_refs[which] != LUA_NOREF);
 
-  L = lmp->L;
+  lua_rawgeti(lmp->L, LUA_REGISTRYINDEX, lmp->callback_refs[which]);
+  return lmp;
+}
 
-  if (!get_callback(L, lmp->callbacks_ref, "on_header_field"))
-    return 0;
+/* Helper to call the pushed callback with nargs arguments; returns its
+ * numeric result, or -1 after storing the error it raised */
+static int call_callback(lua_multipart_parser* lmp, int which, int nargs) {
+  lua_State* L = lmp->L;
+  int result;
 
-  lua_pushlstring(L, at, length);
-  if (lua_pcall(L, 1, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_header_field");
+  if (lua_pcall(L, nargs, 1, 0) != 0) {
+    store_callback_error(lmp, L, callback_names[which]);
     lua_pop(L, 1);
     return -1;
   }
@@ -102,152 +118,182 @@ static int on_header_field_cb(multipart_parser* p, char const* at,
   return result;
 }
 
-static int on_header_value_cb(multipart_parser* p, char const* at,
+/* Callback implementations */
+static int on_header_field_cb(multipart_parser* p, char const* at,
                               size_t length) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
+  lua_multipart_parser* lmp = push_callback(p, LMP_ON_HEADER_FIELD);
 
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
-
-  L = lmp->L;
-
-  if (!get_callback(L, lmp->callbacks_ref, "on_header_value")) return 0;
+  lua_pushlstring(lmp->L, at, length);
+  return call_callback(lmp, LMP_ON_HEADER_FIELD, 1);
+}
 
-  lua_pushlstring(L, at, length);
-  if (lua_pcall(L, 1, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_header_value");
-    lua_pop(L, 1);
-    return -1;
-  }
+static int on_header_value_cb(multipart_parser* p, char const* at,
+                              size_t length) {
+  lua_multipart_parser* lmp = push_callback(p, LMP_ON_HEADER_VALUE);
 
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
-  return result;
+  lua_pushlstring(lmp->L, at, length);
+  return call_callback(lmp, LMP_ON_HEADER_VALUE, 1);
 }
 
 static int on_part_data_cb(multipart_parser* p, char const* at, size_t length) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
+  lua_multipart_parser* lmp = push_callback(p, LMP_ON_PART_DATA);
   int result;
 
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
-
-  L = lmp->L;
-
-  if (!get_callback(L, lmp->callbacks_ref, "on_part_data")) return 0;
-
-  lua_pushlstring(L, at, length);
-  if (lua_pcall(L, 1, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_part_data");
-    lua_pop(L, 1);
-    return -1;
+  if (lmp->slice == NULL) {
+    lua_pushlstring(lmp->L, at, length);
+    return call_callback(lmp, LMP_ON_PART_DATA, 1);
   }
 
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
+  /* Point the parser's slice at the data instead of interning a string */
+  lmp->slice->at = at;
+  lmp->slice->length = length;
+  lua_rawgeti(lmp->L, LUA_REGISTRYINDEX, lmp->slice_ref);
+  result = call_callback(lmp, LMP_ON_PART_DATA, 1);
+  lmp->slice->at = NULL;
+  lmp->slice->length = 0;
   return result;
 }
 
 static int on_part_data_begin_cb(multipart_parser* p) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
-
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
-
-  L = lmp->L;
-
-  if (!get_callback(L, lmp->callbacks_ref, "on_part_data_begin")) return 0;
-
-  if (lua_pcall(L, 0, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_part_data_begin");
-    lua_pop(L, 1);
-    return -1;
-  }
-
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
-  return result;
+  return call_callback(push_callback(p, LMP_ON_PART_DATA_BEGIN),
+                       LMP_ON_PART_DATA_BEGIN, 0);
 }
 
 static int on_headers_complete_cb(multipart_parser* p) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
+  return call_callback(push_callback(p, LMP_ON_HEADERS_COMPLETE),
+                       LMP_ON_HEADERS_COMPLETE, 0);
+}
 
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
+static int on_part_data_end_cb(multipart_parser* p) {
+  return call_callback(push_callback(p, LMP_ON_PART_DATA_END),
+                       LMP_ON_PART_DATA_END, 0);
+}
 
-  L = lmp->L;
+static int on_body_end_cb(multipart_parser* p) {
+  return call_callback(push_callback(p, LMP_ON_BODY_END),
+                       LMP_ON_BODY_END, 0);
+}
 
-  if (!get_callback(L, lmp->callbacks_ref, "on_headers_complete")) return 0;
+/* Slice methods. A slice is only valid inside the on_part_data call that
+ * received it; the parser reuses it for the next call. */
+static lua_multipart_slice* check_slice(lua_State* L) {
+  lua_multipart_slice* s;
 
-  if (lua_pcall(L, 0, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_headers_complete");
-    lua_pop(L, 1);
-    return -1;
+  s = (lua_multipart_slice*)luaL_checkudata(L, 1, MULTIPART_SLICE_MT);
+  if (s->at == NULL) {
+    luaL_error(L, "slice used outside of its on_part_data call");
   }
+  return s;
+}
 
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
-  return result;
+/* Resolve a negative string.sub()-style position from the end */
+static lua_Integer slice_position(lua_Integer pos, size_t length) {
+  return pos < 0 ? pos + (lua_Integer)length + 1 : pos;
 }
 
-static int on_part_data_end_cb(multipart_parser* p) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
+/* Lua API: slice:tostring(), tostring(slice) - copy into a Lua string */
+static int lmp_slice_tostring(lua_State* L) {
+  lua_multipart_slice* s = check_slice(L);
 
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
+  lua_pushlstring(L, s->at, s->length);
+  return 1;
+}
 
-  L = lmp->L;
+/* Lua API: slice:len(), #slice */
+static int lmp_slice_len(lua_State* L) {
+  lua_multipart_slice* s = check_slice(L);
 
-  if (!get_callback(L, lmp->callbacks_ref, "on_part_data_end")) return 0;
+  lua_pushinteger(L, (lua_Integer)s->length);
+  return 1;
+}
 
-  if (lua_pcall(L, 0, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_part_data_end");
-    lua_pop(L, 1);
-    return -1;
+/* Lua API: slice:sub(i, [j]) - like string.sub(), copies only the range */
+static int lmp_slice_sub(lua_State* L) {
+  lua_multipart_slice* s = check_slice(L);
+  lua_Integer from = slice_position(luaL_checkinteger(L, 2), s->length);
+  lua_Integer to = slice_position(luaL_optinteger(L, 3, -1), s->length);
+
+  if (from < 1) {
+    from = 1;
+  }
+  if (to > (lua_Integer)s->length) {
+    to = (lua_Integer)s->length;
+  }
+  if (from <= to) {
+    lua_pushlstring(L, s->at + from - 1, (size_t)(to - from + 1));
+  } else {
+    lua_pushliteral(L, "");
   }
+  return 1;
+}
 
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
-  return result;
+/* Lua API: slice:byte([i]) - the byte at position i (default 1), or
+ * nothing outside the slice */
+static int lmp_slice_byte(lua_State* L) {
+  lua_multipart_slice* s = check_slice(L);
+  lua_Integer pos = slice_position(luaL_optinteger(L, 2, 1), s->length);
+
+  if (pos < 1 || pos > (lua_Integer)s->length) {
+    return 0;
+  }
+  lua_pushinteger(L, (unsigned char)s->at[pos - 1]);
+  return 1;
 }
 
-static int on_body_end_cb(multipart_parser* p) {
-  lua_multipart_parser* lmp;
-  lua_State* L;
-  int result;
+/* Lua API: slice:ptr() - the data as a light userdata and its length, e.g.
+ * for ffi.cast("const char*", ptr) under LuaJIT */
+static int lmp_slice_ptr(lua_State* L) {
+  lua_multipart_slice* s = check_slice(L);
 
-  lmp = (lua_multipart_parser*)multipart_parser_get_data(p);
-  assert(lmp && lmp->L);
+  lua_pushlightuserdata(L, (void*)s->at);
+  lua_pushinteger(L, (lua_Integer)s->length);
+  return 2;
+}
 
-  L = lmp->L;
+static luaL_Reg const slice_methods[] = {
+    {"tostring", lmp_slice_tostring},
+    {"len", lmp_slice_len},
+    {"sub", lmp_slice_sub},
+    {"byte", lmp_slice_byte},
+    {"ptr", lmp_slice_ptr},
+    {NULL, NULL}};
 
-  if (!get_callback(L, lmp->callbacks_ref, "on_body_end")) return 0;
+/* Release the registry refs held by a parser userdata */
+static void release_refs(lua_State* L, lua_multipart_parser* lmp) {
+  int k;
 
-  if (lua_pcall(L, 0, 1, 0) != 0) {
-    store_callback_error(lmp, L, "on_body_end");
-    lua_pop(L, 1);
-    return -1;
+  for (k = 0; k < LMP_CALLBACK_COUNT; k++) {
+    if (lmp->callback_refs[k] != LUA_NOREF) {
+      luaL_unref(L, LUA_REGISTRYINDEX, lmp->callback_refs[k]);
+      lmp->callback_refs[k] = LUA_NOREF;
+    }
+  }
+  if (lmp->slice_ref != LUA_NOREF) {
+    luaL_unref(L, LUA_REGISTRYINDEX, lmp->slice_ref);
+    lmp->slice_ref = LUA_NOREF;
+    lmp->slice = NULL;
   }
-
-  result = lua_isnumber(L, -1) ? (int)lua_tointeger(L, -1) : 0;
-  lua_pop(L, 1);
-  return result;
 }
 
-/* Lua API: multipart_parser.new(boundary, callbacks, max_memory) */
+/* Lua API: multipart_parser.new(boundary, callbacks, options)
+ * The functions of the callbacks table are looked up here, once; changing
+ * the table afterwards has no effect. options.max_depth enables nested
+ * multipart parsing and options.decode transfer decoding (see max_depth and
+ * decode_transfer_encoding in multipart_parser_settings);
+ * options.max_part_size, max_header_bytes, max_parts and max_total_size set
+ * the parser's limits; options.slice passes part data to on_part_data as a
+ * reused slice userdata instead of a new string per call */
 static int lmp_new(lua_State* L) {
   char const* boundary;
   lua_multipart_parser* lmp;
-  int ref = LUA_NOREF;
+  size_t max_depth = 0;
+  int decode = 0;
+  int slice = 0;
+  size_t limits[4] = { 0, 0, 0, 0 };
+  static const char* const limit_names[4] = {
+    "max_part_size", "max_header_bytes", "max_parts", "max_total_size"
+  };
+  int k;
 
   /* Get boundary string */
   boundary = luaL_checkstring(L, 1);
@@ -255,45 +301,98 @@ static int lmp_new(lua_State* L) {
   /* Get callbacks table (optional) */
   if (!lua_isnoneornil(L, 2)) {
     luaL_checktype(L, 2, LUA_TTABLE);
-    lua_pushvalue(L, 2);
-    ref = luaL_ref(L, LUA_REGISTRYINDEX);
-  };
+  }
+
+  /* Get options table (optional; other values are ignored) */
+  if (lua_istable(L, 3)) {
+    lua_getfield(L, 3, "max_depth");
+    if (lua_isnumber(L, -1) && lua_tointeger(L, -1) > 0) {
+      max_depth = (size_t)lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "decode");
+    decode = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "slice");
+    slice = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    for (k = 0; k < 4; k++) {
+      lua_getfield(L, 3, limit_names[k]);
+      if (lua_isnumber(L, -1) && lua_tointeger(L, -1) > 0) {
+        limits[k] = (size_t)lua_tointeger(L, -1);
+      }
+      lua_pop(L, 1);
+    }
+  }
 
   /* Create userdata */
   lmp = (lua_multipart_parser*)lua_newuserdata(L, sizeof(lua_multipart_parser));
   if (!lmp) {
-    luaL_unref(L, LUA_REGISTRYINDEX, ref);
     return luaL_error(L, "Failed to allocate memory for parser");
   }
 
-  /* Initialize basic fields */
+  /* Initialize basic fields; from here on __gc releases the refs */
   lmp->parser = NULL;
   lmp->L = L;
-  lmp->callbacks_ref = ref;
+  for (k = 0; k < LMP_CALLBACK_COUNT; k++) {
+    lmp->callback_refs[k] = LUA_NOREF;
+  }
+  lmp->slice = NULL;
+  lmp->slice_ref = LUA_NOREF;
   lmp->last_error[0] = '\0';
 
   /* Set metatable */
   luaL_getmetatable(L, MULTIPART_PARSER_MT);
   lua_setmetatable(L, -2);
 
-  /* Setup callbacks in the structure's settings */
+  /* Resolve each callback to a registry ref of its own */
+  if (lua_istable(L, 2)) {
+    for (k = 0; k < LMP_CALLBACK_COUNT; k++) {
+      lua_getfield(L, 2, callback_names[k]);
+      if (lua_isfunction(L, -1)) {
+        lmp->callback_refs[k] = luaL_ref(L, LUA_REGISTRYINDEX);
+      } else {
+        lua_pop(L, 1);
+      }
+    }
+  }
+
+  if (slice) {
+    lmp->slice = (lua_multipart_slice*)lua_newuserdata(L, sizeof(lua_multipart_slice));
+    lmp->slice->at = NULL;
+    lmp->slice->length = 0;
+    luaL_getmetatable(L, MULTIPART_SLICE_MT);
+    lua_setmetatable(L, -2);
+    lmp->slice_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  /* Setup callbacks in the structure's settings: only those with a Lua
+   * function, so the parser skips the work for the others */
   memset(&lmp->settings, 0, sizeof(multipart_parser_settings));
-  lmp->settings.on_header_field = on_header_field_cb;
-  lmp->settings.on_header_value = on_header_value_cb;
-  lmp->settings.on_part_data = on_part_data_cb;
-  lmp->settings.on_part_data_begin = on_part_data_begin_cb;
-  lmp->settings.on_headers_complete = on_headers_complete_cb;
-  lmp->settings.on_part_data_end = on_part_data_end_cb;
-  lmp->settings.on_body_end = on_body_end_cb;
+#define LMP_SET_CALLBACK(FOR, WHICH)                                   \
+  if (lmp->callback_refs[WHICH] != LUA_NOREF) {                        \
+    lmp->settings.FOR = FOR##_cb;                                      \
+  }
+  LMP_SET_CALLBACK(on_header_field, LMP_ON_HEADER_FIELD)
+  LMP_SET_CALLBACK(on_header_value, LMP_ON_HEADER_VALUE)
+  LMP_SET_CALLBACK(on_part_data, LMP_ON_PART_DATA)
+  LMP_SET_CALLBACK(on_part_data_begin, LMP_ON_PART_DATA_BEGIN)
+  LMP_SET_CALLBACK(on_headers_complete, LMP_ON_HEADERS_COMPLETE)
+  LMP_SET_CALLBACK(on_part_data_end, LMP_ON_PART_DATA_END)
+  LMP_SET_CALLBACK(on_body_end, LMP_ON_BODY_END)
+#undef LMP_SET_CALLBACK
+  lmp->settings.max_depth = max_depth;
+  lmp->settings.decode_transfer_encoding = decode;
+  lmp->settings.max_part_size = limits[0];
+  lmp->settings.max_header_bytes = limits[1];
+  lmp->settings.max_parts = limits[2];
+  lmp->settings.max_total_size = limits[3];
 
   /* Initialize parser with pointer to our settings */
   lmp->parser = multipart_parser_init(boundary, &lmp->settings);
   if (!lmp->parser) {
-    /* Clean up callbacks_ref to prevent memory leak */
-    if (lmp->callbacks_ref != LUA_NOREF) {
-      luaL_unref(L, LUA_REGISTRYINDEX, lmp->callbacks_ref);
-      lmp->callbacks_ref = LUA_NOREF;
-    }
+    /* Release the refs now rather than at garbage collection */
+    release_refs(L, lmp);
     return luaL_error(L, "Failed to initialize multipart parser");
   }
 
@@ -326,6 +425,10 @@ static int lmp_execute(lua_State* L) {
     return luaL_error(L, "Parser already freed");
   }
 
+  /* Callbacks run on the calling thread, which in a coroutine is not the
+   * one that created the parser */
+  lmp->L = L;
+
   /* Execute parser - the 'data' pointer is safe because index 2 is still on
    * stack */
   parsed = multipart_parser_execute(lmp->parser, data, len);
@@ -334,6 +437,60 @@ static int lmp_execute(lua_State* L) {
   return 1;
 }
 
+/* Lua API: parser:execute_events(data)
+ * Parses data without calling back into Lua. Returns the number of bytes
+ * parsed, a flat array with three slots per event (the event type from
+ * multipart_parser.EVENT, the bytes for header and data events or false for
+ * the others, and the nesting depth) and the number of events. */
+static int lmp_execute_events(lua_State* L) {
+  lua_multipart_parser* lmp;
+  multipart_event events[LMP_EVENT_BATCH];
+  char const* data;
+  size_t len;
+  size_t offset = 0;
+  size_t count;
+  size_t k;
+  int slot = 0;
+
+  lmp = (lua_multipart_parser*)luaL_checkudata(L, 1, MULTIPART_PARSER_MT);
+
+  /* The string at index 2 stays on the stack, so event pointers into it
+   * remain valid while the events table is filled */
+  data = luaL_checklstring(L, 2, &len);
+
+  if (!lmp->parser) {
+    return luaL_error(L, "Parser already freed");
+  }
+
+  lua_newtable(L);
+  while (offset < len) {
+    offset += multipart_parser_execute_events(lmp->parser, data + offset,
+                                              len - offset, events,
+                                              LMP_EVENT_BATCH, &count);
+    for (k = 0; k < count; k++) {
+      lua_pushinteger(L, events[k].type);
+      lua_rawseti(L, -2, ++slot);
+      if (events[k].at != NULL) {
+        lua_pushlstring(L, events[k].at, events[k].length);
+      } else {
+        lua_pushboolean(L, 0);
+      }
+      lua_rawseti(L, -2, ++slot);
+      lua_pushinteger(L, (lua_Integer)events[k].depth);
+      lua_rawseti(L, -2, ++slot);
+    }
+    /* A partly filled batch means the data is consumed or a parse error */
+    if (count < LMP_EVENT_BATCH) {
+      break;
+    }
+  }
+
+  lua_pushinteger(L, offset);
+  lua_insert(L, -2);
+  lua_pushinteger(L, slot / 3);
+  return 3;
+}
+
 /* Lua API: parser:get_error() */
 static int lmp_get_error(lua_State* L) {
   lua_multipart_parser* lmp;
@@ -380,6 +537,62 @@ static int lmp_get_last_lua_error(lua_State* L) {
   return 1;
 }
 
+/* Lua API: parser:get_stats()
+ * Returns a table of the parser's counters, or nil and a message when the
+ * library was built without MULTIPART_PARSER_STATS. */
+static int lmp_get_stats(lua_State* L) {
+  static char const* const callback_names[MULTIPART_STATS_CALLBACK_COUNT] = {
+    "on_header_field", "on_header_value", "on_part_data",
+    "on_part_data_begin", "on_headers_complete", "on_part_data_end",
+    "on_body_end", "on_part_data_span", "on_part_headers"
+  };
+  lua_multipart_parser* lmp;
+  multipart_parser_stats stats;
+  char const* name;
+  size_t k;
+
+  lmp = (lua_multipart_parser*)luaL_checkudata(L, 1, MULTIPART_PARSER_MT);
+
+  if (!lmp->parser) {
+    return luaL_error(L, "Parser already freed");
+  }
+
+  if (multipart_parser_get_stats(lmp->parser, &stats) != 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "statistics not compiled in (define MULTIPART_PARSER_STATS)");
+    return 2;
+  }
+
+  lua_newtable(L);
+
+  lua_newtable(L);
+  for (k = 0; k < MULTIPART_STATS_STATES; k++) {
+    name = multipart_parser_stats_state_name(k);
+    if (name != NULL) {
+      lua_pushinteger(L, (lua_Integer)stats.state_bytes[k]);
+      lua_setfield(L, -2, name);
+    }
+  }
+  lua_setfield(L, -2, "state_bytes");
+
+  lua_newtable(L);
+  for (k = 0; k < MULTIPART_STATS_CALLBACK_COUNT; k++) {
+    lua_pushinteger(L, (lua_Integer)stats.callbacks[k]);
+    lua_setfield(L, -2, callback_names[k]);
+  }
+  lua_setfield(L, -2, "callbacks");
+
+  lua_pushinteger(L, (lua_Integer)stats.cr_false_positives);
+  lua_setfield(L, -2, "cr_false_positives");
+  lua_pushinteger(L, (lua_Integer)stats.lookbehind_replays);
+  lua_setfield(L, -2, "lookbehind_replays");
+  lua_pushinteger(L, (lua_Integer)stats.bytes_buffered);
+  lua_setfield(L, -2, "bytes_buffered");
+  lua_pushinteger(L, (lua_Integer)stats.largest_header);
+  lua_setfield(L, -2, "largest_header");
+  return 1;
+}
+
 /* Lua API: parser:reset(boundary) */
 static int lmp_reset(lua_State* L) {
   lua_multipart_parser* lmp;
@@ -423,10 +636,7 @@ static int lmp_free(lua_State* L) {
     lmp->parser = NULL;
   }
 
-  if (lmp->callbacks_ref != LUA_NOREF) {
-    luaL_unref(L, LUA_REGISTRYINDEX, lmp->callbacks_ref);
-    lmp->callbacks_ref = LUA_NOREF;
-  }
+  release_refs(L, lmp);
 
   return 0;
 }
@@ -435,9 +645,11 @@ static int lmp_free(lua_State* L) {
 static luaL_Reg const parser_methods[] = {
     {"execute", lmp_execute},
     {"feed", lmp_execute},  /* Alias for execute, clearer for streaming use */
+    {"execute_events", lmp_execute_events},
     {"get_error", lmp_get_error},
     {"get_error_message", lmp_get_error_message},
     {"get_last_lua_error", lmp_get_last_lua_error},
+    {"get_stats", lmp_get_stats},
     {"reset", lmp_reset},
     {"free", lmp_free},
     {NULL, NULL}};
@@ -471,12 +683,52 @@ static void create_error_codes(lua_State* L) {
   lua_pushinteger(L, MPPE_INVALID_STATE);
   lua_setfield(L, -2, "INVALID_STATE");
 
+  lua_pushinteger(L, MPPE_PART_TOO_LARGE);
+  lua_setfield(L, -2, "PART_TOO_LARGE");
+
+  lua_pushinteger(L, MPPE_HEADERS_TOO_LARGE);
+  lua_setfield(L, -2, "HEADERS_TOO_LARGE");
+
+  lua_pushinteger(L, MPPE_TOO_MANY_PARTS);
+  lua_setfield(L, -2, "TOO_MANY_PARTS");
+
+  lua_pushinteger(L, MPPE_BODY_TOO_LARGE);
+  lua_setfield(L, -2, "BODY_TOO_LARGE");
+
   lua_pushinteger(L, MPPE_UNKNOWN);
   lua_setfield(L, -2, "UNKNOWN");
 
   lua_setfield(L, -2, "ERROR");
 }
 
+/* Event types table for execute_events() */
+static void create_event_types(lua_State* L) {
+  lua_newtable(L);
+
+  lua_pushinteger(L, MULTIPART_EVENT_PART_BEGIN);
+  lua_setfield(L, -2, "PART_BEGIN");
+
+  lua_pushinteger(L, MULTIPART_EVENT_HEADER_FIELD);
+  lua_setfield(L, -2, "HEADER_FIELD");
+
+  lua_pushinteger(L, MULTIPART_EVENT_HEADER_VALUE);
+  lua_setfield(L, -2, "HEADER_VALUE");
+
+  lua_pushinteger(L, MULTIPART_EVENT_HEADERS_COMPLETE);
+  lua_setfield(L, -2, "HEADERS_COMPLETE");
+
+  lua_pushinteger(L, MULTIPART_EVENT_DATA);
+  lua_setfield(L, -2, "DATA");
+
+  lua_pushinteger(L, MULTIPART_EVENT_PART_END);
+  lua_setfield(L, -2, "PART_END");
+
+  lua_pushinteger(L, MULTIPART_EVENT_BODY_END);
+  lua_setfield(L, -2, "BODY_END");
+
+  lua_setfield(L, -2, "EVENT");
+}
+
 /* Module initialization */
 int luaopen_multipart_parser(lua_State* L) {
   /* Create metatable */
@@ -488,6 +740,17 @@ int luaopen_multipart_parser(lua_State* L) {
   luaL_setfuncs(L, parser_methods, 0);
   lua_pop(L, 1);
 
+  /* Create slice metatable */
+  luaL_newmetatable(L, MULTIPART_SLICE_MT);
+  lua_newtable(L);
+  luaL_setfuncs(L, slice_methods, 0);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, lmp_slice_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, lmp_slice_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+
   /* Create module table */
   lua_newtable(L);
   luaL_setfuncs(L, module_funcs, 0);
@@ -495,6 +758,9 @@ int luaopen_multipart_parser(lua_State* L) {
   /* Add error codes */
   create_error_codes(L);
 
+  /* Add event types */
+  create_event_types(L);
+
   /* Add version */
   lua_pushstring(L, "1.0.0");
   lua_setfield(L, -2, "_VERSION");
@@ -47,158 +47,178 @@ local function extract_boundary(content_type)
   return extract_param(content_type, "boundary")
 end
 
---- Parse multipart data recursively
--- Internal function to handle nested multipart messages
+-- Nesting levels split by the C parser in the same pass; bodies nested
+-- deeper arrive as part data and are parsed from their buffered bytes
+local MAX_DEPTH = 8
+
+--- Turn the parts of a nested body into the value of its enclosing part
+-- @local
+-- @param nested_result (table) Parsed parts of the nested body
+-- @return (table) Named fields as-is, or an array for multipart/mixed
+local function nested_value(nested_result)
+  -- Check if the nested parts have field names or are attachments
+  for k, v in pairs(nested_result) do
+    if type(k) == "string" then
+      -- Has named fields, return as-is (nested form data)
+      return nested_result
+    end
+  end
+  -- All numeric indices, return as array (multipart/mixed)
+  local arr = {}
+  for k, v in pairs(nested_result) do
+    if type(k) == "number" then
+      table.insert(arr, v)
+    end
+  end
+  return arr
+end
+
+local parse_multipart
+
+--- Add a completed part to the parts of its body
+-- @local
+-- @param frame (table) State of the body the part belongs to
+local function finish_part(frame)
+  local result = frame.result
+  local current_headers = frame.headers
+
+  -- Get disposition header (case-insensitive)
+  local disp = current_headers["Content-Disposition"] or current_headers["content-disposition"] or current_headers["Content-disposition"]
+
+  -- Extract field name and filename
+  local field_name = disp and extract_param(disp, "name")
+  local filename = disp and extract_param(disp, "filename")
+
+  -- A multipart part the C parser did not open (e.g. "multipart/mixed,
+  -- boundary=x" instead of ';') is parsed from its buffered data
+  local content_type = current_headers["Content-Type"] or current_headers["Content-type"] or current_headers["content-type"]
+  local inner_boundary = not frame.nested and content_type and
+    content_type:match("multipart/") and extract_boundary(content_type)
+
+  -- Process the part
+  local value
+  if frame.nested then
+    value = nested_value(frame.nested)
+  elseif inner_boundary then
+    value = nested_value(parse_multipart(inner_boundary, table.concat(frame.data_chunks)))
+  else
+    -- Regular field or file
+    local combined_data = table.concat(frame.data_chunks)
+
+    if filename ~= nil then
+      -- File upload (has filename parameter)
+      value = {combined_data}
+      value.filename = filename
+      -- Add all headers except Content-Disposition
+      -- Preserve original header case (e.g., Content-Type vs Content-type)
+      for k, v in pairs(current_headers) do
+        local k_lower = k:lower()
+        if k_lower ~= "content-disposition" then
+          value[k] = v
+        end
+      end
+    else
+      -- Simple field (no filename, even if it has Content-Type)
+      value = combined_data
+    end
+  end
+
+  -- Add to result
+  if field_name then
+    if result[field_name] then
+      -- Field already exists - convert to or append to array
+      if type(result[field_name]) == "table" and result[field_name][1] and not result[field_name].filename then
+        -- Already an array
+        table.insert(result[field_name], value)
+      else
+        -- Convert to array
+        result[field_name] = {result[field_name], value}
+      end
+    else
+      result[field_name] = value
+    end
+  else
+    -- No field name - use numeric index
+    local idx = 1
+    while result[idx] do
+      idx = idx + 1
+    end
+    result[idx] = value
+  end
+end
+
+--- Parse a multipart body, including nested multipart parts
+-- Nested bodies are parsed by the C parser in the same pass (max_depth), so
+-- they are never buffered and scanned a second time. Events carry their
+-- depth; one frame per open body collects the current part.
 -- @local
 -- @param boundary (string) Boundary delimiter
 -- @param body (string) Multipart message body
 -- @return (table) Parsed parts as a table
-local function parse_multipart(boundary, body)
-  local result = {}
-  local current_part = nil
-  local current_field = nil
-  local current_headers = {}
-  local nested_boundary = nil
-  local nested_content_chunks = {}
-
-  local callbacks = {
-    on_part_data_begin = function()
-      current_part = {data_chunks = {}}
-      current_headers = {}
-      current_field = nil
-      nested_boundary = nil
-      nested_content_chunks = {}
-      return 0
-    end,
-
-    on_header_field = function(data)
-      current_field = data
-      return 0
+function parse_multipart(boundary, body)
+  local function new_frame()
+    return {result = {}, headers = {}, data_chunks = {}}
+  end
+  local frames = {new_frame()}
+
+  local handlers = {
+    [mp.EVENT.PART_BEGIN] = function(frame)
+      frame.headers = {}
+      frame.data_chunks = {}
+      frame.field = nil
+      frame.nested = nil
     end,
 
-    on_header_value = function(data)
-      if current_field then
-        current_headers[current_field] = data
-        current_field = nil
-      end
-      return 0
+    [mp.EVENT.HEADER_FIELD] = function(frame, data)
+      frame.field = data
     end,
 
-    on_headers_complete = function()
-      -- Check if this is nested multipart
-      local content_type = current_headers["Content-Type"] or current_headers["Content-type"] or current_headers["content-type"]
-      if content_type and content_type:match("multipart/") then
-        nested_boundary = extract_boundary(content_type)
+    [mp.EVENT.HEADER_VALUE] = function(frame, data)
+      if frame.field then
+        frame.headers[frame.field] = data
+        frame.field = nil
       end
-      return 0
     end,
 
-    on_part_data = function(data)
-      if nested_boundary then
-        -- Collecting nested multipart data
-        table.insert(nested_content_chunks, data)
-      else
-        -- Regular part data
-        table.insert(current_part.data_chunks, data)
-      end
-      return 0
+    [mp.EVENT.DATA] = function(frame, data)
+      table.insert(frame.data_chunks, data)
     end,
 
-    on_part_data_end = function()
-      -- Get disposition header (case-insensitive)
-      local disp = current_headers["Content-Disposition"] or current_headers["content-disposition"] or current_headers["Content-disposition"]
-
-      -- Extract field name and filename
-      local field_name = disp and extract_param(disp, "name")
-      local filename = disp and extract_param(disp, "filename")
-
-      -- Process the part
-      local value
-      if nested_boundary then
-        -- Parse nested multipart
-        local nested_content = table.concat(nested_content_chunks)
-        local nested_result = parse_multipart(nested_boundary, nested_content)
-        -- For nested multipart/mixed, convert the result to an array
-        -- Check if the nested parts have field names or are attachments
-        local has_field_names = false
-        for k, v in pairs(nested_result) do
-          if type(k) == "string" then
-            has_field_names = true
-            break
-          end
-        end
-        if has_field_names then
-          -- Has named fields, return as-is (nested form data)
-          value = nested_result
-        else
-          -- All numeric indices, return as array (multipart/mixed)
-          local arr = {}
-          for k, v in pairs(nested_result) do
-            if type(k) == "number" then
-              table.insert(arr, v)
-            end
-          end
-          value = arr
-        end
-      else
-        -- Regular field or file
-        local combined_data = table.concat(current_part.data_chunks)
-
-        if filename ~= nil then
-          -- File upload (has filename parameter)
-          value = {combined_data}
-          value.filename = filename
-          -- Add all headers except Content-Disposition
-          -- Preserve original header case (e.g., Content-Type vs Content-type)
-          for k, v in pairs(current_headers) do
-            local k_lower = k:lower()
-            if k_lower ~= "content-disposition" then
-              value[k] = v
-            end
-          end
-        else
-          -- Simple field (no filename, even if it has Content-Type)
-          value = combined_data
-        end
-      end
+    [mp.EVENT.PART_END] = finish_part,
 
-      -- Add to result
-      if field_name then
-        if result[field_name] then
-          -- Field already exists - convert to or append to array
-          if type(result[field_name]) == "table" and result[field_name][1] and not result[field_name].filename then
-            -- Already an array
-            table.insert(result[field_name], value)
-          else
-            -- Convert to array
-            result[field_name] = {result[field_name], value}
-          end
-        else
-          result[field_name] = value
-        end
-      else
-        -- No field name - use numeric index
-        local idx = 1
-        while result[idx] do
-          idx = idx + 1
-        end
-        result[idx] = value
+    [mp.EVENT.BODY_END] = function(frame, data, depth)
+      if depth > 0 then
+        -- The nested body is the value of the enclosing part
+        table.remove(frames)
+        frames[depth].nested = frame.result
       end
-
-      return 0
     end,
   }
 
-  -- Create parser and execute
-  local parser = mp.new(boundary, callbacks)
+  -- Create parser and execute. The whole body is parsed in one C call and
+  -- the batched events are dispatched here, instead of the parser calling
+  -- into Lua once per event.
+  local parser = mp.new(boundary, nil, {max_depth = MAX_DEPTH})
   if not parser then
     return {}
   end
 
-  parser:execute(body)
+  local _, events, count = parser:execute_events(body)
   parser:free()
 
-  return result
+  for k = 1, 3 * count, 3 do
+    local depth = events[k + 2]
+    -- The first event at a new depth opens the nested body
+    while #frames <= depth do
+      table.insert(frames, new_frame())
+    end
+    local handler = handlers[events[k]]
+    if handler then
+      handler(frames[depth + 1], events[k + 1], depth)
+    end
+  end
+
+  return frames[1].result
 end
 
 --- Parse multipart/form-data message
@@ -0,0 +1,237 @@
+--- LuaJIT FFI binding for multipart-parser-c
+-- Declares the multipart_parser.h API with ffi.cdef and drives the parser
+-- through its batch event API (multipart_parser_execute_events), so no C
+-- function calls back into Lua. Part data and header bytes stay in the
+-- input as pointer + length until ffi.string() is called on them, and the
+-- whole parse loop can be compiled by the JIT, which the Lua C API of
+-- multipart_parser.so prevents.
+--
+-- Requires LuaJIT and the parser as a shared library (libmultipart.so, see
+-- `make ffi` in binding/lua or `make solib` in the repository root).
+--
+-- @module multipart_ffi
+-- @author multipart-parser-c project
+-- @license MIT
+-- @copyright 2026
+
+local ffi = require("ffi")
+
+local M = {}
+M._VERSION = "1.0.0"
+
+-- Keep in sync with multipart_parser.h
+if not pcall(ffi.typeof, "multipart_event") then
+  ffi.cdef[[
+typedef struct multipart_parser multipart_parser;
+
+typedef int (*multipart_data_cb) (multipart_parser*, const char *at, size_t length);
+typedef int (*multipart_notify_cb) (multipart_parser*);
+typedef int (*multipart_span_cb) (multipart_parser*, size_t offset, size_t length);
+typedef int (*multipart_headers_cb) (multipart_parser*, const void* headers);
+
+typedef struct multipart_parser_settings {
+  multipart_data_cb on_header_field;
+  multipart_data_cb on_header_value;
+  multipart_data_cb on_part_data;
+  multipart_notify_cb on_part_data_begin;
+  multipart_notify_cb on_headers_complete;
+  multipart_notify_cb on_part_data_end;
+  multipart_notify_cb on_body_end;
+  size_t buffer_size;
+  multipart_span_cb on_part_data_span;
+  multipart_headers_cb on_part_headers;
+  size_t header_arena_size;
+  size_t max_depth;
+  int decode_transfer_encoding;
+  int digest;
+  size_t max_part_size;
+  size_t max_header_bytes;
+  size_t max_parts;
+  size_t max_total_size;
+} multipart_parser_settings;
+
+typedef struct {
+  int type;
+  const char *at;
+  size_t length;
+  int header;
+  size_t depth;
+} multipart_event;
+
+multipart_parser* multipart_parser_init(const char *boundary,
+                                        const multipart_parser_settings* settings);
+void multipart_parser_free(multipart_parser* p);
+int multipart_parser_reset(multipart_parser* p, const char *boundary);
+size_t multipart_parser_execute_events(multipart_parser* p,
+                                       const char *buf, size_t len,
+                                       multipart_event* events,
+                                       size_t max_events, size_t* n_events);
+int multipart_parser_get_error(multipart_parser* p);
+const char* multipart_parser_get_error_message(multipart_parser* p);
+]]
+end
+
+--- Event types (multipart_event_type), the same values as multipart_parser.EVENT
+M.EVENT = {
+  PART_BEGIN = 1,
+  HEADER_FIELD = 2,
+  HEADER_VALUE = 3,
+  HEADERS_COMPLETE = 4,
+  DATA = 5,
+  PART_END = 6,
+  BODY_END = 7,
+}
+
+--- Error codes (multipart_parser_error), the same values as multipart_parser.ERROR
+M.ERROR = {
+  OK = 0,
+  PAUSED = 1,
+  INVALID_BOUNDARY = 2,
+  INVALID_HEADER_FIELD = 3,
+  INVALID_HEADER_FORMAT = 4,
+  INVALID_STATE = 5,
+  PART_TOO_LARGE = 6,
+  HEADERS_TOO_LARGE = 7,
+  TOO_MANY_PARTS = 8,
+  BODY_TOO_LARGE = 9,
+  UNKNOWN = 10,
+}
+
+-- Events fetched per multipart_parser_execute_events() call by default
+local DEFAULT_BATCH = 64
+
+local settings_options = {
+  "max_depth", "max_part_size", "max_header_bytes", "max_parts",
+  "max_total_size",
+}
+
+local lib
+
+--- Load the parser library
+-- Called by new() with no argument if no library was loaded yet.
+-- @param path (string, optional) Library name or path for ffi.load();
+--   defaults to "multipart", i.e. libmultipart.so on the library path
+-- @return The ffi library namespace
+function M.load(path)
+  lib = ffi.load(path or "multipart")
+  return lib
+end
+
+local Parser = {}
+Parser.__index = Parser
+
+--- Create a parser
+-- @param boundary (string) The boundary string (without "--" prefix)
+-- @param options (table, optional) `max_depth`, `max_part_size`,
+--   `max_header_bytes`, `max_parts` and `max_total_size` as for
+--   multipart_parser.new(); `batch`, the capacity of the event array
+-- @return Parser object, or nil and an error message
+function M.new(boundary, options)
+  if not lib then
+    M.load()
+  end
+  options = options or {}
+
+  local settings = ffi.new("multipart_parser_settings")
+  for _, name in ipairs(settings_options) do
+    if type(options[name]) == "number" and options[name] > 0 then
+      settings[name] = options[name]
+    end
+  end
+
+  local p = lib.multipart_parser_init(boundary, settings)
+  if p == nil then
+    return nil, "Failed to initialize multipart parser"
+  end
+
+  local batch = options.batch or DEFAULT_BATCH
+  return setmetatable({
+    p = ffi.gc(p, lib.multipart_parser_free),
+    -- The parser keeps a pointer to its settings: they live as long as it
+    settings = settings,
+    --- Events of the last execute() call, indexed from 0
+    events = ffi.new("multipart_event[?]", batch),
+    batch = batch,
+    count = ffi.new("size_t[1]"),
+  }, Parser)
+end
+
+--- Parse bytes into the event array
+-- Parses until the input is consumed or `parser.events` is full. Event
+-- pointers (`at`, `length`) refer to the input, or for part data held back
+-- at a chunk end to parser memory; use them before the next call and while
+-- the input is alive, e.g. with ffi.string(ev.at, ev.length).
+-- @param data (string|cdata) Input, a Lua string or a `const char*`
+-- @param offset (number, optional) Bytes of data to skip, default 0
+-- @param len (number, optional) Bytes to parse from offset; required for
+--   cdata, defaults to the rest of a string
+-- @return (number) Bytes consumed
+-- @return (number) Number of events in `parser.events[0 .. n - 1]`
+function Parser:execute(data, offset, len)
+  local p = self.p
+  if p == nil then
+    error("Parser already freed")
+  end
+  offset = offset or 0
+  len = len or #data - offset
+  local buf = ffi.cast("const char*", data) + offset
+  local parsed = lib.multipart_parser_execute_events(p, buf, len, self.events,
+                                                     self.batch, self.count)
+  return tonumber(parsed), tonumber(self.count[0])
+end
+
+--- Parse a whole chunk and hand each event to a function
+-- @param data (string) Input chunk
+-- @param handler (function) Called as handler(type, at, length, depth) per
+--   event; `at` is a `const char*` or nil, valid during the call
+-- @return (number) Bytes consumed; less than #data after an error, see
+--   get_error()
+function Parser:feed(data, handler)
+  local events = self.events
+  local offset = 0
+  local len = #data
+  while offset < len do
+    local parsed, n = self:execute(data, offset, len - offset)
+    offset = offset + parsed
+    for k = 0, n - 1 do
+      local ev = events[k]
+      handler(ev.type, ev.at ~= nil and ev.at or nil, tonumber(ev.length),
+              tonumber(ev.depth))
+    end
+    -- A partly filled batch means the data is consumed or a parse error
+    if n < self.batch then
+      break
+    end
+  end
+  return offset
+end
+
+--- Get the parser's error code (see M.ERROR)
+function Parser:get_error()
+  return lib.multipart_parser_get_error(self.p)
+end
+
+--- Get a description of the parser's error
+function Parser:get_error_message()
+  return ffi.string(lib.multipart_parser_get_error_message(self.p))
+end
+
+--- Reset the parser for a new body
+-- @param boundary (string, optional) New boundary; keeps the old one if nil
+-- @return true, or nil and an error message if the boundary is too long
+function Parser:reset(boundary)
+  if lib.multipart_parser_reset(self.p, boundary) ~= 0 then
+    return nil, "Failed to reset parser: new boundary too long"
+  end
+  return true
+end
+
+--- Free the parser now instead of at garbage collection
+function Parser:free()
+  if self.p ~= nil then
+    lib.multipart_parser_free(ffi.gc(self.p, nil))
+    self.p = nil
+  end
+end
+
+return M
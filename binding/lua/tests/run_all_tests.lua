@@ -29,6 +29,7 @@ local test_suites = {
   {name = "Streaming Support", file = "test_streaming.lua"},
   {name = "Large Data Handling", file = "test_large_data.lua"},
   {name = "Parse and Build Functions", file = "test_multipart.lua"},
+  {name = "LuaJIT FFI Binding", file = "test_ffi.lua"},
 }
 
 -- Results tracking
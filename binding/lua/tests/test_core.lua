@@ -67,6 +67,10 @@ local function test_error_codes()
     "INVALID_HEADER_FIELD",
     "INVALID_HEADER_FORMAT",
     "INVALID_STATE",
+    "PART_TOO_LARGE",
+    "HEADERS_TOO_LARGE",
+    "TOO_MANY_PARTS",
+    "BODY_TOO_LARGE",
     "UNKNOWN",
   }
 
@@ -400,6 +404,207 @@ local function test_callback_pause()
   test_pass()
 end
 
+-- Test: Batched events
+local function test_execute_events()
+  test_start("Batched events with execute_events")
+
+  if not mp.EVENT then
+    test_fail("EVENT table not found")
+    return
+  end
+
+  local called = false
+  local parser = mp.new("batch", {
+    on_part_data = function()
+      called = true
+      return 0
+    end,
+  })
+  local data = "--batch\r\n" .. "Content-Type: text/plain\r\n" .. "\r\n" ..
+               "hello\r\n" .. "--batch--"
+
+  local parsed, events, count = parser:execute_events(data)
+  parser:free()
+
+  if parsed ~= #data then
+    test_fail(string.format("Parsed %d bytes, expected %d", parsed, #data))
+    return
+  end
+
+  local expected = {
+    {mp.EVENT.PART_BEGIN, false},
+    {mp.EVENT.HEADER_FIELD, "Content-Type"},
+    {mp.EVENT.HEADER_VALUE, "text/plain"},
+    {mp.EVENT.HEADERS_COMPLETE, false},
+    {mp.EVENT.DATA, "hello"},
+    {mp.EVENT.PART_END, false},
+    {mp.EVENT.BODY_END, false},
+  }
+  if count ~= #expected then
+    test_fail(string.format("Got %d events, expected %d", count, #expected))
+    return
+  end
+  for i, ev in ipairs(expected) do
+    if events[3 * i - 2] ~= ev[1] or events[3 * i - 1] ~= ev[2] or
+       events[3 * i] ~= 0 then
+      test_fail("Unexpected event " .. i)
+      return
+    end
+  end
+
+  if called then
+    test_fail("Callbacks must not run for execute_events")
+    return
+  end
+
+  test_pass()
+end
+
+-- Test: Nested multipart events carry their depth
+local function test_nested_events()
+  test_start("Nested multipart with max_depth")
+
+  local parser = mp.new("outer", nil, {max_depth = 1})
+  local data = "--outer\r\n" ..
+               "Content-Type: multipart/mixed; boundary=inner\r\n" .. "\r\n" ..
+               "--inner\r\n" .. "\r\n" .. "x\r\n" .. "--inner--\r\n" ..
+               "--outer--"
+
+  local parsed, events, count = parser:execute_events(data)
+  parser:free()
+
+  if parsed ~= #data then
+    test_fail(string.format("Parsed %d bytes, expected %d", parsed, #data))
+    return
+  end
+
+  local expected = {
+    {mp.EVENT.PART_BEGIN, 0},
+    {mp.EVENT.HEADER_FIELD, 0},
+    {mp.EVENT.HEADER_VALUE, 0},
+    {mp.EVENT.HEADERS_COMPLETE, 0},
+    {mp.EVENT.PART_BEGIN, 1},
+    {mp.EVENT.HEADERS_COMPLETE, 1},
+    {mp.EVENT.DATA, 1},
+    {mp.EVENT.PART_END, 1},
+    {mp.EVENT.BODY_END, 1},
+    {mp.EVENT.PART_END, 0},
+    {mp.EVENT.BODY_END, 0},
+  }
+  if count ~= #expected then
+    test_fail(string.format("Got %d events, expected %d", count, #expected))
+    return
+  end
+  for i, ev in ipairs(expected) do
+    if events[3 * i - 2] ~= ev[1] or events[3 * i] ~= ev[2] then
+      test_fail("Unexpected event " .. i)
+      return
+    end
+  end
+
+  test_pass()
+end
+
+-- Test: base64 parts are decoded with the decode option
+local function test_transfer_decoding()
+  test_start("Transfer decoding with the decode option")
+
+  local chunks = {}
+  local parser = mp.new("b", {
+    on_part_data = function(data)
+      table.insert(chunks, data)
+      return 0
+    end,
+  }, {decode = true})
+  local data = "--b\r\n" ..
+               "Content-Transfer-Encoding: base64\r\n" .. "\r\n" ..
+               "SGVs\r\nbG8=\r\n" ..
+               "--b--"
+
+  local parsed = parser:execute(data)
+  parser:free()
+
+  if parsed ~= #data then
+    test_fail(string.format("Parsed %d bytes, expected %d", parsed, #data))
+    return
+  end
+  if table.concat(chunks) ~= "Hello" then
+    test_fail("Got '" .. table.concat(chunks) .. "', expected 'Hello'")
+    return
+  end
+
+  test_pass()
+end
+
+-- Test: part data as a reused slice with the slice option
+local function test_slice_data()
+  test_start("Part data slices with the slice option")
+
+  local chunks = {}
+  local kept
+  local parser = mp.new("b", {
+    on_part_data = function(slice)
+      kept = slice
+      if #slice ~= slice:len() or slice:sub(1, -1) ~= slice:tostring() or
+         slice:byte(1) ~= string.byte(slice:tostring(), 1) or
+         type((slice:ptr())) ~= "userdata" then
+        error("slice methods disagree")
+      end
+      table.insert(chunks, tostring(slice))
+      return 0
+    end,
+  }, {slice = true})
+  local data = "--b\r\n" .. "\r\n" .. "Hello, slice\r\n" .. "--b--"
+
+  local parsed = parser:execute(data)
+  local err = parser:get_last_lua_error()
+  parser:free()
+
+  if parsed ~= #data or err then
+    test_fail("Parse failed: " .. tostring(err))
+    return
+  end
+  if table.concat(chunks) ~= "Hello, slice" then
+    test_fail("Got '" .. table.concat(chunks) .. "', expected 'Hello, slice'")
+    return
+  end
+  if pcall(function() return kept:tostring() end) then
+    test_fail("Slice usable after its callback returned")
+    return
+  end
+
+  test_pass()
+end
+
+-- Test: callbacks are looked up when the parser is created
+local function test_callbacks_resolved_once()
+  test_start("Callbacks resolved at mp.new()")
+
+  local seen = 0
+  local callbacks = {
+    on_part_data_end = function()
+      seen = seen + 1
+      return 0
+    end,
+  }
+  local parser = mp.new("b", callbacks)
+  callbacks.on_part_data_end = nil
+  callbacks.on_body_end = function()
+    seen = seen + 10
+    return 0
+  end
+
+  parser:execute("--b\r\n\r\nx\r\n--b--")
+  parser:free()
+
+  if seen ~= 1 then
+    test_fail(string.format("Callback count %d, expected 1", seen))
+    return
+  end
+
+  test_pass()
+end
+
 -- Test 10: Parser reuse (multiple parsers)
 local function test_multiple_parsers()
   test_start("Multiple parser instances")
@@ -1084,6 +1289,11 @@ local function run_all_tests()
   test_binary_data()
   test_error_handling()
   test_callback_pause()
+  test_execute_events()
+  test_nested_events()
+  test_transfer_decoding()
+  test_slice_data()
+  test_callbacks_resolved_once()
   test_multiple_parsers()
   test_empty_parts()
   test_large_boundary()
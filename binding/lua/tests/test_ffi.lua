@@ -0,0 +1,175 @@
+#!/usr/bin/env luajit
+-- Test suite for the LuaJIT FFI binding (multipart_ffi.lua)
+-- Skipped when not running under LuaJIT
+
+package.path = package.path .. ";../?.lua"
+
+-- Test results tracking
+local tests_run = 0
+local tests_passed = 0
+local tests_failed = 0
+
+-- Helper functions
+local function test_start(name)
+  tests_run = tests_run + 1
+  io.write(string.format("Test %d: %s ... ", tests_run, name))
+  io.flush()
+end
+
+local function test_pass()
+  io.write("PASSED\n")
+  tests_passed = tests_passed + 1
+end
+
+local function test_fail(msg)
+  io.write(string.format("FAILED: %s\n", msg))
+  tests_failed = tests_failed + 1
+end
+
+local has_ffi, ffi = pcall(require, "ffi")
+local mpffi
+
+-- Test 1: Events and data pointers from the event array
+local function test_events()
+  test_start("Event array with pointer data")
+
+  local parser = mpffi.new("b")
+  local data = "--b\r\n" ..
+               'Content-Disposition: form-data; name="field"\r\n' ..
+               "\r\n" ..
+               "value\r\n" ..
+               "--b--"
+  local parsed, n = parser:execute(data)
+  local E = mpffi.EVENT
+  local types, value = {}, {}
+
+  for k = 0, n - 1 do
+    local ev = parser.events[k]
+    types[#types + 1] = ev.type
+    if ev.type == E.DATA then
+      value[#value + 1] = ffi.string(ev.at, ev.length)
+    end
+  end
+  parser:free()
+
+  if parsed ~= #data then
+    test_fail(string.format("Parsed %d bytes, expected %d", parsed, #data))
+    return
+  end
+  if types[1] ~= E.PART_BEGIN or types[#types] ~= E.BODY_END then
+    test_fail("Unexpected event sequence")
+    return
+  end
+  if table.concat(value) ~= "value" then
+    test_fail("Got '" .. table.concat(value) .. "', expected 'value'")
+    return
+  end
+
+  test_pass()
+end
+
+-- Test 2: feed() across small batches and chunks
+local function test_feed_chunks()
+  test_start("feed() with small batches and chunks")
+
+  local parser = mpffi.new("b", {batch = 2})
+  local data = "--b\r\n\r\none\r\n" ..
+               "--b\r\n\r\n" .. string.rep("x\r", 100) .. "\r\n" ..
+               "--b--"
+  local parts, chunks = 0, {}
+
+  local function handler(type, at, length)
+    if type == mpffi.EVENT.PART_END then
+      parts = parts + 1
+    elseif type == mpffi.EVENT.DATA then
+      chunks[#chunks + 1] = ffi.string(at, length)
+    end
+  end
+
+  for i = 1, #data, 7 do
+    local chunk = data:sub(i, i + 6)
+    if parser:feed(chunk, handler) ~= #chunk then
+      test_fail("Chunk not consumed: " .. parser:get_error_message())
+      parser:free()
+      return
+    end
+  end
+  parser:free()
+
+  if parts ~= 2 or table.concat(chunks) ~= "one" .. string.rep("x\r", 100) then
+    test_fail(string.format("Got %d parts and %d data bytes", parts,
+                            #table.concat(chunks)))
+    return
+  end
+
+  test_pass()
+end
+
+-- Test 3: Limits and errors
+local function test_limits_and_reset()
+  test_start("Limit errors and reset")
+
+  local parser = mpffi.new("b", {max_part_size = 4})
+  local data = "--b\r\n\r\ntoo long\r\n--b--"
+
+  local parsed = parser:execute(data)
+  if parsed >= #data or parser:get_error() ~= mpffi.ERROR.PART_TOO_LARGE then
+    test_fail("Oversized part not rejected")
+    parser:free()
+    return
+  end
+
+  if not parser:reset("c") then
+    test_fail("Reset failed")
+    parser:free()
+    return
+  end
+  data = "--c\r\n\r\nok\r\n--c--"
+  parsed = parser:execute(data)
+  local err = parser:get_error()
+  parser:free()
+
+  if parsed ~= #data or err ~= mpffi.ERROR.OK then
+    test_fail("Parse after reset failed")
+    return
+  end
+
+  test_pass()
+end
+
+local function run_all_tests()
+  print("===========================================")
+  print("LuaJIT FFI Binding Test Suite")
+  print("===========================================")
+  print()
+
+  if not has_ffi then
+    print("Skipped: the FFI binding requires LuaJIT")
+  else
+    mpffi = require("multipart_ffi")
+    mpffi.load("../libmultipart.so")
+
+    test_events()
+    test_feed_chunks()
+    test_limits_and_reset()
+  end
+
+  -- Print summary
+  print()
+  print("===========================================")
+  print(string.format("Tests run: %d", tests_run))
+  print(string.format("Tests passed: %d", tests_passed))
+  print(string.format("Tests failed: %d", tests_failed))
+  print("===========================================")
+
+  -- Exit with appropriate code
+  if tests_failed > 0 then
+    os.exit(1)
+  else
+    print("\nAll tests passed!")
+    os.exit(0)
+  end
+end
+
+-- Run the tests
+run_all_tests()
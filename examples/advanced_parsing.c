@@ -299,45 +299,15 @@ void example_security_validations(void) {
 /* ============================================================================
  * EXAMPLE 4: Streaming with Size Limits
  * ============================================================================
- * Demonstrates enforcing size limits during streaming parse.
+ * Demonstrates enforcing size limits during streaming parse. The parser
+ * checks the limits itself and stops before oversized data reaches a
+ * callback, so on_part_data only ever sees accepted bytes.
  */
 
-typedef struct {
-    size_t total_bytes;
-    size_t max_total_bytes;
-    size_t current_part_bytes;
-    size_t max_part_bytes;
-    int limit_exceeded;
-} size_limiter_t;
-
-int on_part_data_with_limit(multipart_parser* p, const char* at, size_t length) {
-    size_limiter_t* limiter = (size_limiter_t*)multipart_parser_get_data(p);
-    
-    limiter->total_bytes += length;
-    limiter->current_part_bytes += length;
-    
-    /* Check part size limit */
-    if (limiter->current_part_bytes > limiter->max_part_bytes) {
-        printf("  Part size limit exceeded: %zu > %zu\n", 
-               limiter->current_part_bytes, limiter->max_part_bytes);
-        limiter->limit_exceeded = 1;
-        return 1; /* Pause parsing */
-    }
-    
-    /* Check total size limit */
-    if (limiter->total_bytes > limiter->max_total_bytes) {
-        printf("  Total size limit exceeded: %zu > %zu\n",
-               limiter->total_bytes, limiter->max_total_bytes);
-        limiter->limit_exceeded = 1;
-        return 1; /* Pause parsing */
-    }
-    
-    return 0;
-}
-
-int on_part_begin_with_limit(multipart_parser* p) {
-    size_limiter_t* limiter = (size_limiter_t*)multipart_parser_get_data(p);
-    limiter->current_part_bytes = 0;
+int on_part_data_counting(multipart_parser* p, const char* at, size_t length) {
+    size_t* total = (size_t*)multipart_parser_get_data(p);
+    (void)at;
+    *total += length;
     return 0;
 }
 
@@ -358,25 +328,27 @@ void example_size_limits(void) {
     
     multipart_parser_settings settings;
     memset(&settings, 0, sizeof(settings));
-    settings.on_part_data_begin = on_part_begin_with_limit;
-    settings.on_part_data = on_part_data_with_limit;
-    
-    size_limiter_t limiter = {0};
-    limiter.max_total_bytes = 1000;
-    limiter.max_part_bytes = 30; /* Set low to trigger limit */
+    settings.on_part_data = on_part_data_counting;
+    settings.max_total_size = 1000;
+    settings.max_part_size = 30; /* Set low to trigger limit */
+    settings.max_header_bytes = 1024;
+    settings.max_parts = 16;
     
+    size_t delivered = 0;
     multipart_parser* parser = multipart_parser_init(boundary, &settings);
-    multipart_parser_set_data(parser, &limiter);
+    multipart_parser_set_data(parser, &delivered);
     
     printf("Parsing with limits: max_part=%zu, max_total=%zu\n",
-           limiter.max_part_bytes, limiter.max_total_bytes);
+           settings.max_part_size, settings.max_total_size);
     
     size_t parsed = multipart_parser_execute(parser, data, strlen(data));
     
-    printf("Parsed %zu of %zu bytes\n", parsed, strlen(data));
+    printf("Parsed %zu of %zu bytes, %zu data bytes delivered\n",
+           parsed, strlen(data), delivered);
     
-    if (limiter.limit_exceeded) {
-        printf("Size limit enforcement working correctly\n");
+    if (multipart_parser_get_error(parser) == MPPE_PART_TOO_LARGE) {
+        printf("Size limit enforcement working correctly: %s\n",
+               multipart_parser_get_error_message(parser));
     } else {
         printf("All data within limits\n");
     }
@@ -1,6 +1,18 @@
 /* Fuzzing harness for multipart parser
  * Compatible with AFL++ and libFuzzer
+ *
+ * Built with -DFUZZ_SLOW_NS_PER_BYTE=N (see "make fuzz-slow") the harness
+ * also times each input, parsed in one call and fed one byte at a time, and
+ * aborts when either takes longer than N ns per byte plus
+ * FUZZ_SLOW_ALLOWANCE_NS, so the fuzzer saves inputs that make the parser
+ * superlinear. Replay saved inputs with "benchmark --worst-case FILE...".
  */
+#ifdef FUZZ_SLOW_NS_PER_BYTE
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#endif
 #include "multipart_parser.h"
 #include <stdint.h>
 #include <stddef.h>
@@ -48,6 +60,69 @@ static int fuzz_on_body_end(multipart_parser* p) {
     return 0;
 }
 
+#ifdef FUZZ_SLOW_NS_PER_BYTE
+#ifndef FUZZ_SLOW_ALLOWANCE_NS
+/* Fixed time allowed per parse, for parser setup and timer noise */
+#define FUZZ_SLOW_ALLOWANCE_NS 100000
+#endif
+
+/* Nanoseconds to parse content in chunks of chunk bytes (0: one call) */
+static double fuzz_time_parse(const char *boundary,
+                              const multipart_parser_settings *callbacks,
+                              const char *content, size_t size, size_t chunk) {
+    struct timespec start, end;
+    multipart_parser* parser = multipart_parser_init(boundary, callbacks);
+    size_t offset, n;
+
+    if (parser == NULL) {
+        return 0;
+    }
+    if (chunk == 0) {
+        chunk = size;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (offset = 0; offset < size; offset += n) {
+        n = size - offset < chunk ? size - offset : chunk;
+        if (multipart_parser_execute(parser, content + offset, n) != n) {
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    multipart_parser_free(parser);
+    return (double)(end.tv_sec - start.tv_sec) * 1e9 +
+           (double)(end.tv_nsec - start.tv_nsec);
+}
+
+/* Abort if content parses slower than the per-byte budget. An input must be
+ * over budget twice in a row, so a preempted run is not reported. */
+static void fuzz_check_slow(const char *boundary,
+                            const multipart_parser_settings *callbacks,
+                            const char *content, size_t size) {
+    static const size_t chunks[] = {0, 1};
+    double budget = (double)FUZZ_SLOW_NS_PER_BYTE * (double)size +
+                    FUZZ_SLOW_ALLOWANCE_NS;
+    double elapsed;
+    size_t k;
+
+    for (k = 0; k < sizeof(chunks) / sizeof(chunks[0]); k++) {
+        elapsed = fuzz_time_parse(boundary, callbacks, content, size, chunks[k]);
+        if (elapsed <= budget) {
+            continue;
+        }
+        elapsed = fuzz_time_parse(boundary, callbacks, content, size, chunks[k]);
+        if (elapsed > budget) {
+            fprintf(stderr, "==SLOW INPUT== %lu bytes in %s took %.0f ns "
+                    "(%.1f ns/byte, budget %d ns/byte + %d ns)\n",
+                    (unsigned long)size,
+                    chunks[k] == 0 ? "one call" : "one-byte feeds",
+                    elapsed, elapsed / (double)size, FUZZ_SLOW_NS_PER_BYTE,
+                    FUZZ_SLOW_ALLOWANCE_NS);
+            abort();
+        }
+    }
+}
+#endif
+
 #ifdef __AFL_FUZZ_TESTCASE_LEN
 /* AFL++ persistent mode */
 __AFL_FUZZ_INIT();
@@ -127,6 +202,9 @@ int main(void) {
 
     if (content_size > 0) {
         multipart_parser_execute(parser, (const char*)content, content_size);
+#ifdef FUZZ_SLOW_NS_PER_BYTE
+        fuzz_check_slow(boundary, &callbacks, (const char*)content, content_size);
+#endif
     }
 
     /* Cleanup */
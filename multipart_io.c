@@ -0,0 +1,1023 @@
+/* I/O front-ends for multipart_parser
+ * MIT License - http://www.opensource.org/licenses/mit-license.php
+ */
+/* POSIX interfaces, plus madvise() where the C library hides it and
+ * copy_file_range() and sendfile() on Linux */
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "multipart_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define MULTIPART_HAVE_COPY_FILE_RANGE
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#define MULTIPART_HAVE_SENDFILE
+#endif
+
+/* Drop the pages of an already parsed range of a read-only file mapping.
+ * Unlike POSIX_MADV_DONTNEED, which glibc ignores, MADV_DONTNEED frees the
+ * pages right away; they are read back from the file if touched again. */
+static void release_pages(char* at, size_t len) {
+#ifdef MADV_DONTNEED
+  madvise(at, len, MADV_DONTNEED);
+#else
+  posix_madvise(at, len, POSIX_MADV_DONTNEED);
+#endif
+}
+
+/* Parse size bytes of a mapping, releasing each parsed window */
+static int parse_mapping(multipart_parser* p, char* map, size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t released = 0;
+  size_t offset, n, end;
+  int error;
+
+  posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+  for (offset = 0; offset < size; offset += n) {
+    n = size - offset < MULTIPART_IO_WINDOW ? size - offset : MULTIPART_IO_WINDOW;
+    if (multipart_parser_execute(p, map + offset, n) != n) {
+      error = (int)multipart_parser_get_error(p);
+      return error != MPPE_OK ? error : MPPE_UNKNOWN;
+    }
+    end = (offset + n) / page * page;
+    if (end > released) {
+      release_pages(map + released, end - released);
+      released = end;
+    }
+  }
+  return 0;
+}
+
+/* Open and map a file read-only; an empty file gets a NULL mapping */
+static int map_file(const char *path, int* fd, char** map, size_t* size) {
+  struct stat st;
+  void* at;
+  int saved;
+
+  *fd = open(path, O_RDONLY);
+  if (*fd < 0) {
+    return -1;
+  }
+  if (fstat(*fd, &st) != 0) {
+    goto fail;
+  }
+  *size = (size_t)st.st_size;
+  if ((off_t)*size != st.st_size) {
+    errno = EFBIG;
+    goto fail;
+  }
+  *map = NULL;
+  if (*size > 0) {
+    at = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, *fd, 0);
+    if (at == MAP_FAILED) {
+      goto fail;
+    }
+    *map = (char*)at;
+  }
+  return 0;
+
+fail:
+  saved = errno;
+  close(*fd);
+  errno = saved;
+  return -1;
+}
+
+int multipart_parse_file(const char *path, const char *boundary,
+                         const multipart_parser_settings* settings,
+                         void* data) {
+  multipart_parser* p;
+  size_t size;
+  char* map;
+  int fd;
+  int result;
+
+  if (path == NULL || boundary == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (map_file(path, &fd, &map, &size) != 0) {
+    return -1;
+  }
+  close(fd);  /* the mapping keeps the file referenced */
+
+  p = multipart_parser_init(boundary, settings);
+  if (p == NULL) {
+    if (map != NULL) {
+      munmap(map, size);
+    }
+    errno = ENOMEM;
+    return -1;
+  }
+  multipart_parser_set_data(p, data);
+
+  result = map != NULL ? parse_mapping(p, map, size) : 0;
+
+  multipart_parser_free(p);
+  if (map != NULL) {
+    munmap(map, size);
+  }
+  return result;
+}
+
+/* Buffers are used as a FIFO ring: used buffers from head hold the input
+ * not released yet, in stream order, the last one possibly partly filled.
+ * Buffer i covers stream bytes [start[i], start[i] + length[i]). */
+struct multipart_reader {
+  multipart_parser* parser;
+  size_t buffer_size;
+  size_t buffer_count;
+  size_t head;
+  size_t used;
+  size_t parsed;             /* stream offset parsed up to */
+  size_t stream_end;         /* stream offset after the last byte read */
+  int error;                 /* parser error that stopped parsing, or 0 */
+  size_t* start;
+  size_t* length;
+  char* memory;
+};
+
+/* Largest number of buffers filled by one readv() */
+#define MULTIPART_READER_MAX_IOV 16
+
+multipart_reader* multipart_reader_create(multipart_parser* p,
+                                          size_t buffer_size,
+                                          size_t buffer_count) {
+  multipart_reader* r;
+  size_t header;
+
+  if (p == NULL || buffer_count < 3 ||
+      buffer_size < MULTIPART_MAX_BOUNDARY_LENGTH + 4) {
+    return NULL;
+  }
+  /* One block: the reader, the offset arrays, then the buffers */
+  header = sizeof(multipart_reader) + 2 * buffer_count * sizeof(size_t);
+  if ((size_t)-1 / buffer_count <= buffer_size ||
+      (size_t)-1 - header < buffer_size * buffer_count) {
+    return NULL;
+  }
+  r = (multipart_reader*)malloc(header + buffer_size * buffer_count);
+  if (r == NULL) {
+    return NULL;
+  }
+  r->parser = p;
+  r->buffer_size = buffer_size;
+  r->buffer_count = buffer_count;
+  r->head = 0;
+  r->used = 0;
+  r->parsed = 0;
+  r->stream_end = 0;
+  r->error = 0;
+  r->start = (size_t*)(void*)(r + 1);
+  r->length = r->start + buffer_count;
+  r->memory = (char*)(r->length + buffer_count);
+  return r;
+}
+
+void multipart_reader_free(multipart_reader* r) {
+  free(r);
+}
+
+static size_t reader_slot(const multipart_reader* r, size_t ring_pos) {
+  return (r->head + ring_pos) % r->buffer_count;
+}
+
+static char* reader_buffer(const multipart_reader* r, size_t slot) {
+  return r->memory + slot * r->buffer_size;
+}
+
+/* Parse the buffered input not parsed yet */
+static int reader_parse(multipart_reader* r) {
+  const char* at;
+  size_t len, n;
+
+  while (r->parsed < r->stream_end) {
+    at = multipart_reader_at(r, r->parsed, &len);
+    n = multipart_parser_execute(r->parser, at, len);
+    r->parsed += n;
+    r->error = (int)multipart_parser_get_error(r->parser);
+    if (n != len && r->error == MPPE_OK) {
+      r->error = MPPE_UNKNOWN;
+    }
+    if (r->error != MPPE_OK) {
+      return r->error;
+    }
+  }
+  return 0;
+}
+
+/* Reuse the buffers the parser no longer refers to */
+static void reader_recycle(multipart_reader* r) {
+  size_t pending = multipart_parser_pending_offset(r->parser);
+  size_t end;
+
+  while (r->used > 0) {
+    end = r->start[r->head] + r->length[r->head];
+    if (end > r->parsed || end > pending) {
+      break;
+    }
+    r->head = (r->head + 1) % r->buffer_count;
+    r->used--;
+  }
+}
+
+size_t multipart_reader_prepare(multipart_reader* r, struct iovec* iov,
+                                size_t max_iov) {
+  size_t n = 0;
+  size_t pos, slot;
+
+  if (r == NULL || iov == NULL) {
+    return 0;
+  }
+  reader_recycle(r);
+  /* Fill up a partly filled last buffer first, so short reads do not
+   * use up the ring */
+  pos = r->used;
+  if (pos > 0 && r->length[reader_slot(r, pos - 1)] < r->buffer_size) {
+    pos--;
+  }
+  for (; n < max_iov && pos < r->buffer_count; pos++, n++) {
+    slot = reader_slot(r, pos);
+    iov[n].iov_base = reader_buffer(r, slot);
+    iov[n].iov_len = r->buffer_size;
+    if (pos < r->used) {
+      iov[n].iov_base = (char*)iov[n].iov_base + r->length[slot];
+      iov[n].iov_len -= r->length[slot];
+    }
+  }
+  return n;
+}
+
+int multipart_reader_commit(multipart_reader* r, size_t n) {
+  size_t slot, len, space;
+
+  if (r == NULL) {
+    return MPPE_UNKNOWN;
+  }
+  if (r->error != 0 && r->error != MPPE_PAUSED) {
+    return r->error;  /* parse errors are final */
+  }
+  /* More than prepare() can hand out was not read into the ring */
+  space = (r->buffer_count - r->used) * r->buffer_size;
+  if (r->used > 0) {
+    space += r->buffer_size - r->length[reader_slot(r, r->used - 1)];
+  }
+  if (n > space) {
+    return MPPE_UNKNOWN;
+  }
+  while (n > 0) {
+    if (r->used > 0 &&
+        r->length[reader_slot(r, r->used - 1)] < r->buffer_size) {
+      slot = reader_slot(r, r->used - 1);
+    } else {
+      slot = reader_slot(r, r->used++);
+      r->start[slot] = r->stream_end;
+      r->length[slot] = 0;
+    }
+    len = r->buffer_size - r->length[slot];
+    if (len > n) {
+      len = n;
+    }
+    r->length[slot] += len;
+    r->stream_end += len;
+    n -= len;
+  }
+  /* Input left over from a pause is parsed before the new input */
+  return reader_parse(r);
+}
+
+int multipart_reader_read(multipart_reader* r, int fd, size_t* nread) {
+  struct iovec iov[MULTIPART_READER_MAX_IOV];
+  size_t n_iov;
+  ssize_t n;
+  int error;
+
+  if (nread != NULL) {
+    *nread = 0;
+  }
+  if (r == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  /* Input left over from a pause comes first */
+  if (r->error != 0) {
+    error = multipart_reader_commit(r, 0);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  n_iov = multipart_reader_prepare(r, iov, MULTIPART_READER_MAX_IOV);
+  if (n_iov == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  do {
+    n = readv(fd, iov, (int)n_iov);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return -1;
+  }
+  if (nread != NULL) {
+    *nread = (size_t)n;
+  }
+  return multipart_reader_commit(r, (size_t)n);
+}
+
+const char* multipart_reader_at(const multipart_reader* r, size_t offset,
+                                size_t* length) {
+  size_t k, slot;
+
+  if (r == NULL) {
+    return NULL;
+  }
+  for (k = 0; k < r->used; k++) {
+    slot = reader_slot(r, k);
+    if (offset >= r->start[slot] &&
+        offset - r->start[slot] < r->length[slot]) {
+      if (length != NULL) {
+        *length = r->length[slot] - (offset - r->start[slot]);
+      }
+      return reader_buffer(r, slot) + (offset - r->start[slot]);
+    }
+  }
+  return NULL;
+}
+
+/* Part sinks: part data arrives in span mode, so the parser never copies
+ * it; the state below turns spans into writes on the part's descriptor. */
+typedef struct {
+  const multipart_sink* sink;
+  int out_fd;                /* descriptor of the current part, or -1 */
+  int in_fd;                 /* file the spans refer to, or -1 */
+  const char* map;           /* mapping of in_fd */
+  int copy_failed;           /* copy_file_range() is not usable */
+  multipart_reader* reader;  /* stream input, spans are batched */
+  struct iovec iov[MULTIPART_SINK_MAX_IOV];
+  size_t n_iov;
+  int saved_errno;           /* errno of a failed write, or 0 */
+} sink_state;
+
+/* Write all of iov[0..n), retrying partial and interrupted writes */
+static int write_all(int fd, struct iovec* iov, size_t n) {
+  ssize_t written;
+  size_t k;
+
+  while (n > 0) {
+    written = writev(fd, iov, (int)n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    for (k = 0; k < n && (size_t)written >= iov[k].iov_len; k++) {
+      written -= (ssize_t)iov[k].iov_len;
+    }
+    iov += k;
+    n -= k;
+    if (n > 0) {
+      iov[0].iov_base = (char*)iov[0].iov_base + written;
+      iov[0].iov_len -= (size_t)written;
+    }
+  }
+  return 0;
+}
+
+/* Write the batched spans of the current part */
+static int sink_flush(sink_state* s) {
+  size_t n = s->n_iov;
+
+  s->n_iov = 0;
+  if (n > 0 && write_all(s->out_fd, s->iov, n) != 0) {
+    s->saved_errno = errno;
+    return -1;
+  }
+  return 0;
+}
+
+static int sink_part_headers(multipart_parser* p,
+                             const multipart_part_headers* headers) {
+  sink_state* s = (sink_state*)multipart_parser_get_data(p);
+
+  s->out_fd = s->sink->open_part(s->sink->data, headers);
+  return 0;
+}
+
+/* File input: copy in the kernel, else write from the mapping */
+static int sink_copy_span(sink_state* s, size_t offset, size_t length) {
+#ifdef MULTIPART_HAVE_COPY_FILE_RANGE
+  loff_t in_offset = (loff_t)offset;
+  ssize_t n;
+
+  while (length > 0 && !s->copy_failed) {
+    n = copy_file_range(s->in_fd, &in_offset, s->out_fd, NULL, length, 0);
+    if (n > 0) {
+      length -= (size_t)n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n == 0 || errno == ENOSYS || errno == EXDEV ||
+               errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF) {
+      s->copy_failed = 1;  /* e.g. a pipe or too old a kernel */
+    } else {
+      s->saved_errno = errno;
+      return -1;
+    }
+  }
+  offset = (size_t)in_offset;
+#endif
+  if (length > 0) {
+    s->iov[0].iov_base = (char*)s->map + offset;
+    s->iov[0].iov_len = length;
+    s->n_iov = 1;
+    return sink_flush(s);
+  }
+  return 0;
+}
+
+/* Stream input: batch the buffered bytes for one writev() */
+static int sink_batch_span(sink_state* s, size_t offset, size_t length) {
+  const char* at;
+  size_t n;
+
+  while (length > 0) {
+    if (s->n_iov == MULTIPART_SINK_MAX_IOV && sink_flush(s) != 0) {
+      return -1;
+    }
+    at = multipart_reader_at(s->reader, offset, &n);
+    if (n > length) {
+      n = length;
+    }
+    s->iov[s->n_iov].iov_base = (char*)at;
+    s->iov[s->n_iov].iov_len = n;
+    s->n_iov++;
+    offset += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int sink_part_data(multipart_parser* p, size_t offset, size_t length) {
+  sink_state* s = (sink_state*)multipart_parser_get_data(p);
+
+  if (s->out_fd < 0) {
+    return 0;
+  }
+  if (s->reader != NULL) {
+    return sink_batch_span(s, offset, length);
+  }
+  return sink_copy_span(s, offset, length);
+}
+
+static int sink_part_end(multipart_parser* p) {
+  sink_state* s = (sink_state*)multipart_parser_get_data(p);
+  int fd = s->out_fd;
+
+  if (fd < 0) {
+    return 0;
+  }
+  if (sink_flush(s) != 0) {
+    return 1;
+  }
+  s->out_fd = -1;
+  return s->sink->close_part != NULL ?
+      s->sink->close_part(s->sink->data, fd) : 0;
+}
+
+/* Create a parser whose part data goes to the sink */
+static multipart_parser* sink_init(sink_state* s, const char* boundary,
+                                   const multipart_sink* sink,
+                                   multipart_parser_settings* settings) {
+  multipart_parser* p;
+
+  memset(settings, 0, sizeof(multipart_parser_settings));
+  settings->on_part_headers = sink_part_headers;
+  settings->on_part_data_span = sink_part_data;
+  settings->on_part_data_end = sink_part_end;
+
+  memset(s, 0, sizeof(sink_state));
+  s->sink = sink;
+  s->out_fd = -1;
+  s->in_fd = -1;
+  p = multipart_parser_init(boundary, settings);
+  if (p != NULL) {
+    multipart_parser_set_data(p, s);
+  }
+  return p;
+}
+
+/* Map a parse result to the return convention, closing an open part */
+static int sink_finish(sink_state* s, multipart_parser* p, int result) {
+  if (s->out_fd >= 0) {
+    /* The body ended early: hand the descriptor back anyway */
+    s->n_iov = 0;
+    if (s->sink->close_part != NULL) {
+      s->sink->close_part(s->sink->data, s->out_fd);
+    }
+  }
+  multipart_parser_free(p);
+  if (s->saved_errno != 0) {
+    errno = s->saved_errno;
+    return -1;
+  }
+  return result;
+}
+
+int multipart_extract_file(const char *path, const char *boundary,
+                           const multipart_sink* sink) {
+  multipart_parser_settings settings;
+  multipart_parser* p;
+  sink_state s;
+  size_t size;
+  char* map;
+  int fd;
+  int result;
+
+  if (path == NULL || boundary == NULL || sink == NULL ||
+      sink->open_part == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (map_file(path, &fd, &map, &size) != 0) {
+    return -1;
+  }
+
+  p = sink_init(&s, boundary, sink, &settings);
+  if (p == NULL) {
+    if (map != NULL) {
+      munmap(map, size);
+    }
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+  }
+  s.in_fd = fd;
+  s.map = map;
+
+  result = map != NULL ? parse_mapping(p, map, size) : 0;
+  result = sink_finish(&s, p, result);
+
+  if (map != NULL) {
+    munmap(map, size);
+  }
+  close(fd);
+  return result;
+}
+
+int multipart_extract_fd(int fd, const char *boundary,
+                         const multipart_sink* sink) {
+  multipart_parser_settings settings;
+  multipart_parser* p;
+  sink_state s;
+  size_t nread;
+  int result;
+
+  if (boundary == NULL || sink == NULL || sink->open_part == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  p = sink_init(&s, boundary, sink, &settings);
+  if (p != NULL) {
+    s.reader = multipart_reader_create(p, MULTIPART_SINK_BUFFER_SIZE, 4);
+  }
+  if (p == NULL || s.reader == NULL) {
+    multipart_parser_free(p);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Spans point into the reader's buffers: write them before the next
+   * read may recycle a buffer */
+  do {
+    result = multipart_reader_read(s.reader, fd, &nread);
+    if (result == 0 && s.out_fd >= 0 && sink_flush(&s) != 0) {
+      result = MPPE_PAUSED;
+    }
+  } while (result == 0 && nread > 0);
+  if (result == -1) {
+    s.saved_errno = errno;
+  }
+
+  multipart_reader_free(s.reader);
+  return sink_finish(&s, p, result);
+}
+
+/* Encoder: the output is a FIFO ring of segments from head, each a range
+ * of memory (at != NULL) or of a file. Memory segments point to caller
+ * buffers, the delimiter or the header buffer. */
+typedef struct {
+  const char* at;            /* first byte, or NULL for a file range */
+  int fd;
+  off_t offset;              /* file offset of the first byte */
+  size_t length;
+} encoder_segment;
+
+struct multipart_encoder {
+  encoder_segment queue[MULTIPART_ENCODER_MAX_SEGMENTS];
+  size_t head;
+  size_t count;
+  size_t pending;            /* bytes in the queue */
+  size_t header_used;        /* bytes of headers[] referenced by the queue */
+  size_t delimiter_length;   /* length of "\r\n--" boundary */
+  int parts;                 /* parts begun */
+  int finished;              /* closing delimiter queued */
+  int sendfile_failed;       /* sendfile() is not usable */
+  char delimiter[MULTIPART_MAX_BOUNDARY_LENGTH + 8];  /* "\r\n--" boundary "--\r\n" */
+  char headers[MULTIPART_ENCODER_HEADER_SIZE];
+};
+
+/* Bytes of a file range copied through the stack without sendfile() */
+#define MULTIPART_ENCODER_COPY_SIZE (16 * 1024)
+
+/* Header buffer position after an overflow */
+#define HEADER_OVERFLOW ((size_t)-1)
+
+/* RFC 2046 bchars: a space may not be the last character */
+static int boundary_valid(const char* boundary, size_t length) {
+  size_t k;
+  char c;
+
+  if (length == 0 || length > MULTIPART_MAX_BOUNDARY_LENGTH ||
+      boundary[length - 1] == ' ') {
+    return 0;
+  }
+  for (k = 0; k < length; k++) {
+    c = boundary[k];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') || strchr("'()+_,-./:=? ", c) != NULL)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+multipart_encoder* multipart_encoder_create(const char *boundary) {
+  multipart_encoder* e;
+  size_t length;
+
+  if (boundary == NULL) {
+    return NULL;
+  }
+  length = strlen(boundary);
+  if (!boundary_valid(boundary, length)) {
+    return NULL;
+  }
+  e = (multipart_encoder*)malloc(sizeof(multipart_encoder));
+  if (e == NULL) {
+    return NULL;
+  }
+  e->head = 0;
+  e->count = 0;
+  e->pending = 0;
+  e->header_used = 0;
+  e->parts = 0;
+  e->finished = 0;
+  e->sendfile_failed = 0;
+  memcpy(e->delimiter, "\r\n--", 4);
+  memcpy(e->delimiter + 4, boundary, length);
+  memcpy(e->delimiter + 4 + length, "--\r\n", 4);
+  e->delimiter_length = 4 + length;
+  return e;
+}
+
+void multipart_encoder_free(multipart_encoder* e) {
+  free(e);
+}
+
+static void encoder_push(multipart_encoder* e, const char* at, int fd,
+                         off_t offset, size_t length) {
+  encoder_segment* s;
+
+  s = &e->queue[(e->head + e->count) % MULTIPART_ENCODER_MAX_SEGMENTS];
+  s->at = at;
+  s->fd = fd;
+  s->offset = offset;
+  s->length = length;
+  e->count++;
+  e->pending += length;
+}
+
+/* A header value may not end the header line early */
+static int header_value_valid(const multipart_slice* value) {
+  size_t k;
+
+  for (k = 0; value->at != NULL && k < value->length; k++) {
+    if (value->at[k] == '\r' || value->at[k] == '\n' || value->at[k] == '\0') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static size_t header_put(char* buf, size_t pos, const char* at, size_t len) {
+  if (pos == HEADER_OVERFLOW || MULTIPART_ENCODER_HEADER_SIZE - pos < len) {
+    return HEADER_OVERFLOW;
+  }
+  memcpy(buf + pos, at, len);
+  return pos + len;
+}
+
+/* Append "; param=" and the value quoted, escaping '\\' and '"' */
+static size_t header_put_param(char* buf, size_t pos, const char* param,
+                               const multipart_slice* value) {
+  size_t k;
+
+  pos = header_put(buf, pos, param, strlen(param));
+  pos = header_put(buf, pos, "\"", 1);
+  for (k = 0; k < value->length; k++) {
+    if (value->at[k] == '\\' || value->at[k] == '"') {
+      pos = header_put(buf, pos, "\\", 1);
+    }
+    pos = header_put(buf, pos, value->at + k, 1);
+  }
+  return header_put(buf, pos, "\"", 1);
+}
+
+/* Append "Field: value\r\n" if the value is present */
+static size_t header_put_line(char* buf, size_t pos, const char* field,
+                              const multipart_slice* value) {
+  if (value->at == NULL) {
+    return pos;
+  }
+  pos = header_put(buf, pos, field, strlen(field));
+  pos = header_put(buf, pos, value->at, value->length);
+  return header_put(buf, pos, "\r\n", 2);
+}
+
+/* Format the header block, starting with the CRLF ending the delimiter
+ * line; returns the position after it or HEADER_OVERFLOW */
+static size_t encoder_format_headers(char* buf, size_t pos,
+                                     const multipart_part_headers* h) {
+  pos = header_put(buf, pos, "\r\n", 2);
+  if (h == NULL) {
+    return header_put(buf, pos, "\r\n", 2);
+  }
+  if (h->disposition.at != NULL || h->name.at != NULL ||
+      h->filename.at != NULL) {
+    pos = header_put(buf, pos, "Content-Disposition: ", 21);
+    if (h->disposition.at != NULL) {
+      pos = header_put(buf, pos, h->disposition.at, h->disposition.length);
+    } else {
+      pos = header_put(buf, pos, "form-data", 9);
+    }
+    if (h->name.at != NULL) {
+      pos = header_put_param(buf, pos, "; name=", &h->name);
+    }
+    if (h->filename.at != NULL) {
+      pos = header_put_param(buf, pos, "; filename=", &h->filename);
+    }
+    pos = header_put(buf, pos, "\r\n", 2);
+  }
+  pos = header_put_line(buf, pos, "Content-Type: ", &h->content_type);
+  pos = header_put_line(buf, pos, "Content-Transfer-Encoding: ",
+                        &h->transfer_encoding);
+  return header_put(buf, pos, "\r\n", 2);
+}
+
+int multipart_encoder_begin_part(multipart_encoder* e,
+                                 const multipart_part_headers* headers) {
+  size_t end;
+
+  if (e == NULL || e->finished ||
+      (headers != NULL &&
+       (!header_value_valid(&headers->disposition) ||
+        !header_value_valid(&headers->name) ||
+        !header_value_valid(&headers->filename) ||
+        !header_value_valid(&headers->content_type) ||
+        !header_value_valid(&headers->transfer_encoding)))) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (MULTIPART_ENCODER_MAX_SEGMENTS - e->count < 2) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  end = encoder_format_headers(e->headers, e->header_used, headers);
+  if (end == HEADER_OVERFLOW) {
+    /* Nothing else in the buffer: this block can never fit */
+    errno = e->header_used == 0 ? EMSGSIZE : ENOBUFS;
+    return -1;
+  }
+
+  /* The first delimiter has no CRLF before it */
+  if (e->parts == 0) {
+    encoder_push(e, e->delimiter + 2, -1, 0, e->delimiter_length - 2);
+  } else {
+    encoder_push(e, e->delimiter, -1, 0, e->delimiter_length);
+  }
+  encoder_push(e, e->headers + e->header_used, -1, 0, end - e->header_used);
+  e->header_used = end;
+  e->parts++;
+  return 0;
+}
+
+/* Queue a payload range of the current part */
+static int encoder_add(multipart_encoder* e, const char* at, int fd,
+                       off_t offset, size_t length) {
+  if (e == NULL || e->parts == 0 || e->finished) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  if (e->count == MULTIPART_ENCODER_MAX_SEGMENTS) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  encoder_push(e, at, fd, offset, length);
+  return 0;
+}
+
+int multipart_encoder_add_data(multipart_encoder* e, const void* data,
+                               size_t length) {
+  if (data == NULL && length > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return encoder_add(e, (const char*)data, -1, 0, length);
+}
+
+int multipart_encoder_add_file(multipart_encoder* e, int fd, off_t offset,
+                               size_t length) {
+  if (fd < 0 || offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return encoder_add(e, NULL, fd, offset, length);
+}
+
+int multipart_encoder_finish(multipart_encoder* e) {
+  if (e == NULL || e->finished) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (e->count == MULTIPART_ENCODER_MAX_SEGMENTS) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  /* "\r\n--" boundary "--\r\n", without the CRLF before a first line */
+  if (e->parts == 0) {
+    encoder_push(e, e->delimiter + 2, -1, 0, e->delimiter_length + 2);
+  } else {
+    encoder_push(e, e->delimiter, -1, 0, e->delimiter_length + 4);
+  }
+  e->finished = 1;
+  return 0;
+}
+
+size_t multipart_encoder_pending(const multipart_encoder* e) {
+  return e != NULL ? e->pending : 0;
+}
+
+size_t multipart_encoder_next_iovec(multipart_encoder* e, struct iovec* iov,
+                                    size_t max_iov) {
+  const encoder_segment* s;
+  size_t n;
+
+  if (e == NULL || iov == NULL) {
+    return 0;
+  }
+  for (n = 0; n < max_iov && n < e->count; n++) {
+    s = &e->queue[(e->head + n) % MULTIPART_ENCODER_MAX_SEGMENTS];
+    if (s->at == NULL) {
+      break;
+    }
+    iov[n].iov_base = (char*)s->at;
+    iov[n].iov_len = s->length;
+  }
+  return n;
+}
+
+int multipart_encoder_next_file(const multipart_encoder* e, int* fd,
+                                off_t* offset, size_t* length) {
+  const encoder_segment* s;
+
+  if (e == NULL || e->count == 0 || e->queue[e->head].at != NULL) {
+    return 0;
+  }
+  s = &e->queue[e->head];
+  if (fd != NULL) {
+    *fd = s->fd;
+  }
+  if (offset != NULL) {
+    *offset = s->offset;
+  }
+  if (length != NULL) {
+    *length = s->length;
+  }
+  return 1;
+}
+
+void multipart_encoder_consume(multipart_encoder* e, size_t n) {
+  encoder_segment* s;
+
+  if (e == NULL) {
+    return;
+  }
+  while (n > 0 && e->count > 0) {
+    s = &e->queue[e->head];
+    if (n < s->length) {
+      if (s->at != NULL) {
+        s->at += n;
+      } else {
+        s->offset += (off_t)n;
+      }
+      s->length -= n;
+      e->pending -= n;
+      break;
+    }
+    n -= s->length;
+    e->pending -= s->length;
+    e->head = (e->head + 1) % MULTIPART_ENCODER_MAX_SEGMENTS;
+    e->count--;
+  }
+  /* Nothing refers to the header buffer any more */
+  if (e->count == 0) {
+    e->head = 0;
+    e->header_used = 0;
+  }
+}
+
+/* Write some of a file range, in the kernel where possible; returns the
+ * bytes written like write(), 0 at an early end of file */
+static ssize_t encoder_send_file(multipart_encoder* e, int out_fd, int in_fd,
+                                 off_t offset, size_t length) {
+  char buffer[MULTIPART_ENCODER_COPY_SIZE];
+  ssize_t n;
+
+#ifdef MULTIPART_HAVE_SENDFILE
+  if (!e->sendfile_failed) {
+    n = sendfile(out_fd, in_fd, &offset, length);
+    if (n >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+      return n;
+    }
+    e->sendfile_failed = 1;  /* e.g. an O_APPEND output */
+  }
+#else
+  (void)e;
+#endif
+  if (length > sizeof(buffer)) {
+    length = sizeof(buffer);
+  }
+  n = pread(in_fd, buffer, length, offset);
+  if (n <= 0) {
+    return n;
+  }
+  /* Bytes not written are read again by the next call */
+  return write(out_fd, buffer, (size_t)n);
+}
+
+int multipart_encoder_write(multipart_encoder* e, int fd) {
+  struct iovec iov[MULTIPART_SINK_MAX_IOV];
+  size_t n_iov, length;
+  ssize_t n;
+  off_t offset;
+  int in_fd;
+
+  if (e == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  while (e->pending > 0) {
+    n_iov = multipart_encoder_next_iovec(e, iov, MULTIPART_SINK_MAX_IOV);
+    if (n_iov > 0) {
+      n = writev(fd, iov, (int)n_iov);
+    } else {
+      if (!multipart_encoder_next_file(e, &in_fd, &offset, &length)) {
+        errno = EINVAL;
+        return -1;
+      }
+      n = encoder_send_file(e, fd, in_fd, offset, length);
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;  /* a queued file range ends early */
+      return -1;
+    }
+    multipart_encoder_consume(e, (size_t)n);
+  }
+  return 0;
+}
@@ -0,0 +1,405 @@
+/* I/O front-ends for multipart_parser
+ * MIT License - http://www.opensource.org/licenses/mit-license.php
+ */
+#ifndef _multipart_io_h
+#define _multipart_io_h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "multipart_parser.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @file multipart_io.h
+ * @brief Optional POSIX I/O front-ends that feed multipart_parser
+ *
+ * multipart_parser.c itself does no I/O and stays plain C89. This module
+ * drives a parser from files and descriptors with POSIX system calls, and
+ * encodes multipart bodies onto descriptors (multipart_encoder); build
+ * it only where those are available. It has no global state: every function
+ * works on its arguments only and may be used from any thread.
+ */
+
+#ifndef MULTIPART_IO_WINDOW
+/** Bytes of a mapped file parsed before the parsed pages are released */
+#define MULTIPART_IO_WINDOW (1024 * 1024)
+#endif
+
+/**
+ * @brief Parse a multipart body stored in a file
+ *
+ * Maps the file read-only and runs multipart_parser_execute() over the
+ * mapping in windows of MULTIPART_IO_WINDOW bytes, so callbacks receive
+ * pointers straight into the page cache instead of copies read into a
+ * buffer. The mapping is advised for sequential access, and the pages of
+ * each parsed window are released, which keeps the resident size flat for
+ * large files. Pointers passed to callbacks stay valid until the function
+ * returns; released pages are read back from the file if touched again.
+ *
+ * @param path File holding the body
+ * @param boundary The boundary string (without "--" prefix)
+ * @param settings Callback settings
+ * @param data User data pointer for the callbacks (see
+ *             multipart_parser_get_data())
+ * @return 0 if the whole file was parsed, -1 on an I/O or allocation error
+ *         (errno is set), or the multipart_parser_error that stopped the
+ *         parser. A callback returning non-zero stops the parse with
+ *         MPPE_PAUSED.
+ */
+int multipart_parse_file(const char *path, const char *boundary,
+                         const multipart_parser_settings* settings,
+                         void* data);
+
+/**
+ * @brief Ring of read buffers feeding a parser
+ *
+ * A reader owns buffer_count buffers of buffer_size bytes. Input is read
+ * into all free buffers at once (one readv() per call) and parsed as it
+ * arrives, so callers need no read loop of their own and the parser sees
+ * chunks as large as the data available. A buffer is reused only once the
+ * parser has consumed it and multipart_parser_pending_offset() is past it,
+ * so in span mode multipart_reader_at() can resolve every reported span.
+ *
+ * The reader's stream offsets count from the parser's last init or reset;
+ * attach it to a fresh parser. Not thread-safe: one reader per parser.
+ */
+typedef struct multipart_reader multipart_reader;
+
+/**
+ * @brief Create a reader for a parser
+ *
+ * @param p The parser to feed; it must outlive the reader
+ * @param buffer_size Size of each buffer, at least
+ *                    MULTIPART_MAX_BOUNDARY_LENGTH + 4 and larger than the
+ *                    boundary plus 4
+ * @param buffer_count Number of buffers, at least 3
+ * @return The reader, or NULL on invalid arguments or allocation failure
+ */
+multipart_reader* multipart_reader_create(multipart_parser* p,
+                                          size_t buffer_size,
+                                          size_t buffer_count);
+
+/**
+ * @brief Free a reader (the parser is not freed)
+ *
+ * @param r The reader, or NULL
+ */
+void multipart_reader_free(multipart_reader* r);
+
+/**
+ * @brief Read available input from a descriptor and parse it
+ *
+ * Reads once with readv() into the free buffers. Interrupted reads are
+ * retried; with a non-blocking descriptor, -1 with errno EAGAIN means no
+ * data was available.
+ *
+ * @param r The reader
+ * @param fd Descriptor to read from, e.g. a socket
+ * @param nread Receives the number of bytes read, 0 at end of file
+ * @return 0 on success, -1 on an I/O error (errno is set; ENOBUFS if no
+ *         buffer is free), or the multipart_parser_error that stopped the
+ *         parser. After MPPE_PAUSED the next call first parses the rest of
+ *         the input already read.
+ */
+int multipart_reader_read(multipart_reader* r, int fd, size_t* nread);
+
+/**
+ * @brief Get the free buffers for a read issued by the caller
+ *
+ * For completion-based I/O (e.g. io_uring) or any other source: read up to
+ * the total length of the returned vectors into them, in order, then
+ * report the byte count with multipart_reader_commit(). Nothing may be
+ * committed in between. After a short read the first vector is the rest of
+ * the partly filled buffer, so small reads do not use up the ring.
+ *
+ * @param r The reader
+ * @param iov Array receiving the buffers
+ * @param max_iov Capacity of @p iov
+ * @return Number of vectors stored, 0 if no buffer is free
+ */
+size_t multipart_reader_prepare(multipart_reader* r, struct iovec* iov,
+                                size_t max_iov);
+
+/**
+ * @brief Parse bytes read into the buffers from multipart_reader_prepare()
+ *
+ * @p n may not exceed the total length of the vectors prepare() returned.
+ * A count larger than all free buffers is refused with MPPE_UNKNOWN and
+ * leaves the reader unchanged, as those bytes cannot be in the ring.
+ *
+ * @param r The reader
+ * @param n Number of bytes read
+ * @return 0 on success, MPPE_UNKNOWN if @p n exceeds the free buffers, or
+ *         the multipart_parser_error that stopped the parser (see
+ *         multipart_reader_read())
+ */
+int multipart_reader_commit(multipart_reader* r, size_t n);
+
+/**
+ * @brief Map a stream offset onto the reader's buffers
+ *
+ * Resolves spans reported in span mode (see multipart_span_cb); a span may
+ * cover several buffers, so call it again at offset + *length for the rest.
+ *
+ * @param r The reader
+ * @param offset Stream offset
+ * @param length Receives the number of contiguous bytes at the result
+ * @return Pointer to the byte at offset, or NULL if it is not buffered
+ */
+const char* multipart_reader_at(const multipart_reader* r, size_t offset,
+                                size_t* length);
+
+#ifndef MULTIPART_SINK_BUFFER_SIZE
+/** Size of each of the four read buffers of multipart_extract_fd() */
+#define MULTIPART_SINK_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef MULTIPART_SINK_MAX_IOV
+/** Largest number of data ranges written by one writev() */
+#define MULTIPART_SINK_MAX_IOV 64
+#endif
+
+/**
+ * @brief Choose the descriptor a part is written to
+ *
+ * @param data The multipart_sink data pointer
+ * @param headers The part's pre-parsed headers, e.g. headers->filename
+ * @return An open descriptor to append the part data to, or -1 to skip
+ *         the part
+ */
+typedef int (*multipart_sink_open_cb) (void* data,
+                                       const multipart_part_headers* headers);
+
+/**
+ * @brief Called after the last byte of a part was written
+ *
+ * Also called for a part cut short by an error or the end of the input.
+ *
+ * @param data The multipart_sink data pointer
+ * @param fd The descriptor returned by the open callback
+ * @return 0 to continue, non-zero to stop with MPPE_PAUSED
+ */
+typedef int (*multipart_sink_close_cb) (void* data, int fd);
+
+/**
+ * @brief Writes part data straight to file descriptors
+ *
+ * The extract functions parse in span mode, so part data is never copied
+ * into a callback buffer: from a file it is copied in the kernel with
+ * copy_file_range() where available (falling back to write() from the
+ * mapping), from a stream the spans of each read are batched into one
+ * writev(). The descriptors belong to the caller; the sink does not close
+ * them.
+ */
+typedef struct {
+  multipart_sink_open_cb open_part;   /**< Required */
+  multipart_sink_close_cb close_part; /**< Optional, e.g. to close the file */
+  void* data;                         /**< Passed to both callbacks */
+} multipart_sink;
+
+/**
+ * @brief Write the parts of a body stored in a file to descriptors
+ *
+ * @param path File holding the body
+ * @param boundary The boundary string (without "--" prefix)
+ * @param sink Where part data goes
+ * @return 0 if the whole file was parsed, -1 on an I/O or allocation error
+ *         (errno is set), or the multipart_parser_error that stopped the
+ *         parser
+ */
+int multipart_extract_file(const char *path, const char *boundary,
+                           const multipart_sink* sink);
+
+/**
+ * @brief Write the parts of a body read from a descriptor to descriptors
+ *
+ * Reads until end of file through a multipart_reader. A non-blocking
+ * descriptor is not supported: EAGAIN is returned as an I/O error.
+ *
+ * @param fd Descriptor to read from, e.g. a socket or pipe
+ * @param boundary The boundary string (without "--" prefix)
+ * @param sink Where part data goes
+ * @return See multipart_extract_file()
+ */
+int multipart_extract_fd(int fd, const char *boundary,
+                         const multipart_sink* sink);
+
+#ifndef MULTIPART_ENCODER_HEADER_SIZE
+/** Capacity of an encoder's buffer for the header blocks of queued parts */
+#define MULTIPART_ENCODER_HEADER_SIZE 1024
+#endif
+
+#ifndef MULTIPART_ENCODER_MAX_SEGMENTS
+/** Capacity of an encoder's output queue, in segments */
+#define MULTIPART_ENCODER_MAX_SEGMENTS 64
+#endif
+
+/**
+ * @brief Streaming multipart body encoder, the counterpart of the parser
+ *
+ * Parts are queued as a header block plus any number of payload ranges,
+ * then drained with writev(). Delimiter lines come from one copy of the
+ * boundary kept in the encoder and header blocks are formatted into a
+ * fixed buffer of MULTIPART_ENCODER_HEADER_SIZE bytes; payloads are never
+ * copied: caller buffers are passed through as iovec entries, file ranges
+ * are sent with sendfile() where available (falling back to pread() into a
+ * small stack buffer). Queued buffers and descriptors must stay valid until
+ * their bytes are written.
+ *
+ * The queue holds MULTIPART_ENCODER_MAX_SEGMENTS segments: each part takes
+ * two for its delimiter and headers, each payload range one. When it is
+ * full, adding fails with ENOBUFS; write some output and retry. The header
+ * buffer is reused once everything queued has been written.
+ *
+ * Payloads are not searched for the delimiter: choose a boundary that
+ * cannot occur in them. Not thread-safe: one encoder per body.
+ */
+typedef struct multipart_encoder multipart_encoder;
+
+/**
+ * @brief Create an encoder
+ *
+ * @param boundary The boundary string (without "--" prefix): 1 to
+ *                 MULTIPART_MAX_BOUNDARY_LENGTH characters allowed by
+ *                 RFC 2046 (letters, digits and <tt>'()+_,-./:=?</tt>, or
+ *                 spaces other than the last character)
+ * @return The encoder, or NULL on an invalid boundary or allocation failure
+ */
+multipart_encoder* multipart_encoder_create(const char *boundary);
+
+/**
+ * @brief Free an encoder; queued buffers and descriptors are not touched
+ *
+ * @param e The encoder, or NULL
+ */
+void multipart_encoder_free(multipart_encoder* e);
+
+/**
+ * @brief Start a part
+ *
+ * Queues the delimiter line and the header block of the part. From
+ * @p headers, the disposition type (default "form-data" if a name or
+ * filename is set), the name and filename parameters, Content-Type and
+ * Content-Transfer-Encoding are written; absent (NULL) slices are left out
+ * and @c truncated is ignored. Name and filename are quoted with '\' and
+ * '"' escaped, as the parser unescapes them; headers from a parser's
+ * on_part_headers callback can be passed as they are.
+ *
+ * @param e The encoder
+ * @param headers The part's headers, or NULL for a part without headers
+ * @return 0 on success, -1 with errno set: EINVAL if a value contains CR,
+ *         LF or NUL or the body was finished, ENOBUFS if the queue or the
+ *         header buffer is full, EMSGSIZE if the header block is longer
+ *         than MULTIPART_ENCODER_HEADER_SIZE
+ */
+int multipart_encoder_begin_part(multipart_encoder* e,
+                                 const multipart_part_headers* headers);
+
+/**
+ * @brief Queue part data from a buffer
+ *
+ * The buffer is referenced, not copied; it must stay valid and unchanged
+ * until its bytes are written. Empty ranges are ignored.
+ *
+ * @param e The encoder
+ * @param data The bytes
+ * @param length Number of bytes
+ * @return 0 on success, -1 with errno set: EINVAL if no part was started or
+ *         the body was finished, ENOBUFS if the queue is full
+ */
+int multipart_encoder_add_data(multipart_encoder* e, const void* data,
+                               size_t length);
+
+/**
+ * @brief Queue part data from a file
+ *
+ * The range is read when it is written, with pread() semantics: the
+ * descriptor's file offset is not used or changed.
+ *
+ * @param e The encoder
+ * @param fd Descriptor of a regular file, open for reading
+ * @param offset File offset of the first byte
+ * @param length Number of bytes
+ * @return See multipart_encoder_add_data()
+ */
+int multipart_encoder_add_file(multipart_encoder* e, int fd, off_t offset,
+                               size_t length);
+
+/**
+ * @brief Queue the closing delimiter; nothing can be added afterwards
+ *
+ * @param e The encoder
+ * @return 0 on success, -1 with errno set: EINVAL if already finished,
+ *         ENOBUFS if the queue is full
+ */
+int multipart_encoder_finish(multipart_encoder* e);
+
+/**
+ * @brief Get the number of bytes queued and not yet written
+ *
+ * @param e The encoder
+ * @return Bytes pending
+ */
+size_t multipart_encoder_pending(const multipart_encoder* e);
+
+/**
+ * @brief Get the next output as vectors for writev()
+ *
+ * For writers that do their own I/O, e.g. on a non-blocking socket: write
+ * any prefix of the returned vectors, then report the byte count with
+ * multipart_encoder_consume(). The vectors stop before a file range; when
+ * none is returned while bytes are pending, the next output is a file
+ * range, see multipart_encoder_next_file().
+ *
+ * @param e The encoder
+ * @param iov Array receiving the vectors
+ * @param max_iov Capacity of @p iov
+ * @return Number of vectors stored
+ */
+size_t multipart_encoder_next_iovec(multipart_encoder* e, struct iovec* iov,
+                                    size_t max_iov);
+
+/**
+ * @brief Get the file range at the head of the queue
+ *
+ * @param e The encoder
+ * @param fd Receives the descriptor
+ * @param offset Receives the file offset of the next byte
+ * @param length Receives the number of bytes of the range left to write
+ * @return 1 if the next output is a file range, 0 otherwise
+ */
+int multipart_encoder_next_file(const multipart_encoder* e, int* fd,
+                                off_t* offset, size_t* length);
+
+/**
+ * @brief Advance the queue past written bytes
+ *
+ * @param e The encoder
+ * @param n Number of bytes written, at most multipart_encoder_pending()
+ */
+void multipart_encoder_consume(multipart_encoder* e, size_t n);
+
+/**
+ * @brief Write queued output to a descriptor
+ *
+ * Writes until the queue is empty, retrying partial and interrupted
+ * writes. With a non-blocking descriptor, -1 with errno EAGAIN means the
+ * descriptor is full; call again once it is writable.
+ *
+ * @param e The encoder
+ * @param fd Descriptor to write to, e.g. a socket
+ * @return 0 once everything queued was written, -1 on an I/O error (errno
+ *         is set; EIO if a queued file range ends before its length)
+ */
+int multipart_encoder_write(multipart_encoder* e, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
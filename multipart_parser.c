@@ -9,6 +9,37 @@
 #include <stdarg.h>
 #include <string.h>
 
+/* SIMD delimiter scanners. Define MULTIPART_PARSER_NO_SIMD to build only the
+ * portable C89 scanner, or MULTIPART_PARSER_NO_AVX2 to drop the AVX2 kernel
+ * (e.g. for toolchains without target attributes). */
+#ifndef MULTIPART_PARSER_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MULTIPART_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(MULTIPART_HAVE_SSE2) && !defined(MULTIPART_PARSER_NO_AVX2) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#define MULTIPART_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(MULTIPART_HAVE_SSE2) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#define MULTIPART_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MULTIPART_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#define MULTIPART_HAVE_ARM_CRC32 1
+#include <arm_acle.h>
+#endif
+#endif
+
 static void multipart_log(const char * format, ...)
 {
 #ifdef DEBUG_MULTIPART
@@ -22,38 +53,376 @@ static void multipart_log(const char * format, ...)
 #endif
 }
 
-#define NOTIFY_CB(FOR)                                                 \
+/* Callbacks pause the parser by returning non-zero. The parser then returns
+ * RESUME, the number of bytes it consumed: calling multipart_parser_execute()
+ * again with the rest of the buffer continues without losing or repeating
+ * events. Sites update the state before calling out so RESUME is exact. */
+#define NOTIFY_CB(FOR, resume)                                         \
 do {                                                                   \
   if (p->settings->on_##FOR) {                                         \
+    STATS_CALLBACK(FOR);                                               \
     if (p->settings->on_##FOR(p) != 0) {                               \
       p->error = MPPE_PAUSED;                                          \
-      return i;                                                        \
+      return (resume);                                                 \
     }                                                                  \
   }                                                                    \
 } while (0)
 
-#define EMIT_DATA_CB(FOR, ptr, len)                                    \
+/* Parser variants: parse_chunk_variant() is compiled once per combination
+ * of these flags, see select_parse(). A clear flag promises that the
+ * settings it names are unused, so the branches testing them fold away. */
+#define VARIANT_BUFFERED 0x01  /* buffer_size > 0 */
+#define VARIANT_HEADERS  0x02  /* header callbacks or the header arena */
+#define VARIANT_DATA     0x04  /* on_part_data, spans or a digest */
+#define VARIANT_ALL      0x07
+
+#define EMIT_DATA_CB(FOR, ptr, len, resume)                            \
 do {                                                                   \
   if (p->settings->on_##FOR) {                                         \
-    if (p->settings->buffer_size > 0 && p->FOR##_buffer) {             \
+    if ((variant & VARIANT_BUFFERED) &&                                \
+        p->buffer_size > 0 && p->FOR##_buffer) {                       \
       if (buffer_or_emit(p, p->settings->on_##FOR,                     \
                          &p->FOR##_buffer, &p->FOR##_buffer_len,       \
                          ptr, len) != 0) {                             \
-        return i;                                                      \
+        return (resume);                                               \
       }                                                                \
     } else {                                                           \
+      STATS_CALLBACK(FOR);                                             \
       if (p->settings->on_##FOR(p, ptr, len) != 0) {                   \
         p->error = MPPE_PAUSED;                                        \
-        return i;                                                      \
+        return (resume);                                               \
+      }                                                                \
+    }                                                                  \
+  }                                                                    \
+} while (0)
+
+/* Hot-path counters, compiled in only with MULTIPART_PARSER_STATS */
+#ifdef MULTIPART_PARSER_STATS
+#define STATS_ADD(field, n) (p->stats.field += (n))
+#define STATS_CALLBACK(FOR) (p->stats.callbacks[STATS_CB_##FOR]++)
+#define STATS_HEADER_BEGIN(pos) (p->stats_header_start = (pos))
+#define STATS_HEADER_END(pos)                                          \
+do {                                                                   \
+  if ((pos) - p->stats_header_start > p->stats.largest_header) {       \
+    p->stats.largest_header = (pos) - p->stats_header_start;           \
+  }                                                                    \
+} while (0)
+#else
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_CALLBACK(FOR) ((void)0)
+#define STATS_HEADER_BEGIN(pos) ((void)0)
+#define STATS_HEADER_END(pos) ((void)0)
+#endif
+#define STATS_CB_header_field MULTIPART_STATS_HEADER_FIELD
+#define STATS_CB_header_value MULTIPART_STATS_HEADER_VALUE
+#define STATS_CB_part_data MULTIPART_STATS_PART_DATA
+#define STATS_CB_part_data_begin MULTIPART_STATS_PART_DATA_BEGIN
+#define STATS_CB_headers_complete MULTIPART_STATS_HEADERS_COMPLETE
+#define STATS_CB_part_data_end MULTIPART_STATS_PART_DATA_END
+#define STATS_CB_body_end MULTIPART_STATS_BODY_END
+#define STATS_CB_part_data_span MULTIPART_STATS_PART_DATA_SPAN
+#define STATS_CB_part_headers MULTIPART_STATS_PART_HEADERS
+
+/* Hash part data for the part digest, before it is reported */
+#define DIGEST_DATA(ptr, len)                                          \
+do {                                                                   \
+  if (p->digest.type != MULTIPART_DIGEST_NONE) {                       \
+    digest_update(p, (const unsigned char*)(ptr), len);                \
+  }                                                                    \
+} while (0)
+
+/* Part data goes to on_part_data_span as a stream range when span mode is
+ * enabled, through the transfer decoder of the part if it has one,
+ * otherwise through EMIT_DATA_CB. POS is the stream offset of PTR. */
+#define EMIT_PART_DATA(ptr, len, pos, resume)                          \
+do {                                                                   \
+  if (p->max_part_size && !p->epilogue &&                              \
+      (pos) + (len) - p->part_data_offset > p->max_part_size) {        \
+    /* Checked first so rejected data is never buffered or decoded */  \
+    return part_too_large(p);                                          \
+  }                                                                    \
+  if (!(variant & VARIANT_DATA) || p->epilogue) {                      \
+    /* No part data consumer, or the epilogue of a nested body */      \
+  } else if (p->settings->on_part_data_span) {                         \
+    DIGEST_DATA(ptr, len);                                             \
+    if (report_span(p, pos, len) != 0) {                               \
+      return (resume);                                                 \
+    }                                                                  \
+  } else if (p->decoding) {                                            \
+    if (decode_part_data(p, ptr, len) != 0) {                          \
+      return (resume);                                                 \
+    }                                                                  \
+  } else {                                                             \
+    DIGEST_DATA(ptr, len);                                             \
+    EMIT_DATA_CB(part_data, ptr, len, resume);                         \
+  }                                                                    \
+} while (0)
+
+/* Header bytes go to the header callbacks, in variants that have them */
+#define EMIT_HEADER_CB(FOR, ptr, len, resume)                          \
+do {                                                                   \
+  if (variant & VARIANT_HEADERS) {                                     \
+    EMIT_DATA_CB(FOR, ptr, len, resume);                               \
+  }                                                                    \
+} while (0)
+
+/* The last bytes of a header name or value: report them with what is
+ * left of it in its buffer, before any byte that follows */
+#define EMIT_HEADER_DONE(FOR, ptr, len, resume)                        \
+do {                                                                   \
+  if ((variant & VARIANT_HEADERS) && p->settings->on_##FOR) {          \
+    if ((variant & VARIANT_BUFFERED) &&                                \
+        p->buffer_size > 0 && p->FOR##_buffer) {                       \
+      if (buffer_and_flush(p, p->settings->on_##FOR,                   \
+                           &p->FOR##_buffer, &p->FOR##_buffer_len,     \
+                           ptr, len) != 0) {                           \
+        return (resume);                                               \
       }                                                                \
+    } else {                                                           \
+      EMIT_DATA_CB(FOR, ptr, len, resume);                             \
     }                                                                  \
   }                                                                    \
 } while (0)
 
+/* The header block of the current part began at event_offset: fail if it
+ * extends past max_header_bytes by buf[END] */
+#define CHECK_HEADER_BYTES(end)                                        \
+do {                                                                   \
+  if (p->max_header_bytes &&                                           \
+      p->stream_offset + (end) - p->event_offset > p->max_header_bytes) { \
+    p->error = MPPE_HEADERS_TOO_LARGE;                                 \
+    return i;                                                          \
+  }                                                                    \
+} while (0)
+
+/* A part begins at buf[i]: fail if the body already has max_parts */
+#define COUNT_PART()                                                   \
+do {                                                                   \
+  if (p->max_parts && p->part_count >= p->max_parts) {                 \
+    p->error = MPPE_TOO_MANY_PARTS;                                    \
+    return i;                                                          \
+  }                                                                    \
+  p->part_count++;                                                     \
+} while (0)
+
+/* A delimiter candidate of N bytes turned out to be part data. If it began
+ * in this chunk it is still pending in buf[mark..]. Otherwise its bytes are
+ * the first N bytes of the delimiter, which are emitted from p->delimiter
+ * (the slot of the current nesting level, stable until the next reset or
+ * the next push to this level), or in span mode as the N stream bytes
+ * before buf[i].
+ * The caller has already moved back to s_part_data, so a pause resumes by
+ * rescanning buf[i]. */
+#define REPLAY_LOOKBEHIND(n)                                           \
+do {                                                                   \
+  STATS_ADD(cr_false_positives, 1);                                    \
+  if (replay) {                                                        \
+    STATS_ADD(lookbehind_replays, 1);                                  \
+    replay = 0;                                                        \
+    mark = i;                                                          \
+    EMIT_PART_DATA(p->delimiter, n, p->stream_offset + i - (n), i);    \
+  }                                                                    \
+} while (0)
 
 #define LF 10
 #define CR 13
 
+/* Character classes of the header states, indexed by unsigned byte value.
+ * Header names are letters and '-' only; since '-' already has bit 0x20
+ * set, (c | 0x20) lower-cases any byte of class CC_NAME. */
+#define CC_NAME  0x01
+#define CC_CR    0x02
+#define CC_LF    0x04
+#define CC_COLON 0x08
+#define CC_OWS   0x10
+
+#define N CC_NAME
+#define R CC_CR
+#define L CC_LF
+#define C CC_COLON
+#define W CC_OWS
+static const unsigned char char_class[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, W, L, 0, 0, R, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  W, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, N, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, C, 0, 0, 0, 0, 0,
+  0, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+  N, N, N, N, N, N, N, N, N, N, N, 0, 0, 0, 0, 0,
+  0, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+  N, N, N, N, N, N, N, N, N, N, N, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+#undef N
+#undef R
+#undef L
+#undef C
+#undef W
+
+#define CHAR_CLASS(c) char_class[(unsigned char)(c)]
+
+/* Base64 sextet of each byte; bytes outside the alphabet are skipped as
+ * RFC 2045 requires, '=' ends the encoded data */
+#define S 64
+#define P 65
+static const unsigned char base64_value[256] = {
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, 62, S, S, S, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, S, S, S, P, S, S,
+  S, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, S, S, S, S, S,
+  S, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S
+};
+#undef S
+#undef P
+#define BASE64_SKIP 64
+#define BASE64_PAD 65
+
+/* Content-Transfer-Encoding decoders, and the bytes decoded before they
+ * are passed on (see decode_part_data()) */
+enum decoding {
+  DECODE_NONE = 0,
+  DECODE_BASE64,
+  DECODE_QUOTED_PRINTABLE
+};
+#define DECODE_CHUNK 256
+
+/* CRC-32C (Castagnoli, reflected polynomial 0x82F63B78) of each byte */
+static const unsigned long crc32c_table[256] = {
+  0x00000000UL, 0xf26b8303UL, 0xe13b70f7UL, 0x1350f3f4UL,
+  0xc79a971fUL, 0x35f1141cUL, 0x26a1e7e8UL, 0xd4ca64ebUL,
+  0x8ad958cfUL, 0x78b2dbccUL, 0x6be22838UL, 0x9989ab3bUL,
+  0x4d43cfd0UL, 0xbf284cd3UL, 0xac78bf27UL, 0x5e133c24UL,
+  0x105ec76fUL, 0xe235446cUL, 0xf165b798UL, 0x030e349bUL,
+  0xd7c45070UL, 0x25afd373UL, 0x36ff2087UL, 0xc494a384UL,
+  0x9a879fa0UL, 0x68ec1ca3UL, 0x7bbcef57UL, 0x89d76c54UL,
+  0x5d1d08bfUL, 0xaf768bbcUL, 0xbc267848UL, 0x4e4dfb4bUL,
+  0x20bd8edeUL, 0xd2d60dddUL, 0xc186fe29UL, 0x33ed7d2aUL,
+  0xe72719c1UL, 0x154c9ac2UL, 0x061c6936UL, 0xf477ea35UL,
+  0xaa64d611UL, 0x580f5512UL, 0x4b5fa6e6UL, 0xb93425e5UL,
+  0x6dfe410eUL, 0x9f95c20dUL, 0x8cc531f9UL, 0x7eaeb2faUL,
+  0x30e349b1UL, 0xc288cab2UL, 0xd1d83946UL, 0x23b3ba45UL,
+  0xf779deaeUL, 0x05125dadUL, 0x1642ae59UL, 0xe4292d5aUL,
+  0xba3a117eUL, 0x4851927dUL, 0x5b016189UL, 0xa96ae28aUL,
+  0x7da08661UL, 0x8fcb0562UL, 0x9c9bf696UL, 0x6ef07595UL,
+  0x417b1dbcUL, 0xb3109ebfUL, 0xa0406d4bUL, 0x522bee48UL,
+  0x86e18aa3UL, 0x748a09a0UL, 0x67dafa54UL, 0x95b17957UL,
+  0xcba24573UL, 0x39c9c670UL, 0x2a993584UL, 0xd8f2b687UL,
+  0x0c38d26cUL, 0xfe53516fUL, 0xed03a29bUL, 0x1f682198UL,
+  0x5125dad3UL, 0xa34e59d0UL, 0xb01eaa24UL, 0x42752927UL,
+  0x96bf4dccUL, 0x64d4cecfUL, 0x77843d3bUL, 0x85efbe38UL,
+  0xdbfc821cUL, 0x2997011fUL, 0x3ac7f2ebUL, 0xc8ac71e8UL,
+  0x1c661503UL, 0xee0d9600UL, 0xfd5d65f4UL, 0x0f36e6f7UL,
+  0x61c69362UL, 0x93ad1061UL, 0x80fde395UL, 0x72966096UL,
+  0xa65c047dUL, 0x5437877eUL, 0x4767748aUL, 0xb50cf789UL,
+  0xeb1fcbadUL, 0x197448aeUL, 0x0a24bb5aUL, 0xf84f3859UL,
+  0x2c855cb2UL, 0xdeeedfb1UL, 0xcdbe2c45UL, 0x3fd5af46UL,
+  0x7198540dUL, 0x83f3d70eUL, 0x90a324faUL, 0x62c8a7f9UL,
+  0xb602c312UL, 0x44694011UL, 0x5739b3e5UL, 0xa55230e6UL,
+  0xfb410cc2UL, 0x092a8fc1UL, 0x1a7a7c35UL, 0xe811ff36UL,
+  0x3cdb9bddUL, 0xceb018deUL, 0xdde0eb2aUL, 0x2f8b6829UL,
+  0x82f63b78UL, 0x709db87bUL, 0x63cd4b8fUL, 0x91a6c88cUL,
+  0x456cac67UL, 0xb7072f64UL, 0xa457dc90UL, 0x563c5f93UL,
+  0x082f63b7UL, 0xfa44e0b4UL, 0xe9141340UL, 0x1b7f9043UL,
+  0xcfb5f4a8UL, 0x3dde77abUL, 0x2e8e845fUL, 0xdce5075cUL,
+  0x92a8fc17UL, 0x60c37f14UL, 0x73938ce0UL, 0x81f80fe3UL,
+  0x55326b08UL, 0xa759e80bUL, 0xb4091bffUL, 0x466298fcUL,
+  0x1871a4d8UL, 0xea1a27dbUL, 0xf94ad42fUL, 0x0b21572cUL,
+  0xdfeb33c7UL, 0x2d80b0c4UL, 0x3ed04330UL, 0xccbbc033UL,
+  0xa24bb5a6UL, 0x502036a5UL, 0x4370c551UL, 0xb11b4652UL,
+  0x65d122b9UL, 0x97baa1baUL, 0x84ea524eUL, 0x7681d14dUL,
+  0x2892ed69UL, 0xdaf96e6aUL, 0xc9a99d9eUL, 0x3bc21e9dUL,
+  0xef087a76UL, 0x1d63f975UL, 0x0e330a81UL, 0xfc588982UL,
+  0xb21572c9UL, 0x407ef1caUL, 0x532e023eUL, 0xa145813dUL,
+  0x758fe5d6UL, 0x87e466d5UL, 0x94b49521UL, 0x66df1622UL,
+  0x38cc2a06UL, 0xcaa7a905UL, 0xd9f75af1UL, 0x2b9cd9f2UL,
+  0xff56bd19UL, 0x0d3d3e1aUL, 0x1e6dcdeeUL, 0xec064eedUL,
+  0xc38d26c4UL, 0x31e6a5c7UL, 0x22b65633UL, 0xd0ddd530UL,
+  0x0417b1dbUL, 0xf67c32d8UL, 0xe52cc12cUL, 0x1747422fUL,
+  0x49547e0bUL, 0xbb3ffd08UL, 0xa86f0efcUL, 0x5a048dffUL,
+  0x8ecee914UL, 0x7ca56a17UL, 0x6ff599e3UL, 0x9d9e1ae0UL,
+  0xd3d3e1abUL, 0x21b862a8UL, 0x32e8915cUL, 0xc083125fUL,
+  0x144976b4UL, 0xe622f5b7UL, 0xf5720643UL, 0x07198540UL,
+  0x590ab964UL, 0xab613a67UL, 0xb831c993UL, 0x4a5a4a90UL,
+  0x9e902e7bUL, 0x6cfbad78UL, 0x7fab5e8cUL, 0x8dc0dd8fUL,
+  0xe330a81aUL, 0x115b2b19UL, 0x020bd8edUL, 0xf0605beeUL,
+  0x24aa3f05UL, 0xd6c1bc06UL, 0xc5914ff2UL, 0x37faccf1UL,
+  0x69e9f0d5UL, 0x9b8273d6UL, 0x88d28022UL, 0x7ab90321UL,
+  0xae7367caUL, 0x5c18e4c9UL, 0x4f48173dUL, 0xbd23943eUL,
+  0xf36e6f75UL, 0x0105ec76UL, 0x12551f82UL, 0xe03e9c81UL,
+  0x34f4f86aUL, 0xc69f7b69UL, 0xd5cf889dUL, 0x27a40b9eUL,
+  0x79b737baUL, 0x8bdcb4b9UL, 0x988c474dUL, 0x6ae7c44eUL,
+  0xbe2da0a5UL, 0x4c4623a6UL, 0x5f16d052UL, 0xad7d5351UL
+};
+
+/* SHA-256 round constants (FIPS 180-4) */
+static const unsigned long sha256_k[64] = {
+  0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+  0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+  0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+  0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+  0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+  0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+  0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+  0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+  0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+  0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+  0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+  0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+  0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+  0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+  0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+  0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+/* CRC-32C update over buf[0..len) of a pre-inverted crc. Selected once per
+ * parser by select_crc32c() */
+typedef unsigned long (*crc32c_fn)(unsigned long crc, const unsigned char* buf,
+                                   size_t len);
+
+/* Running digest of the current part's data; result holds the final value
+ * once size is set at the part end */
+typedef struct {
+  unsigned char type;             /* multipart_digest_type of the part */
+  unsigned char block_len;        /* SHA-256: bytes pending in block */
+  size_t size;                    /* size of result, 0 until the part ends */
+  unsigned long crc;
+  unsigned long h[8];             /* SHA-256 state, 32 bits per word */
+  unsigned long bytes_low;        /* SHA-256 message length in bytes */
+  unsigned long bytes_high;
+  unsigned char block[64];
+  unsigned char result[MULTIPART_DIGEST_MAX_SIZE];
+} digest_state;
+
+/* Delimiter scanner: returns the first complete "\r\n--boundary" in
+ * buf[0..len), or NULL. Selected once per parser by select_find_delimiter() */
+typedef const char* (*find_delimiter_fn)(const multipart_parser* p,
+                                         const char* buf, size_t len);
+
+/* Execute loop of multipart_parser_execute(): a copy of parse_chunk()
+ * specialized for the parser's settings, selected once by select_parse() */
+typedef size_t (*parse_fn)(multipart_parser* p, const char* buf, size_t len);
+static parse_fn select_parse(const multipart_parser* p);
+
+/* part_data_offset and part_length when a part has no data of its own */
+#define NO_PART_LENGTH ((size_t)-1)
+
 struct multipart_parser {
   void * data;
 
@@ -64,8 +433,11 @@ struct multipart_parser {
   multipart_parser_error error;  /* Last error code */
 
   const multipart_parser_settings* settings;
+  parse_fn parse;
 
-  /* Buffering support for data callbacks */
+  /* Buffering support for data callbacks; buffer_size is copied from the
+   * settings at init so the settings are never consulted for it again */
+  size_t buffer_size;
   char* header_field_buffer;
   size_t header_field_buffer_len;
   char* header_value_buffer;
@@ -73,8 +445,104 @@ struct multipart_parser {
   char* part_data_buffer;
   size_t part_data_buffer_len;
 
-  char* lookbehind;
-  char multipart_boundary[1];
+  /* Span mode: stream offset of buf[0] in the current execute call, and the
+   * part data range not yet passed to on_part_data_span */
+  size_t stream_offset;
+  size_t span_offset;
+  size_t span_length;
+
+  /* Boundary search: Horspool bad-character shifts for the delimiter
+   * "\r\n--" + boundary, built once per boundary by set_boundary() */
+  unsigned char boundary_skip[256];
+  unsigned char boundary_search;  /* 0 when the boundary contains CR */
+  find_delimiter_fn find_delimiter;
+
+  /* Header accumulation (on_part_headers, max_depth): raw header bytes of
+   * the current part, the start of the header being collected, and the
+   * values of the known headers as arena offsets */
+  char* header_arena;
+  size_t header_arena_size;
+  size_t header_arena_len;
+  size_t header_start;
+  size_t header_value_start;
+  size_t known_header_offset[MULTIPART_HEADER_ID_COUNT];
+  size_t known_header_length[MULTIPART_HEADER_ID_COUNT];
+  unsigned char known_headers;    /* bit per header ID present */
+  unsigned char header_overflow;  /* current header did not fit */
+  unsigned char headers_truncated;
+
+  /* Header name recognition: names still matching the bytes seen so far
+   * (bit per multipart_header_id), how many were seen, and the result */
+  unsigned char header_candidates;
+  unsigned char header_name_pos;
+  unsigned char header_id;
+
+  /* Nested multipart: delimiters of nesting levels 1 to max_depth, one
+   * slot of DELIMITER_SLOT_SIZE(boundary_capacity) bytes per level (level 0
+   * is delimiter_storage), and whether the epilogue of a nested body is
+   * being skipped */
+  char* boundary_stack;
+  size_t boundary_capacity;
+  size_t depth;
+  size_t max_depth;
+  unsigned char epilogue;
+
+  /* Pull API: array filled by multipart_parser_execute_events(), else NULL */
+  multipart_event* events;
+  size_t event_count;
+  size_t event_max;
+
+  /* Part index: filled by multipart_parser_execute_index(), else NULL.
+   * event_offset is the stream offset of the part begin, headers complete
+   * or part end being notified; the Content-Disposition value of the
+   * current part is copied to the index strings from disposition_start */
+  multipart_index* part_index;
+  size_t event_offset;
+  size_t disposition_start;
+  unsigned char disposition_state;
+
+  /* Content-Transfer-Encoding decoding (decode_transfer_encoding): the
+   * decoder of the current part and its state carried across chunks, the
+   * sextets or quoted-printable escape seen so far */
+  unsigned char decoding;
+  unsigned char decode_count;
+  unsigned long decode_bits;
+  char decode_out[DECODE_CHUNK];
+
+  /* Part digest (digest setting) */
+  digest_state digest;
+  crc32c_fn crc32c;
+
+  /* Stream offset of the current part's data and the data length of the
+   * part that just ended; NO_PART_LENGTH for a part holding a nested body */
+  size_t part_data_offset;
+  size_t part_length;
+
+  /* Limits copied from the settings (0 = none), and the parts begun */
+  size_t max_part_size;
+  size_t max_header_bytes;
+  size_t max_parts;
+  size_t max_total_size;
+  size_t part_count;
+
+#ifdef MULTIPART_PARSER_STATS
+  /* Hot-path counters, and the stream offset of the header line being
+   * scanned for largest_header */
+  multipart_parser_stats stats;
+  size_t stats_header_start;
+#endif
+
+  /* Hooks the parser memory came from; release is NULL for parsers laid
+   * out in caller-provided memory */
+  multipart_parser_allocator allocator;
+  struct multipart_parser* pool_next;  /* idle list of a multipart_parser_pool */
+
+  /* The active level's "\r\n--boundary". Each level keeps its own slot,
+   * so part data replayed from a delimiter is not rewritten when a nested
+   * body is entered or left. */
+  char* delimiter;
+  char* multipart_boundary;       /* points into delimiter, past "\r\n--" */
+  char delimiter_storage[1];
 };
 
 enum state {
@@ -95,207 +563,2462 @@ enum state {
   s_part_data_almost_end,
   s_part_data_end,
   s_part_data_final_hyphen,
+  s_nested_start,
+  s_nested_end,
   s_end
 };
 
-multipart_parser* multipart_parser_init
-    (const char *boundary, const multipart_parser_settings* settings) {
-  size_t buffer_size;
-  multipart_parser* p;
+/* Part digests. Words are kept in unsigned long and masked to 32 bits, so
+ * the code is the same for 32- and 64-bit longs. */
+#define U32(x) ((x) & 0xffffffffUL)
+#define ROTR32(x, n) U32(((x) >> (n)) | ((x) << (32 - (n))))
 
-  buffer_size = (settings && settings->buffer_size > 0) ? settings->buffer_size : 0;
+static unsigned long crc32c_scalar(unsigned long crc, const unsigned char* buf,
+                                   size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    crc = crc32c_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef MULTIPART_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static unsigned long crc32c_sse42(unsigned long crc, const unsigned char* buf,
+                                  size_t len) {
+#if defined(__x86_64__) && defined(__LP64__)
+  unsigned long word;
+  while (len >= 8) {
+    memcpy(&word, buf, 8);
+    crc = (unsigned long)_mm_crc32_u64(crc, word);
+    buf += 8;
+    len -= 8;
+  }
+#else
+  unsigned int word;
+  while (len >= 4) {
+    memcpy(&word, buf, 4);
+    crc = _mm_crc32_u32((unsigned int)crc, word);
+    buf += 4;
+    len -= 4;
+  }
+#endif
+  while (len > 0) {
+    crc = _mm_crc32_u8((unsigned int)crc, *buf++);
+    len--;
+  }
+  return crc;
+}
+#endif
+
+#ifdef MULTIPART_HAVE_ARM_CRC32
+static unsigned long crc32c_arm(unsigned long crc, const unsigned char* buf,
+                                size_t len) {
+  unsigned int word;
+  while (len >= 4) {
+    memcpy(&word, buf, 4);
+    crc = __crc32cw((unsigned int)crc, word);
+    buf += 4;
+    len -= 4;
+  }
+  while (len > 0) {
+    crc = __crc32cb((unsigned int)crc, *buf++);
+    len--;
+  }
+  return crc;
+}
+#endif
 
-  p = malloc(sizeof(multipart_parser) +
-             strlen(boundary) +
-             strlen(boundary) + 9 +
-             (buffer_size > 0 ? (buffer_size * 3) : 0));  /* 3 buffers if buffering enabled */
+static crc32c_fn select_crc32c(void) {
+#ifdef MULTIPART_HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+#ifdef MULTIPART_HAVE_ARM_CRC32
+  return crc32c_arm;
+#else
+  return crc32c_scalar;
+#endif
+}
 
-  if (p == NULL) {
+static void sha256_block(unsigned long* h, const unsigned char* block) {
+  unsigned long w[64];
+  unsigned long a, b, c, d, e, f, g, hh, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = ((unsigned long)block[4 * i] << 24) |
+           ((unsigned long)block[4 * i + 1] << 16) |
+           ((unsigned long)block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for (i = 16; i < 64; i++) {
+    t1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    t2 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    w[i] = U32(t1 + w[i - 7] + t2 + w[i - 16]);
+  }
+  a = h[0]; b = h[1]; c = h[2]; d = h[3];
+  e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+  for (i = 0; i < 64; i++) {
+    t1 = U32(hh + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+             ((e & f) ^ (~e & g)) + sha256_k[i] + w[i]);
+    t2 = U32((ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c)));
+    hh = g; g = f; f = e;
+    e = U32(d + t1);
+    d = c; c = b; b = a;
+    a = U32(t1 + t2);
+  }
+  h[0] = U32(h[0] + a); h[1] = U32(h[1] + b);
+  h[2] = U32(h[2] + c); h[3] = U32(h[3] + d);
+  h[4] = U32(h[4] + e); h[5] = U32(h[5] + f);
+  h[6] = U32(h[6] + g); h[7] = U32(h[7] + hh);
+}
+
+/* Start the digest of a new part */
+static void digest_begin(multipart_parser* p, unsigned char type) {
+  digest_state* d = &p->digest;
+  static const unsigned long sha256_init[8] = {
+    0x6a09e667UL, 0xbb67ae85UL, 0x3c6ef372UL, 0xa54ff53aUL,
+    0x510e527fUL, 0x9b05688cUL, 0x1f83d9abUL, 0x5be0cd19UL
+  };
+
+  d->type = type;
+  d->size = 0;
+  d->crc = 0xffffffffUL;
+  d->block_len = 0;
+  d->bytes_low = 0;
+  d->bytes_high = 0;
+  memcpy(d->h, sha256_init, sizeof(sha256_init));
+}
+
+static void digest_update(multipart_parser* p, const unsigned char* data,
+                          size_t len) {
+  digest_state* d = &p->digest;
+  unsigned long low;
+  size_t n, room;
+
+  if (d->type == MULTIPART_DIGEST_CRC32C) {
+    d->crc = p->crc32c(d->crc, data, len);
+    return;
+  }
+  /* SHA-256: the message length in bytes, as a 64-bit pair */
+  low = (unsigned long)(len & 0xffffffffUL);
+  d->bytes_low = U32(d->bytes_low + low);
+  d->bytes_high = U32(d->bytes_high + (unsigned long)(len >> 16 >> 16) +
+                      (d->bytes_low < low));
+  if (d->block_len > 0) {
+    room = sizeof(d->block) - d->block_len;
+    n = room < len ? room : len;
+    memcpy(d->block + d->block_len, data, n);
+    d->block_len = (unsigned char)(d->block_len + n);
+    data += n;
+    len -= n;
+    if (d->block_len < 64) {
+      return;
+    }
+    sha256_block(d->h, d->block);
+    d->block_len = 0;
+  }
+  /* Whole blocks are hashed from the data itself */
+  while (len >= 64) {
+    sha256_block(d->h, data);
+    data += 64;
+    len -= 64;
+  }
+  memcpy(d->block, data, len);
+  d->block_len = (unsigned char)len;
+}
+
+/* End of the part: store the result. Safe to call more than once. */
+static void digest_finish(multipart_parser* p) {
+  digest_state* d = &p->digest;
+  unsigned long bits_high, bits_low;
+  int i;
+
+  if (d->type == MULTIPART_DIGEST_CRC32C) {
+    d->crc ^= 0xffffffffUL;
+    for (i = 0; i < 4; i++) {
+      d->result[i] = (unsigned char)(d->crc >> (24 - 8 * i));
+    }
+    d->size = 4;
+  } else if (d->type == MULTIPART_DIGEST_SHA256) {
+    bits_high = U32((d->bytes_high << 3) | (d->bytes_low >> 29));
+    bits_low = U32(d->bytes_low << 3);
+    d->block[d->block_len++] = 0x80;
+    if (d->block_len > 56) {
+      memset(d->block + d->block_len, 0, 64 - d->block_len);
+      sha256_block(d->h, d->block);
+      d->block_len = 0;
+    }
+    memset(d->block + d->block_len, 0, 56 - d->block_len);
+    for (i = 0; i < 4; i++) {
+      d->block[56 + i] = (unsigned char)(bits_high >> (24 - 8 * i));
+      d->block[60 + i] = (unsigned char)(bits_low >> (24 - 8 * i));
+    }
+    sha256_block(d->h, d->block);
+    for (i = 0; i < 32; i++) {
+      d->result[i] = (unsigned char)(d->h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    d->size = 32;
+  }
+  d->type = MULTIPART_DIGEST_NONE;
+}
+
+/* Length of the "\r\n--" prefix that precedes every boundary inside a body */
+#define DELIMITER_PREFIX_LEN 4
+
+/* Bytes of one nesting level's delimiter, NUL-terminated */
+#define DELIMITER_SLOT_SIZE(capacity) (DELIMITER_PREFIX_LEN + (capacity) + 1)
+
+/* Delimiter storage of a nesting level */
+static char* delimiter_slot(multipart_parser* p, size_t level) {
+  if (level == 0) {
+    return p->delimiter_storage;
+  }
+  return p->boundary_stack +
+         (level - 1) * DELIMITER_SLOT_SIZE(p->boundary_capacity);
+}
+
+/* Make the delimiter of a level active and build the Horspool shift table
+ * for it. Shifts are capped at 255, which only makes the search skip less
+ * for very long boundaries, never incorrectly. */
+static void use_delimiter(multipart_parser* p, size_t level) {
+  size_t i;
+  size_t m;
+  size_t shift;
+
+  p->delimiter = delimiter_slot(p, level);
+  p->multipart_boundary = p->delimiter + DELIMITER_PREFIX_LEN;
+  p->boundary_length = strlen(p->multipart_boundary);
+
+  m = p->boundary_length + DELIMITER_PREFIX_LEN;
+  memset(p->boundary_skip, m > 255 ? 255 : (int)m, sizeof(p->boundary_skip));
+  for (i = 0; i + 1 < m; i++) {
+    shift = m - 1 - i;
+    p->boundary_skip[(unsigned char)p->delimiter[i]] =
+        (unsigned char)(shift > 255 ? 255 : shift);
+  }
+
+  /* A CR inside the boundary lets a real delimiter start inside a failed
+   * partial match, which the byte state machine does not rescan. Keep both
+   * paths in agreement by disabling the skip search for such boundaries. */
+  p->boundary_search = (memchr(p->multipart_boundary, CR,
+                                p->boundary_length) == NULL);
+}
+
+/* Store a boundary as the full delimiter "\r\n--boundary" of a level */
+static void write_delimiter(multipart_parser* p, size_t level,
+                            const char* boundary, size_t length) {
+  char* slot = delimiter_slot(p, level);
+
+  slot[0] = CR;
+  slot[1] = LF;
+  slot[2] = '-';
+  slot[3] = '-';
+  memcpy(slot + DELIMITER_PREFIX_LEN, boundary, length);
+  slot[DELIMITER_PREFIX_LEN + length] = '\0';
+}
+
+/* Make boundary the active boundary of the current level */
+static void set_boundary(multipart_parser* p, const char* boundary,
+                         size_t length) {
+  write_delimiter(p, p->depth, boundary, length);
+  use_delimiter(p, p->depth);
+}
+
+/* Find the first complete delimiter in buf[0..len), or NULL. Only positions
+ * where the whole delimiter fits are examined; a partial delimiter at the
+ * end of the chunk is left to the byte state machine. */
+static const char* find_delimiter_scalar(const multipart_parser* p,
+                                         const char* buf, size_t len) {
+  const unsigned char* s = (const unsigned char*)buf;
+  size_t m = p->boundary_length + DELIMITER_PREFIX_LEN;
+  unsigned char last = (unsigned char)p->delimiter[m - 1];
+  size_t pos = 0;
+  unsigned char c;
+
+  if (len < m) {
     return NULL;
   }
 
-  strcpy(p->multipart_boundary, boundary);
-  p->boundary_length = strlen(boundary);
+  while (pos <= len - m) {
+    c = s[pos + m - 1];
+    if (c == last && memcmp(s + pos, p->delimiter, m - 1) == 0) {
+      return buf + pos;
+    }
+    pos += p->boundary_skip[c];
+  }
+  return NULL;
+}
 
-  p->lookbehind = (p->multipart_boundary + p->boundary_length + 1);
+#if defined(MULTIPART_HAVE_SSE2) || defined(MULTIPART_HAVE_NEON)
+/* Index of the lowest set bit of a non-zero mask */
+static unsigned int lowest_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned int)__builtin_ctz(mask);
+#else
+  unsigned int n = 0;
+  while ((mask & 1u) == 0) {
+    mask >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
 
-  /* Initialize buffer pointers */
-  if (buffer_size > 0) {
-    p->header_field_buffer = p->lookbehind + p->boundary_length + 8;
-    p->header_value_buffer = p->header_field_buffer + buffer_size;
-    p->part_data_buffer = p->header_value_buffer + buffer_size;
-  } else {
-    p->header_field_buffer = NULL;
-    p->header_value_buffer = NULL;
-    p->part_data_buffer = NULL;
+/* Confirm a candidate whose first five bytes already matched */
+static int delimiter_tail_matches(const multipart_parser* p,
+                                  const char* candidate) {
+  return memcmp(candidate + 5, p->delimiter + 5, p->boundary_length - 1) == 0;
+}
+#endif
+
+/*
+ * SIMD kernels compare the five bytes "\r\n--" + boundary[0] at W candidate
+ * positions per step and only memcmp() the rest of the delimiter at
+ * positions where all five matched. Positions too close to the end of the
+ * buffer for a full vector load are handed to the scalar scanner.
+ */
+#ifdef MULTIPART_HAVE_SSE2
+static const char* find_delimiter_sse2(const multipart_parser* p,
+                                       const char* buf, size_t len) {
+  size_t m = p->boundary_length + DELIMITER_PREFIX_LEN;
+  size_t pos = 0;
+  const __m128i v0 = _mm_set1_epi8(CR);
+  const __m128i v1 = _mm_set1_epi8(LF);
+  const __m128i v2 = _mm_set1_epi8('-');
+  const __m128i v4 = _mm_set1_epi8(p->delimiter[4]);
+  __m128i eq;
+  unsigned int mask;
+  size_t candidate;
+
+  if (p->boundary_length == 0 || len < m) {
+    return find_delimiter_scalar(p, buf, len);
   }
 
-  p->header_field_buffer_len = 0;
-  p->header_value_buffer_len = 0;
-  p->part_data_buffer_len = 0;
+  while (pos + 16 + 4 <= len) {
+    eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos)), v0);
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos + 1)), v1));
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos + 2)), v2));
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos + 3)), v2));
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos + 4)), v4));
+    mask = (unsigned int)_mm_movemask_epi8(eq);
+    while (mask != 0) {
+      candidate = pos + lowest_bit(mask);
+      if (candidate > len - m) {
+        return NULL;
+      }
+      if (delimiter_tail_matches(p, buf + candidate)) {
+        return buf + candidate;
+      }
+      mask &= mask - 1;
+    }
+    pos += 16;
+  }
 
-  p->index = 0;
-  p->state = s_start;
-  p->settings = settings;
-  p->error = MPPE_OK;  /* Initialize error state */
+  if (pos > len - m) {
+    return NULL;
+  }
+  return find_delimiter_scalar(p, buf + pos, len - pos);
+}
+#endif
 
-  return p;
+#ifdef MULTIPART_HAVE_AVX2
+__attribute__((target("avx2")))
+static const char* find_delimiter_avx2(const multipart_parser* p,
+                                       const char* buf, size_t len) {
+  size_t m = p->boundary_length + DELIMITER_PREFIX_LEN;
+  size_t pos = 0;
+  const __m256i v0 = _mm256_set1_epi8(CR);
+  const __m256i v1 = _mm256_set1_epi8(LF);
+  const __m256i v2 = _mm256_set1_epi8('-');
+  const __m256i v4 = _mm256_set1_epi8(p->delimiter[4]);
+  __m256i eq;
+  unsigned int mask;
+  size_t candidate;
+
+  if (p->boundary_length == 0 || len < m) {
+    return find_delimiter_scalar(p, buf, len);
+  }
+
+  while (pos + 32 + 4 <= len) {
+    eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + pos)), v0);
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + pos + 1)), v1));
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + pos + 2)), v2));
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + pos + 3)), v2));
+    eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + pos + 4)), v4));
+    mask = (unsigned int)_mm256_movemask_epi8(eq);
+    while (mask != 0) {
+      candidate = pos + lowest_bit(mask);
+      if (candidate > len - m) {
+        return NULL;
+      }
+      if (delimiter_tail_matches(p, buf + candidate)) {
+        return buf + candidate;
+      }
+      mask &= mask - 1;
+    }
+    pos += 32;
+  }
+
+  if (pos > len - m) {
+    return NULL;
+  }
+  return find_delimiter_sse2(p, buf + pos, len - pos);
 }
+#endif
 
-/* Helper function to flush buffered data */
-static int flush_buffer(multipart_parser* p, multipart_data_cb callback,
-                        char** buffer, size_t* buffer_len) {
-  int result = 0;
-  if (*buffer_len > 0 && callback) {
-    result = callback(p, *buffer, *buffer_len);
-    *buffer_len = 0;
+#ifdef MULTIPART_HAVE_NEON
+static const char* find_delimiter_neon(const multipart_parser* p,
+                                       const char* buf, size_t len) {
+  const unsigned char* s = (const unsigned char*)buf;
+  size_t m = p->boundary_length + DELIMITER_PREFIX_LEN;
+  size_t pos = 0;
+  const uint8x16_t v0 = vdupq_n_u8(CR);
+  const uint8x16_t v1 = vdupq_n_u8(LF);
+  const uint8x16_t v2 = vdupq_n_u8('-');
+  const uint8x16_t v4 = vdupq_n_u8((unsigned char)p->delimiter[4]);
+  uint8x16_t eq;
+  uint8x8_t nibbles;
+  unsigned int half[2];
+  unsigned int h;
+  size_t candidate;
+
+  if (p->boundary_length == 0 || len < m) {
+    return find_delimiter_scalar(p, buf, len);
+  }
+
+  while (pos + 16 + 4 <= len) {
+    eq = vceqq_u8(vld1q_u8(s + pos), v0);
+    eq = vandq_u8(eq, vceqq_u8(vld1q_u8(s + pos + 1), v1));
+    eq = vandq_u8(eq, vceqq_u8(vld1q_u8(s + pos + 2), v2));
+    eq = vandq_u8(eq, vceqq_u8(vld1q_u8(s + pos + 3), v2));
+    eq = vandq_u8(eq, vceqq_u8(vld1q_u8(s + pos + 4), v4));
+    /* Narrow to 4 bits per byte: a 64-bit mask split into two halves */
+    nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    half[0] = vget_lane_u32(vreinterpret_u32_u8(nibbles), 0);
+    half[1] = vget_lane_u32(vreinterpret_u32_u8(nibbles), 1);
+    for (h = 0; h < 2; h++) {
+      while (half[h] != 0) {
+        candidate = pos + h * 8 + (lowest_bit(half[h]) >> 2);
+        if (candidate > len - m) {
+          return NULL;
+        }
+        if (delimiter_tail_matches(p, buf + candidate)) {
+          return buf + candidate;
+        }
+        half[h] &= ~(0xFu << (lowest_bit(half[h]) & ~3u));
+      }
+    }
+    pos += 16;
+  }
+
+  if (pos > len - m) {
+    return NULL;
+  }
+  return find_delimiter_scalar(p, buf + pos, len - pos);
+}
+#endif
+
+/* Pick the widest scanner the running CPU supports */
+static find_delimiter_fn select_find_delimiter(void) {
+#ifdef MULTIPART_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return find_delimiter_avx2;
+  }
+#endif
+#if defined(MULTIPART_HAVE_SSE2)
+  return find_delimiter_sse2;
+#elif defined(MULTIPART_HAVE_NEON)
+  return find_delimiter_neon;
+#else
+  return find_delimiter_scalar;
+#endif
+}
+
+/* Lower-case names of the well-known headers, indexed by multipart_header_id */
+static const char* const header_names[MULTIPART_HEADER_ID_COUNT] = {
+  "",
+  "content-disposition",
+  "content-type",
+  "content-transfer-encoding"
+};
+
+#define ALL_HEADER_CANDIDATES \
+  ((1 << MULTIPART_HEADER_CONTENT_DISPOSITION) | \
+   (1 << MULTIPART_HEADER_CONTENT_TYPE) | \
+   (1 << MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING))
+
+/* A header name starts: every well-known name is a candidate */
+static void header_name_begin(multipart_parser* p) {
+  p->header_candidates = ALL_HEADER_CANDIDATES;
+  p->header_name_pos = 0;
+  p->header_id = MULTIPART_HEADER_OTHER;
+}
+
+/* Feed one lower-cased name byte: drop the candidates it does not match.
+ * Names are short and share the "content-" prefix, so this is a couple of
+ * compares per byte and stops for good once nothing matches. */
+static void header_name_step(multipart_parser* p, char cl) {
+  unsigned char candidates = p->header_candidates;
+  int id;
+
+  for (id = 1; id < MULTIPART_HEADER_ID_COUNT; id++) {
+    if ((candidates & (1 << id)) && header_names[id][p->header_name_pos] != cl) {
+      candidates &= (unsigned char)~(1 << id);
+    }
+  }
+  p->header_candidates = candidates;
+  p->header_name_pos++;
+}
+
+/* The name is complete: the candidate matched in full, if any */
+static void header_name_end(multipart_parser* p) {
+  int id;
+
+  p->header_id = MULTIPART_HEADER_OTHER;
+  for (id = 1; id < MULTIPART_HEADER_ID_COUNT; id++) {
+    if ((p->header_candidates & (1 << id)) &&
+        header_names[id][p->header_name_pos] == '\0') {
+      p->header_id = (unsigned char)id;
+    }
+  }
+  p->header_candidates = 0;
+}
+
+/* Start collecting the headers of a new part */
+static void headers_begin(multipart_parser* p) {
+  p->header_arena_len = 0;
+  p->header_start = 0;
+  p->header_value_start = 0;
+  p->known_headers = 0;
+  p->header_overflow = 0;
+  p->headers_truncated = 0;
+}
+
+/* Append header bytes to the arena. A header that does not fit is dropped
+ * as a whole when its value ends. */
+static void header_append(multipart_parser* p, const char* at, size_t len) {
+  if (p->header_overflow) {
+    return;
+  }
+  if (len > p->header_arena_size - p->header_arena_len) {
+    p->header_overflow = 1;
+    p->headers_truncated = 1;
+    return;
+  }
+  memcpy(p->header_arena + p->header_arena_len, at, len);
+  p->header_arena_len += len;
+}
+
+/* The field name is complete: the value starts here */
+static void header_field_done(multipart_parser* p) {
+  p->header_value_start = p->header_arena_len;
+}
+
+/* ASCII case-insensitive comparison with a lower-case name */
+static int param_name_is(const char* at, size_t len, const char* name) {
+  size_t i;
+  char c;
+  for (i = 0; i < len; i++) {
+    c = at[i];
+    if (c >= 'A' && c <= 'Z') {
+      c = (char)(c - 'A' + 'a');
+    }
+    if (name[i] == '\0' || c != name[i]) {
+      return 0;
+    }
+  }
+  return name[len] == '\0';
+}
+
+static int is_ows(char c) {
+  return c == ' ' || c == '\t';
+}
+
+/* The value is complete: remember it if the field is a known header */
+static void header_value_done(multipart_parser* p) {
+  size_t start = p->header_value_start;
+  size_t end = p->header_arena_len;
+  int known = p->header_id;
+
+  if (p->header_overflow) {
+    /* Drop the partial header */
+    p->header_arena_len = p->header_start;
+    p->header_overflow = 0;
+    return;
+  }
+
+  if (known != MULTIPART_HEADER_OTHER) {
+    while (start < end && is_ows(p->header_arena[start])) {
+      start++;
+    }
+    while (end > start && is_ows(p->header_arena[end - 1])) {
+      end--;
+    }
+    p->known_header_offset[known] = start;
+    p->known_header_length[known] = end - start;
+    p->known_headers |= (unsigned char)(1 << known);
+  }
+  p->header_start = p->header_arena_len;
+}
+
+/* Split a header value "type; param=value; ..." at its first ';': sets
+ * the type without trailing whitespace and leaves *pos at the ';' */
+static void parse_value_type(const char* v, size_t len, size_t* pos,
+                             multipart_slice* type) {
+  size_t end;
+
+  while (*pos < len && v[*pos] != ';') {
+    (*pos)++;
+  }
+  end = *pos;
+  while (end > 0 && is_ows(v[end - 1])) {
+    end--;
+  }
+  type->at = v;
+  type->length = end;
+}
+
+/* Next "; key=value" parameter after *pos, or 0 when there is none left.
+ * Quoted values are unescaped in place, which only ever shortens them, so
+ * each value may be parsed once only. */
+static int next_param(char* v, size_t len, size_t* pos,
+                      multipart_slice* key, multipart_slice* value) {
+  size_t k, key_end, val, out;
+
+  while (*pos < len) {
+    (*pos)++;  /* skip ';' */
+    while (*pos < len && is_ows(v[*pos])) {
+      (*pos)++;
+    }
+    k = *pos;
+    while (*pos < len && v[*pos] != '=' && v[*pos] != ';') {
+      (*pos)++;
+    }
+    key_end = *pos;
+    while (key_end > k && is_ows(v[key_end - 1])) {
+      key_end--;
+    }
+    if (*pos >= len || v[*pos] != '=') {
+      continue;  /* parameter without value */
+    }
+    (*pos)++;
+    while (*pos < len && is_ows(v[*pos])) {
+      (*pos)++;
+    }
+    val = *pos;
+    if (*pos < len && v[*pos] == '"') {
+      /* quoted-string: copy down over the quote and backslashes */
+      val = out = ++(*pos);
+      while (*pos < len && v[*pos] != '"') {
+        if (v[*pos] == '\\' && *pos + 1 < len) {
+          (*pos)++;
+        }
+        v[out++] = v[(*pos)++];
+      }
+      if (*pos < len) {
+        (*pos)++;  /* closing quote */
+      }
+      while (*pos < len && v[*pos] != ';') {
+        (*pos)++;
+      }
+    } else {
+      while (*pos < len && v[*pos] != ';') {
+        (*pos)++;
+      }
+      out = *pos;
+      while (out > val && is_ows(v[out - 1])) {
+        out--;
+      }
+    }
+    key->at = v + k;
+    key->length = key_end - k;
+    value->at = v + val;
+    value->length = out - val;
+    return 1;
+  }
+  return 0;
+}
+
+/* Parse Content-Disposition in place, filling disposition, name and
+ * filename */
+static void parse_disposition(char* v, size_t len, multipart_part_headers* h) {
+  size_t pos = 0;
+  multipart_slice key, value;
+
+  parse_value_type(v, len, &pos, &h->disposition);
+  while (next_param(v, len, &pos, &key, &value)) {
+    if (param_name_is(key.at, key.length, "name")) {
+      h->name = value;
+    } else if (param_name_is(key.at, key.length, "filename")) {
+      h->filename = value;
+    }
+  }
+}
+
+/* Whether the current part's Content-Type is multipart/... */
+static int part_is_multipart(const multipart_parser* p) {
+  size_t n = sizeof("multipart/") - 1;
+
+  return (p->known_headers & (1 << MULTIPART_HEADER_CONTENT_TYPE)) &&
+      p->known_header_length[MULTIPART_HEADER_CONTENT_TYPE] > n &&
+      param_name_is(p->header_arena + p->known_header_offset[MULTIPART_HEADER_CONTENT_TYPE],
+                    n, "multipart/");
+}
+
+/* Enter the multipart body of the current part: find its boundary
+ * parameter and make it the active boundary, in the next level's slot.
+ * Returns 0 if there is no usable boundary. */
+static int push_boundary(multipart_parser* p) {
+  char* v = p->header_arena + p->known_header_offset[MULTIPART_HEADER_CONTENT_TYPE];
+  size_t len = p->known_header_length[MULTIPART_HEADER_CONTENT_TYPE];
+  size_t pos = 0;
+  multipart_slice type, key, value;
+
+  parse_value_type(v, len, &pos, &type);
+  while (next_param(v, len, &pos, &key, &value)) {
+    if (param_name_is(key.at, key.length, "boundary")) {
+      if (value.length == 0 || value.length > p->boundary_capacity ||
+          memchr(value.at, '\0', value.length) != NULL) {
+        return 0;
+      }
+      p->depth++;
+      set_boundary(p, value.at, value.length);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Leave a nested body: the enclosing boundary is active again */
+static void pop_boundary(multipart_parser* p) {
+  p->depth--;
+  use_delimiter(p, p->depth);
+}
+
+/* Build the pre-parsed headers of the current part and report them */
+static int report_headers(multipart_parser* p) {
+  multipart_part_headers h;
+  char* arena = p->header_arena;
+
+  memset(&h, 0, sizeof(h));
+  if (p->known_headers & (1 << MULTIPART_HEADER_CONTENT_DISPOSITION)) {
+    parse_disposition(arena + p->known_header_offset[MULTIPART_HEADER_CONTENT_DISPOSITION],
+                      p->known_header_length[MULTIPART_HEADER_CONTENT_DISPOSITION], &h);
+  }
+  if (p->known_headers & (1 << MULTIPART_HEADER_CONTENT_TYPE)) {
+    h.content_type.at = arena + p->known_header_offset[MULTIPART_HEADER_CONTENT_TYPE];
+    h.content_type.length = p->known_header_length[MULTIPART_HEADER_CONTENT_TYPE];
+  }
+  if (p->known_headers & (1 << MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING)) {
+    h.transfer_encoding.at = arena + p->known_header_offset[MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING];
+    h.transfer_encoding.length = p->known_header_length[MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING];
+  }
+  h.truncated = p->headers_truncated;
+
+  STATS_CALLBACK(part_headers);
+  if (p->settings->on_part_headers(p, &h) != 0) {
+    p->error = MPPE_PAUSED;
+    return 1;
+  }
+  return 0;
+}
+
+/* Capacity of each level's boundary: nested boundaries share the size of
+ * the delimiter slots */
+static size_t boundary_capacity_for(size_t boundary_length, size_t max_depth) {
+  if (max_depth > 0 && boundary_length < MULTIPART_MAX_BOUNDARY_LENGTH) {
+    return MULTIPART_MAX_BOUNDARY_LENGTH;
+  }
+  return boundary_length;
+}
+
+static size_t header_arena_size_for(const multipart_parser_settings* settings) {
+  if (settings && (settings->on_part_headers || settings->max_depth > 0 ||
+                   settings->decode_transfer_encoding)) {
+    return settings->header_arena_size > 0 ?
+           settings->header_arena_size : MULTIPART_HEADER_ARENA_SIZE;
+  }
+  return 0;
+}
+
+size_t multipart_parser_sizeof(size_t boundary_length,
+                               const multipart_parser_settings* settings) {
+  size_t buffer_size = (settings && settings->buffer_size > 0) ? settings->buffer_size : 0;
+  size_t max_depth = settings ? settings->max_depth : 0;
+  size_t boundary_capacity = boundary_capacity_for(boundary_length, max_depth);
+
+  return sizeof(multipart_parser) +
+         DELIMITER_PREFIX_LEN + boundary_capacity +
+         buffer_size * 3 +                       /* 3 buffers if buffering enabled */
+         header_arena_size_for(settings) +
+         max_depth * DELIMITER_SLOT_SIZE(boundary_capacity); /* nested delimiters */
+}
+
+static void* default_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void default_release(void* ctx, void* ptr) {
+  (void)ctx;
+  free(ptr);
+}
+
+/* Lay the parser out in mem, which holds at least multipart_parser_sizeof()
+ * bytes for max(strlen(boundary), min_capacity). The allocator is left to
+ * the caller. */
+static multipart_parser* setup_parser(void* mem, const char *boundary,
+                                      const multipart_parser_settings* settings,
+                                      size_t min_capacity) {
+  size_t buffer_size;
+  size_t arena_size;
+  size_t boundary_length;
+  size_t boundary_capacity;
+  size_t max_depth;
+  multipart_parser* p = (multipart_parser*)mem;
+
+  buffer_size = (settings && settings->buffer_size > 0) ? settings->buffer_size : 0;
+  max_depth = settings ? settings->max_depth : 0;
+  arena_size = header_arena_size_for(settings);
+  boundary_length = strlen(boundary);
+  boundary_capacity = boundary_capacity_for(
+      boundary_length > min_capacity ? boundary_length : min_capacity, max_depth);
+
+  p->depth = 0;
+  set_boundary(p, boundary, boundary_length);
+  p->boundary_capacity = boundary_capacity;
+  p->find_delimiter = select_find_delimiter();
+
+  /* Initialize buffer pointers */
+  p->buffer_size = buffer_size;
+  if (buffer_size > 0) {
+    p->header_field_buffer = p->multipart_boundary + boundary_capacity + 1;
+    p->header_value_buffer = p->header_field_buffer + buffer_size;
+    p->part_data_buffer = p->header_value_buffer + buffer_size;
+  } else {
+    p->header_field_buffer = NULL;
+    p->header_value_buffer = NULL;
+    p->part_data_buffer = NULL;
+  }
+
+  p->header_field_buffer_len = 0;
+  p->header_value_buffer_len = 0;
+  p->part_data_buffer_len = 0;
+
+  /* Header arena follows the data buffers, the boundary stack the arena */
+  p->header_arena = p->multipart_boundary + boundary_capacity + 1 + buffer_size * 3;
+  p->header_arena_size = arena_size;
+  p->boundary_stack = p->header_arena + arena_size;
+  p->max_depth = max_depth;
+  p->epilogue = 0;
+  headers_begin(p);
+  header_name_begin(p);
+  p->header_candidates = 0;
+
+  p->stream_offset = 0;
+  p->span_offset = 0;
+  p->span_length = 0;
+  p->events = NULL;
+  p->event_count = 0;
+  p->event_max = 0;
+  p->part_index = NULL;
+  p->event_offset = 0;
+  p->disposition_start = 0;
+  p->disposition_state = 0;
+  p->decoding = DECODE_NONE;
+  p->crc32c = select_crc32c();
+  digest_begin(p, MULTIPART_DIGEST_NONE);
+  p->part_data_offset = NO_PART_LENGTH;
+  p->part_length = NO_PART_LENGTH;
+  p->max_part_size = settings ? settings->max_part_size : 0;
+  p->max_header_bytes = settings ? settings->max_header_bytes : 0;
+  p->max_parts = settings ? settings->max_parts : 0;
+  p->max_total_size = settings ? settings->max_total_size : 0;
+  p->part_count = 0;
+#ifdef MULTIPART_PARSER_STATS
+  memset(&p->stats, 0, sizeof(p->stats));
+  p->stats_header_start = 0;
+#endif
+
+  p->index = 0;
+  p->state = s_start;
+  p->settings = settings;
+  p->parse = select_parse(p);
+  p->error = MPPE_OK;  /* Initialize error state */
+  p->allocator.alloc = NULL;
+  p->allocator.release = NULL;
+  p->allocator.ctx = NULL;
+  p->pool_next = NULL;
+
+  return p;
+}
+
+multipart_parser* multipart_parser_init
+    (const char *boundary, const multipart_parser_settings* settings) {
+  return multipart_parser_init_ex(boundary, settings, NULL);
+}
+
+multipart_parser* multipart_parser_init_ex
+    (const char *boundary, const multipart_parser_settings* settings,
+     const multipart_parser_allocator* allocator) {
+  multipart_parser_allocator a;
+  multipart_parser* p;
+  void* mem;
+
+  if (allocator != NULL) {
+    a = *allocator;
+  } else {
+    a.alloc = default_alloc;
+    a.release = default_release;
+    a.ctx = NULL;
+  }
+
+  mem = a.alloc(a.ctx, multipart_parser_sizeof(strlen(boundary), settings));
+  if (mem == NULL) {
+    return NULL;
+  }
+
+  p = setup_parser(mem, boundary, settings, 0);
+  p->allocator = a;
+  return p;
+}
+
+multipart_parser* multipart_parser_init_in_place
+    (void* mem, size_t size, const char *boundary,
+     const multipart_parser_settings* settings) {
+  if (mem == NULL || boundary == NULL ||
+      size < multipart_parser_sizeof(strlen(boundary), settings)) {
+    return NULL;
+  }
+  /* No release hook: the memory stays the caller's */
+  return setup_parser(mem, boundary, settings, 0);
+}
+
+struct multipart_parser_pool {
+  const multipart_parser_settings* settings;
+  multipart_parser_allocator allocator;
+  multipart_parser* idle;         /* released parsers, linked by pool_next */
+  size_t idle_count;
+  size_t max_idle;
+};
+
+multipart_parser_pool* multipart_parser_pool_create
+    (const multipart_parser_settings* settings, size_t max_idle,
+     const multipart_parser_allocator* allocator) {
+  multipart_parser_allocator a;
+  multipart_parser_pool* pool;
+
+  if (allocator != NULL) {
+    a = *allocator;
+  } else {
+    a.alloc = default_alloc;
+    a.release = default_release;
+    a.ctx = NULL;
+  }
+
+  pool = (multipart_parser_pool*)a.alloc(a.ctx, sizeof(multipart_parser_pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->settings = settings;
+  pool->allocator = a;
+  pool->idle = NULL;
+  pool->idle_count = 0;
+  pool->max_idle = max_idle;
+  return pool;
+}
+
+multipart_parser* multipart_parser_pool_acquire(multipart_parser_pool* pool,
+                                                const char *boundary) {
+  multipart_parser* p;
+  void* mem;
+
+  if (pool == NULL || boundary == NULL ||
+      strlen(boundary) > MULTIPART_MAX_BOUNDARY_LENGTH) {
+    return NULL;
+  }
+
+  p = pool->idle;
+  if (p != NULL) {
+    pool->idle = p->pool_next;
+    pool->idle_count--;
+    p->pool_next = NULL;
+    /* Sized for any boundary up to the RFC limit, so this cannot fail */
+    multipart_parser_reset(p, boundary);
+  } else {
+    mem = pool->allocator.alloc(pool->allocator.ctx,
+        multipart_parser_sizeof(MULTIPART_MAX_BOUNDARY_LENGTH, pool->settings));
+    if (mem == NULL) {
+      return NULL;
+    }
+    p = setup_parser(mem, boundary, pool->settings, MULTIPART_MAX_BOUNDARY_LENGTH);
+    p->allocator = pool->allocator;
+  }
+  p->data = NULL;
+  return p;
+}
+
+void multipart_parser_pool_release(multipart_parser_pool* pool,
+                                   multipart_parser* p) {
+  if (p == NULL) {
+    return;
+  }
+  if (pool == NULL || pool->idle_count >= pool->max_idle) {
+    multipart_parser_free(p);
+    return;
+  }
+  p->pool_next = pool->idle;
+  pool->idle = p;
+  pool->idle_count++;
+}
+
+void multipart_parser_pool_destroy(multipart_parser_pool* pool) {
+  multipart_parser* p;
+
+  if (pool == NULL) {
+    return;
+  }
+  while (pool->idle != NULL) {
+    p = pool->idle;
+    pool->idle = p->pool_next;
+    multipart_parser_free(p);
+  }
+  pool->allocator.release(pool->allocator.ctx, pool);
+}
+
+/* Count a data callback made through a buffer, by its settings slot */
+#ifdef MULTIPART_PARSER_STATS
+static void stats_data_callback(multipart_parser* p, multipart_data_cb callback) {
+  if (callback == p->settings->on_header_field) {
+    STATS_CALLBACK(header_field);
+  } else if (callback == p->settings->on_header_value) {
+    STATS_CALLBACK(header_value);
+  } else {
+    STATS_CALLBACK(part_data);
+  }
+}
+#else
+#define stats_data_callback(p, callback) ((void)0)
+#endif
+
+/* Helper function to flush buffered data */
+static int flush_buffer(multipart_parser* p, multipart_data_cb callback,
+                        char** buffer, size_t* buffer_len) {
+  int result = 0;
+  if (*buffer_len > 0 && callback) {
+    stats_data_callback(p, callback);
+    result = callback(p, *buffer, *buffer_len);
+    *buffer_len = 0;
+  }
+  return result;
+}
+
+/* Call a data callback directly; returns 1 and sets MPPE_PAUSED if it
+ * asks to pause */
+static int emit_unbuffered(multipart_parser* p, multipart_data_cb callback,
+                           const char* data, size_t len) {
+  if (callback) {
+    stats_data_callback(p, callback);
+    if (callback(p, data, len) != 0) {
+      p->error = MPPE_PAUSED;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Helper function to append data to buffer or emit immediately */
+static int buffer_or_emit(multipart_parser* p, multipart_data_cb callback,
+                          char** buffer, size_t* buffer_len,
+                          const char* data, size_t len) {
+  size_t buffer_size = p->buffer_size;
+  int paused;
+
+  /* If buffering disabled or no buffer, emit immediately */
+  if (buffer_size == 0 || *buffer == NULL) {
+    return emit_unbuffered(p, callback, data, len);
+  }
+
+  /* Try to buffer the data */
+  if (*buffer_len + len <= buffer_size) {
+    /* Fits in buffer */
+    memcpy(*buffer + *buffer_len, data, len);
+    *buffer_len += len;
+    STATS_ADD(bytes_buffered, len);
+    return 0;
+  }
+
+  /* Buffer would overflow - flush current buffer and handle new data.
+   * The caller resumes past the new data, so if the flush pauses, data
+   * that fits stays buffered and longer data is still reported: the pause
+   * takes effect after it. */
+  if (*buffer_len > 0) {
+    paused = emit_unbuffered(p, callback, *buffer, *buffer_len);
+    *buffer_len = 0;
+    if (paused) {
+      if (len <= buffer_size) {
+        memcpy(*buffer, data, len);
+        *buffer_len = len;
+        STATS_ADD(bytes_buffered, len);
+      } else {
+        emit_unbuffered(p, callback, data, len);
+      }
+      p->error = MPPE_PAUSED;
+      return 1;
+    }
+  }
+
+  /* If new data fits in empty buffer, buffer it */
+  if (len <= buffer_size) {
+    memcpy(*buffer, data, len);
+    *buffer_len = len;
+    STATS_ADD(bytes_buffered, len);
+    return 0;
+  }
+
+  /* Data too large for buffer, emit directly */
+  return emit_unbuffered(p, callback, data, len);
+}
+
+/* Helper function to emit the last data of a run together with the
+ * buffer, leaving the buffer empty. A pause requested by the flush takes
+ * effect after the data that did not fit is reported too. */
+static int buffer_and_flush(multipart_parser* p, multipart_data_cb callback,
+                            char** buffer, size_t* buffer_len,
+                            const char* data, size_t len) {
+  int paused = 0;
+
+  if (*buffer_len + len <= p->buffer_size) {
+    memcpy(*buffer + *buffer_len, data, len);
+    *buffer_len += len;
+    STATS_ADD(bytes_buffered, len);
+    len = 0;
+  }
+  if (*buffer_len > 0) {
+    paused = emit_unbuffered(p, callback, *buffer, *buffer_len);
+    *buffer_len = 0;
+  }
+  if (len > 0 && emit_unbuffered(p, callback, data, len) != 0) {
+    paused = 1;
+  }
+  return paused;
+}
+
+/* Append a part data byte range to the pending span. Part data is
+ * contiguous in the body stream, so ranges only start a new span after the
+ * previous one was flushed. */
+static int report_span(multipart_parser* p, size_t offset, size_t len) {
+  size_t prev_offset = p->span_offset;
+  size_t prev_length = p->span_length;
+
+  if (prev_length > 0 && prev_offset + prev_length == offset) {
+    p->span_length += len;
+    return 0;
+  }
+  /* Start the new span first: it stays pending if the old one pauses */
+  p->span_offset = offset;
+  p->span_length = len;
+  if (prev_length > 0) {
+    STATS_CALLBACK(part_data_span);
+    if (p->settings->on_part_data_span(p, prev_offset, prev_length) != 0) {
+      p->error = MPPE_PAUSED;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Deliver the pending span, if any */
+static int flush_span(multipart_parser* p) {
+  size_t len = p->span_length;
+  if (len > 0) {
+    p->span_length = 0;
+    STATS_CALLBACK(part_data_span);
+    if (p->settings->on_part_data_span(p, p->span_offset, len) != 0) {
+      p->error = MPPE_PAUSED;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Content-Transfer-Encoding decoders (RFC 2045). Output collects in
+ * p->decode_out and goes to on_part_data, buffered if buffer_size is set.
+ * A pause requested while a run of part data is decoded takes effect after
+ * the run: the decoder state has already moved past its input, so stopping
+ * in the middle would lose the decoded rest. */
+/* decode_count once base64 padding was seen: the rest of the part is
+ * ignored */
+#define BASE64_DONE 4
+
+/* Quoted-printable decode_count: after '=', after '=' and a hex digit
+ * (kept in decode_bits), after '=' CR */
+#define QP_EQUALS 1
+#define QP_HEX 2
+#define QP_CR 3
+
+/* Decoder announced by the current part's Content-Transfer-Encoding */
+static unsigned char part_decoding(const multipart_parser* p) {
+  const char* value = p->header_arena +
+      p->known_header_offset[MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING];
+  size_t len = p->known_header_length[MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING];
+
+  if (!(p->known_headers & (1 << MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING))) {
+    return DECODE_NONE;
+  }
+  if (param_name_is(value, len, "base64")) {
+    return DECODE_BASE64;
+  }
+  if (param_name_is(value, len, "quoted-printable")) {
+    return DECODE_QUOTED_PRINTABLE;
+  }
+  return DECODE_NONE;  /* 7bit, 8bit and binary need no decoding */
+}
+
+/* Pass n decoded bytes on; returns non-zero if the callback paused */
+static int emit_decoded(multipart_parser* p, size_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  if (p->digest.type != MULTIPART_DIGEST_NONE) {
+    digest_update(p, (const unsigned char*)p->decode_out, n);
+  }
+  if (p->settings->on_part_data == NULL) {
+    return 0;
+  }
+  return buffer_or_emit(p, p->settings->on_part_data, &p->part_data_buffer,
+                        &p->part_data_buffer_len, p->decode_out, n);
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;  /* lower case is tolerated */
+  }
+  return -1;
+}
+
+/* Decode base64 into p->decode_out, stopping when DECODE_CHUNK - 3 bytes
+ * are exceeded; returns the input consumed and stores the output length */
+static size_t decode_base64(multipart_parser* p, const unsigned char* in,
+                            size_t len, size_t* out_len) {
+  unsigned char* out = (unsigned char*)p->decode_out;
+  size_t i = 0, n = 0;
+  unsigned long bits = p->decode_bits;
+  unsigned char count = p->decode_count;
+  unsigned char v;
+
+  while (i < len && n < DECODE_CHUNK - 3) {
+    if (count == BASE64_DONE) {
+      i = len;
+      break;
+    }
+    /* Whole quads between line breaks decode without state updates */
+    if (count == 0) {
+      while (i + 4 <= len && n < DECODE_CHUNK - 3 &&
+             (base64_value[in[i]] | base64_value[in[i + 1]] |
+              base64_value[in[i + 2]] | base64_value[in[i + 3]]) < 64) {
+        bits = ((unsigned long)base64_value[in[i]] << 18) |
+               ((unsigned long)base64_value[in[i + 1]] << 12) |
+               ((unsigned long)base64_value[in[i + 2]] << 6) |
+               base64_value[in[i + 3]];
+        out[n] = (unsigned char)(bits >> 16);
+        out[n + 1] = (unsigned char)(bits >> 8);
+        out[n + 2] = (unsigned char)bits;
+        n += 3;
+        i += 4;
+      }
+      if (i == len || n >= DECODE_CHUNK - 3) {
+        break;
+      }
+    }
+    v = base64_value[in[i++]];
+    if (v == BASE64_SKIP) {
+      continue;
+    }
+    if (v == BASE64_PAD) {
+      /* "xx==" and "xxx=" end the data; a stray '=' is skipped */
+      if (count == 2) {
+        out[n++] = (unsigned char)(bits >> 4);
+        count = BASE64_DONE;
+      } else if (count == 3) {
+        out[n++] = (unsigned char)(bits >> 10);
+        out[n++] = (unsigned char)(bits >> 2);
+        count = BASE64_DONE;
+      }
+      continue;
+    }
+    bits = (bits << 6) | v;
+    if (++count == 4) {
+      out[n] = (unsigned char)(bits >> 16);
+      out[n + 1] = (unsigned char)(bits >> 8);
+      out[n + 2] = (unsigned char)bits;
+      n += 3;
+      count = 0;
+      bits = 0;
+    }
+  }
+  p->decode_bits = bits;
+  p->decode_count = count;
+  *out_len = n;
+  return i;
+}
+
+/* Decode quoted-printable like decode_base64(). Soft line breaks are
+ * removed; an '=' not starting a valid escape is kept literally. */
+static size_t decode_quoted_printable(multipart_parser* p, const char* in,
+                                      size_t len, size_t* out_len) {
+  char* out = p->decode_out;
+  size_t i = 0, n = 0;
+  unsigned char count = p->decode_count;
+  const char* eq;
+  int hi, lo;
+  char c;
+
+  while (i < len && n < DECODE_CHUNK - 3) {
+    if (count == 0) {
+      /* Copy up to the next '=' */
+      size_t run = len - i < DECODE_CHUNK - 3 - n ? len - i : DECODE_CHUNK - 3 - n;
+      eq = (const char*)memchr(in + i, '=', run);
+      if (eq == NULL) {
+        memcpy(out + n, in + i, run);
+        n += run;
+        i += run;
+        continue;
+      }
+      memcpy(out + n, in + i, (size_t)(eq - (in + i)));
+      n += (size_t)(eq - (in + i));
+      i = (size_t)(eq - in) + 1;
+      count = QP_EQUALS;
+      continue;
+    }
+    c = in[i];
+    if (count == QP_EQUALS) {
+      if (c == CR) {
+        count = QP_CR;
+        i++;
+      } else if (c == LF) {
+        count = 0;  /* soft line break with a bare LF */
+        i++;
+      } else if (hex_value(c) >= 0) {
+        p->decode_bits = (unsigned long)(unsigned char)c;
+        count = QP_HEX;
+        i++;
+      } else {
+        out[n++] = '=';
+        count = 0;
+      }
+    } else if (count == QP_HEX) {
+      hi = hex_value((char)p->decode_bits);
+      lo = hex_value(c);
+      if (lo >= 0) {
+        out[n++] = (char)(hi * 16 + lo);
+        i++;
+      } else {
+        out[n++] = '=';
+        out[n++] = (char)p->decode_bits;
+      }
+      count = 0;
+    } else {
+      /* "=\r\n" is a soft line break; "=\r" without LF is kept */
+      if (c == LF) {
+        i++;
+      } else {
+        out[n++] = '=';
+        out[n++] = CR;
+      }
+      count = 0;
+    }
+  }
+  p->decode_count = count;
+  *out_len = n;
+  return i;
+}
+
+/* Decode a run of part data and pass the result on */
+static int decode_part_data(multipart_parser* p, const char* data, size_t len) {
+  size_t used, n;
+  int paused = 0;
+
+  while (len > 0) {
+    if (p->decoding == DECODE_BASE64) {
+      used = decode_base64(p, (const unsigned char*)data, len, &n);
+    } else {
+      used = decode_quoted_printable(p, data, len, &n);
+    }
+    data += used;
+    len -= used;
+    if (emit_decoded(p, n) != 0) {
+      paused = 1;
+    }
+  }
+  if (paused) {
+    p->error = MPPE_PAUSED;
+  }
+  return paused;
+}
+
+/* End of a decoded part: pass on what the decoder still holds. Unpadded
+ * base64 is accepted; a quoted-printable escape cut off by the delimiter
+ * is kept literally. */
+static int decode_finish(multipart_parser* p) {
+  size_t n = 0;
+  unsigned long bits = p->decode_bits;
+
+  if (p->decoding == DECODE_BASE64) {
+    if (p->decode_count == 2) {
+      p->decode_out[n++] = (char)(bits >> 4);
+    } else if (p->decode_count == 3) {
+      p->decode_out[n++] = (char)(bits >> 10);
+      p->decode_out[n++] = (char)(bits >> 2);
+    }
+  } else if (p->decode_count == QP_EQUALS) {
+    p->decode_out[n++] = '=';
+  } else if (p->decode_count == QP_HEX) {
+    p->decode_out[n++] = '=';
+    p->decode_out[n++] = (char)bits;
+  } else if (p->decode_count == QP_CR) {
+    p->decode_out[n++] = '=';
+    p->decode_out[n++] = CR;
+  }
+  p->decoding = DECODE_NONE;
+  if (emit_decoded(p, n) != 0) {
+    p->error = MPPE_PAUSED;
+    return 1;
+  }
+  return 0;
+}
+
+/* Flush buffered or pending part data before a part ends */
+static int flush_part_data(multipart_parser* p) {
+  if (p->decoding && decode_finish(p) != 0) {
+    return 1;
+  }
+  digest_finish(p);
+  if (flush_buffer(p, p->settings->on_part_data, &p->part_data_buffer, &p->part_data_buffer_len) != 0) {
+    p->error = MPPE_PAUSED;
+    return 1;
+  }
+  return flush_span(p);
+}
+
+/* Number of delimiter bytes matched by a pending candidate, 0 outside the
+ * s_part_data_almost_boundary .. s_part_data_boundary_hyphen2 states. The
+ * candidate's bytes are always p->delimiter[0 .. length). */
+static size_t lookbehind_length(const multipart_parser* p) {
+  switch (p->state) {
+    case s_part_data_almost_boundary:
+      return 1;
+    case s_part_data_boundary:
+    case s_part_data_boundary_hyphen2:
+      return 2 + p->index;
+    default:
+      return 0;
+  }
+}
+
+/* Part data past max_part_size is about to be reported: fail at the first
+ * byte beyond the limit, or at buf[0] if it was held from an earlier chunk */
+static size_t part_too_large(multipart_parser* p) {
+  size_t limit = p->part_data_offset + p->max_part_size;
+  p->error = MPPE_PART_TOO_LARGE;
+  return limit > p->stream_offset ? limit - p->stream_offset : 0;
+}
+
+/* The part whose delimiter starts at event_offset has ended */
+static void record_part_length(multipart_parser* p) {
+  p->part_length = p->part_data_offset == NO_PART_LENGTH ?
+                   NO_PART_LENGTH : p->event_offset - p->part_data_offset;
+}
+
+/* Enter the delimiter state that holds the first held bytes of the
+ * delimiter (0 < held < full length); the inverse of lookbehind_length() */
+static void hold_delimiter_prefix(multipart_parser* p, size_t held) {
+  if (held == 1) {
+    p->state = s_part_data_almost_boundary;
+  } else if (held < DELIMITER_PREFIX_LEN) {
+    p->state = s_part_data_boundary;
+    p->index = held - 2;
+  } else {
+    p->state = s_part_data_boundary_hyphen2;
+    p->index = held - 2;
+  }
+}
+
+void multipart_parser_free(multipart_parser* p) {
+  if (p != NULL && p->allocator.release != NULL) {
+    p->allocator.release(p->allocator.ctx, p);
+  }
+}
+
+void multipart_parser_set_data(multipart_parser *p, void *data) {
+    if (p != NULL) {
+        p->data = data;
+    }
+}
+
+void *multipart_parser_get_data(multipart_parser *p) {
+    if (p == NULL) {
+        return NULL;
+    }
+    return p->data;
+}
+
+multipart_parser_error multipart_parser_get_error(multipart_parser* p) {
+    if (p == NULL) {
+        return MPPE_UNKNOWN;
+    }
+    return p->error;
+}
+
+const char* multipart_parser_get_error_message(multipart_parser* p) {
+    if (p == NULL) {
+        return "Invalid parser pointer";
+    }
+    switch (p->error) {
+        case MPPE_OK:
+            return "No error";
+        case MPPE_PAUSED:
+            return "Parsing paused by callback";
+        case MPPE_INVALID_BOUNDARY:
+            return "Invalid boundary format";
+        case MPPE_INVALID_HEADER_FIELD:
+            return "Invalid character in header field name";
+        case MPPE_INVALID_HEADER_FORMAT:
+            return "Invalid header format";
+        case MPPE_INVALID_STATE:
+            return "Parser in invalid state";
+        case MPPE_PART_TOO_LARGE:
+            return "Part data exceeds max_part_size";
+        case MPPE_HEADERS_TOO_LARGE:
+            return "Part headers exceed max_header_bytes";
+        case MPPE_TOO_MANY_PARTS:
+            return "Body has more than max_parts parts";
+        case MPPE_BODY_TOO_LARGE:
+            return "Body exceeds max_total_size";
+        case MPPE_UNKNOWN:
+        default:
+            return "Unknown error";
+    }
+}
+
+int multipart_parser_reset(multipart_parser* p, const char *boundary) {
+    size_t new_boundary_length;
+
+    /* Validate parser pointer */
+    if (p == NULL) {
+        return -1;
+    }
+
+    if (boundary != NULL) {
+        new_boundary_length = strlen(boundary);
+
+        /* Check if new boundary fits in allocated space
+         * The original allocation has space for the delimiter of the original boundary,
+         * so we can accept any boundary up to and including the original length */
+        if (new_boundary_length > p->boundary_capacity) {
+            return -1;
+        }
+
+        /* Update boundary and rebuild the search table */
+        p->depth = 0;
+        set_boundary(p, boundary, new_boundary_length);
+    } else if (p->depth > 0) {
+        /* Stopped inside a nested body: back to the top-level boundary */
+        p->depth = 0;
+        use_delimiter(p, 0);
+    }
+    p->epilogue = 0;
+
+    /* Reset parser state */
+    p->index = 0;
+    p->state = s_start;
+    p->error = MPPE_OK;
+
+    /* Clear buffer lengths (but keep buffer pointers) */
+    p->header_field_buffer_len = 0;
+    p->header_value_buffer_len = 0;
+    p->part_data_buffer_len = 0;
+    headers_begin(p);
+    header_name_begin(p);
+    p->header_candidates = 0;
+
+    /* Restart stream offsets, dropping any span of the previous body */
+    p->stream_offset = 0;
+    p->span_offset = 0;
+    p->span_length = 0;
+    p->disposition_state = 0;
+    p->decoding = DECODE_NONE;
+    digest_begin(p, MULTIPART_DIGEST_NONE);
+    p->part_data_offset = NO_PART_LENGTH;
+    p->part_length = NO_PART_LENGTH;
+    p->part_count = 0;
+
+    /* Note: settings and data pointer are preserved */
+
+    return 0;
+}
+
+static size_t parse_chunk(multipart_parser* p, const char *buf, size_t len);
+
+size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len) {
+  size_t parsed;
+
+  /* Safety check: Validate parser pointer */
+  if (p == NULL) {
+    return 0;
+  }
+
+  parsed = p->parse(p, buf, len);
+  p->stream_offset += parsed;
+  return parsed;
+}
+
+/* Pull API: multipart_parser_execute_events() runs the parser with these
+ * callbacks. Each appends its event and pauses once the array is full, so
+ * parse_chunk() returns right after the last event with the number of
+ * bytes consumed. */
+static int pull_event(multipart_parser* p, multipart_event_type type,
+                      const char *at, size_t length) {
+  multipart_event* ev = p->events + p->event_count++;
+  ev->type = type;
+  ev->at = at;
+  ev->length = length;
+  ev->header = (type == MULTIPART_EVENT_HEADER_FIELD ||
+                type == MULTIPART_EVENT_HEADER_VALUE) ?
+               (multipart_header_id)p->header_id : MULTIPART_HEADER_OTHER;
+  ev->depth = p->depth;
+  return p->event_count == p->event_max;
+}
+
+static int pull_header_field(multipart_parser* p, const char *at, size_t length) {
+  return pull_event(p, MULTIPART_EVENT_HEADER_FIELD, at, length);
+}
+
+static int pull_header_value(multipart_parser* p, const char *at, size_t length) {
+  return pull_event(p, MULTIPART_EVENT_HEADER_VALUE, at, length);
+}
+
+static int pull_part_data(multipart_parser* p, const char *at, size_t length) {
+  return pull_event(p, MULTIPART_EVENT_DATA, at, length);
+}
+
+static int pull_part_data_begin(multipart_parser* p) {
+  return pull_event(p, MULTIPART_EVENT_PART_BEGIN, NULL, 0);
+}
+
+static int pull_headers_complete(multipart_parser* p) {
+  return pull_event(p, MULTIPART_EVENT_HEADERS_COMPLETE, NULL, 0);
+}
+
+static int pull_part_data_end(multipart_parser* p) {
+  return pull_event(p, MULTIPART_EVENT_PART_END, NULL, 0);
+}
+
+static int pull_body_end(multipart_parser* p) {
+  return pull_event(p, MULTIPART_EVENT_BODY_END, NULL, 0);
+}
+
+static const multipart_parser_settings pull_settings = {
+  pull_header_field,
+  pull_header_value,
+  pull_part_data,
+  pull_part_data_begin,
+  pull_headers_complete,
+  pull_part_data_end,
+  pull_body_end,
+  0,                              /* no buffering: events point into buf */
+  NULL                            /* no span mode */
+};
+
+size_t multipart_parser_execute_events(multipart_parser* p,
+                                       const char *buf, size_t len,
+                                       multipart_event* events,
+                                       size_t max_events, size_t* n_events) {
+  const multipart_parser_settings* settings;
+  size_t buffer_size;
+  size_t parsed;
+
+  if (n_events != NULL) {
+    *n_events = 0;
+  }
+
+  /* Safety check: Validate parser and event array */
+  if (p == NULL || events == NULL || max_events == 0) {
+    return 0;
+  }
+
+  settings = p->settings;
+  buffer_size = p->buffer_size;
+  p->settings = &pull_settings;
+  p->buffer_size = 0;
+  p->events = events;
+  p->event_count = 0;
+  p->event_max = max_events;
+  parsed = parse_chunk(p, buf, len);
+  p->settings = settings;
+  p->buffer_size = buffer_size;
+  p->events = NULL;
+  p->stream_offset += parsed;
+
+  /* A pause can only come from a full array: not an error for the caller */
+  if (p->error == MPPE_PAUSED) {
+    p->error = MPPE_OK;
+  }
+  if (n_events != NULL) {
+    *n_events = p->event_count;
+  }
+  return parsed;
+}
+
+size_t multipart_parser_next(multipart_parser* p, const char *buf, size_t len,
+                             multipart_event* event) {
+  size_t n = 0;
+  size_t parsed;
+
+  if (event == NULL) {
+    return 0;
+  }
+
+  parsed = multipart_parser_execute_events(p, buf, len, event, 1, &n);
+  if (n == 0) {
+    event->type = MULTIPART_EVENT_NONE;
+    event->at = NULL;
+    event->length = 0;
+  }
+  return parsed;
+}
+
+/* Part index: multipart_parser_execute_index() runs the parser with these
+ * callbacks. Part data has no callback at all; the boundary events record
+ * p->event_offset in the entry of the current part, which is the last
+ * entry at the current depth while its data_length is still open. */
+static multipart_index_entry* index_open_entry(multipart_parser* p) {
+  multipart_index* ix = p->part_index;
+  size_t k = ix->count;
+
+  while (k > 0) {
+    k--;
+    if (ix->entries[k].depth == p->depth) {
+      return ix->entries[k].data_length == MULTIPART_INDEX_OPEN ?
+             ix->entries + k : NULL;
+    }
+    if (ix->entries[k].depth < p->depth) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Move a parameter value, if present, down to the end of the index
+ * strings */
+static void index_keep(multipart_index* ix, const multipart_slice* s,
+                       size_t* offset, size_t* length) {
+  if (s->at == NULL) {
+    return;
+  }
+  memmove(ix->strings + ix->strings_length, s->at, s->length);
+  *offset = ix->strings_length;
+  *length = s->length;
+  ix->strings_length += s->length;
+}
+
+/* Content-Disposition copy states */
+#define DISPOSITION_NONE 0
+#define DISPOSITION_COPYING 1
+#define DISPOSITION_COPIED 2
+#define DISPOSITION_DROPPED 3
+
+static int index_part_begin(multipart_parser* p) {
+  multipart_index* ix = p->part_index;
+  multipart_index_entry* e;
+
+  p->disposition_state = DISPOSITION_NONE;
+  if (ix->count == ix->max_entries) {
+    ix->truncated = 1;
+    return 0;
+  }
+  e = ix->entries + ix->count++;
+  memset(e, 0, sizeof(multipart_index_entry));
+  e->header_offset = p->event_offset;
+  e->data_length = MULTIPART_INDEX_OPEN;
+  e->depth = p->depth;
+  /* Full: return so the caller can make room before the next part */
+  return ix->count == ix->max_entries;
+}
+
+static int index_header_field(multipart_parser* p, const char *at, size_t length) {
+  (void)at;
+  (void)length;
+  if (p->disposition_state == DISPOSITION_COPYING) {
+    p->disposition_state = DISPOSITION_COPIED;
+  } else if (p->disposition_state == DISPOSITION_DROPPED) {
+    p->disposition_state = DISPOSITION_NONE;
+  }
+  return 0;
+}
+
+static int index_header_value(multipart_parser* p, const char *at, size_t length) {
+  multipart_index* ix = p->part_index;
+
+  if (p->header_id != MULTIPART_HEADER_CONTENT_DISPOSITION) {
+    return 0;
+  }
+  if (p->disposition_state == DISPOSITION_NONE ||
+      p->disposition_state == DISPOSITION_COPIED) {
+    /* A repeated Content-Disposition replaces the earlier one */
+    if (p->disposition_state == DISPOSITION_COPIED) {
+      ix->strings_length = p->disposition_start;
+    }
+    p->disposition_start = ix->strings_length;
+    p->disposition_state = DISPOSITION_COPYING;
+  }
+  if (p->disposition_state == DISPOSITION_DROPPED) {
+    return 0;
+  }
+  if (ix->strings == NULL || length > ix->strings_size - ix->strings_length) {
+    ix->strings_length = p->disposition_start;
+    p->disposition_state = DISPOSITION_DROPPED;
+    ix->truncated = 1;
+    return 0;
+  }
+  memcpy(ix->strings + ix->strings_length, at, length);
+  ix->strings_length += length;
+  return 0;
+}
+
+static int index_headers_complete(multipart_parser* p) {
+  multipart_index* ix = p->part_index;
+  multipart_index_entry* e = index_open_entry(p);
+  multipart_part_headers h;
+
+  if (p->disposition_state == DISPOSITION_COPYING ||
+      p->disposition_state == DISPOSITION_COPIED) {
+    memset(&h, 0, sizeof(h));
+    if (e != NULL) {
+      parse_disposition(ix->strings + p->disposition_start,
+                        ix->strings_length - p->disposition_start, &h);
+    }
+    /* Keep only the parameter values; moving the earlier one first never
+     * overwrites the other */
+    ix->strings_length = p->disposition_start;
+    if (h.filename.at != NULL && (h.name.at == NULL || h.filename.at < h.name.at)) {
+      index_keep(ix, &h.filename, &e->filename_offset, &e->filename_length);
+      index_keep(ix, &h.name, &e->name_offset, &e->name_length);
+    } else if (h.name.at != NULL) {
+      index_keep(ix, &h.name, &e->name_offset, &e->name_length);
+      index_keep(ix, &h.filename, &e->filename_offset, &e->filename_length);
+    }
+    if (e != NULL) {
+      e->has_name = h.name.at != NULL;
+      e->has_filename = h.filename.at != NULL;
+    }
+  }
+  p->disposition_state = DISPOSITION_NONE;
+
+  if (e != NULL) {
+    e->data_offset = p->event_offset;
+    e->header_length = e->data_offset - e->header_offset;
+  }
+  return 0;
+}
+
+static int index_part_end(multipart_parser* p) {
+  multipart_index_entry* e = index_open_entry(p);
+
+  if (e != NULL) {
+    e->data_length = p->event_offset - e->data_offset;
+  }
+  return 0;
+}
+
+static const multipart_parser_settings index_settings = {
+  index_header_field,
+  index_header_value,
+  NULL,                           /* part data is skipped */
+  index_part_begin,
+  index_headers_complete,
+  index_part_end,
+  NULL,
+  0,
+  NULL
+};
+
+size_t multipart_parser_execute_index(multipart_parser* p,
+                                      const char *buf, size_t len,
+                                      multipart_index* index) {
+  const multipart_parser_settings* settings;
+  size_t buffer_size;
+  size_t parsed;
+
+  /* Safety check: Validate parser and index */
+  if (p == NULL || index == NULL || index->entries == NULL ||
+      index->max_entries == 0) {
+    return 0;
   }
-  return result;
+
+  settings = p->settings;
+  buffer_size = p->buffer_size;
+  p->settings = &index_settings;
+  p->buffer_size = 0;
+  p->part_index = index;
+  parsed = parse_chunk(p, buf, len);
+  p->settings = settings;
+  p->buffer_size = buffer_size;
+  p->part_index = NULL;
+  p->stream_offset += parsed;
+
+  /* A pause can only come from a full array: not an error for the caller */
+  if (p->error == MPPE_PAUSED) {
+    p->error = MPPE_OK;
+  }
+  return parsed;
 }
 
-/* Helper function to append data to buffer or emit immediately */
-static int buffer_or_emit(multipart_parser* p, multipart_data_cb callback,
-                          char** buffer, size_t* buffer_len,
-                          const char* data, size_t len) {
-  size_t buffer_size = p->settings->buffer_size;
+const multipart_index_entry* multipart_index_find(const multipart_index* index,
+                                                  const char *name) {
+  size_t k;
+  size_t len;
 
-  /* If buffering disabled or no buffer, emit immediately */
-  if (buffer_size == 0 || *buffer == NULL) {
-    if (callback && callback(p, data, len) != 0) {
-      p->error = MPPE_PAUSED;
-      return 1;
+  if (index == NULL || name == NULL) {
+    return NULL;
+  }
+  len = strlen(name);
+  for (k = 0; k < index->count; k++) {
+    if (index->entries[k].has_name && index->entries[k].name_length == len &&
+        memcmp(index->strings + index->entries[k].name_offset, name, len) == 0) {
+      return index->entries + k;
     }
-    return 0;
   }
+  return NULL;
+}
 
-  /* Try to buffer the data */
-  if (*buffer_len + len <= buffer_size) {
-    /* Fits in buffer */
-    memcpy(*buffer + *buffer_len, data, len);
-    *buffer_len += len;
+size_t multipart_parser_find_delimiters(const multipart_parser* p,
+                                        const char *buf, size_t len,
+                                        size_t from, size_t to,
+                                        size_t* offsets, size_t max_offsets) {
+  size_t m;
+  size_t count = 0;
+  size_t pos;
+  size_t limit;
+  const char *hit;
+
+  if (p == NULL || buf == NULL || offsets == NULL) {
     return 0;
   }
+  if (to > len) {
+    to = len;
+  }
+  m = p->boundary_length + DELIMITER_PREFIX_LEN;
 
-  /* Buffer would overflow - flush current buffer and handle new data */
-  if (*buffer_len > 0) {
-    if (callback && callback(p, *buffer, *buffer_len) != 0) {
-      p->error = MPPE_PAUSED;
-      return 1;
+  /* The delimiter that opens a body without preamble has no CRLF */
+  if (from == 0 && to > 0 && max_offsets > 0 && len >= m - 2 &&
+      memcmp(buf, p->delimiter + 2, m - 2) == 0) {
+    offsets[count++] = 0;
+  }
+  if (to < 2 || from >= to) {
+    return count;
+  }
+
+  /* Search for the CR of every "\r\n--boundary" whose boundary line
+   * starts in [from, to); the delimiter may extend past to */
+  pos = from >= 2 ? from - 2 : 0;
+  limit = to - 2 + m - 1;
+  if (limit > len) {
+    limit = len;
+  }
+  while (count < max_offsets && pos < limit) {
+    hit = p->find_delimiter(p, buf + pos, limit - pos);
+    if (hit == NULL) {
+      break;
     }
-    *buffer_len = 0;
+    pos = (size_t)(hit - buf);
+    offsets[count++] = pos + 2;
+    pos++;
   }
+  return count;
+}
 
-  /* If new data fits in empty buffer, buffer it */
-  if (len <= buffer_size) {
-    memcpy(*buffer, data, len);
-    *buffer_len = len;
+size_t multipart_parser_pending_offset(multipart_parser* p) {
+  if (p == NULL) {
     return 0;
   }
+  if (p->span_length > 0) {
+    return p->span_offset;
+  }
+  return p->stream_offset - lookbehind_length(p);
+}
 
-  /* Data too large for buffer, emit directly */
-  if (callback && callback(p, data, len) != 0) {
-    p->error = MPPE_PAUSED;
-    return 1;
+size_t multipart_parser_get_offset(multipart_parser* p) {
+  if (p == NULL) {
+    return 0;
   }
-  return 0;
+  return p->stream_offset;
 }
 
-void multipart_parser_free(multipart_parser* p) {
-  /* Note: free(NULL) is safe per C standard */
-  free(p);
+/* Snapshots: "MPS" and a version number, then the parse state as unsigned
+ * LEB128 numbers and length-prefixed byte strings, so the format does not
+ * depend on the size or byte order of the machine's integers */
+#define SNAPSHOT_MAGIC "MPS"
+#define SNAPSHOT_MAGIC_LEN 3
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+  unsigned char* at;              /* NULL to only count */
+  size_t size;
+  size_t len;                     /* bytes of the snapshot so far */
+} snapshot_writer;
+
+typedef struct {
+  const unsigned char* at;
+  size_t len;                     /* bytes left */
+  int failed;
+} snapshot_reader;
+
+static void snapshot_put_raw(snapshot_writer* w, const void* at, size_t n) {
+  if (w->at != NULL && n > 0 && w->size >= w->len && w->size - w->len >= n) {
+    memcpy(w->at + w->len, at, n);
+  }
+  w->len += n;
 }
 
-void multipart_parser_set_data(multipart_parser *p, void *data) {
-    if (p != NULL) {
-        p->data = data;
+static void snapshot_put(snapshot_writer* w, size_t value) {
+  unsigned char c;
+
+  do {
+    c = (unsigned char)(value & 0x7f);
+    value >>= 7;
+    if (value != 0) {
+      c |= 0x80;
     }
+    snapshot_put_raw(w, &c, 1);
+  } while (value != 0);
 }
 
-void *multipart_parser_get_data(multipart_parser *p) {
-    if (p == NULL) {
-        return NULL;
-    }
-    return p->data;
+static void snapshot_put_bytes(snapshot_writer* w, const char* at, size_t n) {
+  snapshot_put(w, n);
+  snapshot_put_raw(w, at, n);
 }
 
-multipart_parser_error multipart_parser_get_error(multipart_parser* p) {
-    if (p == NULL) {
-        return MPPE_UNKNOWN;
+/* Read a number; values above max fail the snapshot */
+static size_t snapshot_get(snapshot_reader* r, size_t max) {
+  size_t value = 0;
+  size_t bits;
+  unsigned shift = 0;
+  unsigned char c;
+
+  do {
+    if (r->len == 0 || shift >= sizeof(size_t) * 8) {
+      r->failed = 1;
+      return 0;
     }
-    return p->error;
+    c = *r->at++;
+    r->len--;
+    bits = (size_t)(c & 0x7f);
+    if (((bits << shift) >> shift) != bits) {
+      r->failed = 1;              /* does not fit in a size_t here */
+      return 0;
+    }
+    value |= bits << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  if (value > max) {
+    r->failed = 1;
+    return 0;
+  }
+  return value;
 }
 
-const char* multipart_parser_get_error_message(multipart_parser* p) {
-    if (p == NULL) {
-        return "Invalid parser pointer";
+/* Read a byte string of at most max bytes; *n receives its length */
+static const char* snapshot_get_bytes(snapshot_reader* r, size_t max,
+                                      size_t* n) {
+  const char* at;
+
+  *n = snapshot_get(r, max);
+  if (r->failed || *n > r->len) {
+    r->failed = 1;
+    *n = 0;
+    return NULL;
+  }
+  at = (const char*)r->at;
+  r->at += *n;
+  r->len -= *n;
+  return at;
+}
+
+/* A boundary saved on the stack is read back with strlen() */
+static const char* snapshot_get_boundary(snapshot_reader* r, size_t max,
+                                         size_t* n) {
+  const char* at = snapshot_get_bytes(r, max, n);
+
+  if (at != NULL && memchr(at, '\0', *n) != NULL) {
+    r->failed = 1;
+  }
+  return at;
+}
+
+static void snapshot_save(const multipart_parser* p, snapshot_writer* w) {
+  const digest_state* d = &p->digest;
+  const char* slot;
+  size_t k;
+
+  snapshot_put_raw(w, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+  snapshot_put(w, SNAPSHOT_VERSION);
+  snapshot_put(w, p->state);
+  snapshot_put(w, (size_t)p->error);
+  snapshot_put(w, p->index);
+
+  /* Active boundary, then the enclosing ones */
+  snapshot_put_bytes(w, p->multipart_boundary, p->boundary_length);
+  snapshot_put(w, p->depth);
+  for (k = 0; k < p->depth; k++) {
+    slot = delimiter_slot((multipart_parser*)p, k) + DELIMITER_PREFIX_LEN;
+    snapshot_put_bytes(w, slot, strlen(slot));
+  }
+  snapshot_put(w, p->epilogue);
+
+  snapshot_put(w, p->stream_offset);
+  snapshot_put(w, p->span_offset);
+  snapshot_put(w, p->span_length);
+  snapshot_put_bytes(w, p->header_field_buffer, p->header_field_buffer_len);
+  snapshot_put_bytes(w, p->header_value_buffer, p->header_value_buffer_len);
+  snapshot_put_bytes(w, p->part_data_buffer, p->part_data_buffer_len);
+
+  /* Header accumulation and name recognition */
+  snapshot_put_bytes(w, p->header_arena, p->header_arena_len);
+  snapshot_put(w, p->header_start);
+  snapshot_put(w, p->header_value_start);
+  snapshot_put(w, p->known_headers);
+  for (k = 0; k < MULTIPART_HEADER_ID_COUNT; k++) {
+    if (p->known_headers & (1 << k)) {
+      snapshot_put(w, p->known_header_offset[k]);
+      snapshot_put(w, p->known_header_length[k]);
     }
-    switch (p->error) {
-        case MPPE_OK:
-            return "No error";
-        case MPPE_PAUSED:
-            return "Parsing paused by callback";
-        case MPPE_INVALID_BOUNDARY:
-            return "Invalid boundary format";
-        case MPPE_INVALID_HEADER_FIELD:
-            return "Invalid character in header field name";
-        case MPPE_INVALID_HEADER_FORMAT:
-            return "Invalid header format";
-        case MPPE_INVALID_STATE:
-            return "Parser in invalid state";
-        case MPPE_UNKNOWN:
-        default:
-            return "Unknown error";
+  }
+  snapshot_put(w, p->header_overflow);
+  snapshot_put(w, p->headers_truncated);
+  snapshot_put(w, p->header_candidates);
+  snapshot_put(w, p->header_name_pos);
+  snapshot_put(w, p->header_id);
+
+  snapshot_put(w, p->event_offset);
+  snapshot_put(w, p->disposition_start);
+  snapshot_put(w, p->disposition_state);
+  /* The decoder state is set when a part's decoding begins. Of the base64
+   * bits only the pending sextets are used, so only they are saved. */
+  snapshot_put(w, p->decoding);
+  if (p->decoding == DECODE_BASE64) {
+    k = p->decode_count < 3 ? p->decode_count : 3;
+    snapshot_put(w, p->decode_count);
+    snapshot_put(w, (size_t)(p->decode_bits & ((1UL << (6 * k)) - 1)));
+  } else if (p->decoding != DECODE_NONE) {
+    snapshot_put(w, p->decode_count);
+    snapshot_put(w, (size_t)p->decode_bits);
+  }
+
+  /* Digest: the running state of the part's type, and the last result */
+  snapshot_put(w, d->type);
+  if (d->type == MULTIPART_DIGEST_CRC32C) {
+    snapshot_put(w, (size_t)d->crc);
+  } else if (d->type == MULTIPART_DIGEST_SHA256) {
+    for (k = 0; k < 8; k++) {
+      snapshot_put(w, (size_t)d->h[k]);
     }
+    snapshot_put(w, (size_t)d->bytes_low);
+    snapshot_put(w, (size_t)d->bytes_high);
+    snapshot_put_bytes(w, (const char*)d->block, d->block_len);
+  }
+  snapshot_put_bytes(w, (const char*)d->result, d->size);
+
+  /* NO_PART_LENGTH is stored as 0 */
+  snapshot_put(w, p->part_data_offset + 1);
+  snapshot_put(w, p->part_length + 1);
+  snapshot_put(w, p->part_count);
 }
 
-int multipart_parser_reset(multipart_parser* p, const char *boundary) {
-    size_t new_boundary_length;
+/* Read a snapshot, checking that it fits p; with apply set, store it in p.
+ * Run once without apply first, so a rejected snapshot changes nothing. */
+#define SNAPSHOT_GET(field, type, max)                                 \
+do {                                                                   \
+  v = snapshot_get(&r, (max));                                         \
+  if (apply) {                                                         \
+    (field) = (type)v;                                                 \
+  }                                                                    \
+} while (0)
 
-    /* Validate parser pointer */
-    if (p == NULL) {
-        return -1;
-    }
+#define SNAPSHOT_GET_BYTES(dst, field, max)                            \
+do {                                                                   \
+  at = snapshot_get_bytes(&r, (max), &n);                              \
+  if (apply) {                                                         \
+    if (n > 0) {                                                       \
+      memcpy((dst), at, n);                                            \
+    }                                                                  \
+    (field) = n;                                                       \
+  }                                                                    \
+} while (0)
 
-    if (boundary != NULL) {
-        new_boundary_length = strlen(boundary);
+static int snapshot_load(multipart_parser* p, snapshot_reader r, int apply) {
+  digest_state* d = &p->digest;
+  size_t cap = p->boundary_capacity;
+  const char *at, *active;
+  size_t n, k, v, index, arena_len, active_len, offset;
+  unsigned char known, state;
 
-        /* Check if new boundary fits in allocated space
-         * The original allocation has space for the boundary plus lookbehind (boundary_length + 8)
-         * So we can accept any boundary up to and including the original length */
-        if (new_boundary_length > p->boundary_length) {
-            return -1;
-        }
+  if (r.len < SNAPSHOT_MAGIC_LEN ||
+      memcmp(r.at, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0) {
+    return -1;
+  }
+  r.at += SNAPSHOT_MAGIC_LEN;
+  r.len -= SNAPSHOT_MAGIC_LEN;
+  if (snapshot_get(&r, SNAPSHOT_VERSION) != SNAPSHOT_VERSION) {
+    return -1;
+  }
 
-        /* Update boundary */
-        strcpy(p->multipart_boundary, boundary);
-        p->boundary_length = new_boundary_length;
+  SNAPSHOT_GET(p->state, unsigned char, s_end);
+  r.failed |= (v < s_start);
+  state = (unsigned char)v;
+  SNAPSHOT_GET(p->error, multipart_parser_error, MPPE_UNKNOWN);
+  index = snapshot_get(&r, (size_t)-1);
+
+  /* Active boundary, then the enclosing ones */
+  active = snapshot_get_boundary(&r, cap, &active_len);
+  r.failed |= (index > active_len + DELIMITER_PREFIX_LEN);
+  SNAPSHOT_GET(p->depth, size_t, p->max_depth);
+  /* Entering a nested body needs a free level, leaving one a saved one */
+  r.failed |= (state == s_nested_start && v >= p->max_depth) ||
+              (state == s_nested_end && v == 0);
+  for (k = 0; k < v && !r.failed; k++) {
+    at = snapshot_get_boundary(&r, cap, &n);
+    if (apply) {
+      write_delimiter(p, k, at, n);
+    }
+  }
+  if (apply) {
+    set_boundary(p, active, active_len);
+    p->index = index;
+  }
+  SNAPSHOT_GET(p->epilogue, unsigned char, 1);
+
+  /* Parsing stops at max_total_size, so only the end state is past it */
+  SNAPSHOT_GET(p->stream_offset, size_t, (size_t)-1);
+  offset = v;
+  r.failed |= (p->max_total_size && state != s_end &&
+               offset > p->max_total_size);
+  SNAPSHOT_GET(p->span_offset, size_t, (size_t)-1);
+  SNAPSHOT_GET(p->span_length, size_t, (size_t)-1);
+  SNAPSHOT_GET_BYTES(p->header_field_buffer, p->header_field_buffer_len,
+                     p->buffer_size);
+  SNAPSHOT_GET_BYTES(p->header_value_buffer, p->header_value_buffer_len,
+                     p->buffer_size);
+  SNAPSHOT_GET_BYTES(p->part_data_buffer, p->part_data_buffer_len,
+                     p->buffer_size);
+
+  /* Header accumulation and name recognition; offsets stay in the arena */
+  SNAPSHOT_GET_BYTES(p->header_arena, p->header_arena_len,
+                     p->header_arena_size);
+  arena_len = n;
+  SNAPSHOT_GET(p->header_start, size_t, arena_len);
+  SNAPSHOT_GET(p->header_value_start, size_t, arena_len);
+  SNAPSHOT_GET(p->known_headers, unsigned char, ALL_HEADER_CANDIDATES);
+  known = (unsigned char)v;
+  /* The nested boundary comes from the Content-Type of the part */
+  r.failed |= (state == s_nested_start &&
+               !(known & (1 << MULTIPART_HEADER_CONTENT_TYPE)));
+  for (k = 0; k < MULTIPART_HEADER_ID_COUNT; k++) {
+    if (known & (1 << k)) {
+      SNAPSHOT_GET(p->known_header_offset[k], size_t, arena_len);
+      SNAPSHOT_GET(p->known_header_length[k], size_t, arena_len - v);
     }
+  }
+  SNAPSHOT_GET(p->header_overflow, unsigned char, 1);
+  SNAPSHOT_GET(p->headers_truncated, unsigned char, 1);
+  SNAPSHOT_GET(p->header_candidates, unsigned char, ALL_HEADER_CANDIDATES);
+  known = (unsigned char)v;
+  /* A name still matching a candidate is no longer than the candidate */
+  SNAPSHOT_GET(p->header_name_pos, unsigned char, 255);
+  for (k = 1; k < MULTIPART_HEADER_ID_COUNT; k++) {
+    r.failed |= ((known & (1 << k)) && v > strlen(header_names[k]));
+  }
+  SNAPSHOT_GET(p->header_id, unsigned char, MULTIPART_HEADER_ID_COUNT - 1);
+
+  SNAPSHOT_GET(p->event_offset, size_t, offset);
+  SNAPSHOT_GET(p->disposition_start, size_t, arena_len);
+  SNAPSHOT_GET(p->disposition_state, unsigned char, DISPOSITION_DROPPED);
+  SNAPSHOT_GET(p->decoding, unsigned char, DECODE_QUOTED_PRINTABLE);
+  r.failed |= (v != DECODE_NONE && !p->settings->decode_transfer_encoding);
+  if (v == DECODE_BASE64) {
+    /* Up to three sextets are pending, none once padding was seen */
+    SNAPSHOT_GET(p->decode_count, unsigned char, BASE64_DONE);
+    k = v < 3 ? v : 3;
+    SNAPSHOT_GET(p->decode_bits, unsigned long, (1UL << (6 * k)) - 1);
+  } else if (v == DECODE_QUOTED_PRINTABLE) {
+    /* After '=' and a hex digit, decode_bits holds the digit */
+    SNAPSHOT_GET(p->decode_count, unsigned char, QP_CR);
+    k = v;
+    SNAPSHOT_GET(p->decode_bits, unsigned long, 255);
+    r.failed |= (k == QP_HEX && hex_value((char)v) < 0);
+  }
 
-    /* Reset parser state */
-    p->index = 0;
-    p->state = s_start;
-    p->error = MPPE_OK;
+  /* Digest */
+  SNAPSHOT_GET(d->type, unsigned char, MULTIPART_DIGEST_SHA256);
+  if (v == MULTIPART_DIGEST_CRC32C) {
+    SNAPSHOT_GET(d->crc, unsigned long, 0xffffffffUL);
+  } else if (v == MULTIPART_DIGEST_SHA256) {
+    for (k = 0; k < 8; k++) {
+      SNAPSHOT_GET(d->h[k], unsigned long, 0xffffffffUL);
+    }
+    SNAPSHOT_GET(d->bytes_low, unsigned long, (size_t)-1);
+    SNAPSHOT_GET(d->bytes_high, unsigned long, (size_t)-1);
+    SNAPSHOT_GET_BYTES(d->block, d->block_len, sizeof(d->block) - 1);
+  }
+  SNAPSHOT_GET_BYTES(d->result, d->size, MULTIPART_DIGEST_MAX_SIZE);
 
-    /* Clear buffer lengths (but keep buffer pointers) */
-    p->header_field_buffer_len = 0;
-    p->header_value_buffer_len = 0;
-    p->part_data_buffer_len = 0;
+  /* Stored plus one; the part data began no later than the stream offset */
+  SNAPSHOT_GET(p->part_data_offset, size_t, (size_t)-1);
+  r.failed |= (v != 0 && v - 1 > offset);
+  if (apply) {
+    p->part_data_offset--;        /* NO_PART_LENGTH was stored as 0 */
+  }
+  SNAPSHOT_GET(p->part_length, size_t, (size_t)-1);
+  if (apply) {
+    p->part_length--;
+  }
+  SNAPSHOT_GET(p->part_count, size_t, (size_t)-1);
 
-    /* Note: settings and data pointer are preserved */
+  return r.failed || r.len != 0 ? -1 : 0;
+}
+
+size_t multipart_parser_snapshot(multipart_parser* p, void* buf, size_t size) {
+  snapshot_writer w;
 
+  if (p == NULL) {
     return 0;
+  }
+  w.at = (unsigned char*)buf;
+  w.size = buf != NULL ? size : 0;
+  w.len = 0;
+  snapshot_save(p, &w);
+  return w.len;
 }
 
-size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len) {
-  size_t i = 0;
-  size_t mark = 0;
-  char c, cl;
-  int is_last = 0;
+int multipart_parser_restore(multipart_parser* p, const void* buf, size_t len) {
+  snapshot_reader r;
 
-  /* Safety check: Validate parser pointer */
+  if (p == NULL || buf == NULL) {
+    return -1;
+  }
+  r.at = (const unsigned char*)buf;
+  r.len = len;
+  r.failed = 0;
+  if (snapshot_load(p, r, 0) != 0) {
+    return -1;
+  }
+  return snapshot_load(p, r, 1);
+}
+
+multipart_header_id multipart_parser_get_header_id(multipart_parser* p) {
   if (p == NULL) {
+    return MULTIPART_HEADER_OTHER;
+  }
+  return (multipart_header_id)p->header_id;
+}
+
+size_t multipart_parser_get_depth(multipart_parser* p) {
+  if (p == NULL) {
+    return 0;
+  }
+  return p->depth;
+}
+
+size_t multipart_parser_get_digest(multipart_parser* p, unsigned char* out) {
+  if (p == NULL || out == NULL) {
     return 0;
   }
+  memcpy(out, p->digest.result, p->digest.size);
+  return p->digest.size;
+}
+
+int multipart_parser_get_part_length(multipart_parser* p, size_t* length) {
+  if (p == NULL || length == NULL || p->part_length == NO_PART_LENGTH) {
+    return -1;
+  }
+  *length = p->part_length;
+  return 0;
+}
+
+int multipart_parser_get_stats(multipart_parser* p, multipart_parser_stats* stats) {
+#ifdef MULTIPART_PARSER_STATS
+  if (p == NULL || stats == NULL) {
+    return -1;
+  }
+  *stats = p->stats;
+  return 0;
+#else
+  (void)p;
+  (void)stats;
+  return -1;
+#endif
+}
+
+const char* multipart_parser_stats_state_name(size_t state) {
+  static const char* const names[MULTIPART_STATS_STATES] = {
+    NULL,
+    "uninitialized",
+    "start",
+    "start_boundary",
+    "start_boundary_hyphen2",
+    "header_field_start",
+    "header_field",
+    "headers_almost_done",
+    "header_value",
+    "header_value_almost_done",
+    "part_data_start",
+    "part_data",
+    "part_data_almost_boundary",
+    "part_data_boundary",
+    "part_data_boundary_hyphen2",
+    "part_data_almost_end",
+    "part_data_end",
+    "part_data_final_hyphen",
+    "nested_start",
+    "nested_end",
+    "end"
+  };
+  return state < MULTIPART_STATS_STATES ? names[state] : NULL;
+}
+
+/* Inlined into each variant below, which folds the variant tests. Plain
+ * C89 compilers get one function testing the flags at run time. */
+#if defined(__GNUC__)
+#define MULTIPART_ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#else
+#define MULTIPART_ALWAYS_INLINE
+#endif
+
+static MULTIPART_ALWAYS_INLINE size_t parse_chunk_variant(multipart_parser* p,
+                                                          const char *buf,
+                                                          size_t len,
+                                                          const unsigned int variant) {
+  size_t i = 0;
+  size_t mark = 0;
+  char c;
+  /* Set while a delimiter candidate holds bytes of an earlier chunk */
+  int replay = lookbehind_length(p) > 0;
+  /* Length of the chunk when max_total_size cut len short, else 0 */
+  size_t full_len = 0;
+#ifdef MULTIPART_PARSER_STATS
+  size_t stats_start;
+  unsigned char stats_state;
+#endif
 
   /* Safety check: Validate buffer pointer if len > 0 */
   if (len > 0 && buf == NULL) {
@@ -303,13 +3026,77 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
     return 0;
   }
 
+  /* A limit once exceeded stays exceeded */
+  if (p->error >= MPPE_PART_TOO_LARGE && p->error <= MPPE_BODY_TOO_LARGE) {
+    return 0;
+  }
+
   /* Reset error state at start of parsing */
   p->error = MPPE_OK;
 
+  /* Parse no further than max_total_size; what follows is an error unless
+   * the body ends by then */
+  if (p->max_total_size && p->state != s_end &&
+      len > p->max_total_size - p->stream_offset) {
+    full_len = len;
+    len = p->max_total_size - p->stream_offset;
+  }
+
+  /* The previous chunk ended inside a delimiter candidate: compare the rest
+   * of the delimiter with the start of this chunk at once rather than
+   * stepping through the boundary states byte by byte */
+  if (replay && len > 0) {
+    size_t held = lookbehind_length(p);
+    size_t rest = p->boundary_length + DELIMITER_PREFIX_LEN - held;
+    const char *expect = p->delimiter + held;
+
+    if (memcmp(buf, expect, rest < len ? rest : len) != 0) {
+      while (buf[i] == expect[i]) {
+        i++;
+      }
+      /* buf[i] is part data or begins a new candidate */
+      p->state = s_part_data;
+      REPLAY_LOOKBEHIND(held + i);
+    } else if (rest > len) {
+      /* Still a candidate: all of the chunk belongs to it */
+      hold_delimiter_prefix(p, held + len);
+      i = len;
+    } else {
+      /* As in s_part_data_boundary_hyphen2, a pause before part_data_end
+       * leaves the last delimiter byte unconsumed */
+      hold_delimiter_prefix(p, held + rest - 1);
+      if (flush_part_data(p) != 0) {
+        return rest - 1;
+      }
+      replay = 0;
+      p->index = p->boundary_length + 2;
+      p->state = s_part_data_almost_end;
+      p->event_offset = p->stream_offset + rest -
+                        (p->boundary_length + DELIMITER_PREFIX_LEN);
+      record_part_length(p);
+      i = rest;
+      NOTIFY_CB(part_data_end, rest);
+    }
+    STATS_ADD(state_bytes[s_part_data_boundary_hyphen2], i);
+  }
+
   while(i < len) {
     c = buf[i];
-    is_last = (i == (len - 1));
+#ifdef MULTIPART_PARSER_STATS
+    stats_start = i;
+    stats_state = p->state;
+#endif
     switch (p->state) {
+      case s_nested_start:
+        multipart_log("s_nested_start");
+        if (!push_boundary(p)) {
+          /* No usable boundary: the part is plain data after all */
+          mark = i;
+          p->state = s_part_data;
+          continue;
+        }
+
+      /* fallthrough */
       case s_start:
         multipart_log("s_start");
         p->index = 0;
@@ -361,9 +3148,12 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
           if (c != LF) {
             return i;
           }
+          COUNT_PART();
           p->index = 0;
-          NOTIFY_CB(part_data_begin);
           p->state = s_header_field_start;
+          headers_begin(p);
+          p->event_offset = p->stream_offset + i + 1;
+          NOTIFY_CB(part_data_begin, i + 1);
           break;
         }
         if (c != p->multipart_boundary[p->index - 2]) {
@@ -380,33 +3170,58 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
 
       case s_header_field_start:
         multipart_log("s_header_field_start");
+        STATS_HEADER_BEGIN(p->stream_offset + i);
         mark = i;
         p->state = s_header_field;
+        header_name_begin(p);
 
       /* fallthrough */
       case s_header_field:
         multipart_log("s_header_field");
-        if (c == CR) {
-          p->state = s_headers_almost_done;
-          break;
+        /* Optimization: consume the run of name bytes in one step. Only the
+         * first bytes feed the header-name matcher, which gives up early. */
+        {
+          size_t j = i;
+          while (j < len && (CHAR_CLASS(buf[j]) & CC_NAME)) {
+            if (p->header_candidates) {
+              header_name_step(p, (char)(buf[j] | 0x20));
+            }
+            j++;
+          }
+          CHECK_HEADER_BYTES(j);
+          if (j == len) {
+            i = len - 1;
+            if ((variant & VARIANT_HEADERS) && p->header_arena_size) {
+              header_append(p, buf + mark, len - mark);
+            }
+            EMIT_HEADER_CB(header_field, buf + mark, len - mark, len);
+            break;
+          }
+          i = j;
+          c = buf[i];
         }
 
-        if (c == ':') {
-          EMIT_DATA_CB(header_field, buf + mark, i - mark);
-          /* Optimization: Skip intermediate s_header_value_start state */
-          mark = i + 1;  /* Mark start after colon */
-          p->state = s_header_value;
+        if (c == CR) {
+          p->state = s_headers_almost_done;
           break;
         }
 
-        cl = tolower(c);
-        if ((c != '-') && (cl < 'a' || cl > 'z')) {
+        if (c != ':') {
           multipart_log("invalid character in header name");
           p->error = MPPE_INVALID_HEADER_FIELD;
           return i;
         }
-        if (is_last)
-            EMIT_DATA_CB(header_field, buf + mark, (i - mark) + 1);
+
+        header_name_end(p);
+        /* Optimization: Skip intermediate s_header_value_start state */
+        p->state = s_header_value;
+        p->index = 0;  /* no value byte seen yet */
+        if ((variant & VARIANT_HEADERS) && p->header_arena_size) {
+          header_append(p, buf + mark, i - mark);
+          header_field_done(p);
+        }
+        EMIT_HEADER_DONE(header_field, buf + mark, i - mark, i + 1);
+        mark = i + 1;  /* Mark start after colon */
         break;
 
       case s_headers_almost_done:
@@ -415,27 +3230,45 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
           p->error = MPPE_INVALID_HEADER_FORMAT;
           return i;
         }
+        CHECK_HEADER_BYTES(i + 1);
 
         p->state = s_part_data_start;
+        p->index = 0;  /* part headers not reported yet */
         break;
 
       case s_header_value:
         multipart_log("s_header_value");
-        /* Optimization: Handle leading space inline (was s_header_value_start) */
-        while (mark < len && buf[mark] == ' ') {
-          mark++;  /* Skip leading spaces */
+        /* Optimization: Handle leading whitespace inline (was
+         * s_header_value_start). Only whitespace in front of the value is
+         * skipped, not that at the start of a later chunk. */
+        if (p->index == 0) {
+          if (CHAR_CLASS(c) & CC_OWS) {
+            mark = i + 1;
+            break;
+          }
+          p->index = 1;
         }
-        if (mark > i) {
-          /* All consumed were spaces, continue to next iteration */
-          break;
+        /* Optimization: the rest of the line is value, jump to its CR */
+        {
+          const char *cr_pos = (const char*)memchr(buf + i, CR, len - i);
+          if (cr_pos == NULL) {
+            CHECK_HEADER_BYTES(len);
+            i = len - 1;
+            if ((variant & VARIANT_HEADERS) && p->header_arena_size) {
+              header_append(p, buf + mark, len - mark);
+            }
+            EMIT_HEADER_CB(header_value, buf + mark, len - mark, len);
+            break;
+          }
+          i = (size_t)(cr_pos - buf);
+          CHECK_HEADER_BYTES(i);
         }
-        if (c == CR) {
-          EMIT_DATA_CB(header_value, buf + mark, i - mark);
-          p->state = s_header_value_almost_done;
-          break;
+        p->state = s_header_value_almost_done;
+        if ((variant & VARIANT_HEADERS) && p->header_arena_size) {
+          header_append(p, buf + mark, i - mark);
+          header_value_done(p);
         }
-        if (is_last)
-            EMIT_DATA_CB(header_value, buf + mark, (i - mark) + 1);
+        EMIT_HEADER_DONE(header_value, buf + mark, i - mark, i + 1);
         break;
 
       case s_header_value_almost_done:
@@ -444,6 +3277,7 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
           p->error = MPPE_INVALID_HEADER_FORMAT;
           return i;
         }
+        STATS_HEADER_END(p->stream_offset + i + 1);
         p->state = s_header_field_start;
         break;
 
@@ -458,59 +3292,86 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
           p->error = MPPE_PAUSED;
           return i;
         }
-        NOTIFY_CB(headers_complete);
+        if (p->settings->on_part_headers && p->index == 0) {
+          p->index = 1;
+          if (report_headers(p) != 0) {
+            return i;
+          }
+        }
+        p->decoding = p->settings->decode_transfer_encoding ?
+                      part_decoding(p) : DECODE_NONE;
+        p->decode_count = 0;
+        p->decode_bits = 0;
+        digest_begin(p, (unsigned char)p->settings->digest);
+        p->event_offset = p->stream_offset + i;
+        p->part_data_offset = p->event_offset;
+        p->part_length = NO_PART_LENGTH;
+        if (p->depth < p->max_depth && part_is_multipart(p)) {
+          /* The part is a multipart body: parse its parts instead */
+          p->state = s_nested_start;
+          NOTIFY_CB(headers_complete, i);
+          continue;
+        }
         mark = i;
         p->state = s_part_data;
+        NOTIFY_CB(headers_complete, i);
 
       /* fallthrough */
       case s_part_data:
         multipart_log("s_part_data");
-        /* Optimization: Use memchr() to batch-scan for CR instead of char-by-char */
-        if (i < len) {
+        /* Optimization: Horspool search for the complete delimiter skips CR
+         * bytes that cannot start a boundary. Only the last
+         * boundary_length + 3 bytes of the chunk, where a delimiter may be
+         * cut off, are left to the memchr() scan and byte states below. */
+        if (p->boundary_search &&
+            len - i >= p->boundary_length + DELIMITER_PREFIX_LEN) {
+            const char *hit = p->find_delimiter(p, buf + i, len - i);
+            if (hit != NULL) {
+                /* A pause before part_data_end resumes at the delimiter */
+                i = (size_t)(hit - buf);
+                if (i > mark) {
+                    EMIT_PART_DATA(buf + mark, i - mark, p->stream_offset + mark, i);
+                }
+                /* Flush part data before ending part */
+                if (flush_part_data(p) != 0) {
+                  return i;
+                }
+                p->event_offset = p->stream_offset + i;
+                record_part_length(p);
+                i += p->boundary_length + DELIMITER_PREFIX_LEN - 1;
+                p->state = s_part_data_almost_end;
+                NOTIFY_CB(part_data_end, i + 1);
+                break;
+            }
+            i = len - (p->boundary_length + DELIMITER_PREFIX_LEN) + 1;
+        }
+        /* Optimization: Use memchr() to batch-scan for CR instead of char-by-char.
+         * Data in front of the CR stays pending in buf[mark..] so that a CR
+         * which turns out not to start a delimiter costs no extra callback. */
+        {
             const char *cr_pos = (const char*)memchr(buf + i, CR, len - i);
             if (cr_pos == NULL) {
                 /* No CR found, emit all remaining data */
-                EMIT_DATA_CB(part_data, buf + mark, len - mark);
+                EMIT_PART_DATA(buf + mark, len - mark, p->stream_offset + mark, len);
                 /* Skip to end - loop will increment i to len and exit */
                 i = len - 1;
                 break;
-            } else {
-                /* CR found, emit data up to CR */
-                size_t cr_index = (size_t)(cr_pos - buf);
-                if (cr_index > mark) {
-                    EMIT_DATA_CB(part_data, buf + mark, cr_index - mark);
-                }
-                i = cr_index;
-                c = CR;
-                mark = i;
-                p->state = s_part_data_almost_boundary;
-                p->lookbehind[0] = CR;
-                break;
             }
-        }
-        /* Fallback for single character (shouldn't reach here with optimization) */
-        if (c == CR) {
-            EMIT_DATA_CB(part_data, buf + mark, i - mark);
-            mark = i;
+            i = (size_t)(cr_pos - buf);
             p->state = s_part_data_almost_boundary;
-            p->lookbehind[0] = CR;
-            break;
         }
-        if (is_last)
-            EMIT_DATA_CB(part_data, buf + mark, (i - mark) + 1);
         break;
 
       case s_part_data_almost_boundary:
         multipart_log("s_part_data_almost_boundary");
         if (c == LF) {
             p->state = s_part_data_boundary;
-            p->lookbehind[1] = LF;
             p->index = 0;
             break;
         }
-        EMIT_DATA_CB(part_data, p->lookbehind, 1);
         p->state = s_part_data;
-        mark = i --;
+        REPLAY_LOOKBEHIND(1);
+        i --;
         break;
 
       case s_part_data_boundary:
@@ -518,22 +3379,20 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         /* RFC 2046: boundary must start with -- after CRLF */
         if (p->index == 0) {
           if (c != '-') {
-            EMIT_DATA_CB(part_data, p->lookbehind, 2);
             p->state = s_part_data;
-            mark = i --;
+            REPLAY_LOOKBEHIND(2);
+            i --;
             break;
           }
-          p->lookbehind[2] = c;
           p->index++;
           break;
         } else if (p->index == 1) {
           if (c != '-') {
-            EMIT_DATA_CB(part_data, p->lookbehind, 3);
             p->state = s_part_data;
-            mark = i --;
+            REPLAY_LOOKBEHIND(3);
+            i --;
             break;
           }
-          p->lookbehind[3] = c;
           p->index++;
           p->state = s_part_data_boundary_hyphen2;
           break;
@@ -545,25 +3404,41 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
       case s_part_data_boundary_hyphen2:
         multipart_log("s_part_data_boundary_hyphen2");
         if (p->multipart_boundary[p->index - 2] != c) {
-          EMIT_DATA_CB(part_data, p->lookbehind, 2 + p->index);
           p->state = s_part_data;
-          mark = i --;
+          REPLAY_LOOKBEHIND(2 + p->index);
+          i --;
           break;
         }
-        p->lookbehind[2 + p->index] = c;
-        if ((++ p->index) == (p->boundary_length + 2)) {
-            /* Flush part data buffer before ending part */
-            if (flush_buffer(p, p->settings->on_part_data, &p->part_data_buffer, &p->part_data_buffer_len) != 0) {
-              p->error = MPPE_PAUSED;
+        if ((p->index + 1) == (p->boundary_length + 2)) {
+            /* A pause before part_data_end leaves the last delimiter byte
+             * unconsumed; the rest of the candidate is pending by now, so
+             * the resumed call takes the replay branch and emits nothing. */
+            if (replay) {
+              /* Delimiter started in an earlier chunk, data already emitted */
+              replay = 0;
+            } else if (i + 1 - (p->boundary_length + DELIMITER_PREFIX_LEN) > mark) {
+              EMIT_PART_DATA(buf + mark,
+                             i + 1 - (p->boundary_length + DELIMITER_PREFIX_LEN) - mark,
+                             p->stream_offset + mark, i);
+            }
+            /* Flush part data before ending part */
+            if (flush_part_data(p) != 0) {
               return i;
             }
-            NOTIFY_CB(part_data_end);
+            p->index++;
             p->state = s_part_data_almost_end;
+            p->event_offset = p->stream_offset + i + 1 -
+                              (p->boundary_length + DELIMITER_PREFIX_LEN);
+            record_part_length(p);
+            NOTIFY_CB(part_data_end, i + 1);
+            break;
         }
+        p->index++;
         break;
 
       case s_part_data_almost_end:
         multipart_log("s_part_data_almost_end");
+        p->epilogue = 0;
         if (c == '-') {
             p->state = s_part_data_final_hyphen;
             break;
@@ -578,28 +3453,43 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
       case s_part_data_final_hyphen:
         multipart_log("s_part_data_final_hyphen");
         if (c == '-') {
-            /* Flush part data buffer before body end */
-            if (flush_buffer(p, p->settings->on_part_data, &p->part_data_buffer, &p->part_data_buffer_len) != 0) {
-              p->error = MPPE_PAUSED;
+            /* Flush part data before body end */
+            if (flush_part_data(p) != 0) {
               return i;
             }
-            NOTIFY_CB(body_end);
-            p->state = s_end;
+            /* A nested body ends at the current depth, then its enclosing
+             * part continues */
+            p->state = p->depth > 0 ? s_nested_end : s_end;
+            NOTIFY_CB(body_end, i + 1);
             break;
         }
         p->error = MPPE_INVALID_BOUNDARY;
         return i;
 
+      case s_nested_end:
+        multipart_log("s_nested_end");
+        /* Skip the epilogue up to the delimiter of the enclosing part */
+        pop_boundary(p);
+        p->digest.size = 0;  /* the digest of the last inner part */
+        p->part_data_offset = NO_PART_LENGTH;
+        p->part_length = NO_PART_LENGTH;
+        p->epilogue = 1;
+        mark = i;
+        p->state = s_part_data;
+        continue;
+
       case s_part_data_end:
         multipart_log("s_part_data_end");
         if (c == LF) {
-            /* Flush part data buffer before starting new part */
-            if (flush_buffer(p, p->settings->on_part_data, &p->part_data_buffer, &p->part_data_buffer_len) != 0) {
-              p->error = MPPE_PAUSED;
+            /* Flush part data before starting new part */
+            if (flush_part_data(p) != 0) {
               return i;
             }
+            COUNT_PART();
             p->state = s_header_field_start;
-            NOTIFY_CB(part_data_begin);
+            headers_begin(p);
+            p->event_offset = p->stream_offset + i + 1;
+            NOTIFY_CB(part_data_begin, i + 1);
             break;
         }
         p->error = MPPE_INVALID_BOUNDARY;
@@ -614,8 +3504,83 @@ size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len
         p->error = MPPE_INVALID_STATE;
         return 0;
     }
+#ifdef MULTIPART_PARSER_STATS
+    /* i + 1 - stats_start is 0 when the byte is rescanned (i --) */
+    p->stats.state_bytes[stats_state] += i + 1 - stats_start;
+#endif
     ++ i;
   }
 
+  if (full_len) {
+    if (p->state != s_end) {
+      p->error = MPPE_BODY_TOO_LARGE;
+      return len;
+    }
+    /* The rest of the chunk is epilogue */
+    len = full_len;
+  }
+
+  /* The chunk ended inside a possible delimiter: report the part data in
+   * front of it, the candidate itself is kept as state and p->index */
+  if (!replay && lookbehind_length(p) > 0 &&
+      len - lookbehind_length(p) > mark) {
+    EMIT_PART_DATA(buf + mark, len - lookbehind_length(p) - mark,
+                   p->stream_offset + mark, len);
+  }
+
+  /* Spans must not outlive the call that supplied their bytes, except for
+   * the held delimiter candidate (see multipart_parser_pending_offset()) */
+  if (flush_span(p) != 0) {
+    return len;
+  }
+
   return len;
 }
+
+/* Any settings; also used by the pull and index APIs, which swap them */
+static size_t parse_chunk(multipart_parser* p, const char *buf, size_t len) {
+  return parse_chunk_variant(p, buf, len, VARIANT_ALL);
+}
+
+#ifndef MULTIPART_PARSER_NO_VARIANTS
+static size_t parse_chunk_unbuffered(multipart_parser* p, const char *buf,
+                                     size_t len) {
+  return parse_chunk_variant(p, buf, len, VARIANT_HEADERS | VARIANT_DATA);
+}
+
+static size_t parse_chunk_data_only(multipart_parser* p, const char *buf,
+                                    size_t len) {
+  return parse_chunk_variant(p, buf, len, VARIANT_DATA);
+}
+
+static size_t parse_chunk_headers_only(multipart_parser* p, const char *buf,
+                                       size_t len) {
+  return parse_chunk_variant(p, buf, len, VARIANT_BUFFERED | VARIANT_HEADERS);
+}
+#endif
+
+/* Pick the smallest execute loop that serves the parser's settings. Define
+ * MULTIPART_PARSER_NO_VARIANTS to build only the generic loop. */
+static parse_fn select_parse(const multipart_parser* p) {
+#ifndef MULTIPART_PARSER_NO_VARIANTS
+  const multipart_parser_settings* s = p->settings;
+  int headers, data;
+
+  if (s == NULL) {
+    return parse_chunk;
+  }
+  headers = s->on_header_field != NULL || s->on_header_value != NULL ||
+            p->header_arena_size > 0;
+  data = s->on_part_data != NULL || s->on_part_data_span != NULL ||
+         s->digest != MULTIPART_DIGEST_NONE;
+  if (!data) {
+    return parse_chunk_headers_only;
+  }
+  if (p->buffer_size == 0) {
+    return headers ? parse_chunk_unbuffered : parse_chunk_data_only;
+  }
+#else
+  (void)p;
+#endif
+  return parse_chunk;
+}
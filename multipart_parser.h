@@ -38,6 +38,10 @@ typedef enum {
     MPPE_INVALID_HEADER_FIELD,      /**< Invalid header field character */
     MPPE_INVALID_HEADER_FORMAT,     /**< Invalid header format */
     MPPE_INVALID_STATE,             /**< Parser in invalid state */
+    MPPE_PART_TOO_LARGE,            /**< Part data exceeds max_part_size */
+    MPPE_HEADERS_TOO_LARGE,         /**< Part headers exceed max_header_bytes */
+    MPPE_TOO_MANY_PARTS,            /**< More parts than max_parts */
+    MPPE_BODY_TOO_LARGE,            /**< Body exceeds max_total_size */
     MPPE_UNKNOWN                    /**< Unknown error */
 } multipart_parser_error;
 
@@ -63,10 +67,89 @@ typedef int (*multipart_data_cb) (multipart_parser*, const char *at, size_t leng
  */
 typedef int (*multipart_notify_cb) (multipart_parser*);
 
+/**
+ * @brief Callback for part data reported as a byte range of the body stream
+ *
+ * Offsets count every byte consumed by multipart_parser_execute() since
+ * multipart_parser_init() or multipart_parser_reset(), i.e. the sum of the
+ * values it returned. A caller that knows the stream offset of each buffer it
+ * passed in maps the range to (buffer, offset, length) entries for writev()
+ * or similar scatter-gather I/O without copying the data.
+ *
+ * @param p Pointer to the parser
+ * @param offset Stream offset of the first part data byte
+ * @param length Number of part data bytes
+ * @return 0 to continue parsing, non-zero to pause
+ */
+typedef int (*multipart_span_cb) (multipart_parser*, size_t offset, size_t length);
+
+/** Default capacity of the header arena used by on_part_headers */
+#define MULTIPART_HEADER_ARENA_SIZE 1024
+
+/** Longest boundary allowed by RFC 2046; longer nested boundaries are not followed */
+#define MULTIPART_MAX_BOUNDARY_LENGTH 70
+
+/**
+ * @brief Per-part digest computed while part data is reported
+ */
+typedef enum {
+    MULTIPART_DIGEST_NONE = 0,      /**< No digest */
+    MULTIPART_DIGEST_CRC32C,        /**< CRC-32C (Castagnoli), 4 bytes big-endian */
+    MULTIPART_DIGEST_SHA256         /**< SHA-256, 32 bytes */
+} multipart_digest_type;
+
+/** Size of the largest digest (SHA-256) */
+#define MULTIPART_DIGEST_MAX_SIZE 32
+
+/**
+ * @brief A byte range, used for pre-parsed header values
+ *
+ * @c at is NULL when the value is absent.
+ */
+typedef struct {
+    const char *at;                   /**< First byte, or NULL */
+    size_t length;                    /**< Number of bytes */
+} multipart_slice;
+
+/**
+ * @brief Headers of one part, collected and pre-parsed by the parser
+ *
+ * Slices point into the parser's header arena. They stay valid until the
+ * next part begins or the parser is reset or freed. Quoted parameter values
+ * are unquoted and unescaped; header values have surrounding whitespace
+ * removed. RFC 5987 parameters (@c filename*) are not decoded.
+ */
+typedef struct {
+    multipart_slice disposition;      /**< Content-Disposition type, e.g. "form-data" */
+    multipart_slice name;             /**< Content-Disposition name parameter */
+    multipart_slice filename;         /**< Content-Disposition filename parameter */
+    multipart_slice content_type;     /**< Content-Type value */
+    multipart_slice transfer_encoding; /**< Content-Transfer-Encoding value */
+    int truncated;                    /**< Non-zero if headers did not fit in the arena */
+} multipart_part_headers;
+
+/**
+ * @brief Callback receiving the collected headers of a part
+ *
+ * @param p Pointer to the parser
+ * @param headers Pre-parsed headers (valid during the callback; slices see
+ *                multipart_part_headers)
+ * @return 0 to continue parsing, non-zero to pause
+ */
+typedef int (*multipart_headers_cb) (multipart_parser*, const multipart_part_headers* headers);
+
 /**
  * @brief Parser callback settings
  *
  * All callbacks are optional. Set unused callbacks to NULL.
+ *
+ * The parser never writes to its settings, and the sizes (buffer_size,
+ * header_arena_size, max_depth and the limits) are copied into the parser
+ * at init. One settings object can therefore be shared without locking by
+ * parsers on any number of threads, as long as it is not modified while
+ * they exist (the parser also picks an execute loop specialized for the
+ * callbacks that are set at init). All per-body state, including the
+ * boundary search tables, lives in the parser itself.
  */
 struct multipart_parser_settings {
   multipart_data_cb on_header_field;      /**< Called when a header field is parsed */
@@ -78,9 +161,187 @@ struct multipart_parser_settings {
   multipart_notify_cb on_part_data_end;   /**< Called when a part ends */
   multipart_notify_cb on_body_end;        /**< Called when the entire body ends */
 
-  size_t buffer_size;                     /**< Buffer size for data callbacks (0 = no buffering) */
+  /**
+   * Buffer size for data callbacks (0 = no buffering). Data runs are merged
+   * until the buffer is full. If flushing it pauses and the next run is
+   * longer than buffer_size, that run is still reported before the pause
+   * takes effect.
+   */
+  size_t buffer_size;
+
+  /**
+   * Span mode (optional). When set, part data is reported here instead of
+   * through on_part_data, and buffer_size does not apply to part data.
+   *
+   * Part data is contiguous in the body stream, so each execute call reports
+   * at most one span per part: a partially matched delimiter that turns out
+   * to be data at a chunk boundary is folded into the next span instead of
+   * being replayed from an internal copy. Such a span starts in an earlier
+   * buffer; see multipart_parser_pending_offset() for what to keep.
+   */
+  multipart_span_cb on_part_data_span;
+
+  /**
+   * Header accumulation (optional). When set, the parser copies each part's
+   * header bytes into a fixed-capacity arena as it scans them and calls this
+   * once per part, right before on_headers_complete, with Content-Disposition
+   * (type, name, filename), Content-Type and Content-Transfer-Encoding
+   * already extracted. Headers that do not fit are dropped and reported via
+   * multipart_part_headers.truncated. on_header_field and on_header_value
+   * are still called if set.
+   */
+  multipart_headers_cb on_part_headers;
+  size_t header_arena_size;               /**< Arena capacity (0 = MULTIPART_HEADER_ARENA_SIZE) */
+
+  /**
+   * Nested multipart (optional). When non-zero, a part whose Content-Type is
+   * multipart/... with a boundary parameter is parsed as a multipart body of
+   * its own instead of being reported as part data: the inner boundary is
+   * pushed, up to this many levels deep, and popped at its close delimiter.
+   * Events of the inner parts, including the on_body_end of the nested body,
+   * run at the next depth (see multipart_parser_get_depth()); the epilogue
+   * after it is skipped and the enclosing part ends at its own delimiter.
+   * Headers are collected in the header arena to find the boundary, so a
+   * Content-Type that does not fit in it is not followed.
+   */
+  size_t max_depth;
+
+  /**
+   * Transfer decoding (optional). When non-zero, headers are collected in
+   * the header arena and a part with Content-Transfer-Encoding base64 or
+   * quoted-printable reaches on_part_data decoded, in chunks of at most a
+   * few hundred bytes (merged if buffer_size is set), without a copy of the
+   * whole part. Other encodings are passed through unchanged. Span mode
+   * and the pull and index APIs always report the encoded bytes. A pause
+   * requested while a run of data is decoded takes effect once the run is
+   * done, so on_part_data may be called a few more times first.
+   */
+  int decode_transfer_encoding;
+
+  /**
+   * Part digest (optional). Every byte of part data is hashed as it is
+   * reported, once, while it is still in cache: the bytes passed to
+   * on_part_data (after transfer decoding) or covered by on_part_data_span.
+   * Read the result with multipart_parser_get_digest() from
+   * on_part_data_end. CRC-32C uses the SSE4.2 or ARMv8 CRC instructions
+   * where available. The pull and index APIs compute no digest.
+   */
+  multipart_digest_type digest;
+
+  /**
+   * Limits (optional, 0 = none). The parser stops with the error code of
+   * the limit as soon as the input goes past it, before any byte beyond the
+   * limit is reported or buffered:
+   * - max_part_size: data bytes of one part as they appear in the body,
+   *   i.e. before transfer decoding (MPPE_PART_TOO_LARGE)
+   * - max_header_bytes: header block of one part, from the line after the
+   *   boundary through the empty line (MPPE_HEADERS_TOO_LARGE)
+   * - max_parts: parts in the body, those of nested bodies included
+   *   (MPPE_TOO_MANY_PARTS)
+   * - max_total_size: bytes of the body up to its close delimiter; the
+   *   epilogue after it is not counted (MPPE_BODY_TOO_LARGE)
+   * Executing more input fails the same way until multipart_parser_reset().
+   */
+  size_t max_part_size;
+  size_t max_header_bytes;
+  size_t max_parts;
+  size_t max_total_size;
 };
 
+/**
+ * @brief Event types returned by multipart_parser_next()
+ *
+ * Each type corresponds to one callback in multipart_parser_settings.
+ */
+typedef enum {
+    MULTIPART_EVENT_NONE = 0,         /**< No event: the buffer was consumed or an error occurred */
+    MULTIPART_EVENT_PART_BEGIN,       /**< A new part begins (on_part_data_begin) */
+    MULTIPART_EVENT_HEADER_FIELD,     /**< Header field bytes (on_header_field) */
+    MULTIPART_EVENT_HEADER_VALUE,     /**< Header value bytes (on_header_value) */
+    MULTIPART_EVENT_HEADERS_COMPLETE, /**< Headers of the part are complete (on_headers_complete) */
+    MULTIPART_EVENT_DATA,             /**< Part data bytes (on_part_data) */
+    MULTIPART_EVENT_PART_END,         /**< The part ends (on_part_data_end) */
+    MULTIPART_EVENT_BODY_END          /**< The closing boundary was seen (on_body_end) */
+} multipart_event_type;
+
+/**
+ * @brief Well-known header names, recognized while the name is parsed
+ *
+ * Matching is ASCII case-insensitive and costs no extra pass over the name.
+ * @see multipart_parser_get_header_id()
+ */
+typedef enum {
+    MULTIPART_HEADER_OTHER = 0,                 /**< Unknown header, or no header */
+    MULTIPART_HEADER_CONTENT_DISPOSITION,       /**< Content-Disposition */
+    MULTIPART_HEADER_CONTENT_TYPE,              /**< Content-Type */
+    MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING, /**< Content-Transfer-Encoding */
+    MULTIPART_HEADER_ID_COUNT                   /**< Number of IDs, not an ID */
+} multipart_header_id;
+
+/**
+ * @brief One event returned by multipart_parser_next() or
+ *        multipart_parser_execute_events()
+ *
+ * For HEADER_FIELD, HEADER_VALUE and DATA events @c at and @c length
+ * describe the bytes, which may arrive in several events just like the
+ * corresponding callbacks. @c at usually points into the caller's buffer,
+ * but part data held back as a possible delimiter at a chunk boundary is
+ * returned from the parser's own memory, which stays valid until the parser
+ * is reset or freed (inside a nested body: until the next nested body at
+ * the same depth begins). For other events @c at is NULL and @c length 0.
+ */
+typedef struct {
+    multipart_event_type type;        /**< Event type */
+    const char *at;                   /**< Event bytes, or NULL */
+    size_t length;                    /**< Number of event bytes */
+    multipart_header_id header;       /**< For HEADER_VALUE events and the HEADER_FIELD
+                                           event ending the name: the header ID */
+    size_t depth;                     /**< Nesting depth, see multipart_parser_get_depth() */
+} multipart_event;
+
+/** data_length of a part whose delimiter has not been seen yet */
+#define MULTIPART_INDEX_OPEN ((size_t)-1)
+
+/**
+ * @brief One part of a multipart_index
+ *
+ * Offsets are stream offsets (see multipart_span_cb). The header block runs
+ * from the line after the boundary through the empty line, so the data
+ * follows it directly and ends at the CRLF of the next delimiter. For a
+ * nested multipart part the data is the whole nested body, whose parts have
+ * entries of their own.
+ */
+typedef struct {
+    size_t header_offset;             /**< First byte of the header block */
+    size_t header_length;             /**< Header block length, empty line included */
+    size_t data_offset;               /**< First byte of the part data */
+    size_t data_length;               /**< Data length, or MULTIPART_INDEX_OPEN */
+    size_t name_offset;               /**< name parameter, in multipart_index.strings */
+    size_t name_length;
+    size_t filename_offset;           /**< filename parameter, in multipart_index.strings */
+    size_t filename_length;
+    unsigned char has_name;           /**< Non-zero if name_offset/name_length are set */
+    unsigned char has_filename;       /**< Non-zero if filename_offset/filename_length are set */
+    size_t depth;                     /**< Nesting depth, see multipart_parser_get_depth() */
+} multipart_index_entry;
+
+/**
+ * @brief Part table built by multipart_parser_execute_index()
+ *
+ * The caller provides both arrays and sets count and strings_length to 0
+ * before the first call. The Content-Disposition name and filename of each
+ * part are unquoted into @c strings (not NUL-terminated).
+ */
+typedef struct {
+    multipart_index_entry* entries;   /**< Array receiving one entry per part */
+    size_t max_entries;               /**< Capacity of entries (must be > 0) */
+    size_t count;                     /**< Number of entries stored */
+    char* strings;                    /**< Storage for names and filenames, or NULL */
+    size_t strings_size;              /**< Capacity of strings */
+    size_t strings_length;            /**< Bytes of strings in use */
+    int truncated;                    /**< Non-zero if a part or name was not indexed */
+} multipart_index;
+
 /**
  * @brief Initialize a new multipart parser
  *
@@ -98,10 +359,130 @@ struct multipart_parser_settings {
 multipart_parser* multipart_parser_init
     (const char *boundary, const multipart_parser_settings* settings);
 
+/**
+ * @brief Memory hooks for multipart_parser_init_ex()
+ *
+ * Each parser is one allocation, made by multipart_parser_init_ex() and
+ * released by multipart_parser_free().
+ */
+typedef struct {
+  void* (*alloc)(void* ctx, size_t size);  /**< Return size bytes aligned like malloc(), or NULL */
+  void (*release)(void* ctx, void* ptr);   /**< Release a block returned by alloc */
+  void* ctx;                               /**< Passed to both hooks */
+} multipart_parser_allocator;
+
+/**
+ * @brief Initialize a new multipart parser with custom allocation
+ *
+ * Same as multipart_parser_init(), but the parser memory is obtained from
+ * the given hooks, e.g. a per-connection arena, and returned to them by
+ * multipart_parser_free(). The hooks are copied into the parser.
+ *
+ * @param boundary The boundary string (without "--" prefix)
+ * @param settings Pointer to callback settings structure
+ * @param allocator Allocation hooks, or NULL for malloc() and free()
+ * @return Pointer to the new parser, or NULL if allocation failed
+ */
+multipart_parser* multipart_parser_init_ex
+    (const char *boundary, const multipart_parser_settings* settings,
+     const multipart_parser_allocator* allocator);
+
+/**
+ * @brief Number of bytes a parser needs
+ *
+ * The size depends on the boundary length and on the settings that add
+ * storage: buffer_size, on_part_headers / decode_transfer_encoding /
+ * header_arena_size and max_depth.
+ *
+ * @param boundary_length Length of the boundary (without "--" prefix)
+ * @param settings Settings the parser will be used with (may be NULL)
+ * @return Size to pass to multipart_parser_init_in_place()
+ */
+size_t multipart_parser_sizeof(size_t boundary_length,
+                               const multipart_parser_settings* settings);
+
+/**
+ * @brief Initialize a parser in caller-provided memory
+ *
+ * Lays the parser out in mem without any heap allocation, e.g. on the stack
+ * or inside a larger per-connection object. mem must be aligned like
+ * malloc() memory and stay valid while the parser is used. Calling
+ * multipart_parser_free() on the result is allowed and does nothing.
+ *
+ * @param mem Memory for the parser
+ * @param size Size of mem, at least multipart_parser_sizeof()
+ * @param boundary The boundary string (without "--" prefix)
+ * @param settings Pointer to callback settings structure
+ * @return The parser (located at mem), or NULL if mem is NULL or too small
+ */
+multipart_parser* multipart_parser_init_in_place
+    (void* mem, size_t size, const char *boundary,
+     const multipart_parser_settings* settings);
+
+/**
+ * @brief Pool of reusable parsers
+ *
+ * Parsers from a pool are sized for any boundary up to
+ * MULTIPART_MAX_BOUNDARY_LENGTH, so a released parser can serve the next
+ * request whatever its boundary, at the cost of a reset instead of a
+ * malloc/free pair. A pool has no locking: use one pool per thread, e.g. per
+ * event loop, which keeps its free list local to that thread.
+ */
+typedef struct multipart_parser_pool multipart_parser_pool;
+
+/**
+ * @brief Create a parser pool
+ *
+ * @param settings Settings for all parsers of the pool; must outlive it
+ * @param max_idle Number of released parsers kept for reuse; parsers
+ *                 released beyond that are freed
+ * @param allocator Allocation hooks for the pool and its parsers, or NULL
+ *                  for malloc() and free()
+ * @return The pool, or NULL if allocation failed
+ */
+multipart_parser_pool* multipart_parser_pool_create
+    (const multipart_parser_settings* settings, size_t max_idle,
+     const multipart_parser_allocator* allocator);
+
+/**
+ * @brief Get a parser for a new body
+ *
+ * Returns an idle parser reset to the boundary, or allocates a new one. The
+ * user data pointer is NULL.
+ *
+ * @param pool The pool
+ * @param boundary The boundary string (without "--" prefix)
+ * @return The parser, or NULL if the boundary is longer than
+ *         MULTIPART_MAX_BOUNDARY_LENGTH or allocation failed
+ */
+multipart_parser* multipart_parser_pool_acquire(multipart_parser_pool* pool,
+                                                const char *boundary);
+
+/**
+ * @brief Return a parser to its pool
+ *
+ * @param pool The pool the parser was acquired from
+ * @param p The parser; it must not be used afterwards
+ */
+void multipart_parser_pool_release(multipart_parser_pool* pool,
+                                   multipart_parser* p);
+
+/**
+ * @brief Free a pool and its idle parsers
+ *
+ * Parsers still acquired stay valid and are freed with
+ * multipart_parser_free().
+ *
+ * @param pool The pool, or NULL
+ */
+void multipart_parser_pool_destroy(multipart_parser_pool* pool);
+
 /**
  * @brief Free a multipart parser
  *
- * Releases all resources associated with the parser.
+ * Releases all resources associated with the parser, through the allocator
+ * it was created with. Parsers from multipart_parser_init_in_place() own no
+ * memory and are left alone.
  *
  * @param p Pointer to the parser to free
  */
@@ -118,12 +499,270 @@ void multipart_parser_free(multipart_parser* p);
  * @param len Length of the data buffer
  * @return Number of bytes parsed, or position where error/pause occurred
  *
- * @note If return value < len, check multipart_parser_get_error() for details
+ * @note If return value < len, check multipart_parser_get_error() for details.
+ *       After a pause (MPPE_PAUSED) the return value is the number of bytes
+ *       consumed: call again with the remaining bytes to resume parsing.
  * @see multipart_parser_get_error()
  * @see multipart_parser_get_error_message()
  */
 size_t multipart_parser_execute(multipart_parser* p, const char *buf, size_t len);
 
+/**
+ * @brief Parse until the next event (pull API)
+ *
+ * Alternative to the callbacks in multipart_parser_settings: parses @p buf
+ * until one event is found and returns it in @p event, together with the
+ * number of bytes consumed. Call again with the remaining bytes, or the next
+ * chunk once the whole buffer is consumed:
+ *
+ * @code
+ * while (len > 0) {
+ *   size_t n = multipart_parser_next(p, buf, len, &ev);
+ *   if (ev.type == MULTIPART_EVENT_NONE && n < len) break;
+ *   handle(&ev);
+ *   buf += n; len -= n;
+ * }
+ * @endcode
+ *
+ * The loop stops early on a parse error. The callbacks, buffer_size and
+ * span mode of the settings are not used by this function. Use either this
+ * function or multipart_parser_execute() for a given message, not both.
+ *
+ * @param p Pointer to the parser
+ * @param buf Pointer to the data buffer
+ * @param len Length of the data buffer
+ * @param event Receives the event; type is MULTIPART_EVENT_NONE if the
+ *              buffer was consumed without an event or an error occurred
+ * @return Number of bytes consumed. If no event was returned and the value
+ *         is less than len, check multipart_parser_get_error()
+ */
+size_t multipart_parser_next(multipart_parser* p, const char *buf, size_t len,
+                             multipart_event* event);
+
+/**
+ * @brief Parse into a caller-supplied event array (batch API)
+ *
+ * Like multipart_parser_next(), but stores up to @p max_events events per
+ * call, so a language binding can hand a whole chunk's events to its
+ * runtime in one step instead of crossing into it once per callback. Parsing
+ * stops when the array is full or the buffer is consumed; call again with
+ * the remaining bytes in the first case. All events of one call stay valid
+ * together (see multipart_event).
+ *
+ * @param p Pointer to the parser
+ * @param buf Pointer to the data buffer
+ * @param len Length of the data buffer
+ * @param events Array receiving the events
+ * @param max_events Capacity of @p events (must be > 0)
+ * @param n_events Receives the number of events stored (may be NULL)
+ * @return Number of bytes consumed. If it is less than len and fewer than
+ *         max_events events were stored, check multipart_parser_get_error()
+ */
+size_t multipart_parser_execute_events(multipart_parser* p,
+                                       const char *buf, size_t len,
+                                       multipart_event* events,
+                                       size_t max_events, size_t* n_events);
+
+/**
+ * @brief Index the parts of a chunk without reporting their data
+ *
+ * Runs the parser with internal callbacks that record where each part's
+ * headers and data are instead of calling the parser's settings; part data
+ * is skipped without any callback. Call it for consecutive chunks with the
+ * same index, and afterwards seek to the parts needed in the stored body.
+ *
+ * When a part takes the last free entry, the call returns right after the
+ * boundary line of that part. Grow the array (copying the entries) and call
+ * again with the rest of the buffer; the entry is completed as parsing
+ * continues. A part beginning while the array is
+ * still full is skipped and sets @c truncated, as does a Content-Disposition
+ * value that does not fit in @c strings.
+ *
+ * @param p Pointer to the parser
+ * @param buf Pointer to the data buffer
+ * @param len Length of the data buffer
+ * @param index Index to extend
+ * @return Number of bytes consumed. If it is less than len and the array is
+ *         not full, check multipart_parser_get_error()
+ */
+size_t multipart_parser_execute_index(multipart_parser* p,
+                                      const char *buf, size_t len,
+                                      multipart_index* index);
+
+/**
+ * @brief Find the first indexed part with the given name parameter
+ *
+ * @param index Index built by multipart_parser_execute_index()
+ * @param name Name to look for (compared byte by byte)
+ * @return The entry, or NULL if no part has that name
+ */
+const multipart_index_entry* multipart_index_find(const multipart_index* index,
+                                                  const char *name);
+
+/**
+ * @brief Find the boundary lines in a fully buffered body
+ *
+ * Stores the offsets of the boundary lines ("--boundary", after the CRLF
+ * that belongs to the delimiter) that start in buf[from..to), in order, using
+ * the parser's boundary search. No parse state is touched, so threads may
+ * scan disjoint ranges of one body with one shared, otherwise idle parser
+ * and concatenate the results in range order; a delimiter that crosses the
+ * end of a range is found by the range in which it starts. Part k then
+ * spans from the end of the line at offsets[k] to offsets[k + 1] - 2.
+ *
+ * Since the boundary may not occur in encapsulated data (RFC 2046), every
+ * match is a delimiter of the body; a close delimiter is followed by "--".
+ *
+ * @param p Parser holding the boundary, freshly initialized or reset
+ * @param buf The whole body
+ * @param len Length of the body
+ * @param from Start of the range to scan
+ * @param to End of the range to scan (clamped to len)
+ * @param offsets Array receiving the offsets
+ * @param max_offsets Capacity of @p offsets
+ * @return Number of offsets stored. If it equals max_offsets, continue with
+ *         from = offsets[max_offsets - 1] + 1
+ */
+size_t multipart_parser_find_delimiters(const multipart_parser* p,
+                                        const char *buf, size_t len,
+                                        size_t from, size_t to,
+                                        size_t* offsets, size_t max_offsets);
+
+/**
+ * @brief Get the oldest stream offset that may still be reported as data
+ *
+ * At a chunk boundary the parser may be holding the start of a possible
+ * delimiter (at most boundary length + 3 bytes). In span mode these bytes
+ * are reported later as part of a span if they turn out to be data, so the
+ * caller must keep the stream bytes from this offset onwards available.
+ * Buffers that lie entirely before it can be reused.
+ *
+ * @param p Pointer to the parser
+ * @return Stream offset (see multipart_span_cb), or 0 if p is NULL
+ */
+size_t multipart_parser_pending_offset(multipart_parser* p);
+
+/**
+ * @brief Get the number of bytes consumed so far
+ *
+ * The sum of the values returned by the execute functions since
+ * multipart_parser_init() or multipart_parser_reset(), carried over by
+ * multipart_parser_restore(): the stream offset of the next input byte.
+ *
+ * @param p Pointer to the parser
+ * @return Stream offset (see multipart_span_cb), or 0 if p is NULL
+ */
+size_t multipart_parser_get_offset(multipart_parser* p);
+
+/**
+ * @brief Get the ID of the header being parsed
+ *
+ * Valid from the on_header_field call that completes a header name (the one
+ * made when the colon is seen) through the on_header_value calls of that
+ * header. Lets callbacks switch on an integer instead of comparing names.
+ *
+ * @param p Pointer to the parser
+ * @return Header ID, MULTIPART_HEADER_OTHER for unknown headers, outside a
+ *         header, or if p is NULL
+ */
+multipart_header_id multipart_parser_get_header_id(multipart_parser* p);
+
+/**
+ * @brief Get the nesting depth of the current event
+ *
+ * 0 for the parts of the top-level body, 1 for the parts of a multipart
+ * body nested in one of them, and so on. Always 0 unless
+ * multipart_parser_settings.max_depth is set.
+ *
+ * @param p Pointer to the parser
+ * @return Nesting depth, or 0 if p is NULL
+ */
+size_t multipart_parser_get_depth(multipart_parser* p);
+
+/**
+ * @brief Get the digest of the part that just ended
+ *
+ * Valid from on_part_data_end until the next part begins. A part that holds
+ * a nested multipart body has no digest of its own.
+ *
+ * @param p Pointer to the parser
+ * @param out Receives the digest, at least MULTIPART_DIGEST_MAX_SIZE bytes
+ * @return Size of the digest in bytes, or 0 if none is available
+ */
+size_t multipart_parser_get_digest(multipart_parser* p, unsigned char* out);
+
+/**
+ * @brief Get the data length of the part that just ended
+ *
+ * Valid from on_part_data_end until the next part begins, in any mode
+ * (also in span mode and with decoding, where it counts the encoded bytes
+ * of the stream). Together with on_part_headers this is all a header-only
+ * scan needs: with no on_part_data, on_part_data_span or digest set, part
+ * data is skipped by the boundary search without being reported.
+ *
+ * @param p Pointer to the parser
+ * @param length Receives the number of part data bytes
+ * @return 0 on success, -1 if no part just ended or the part held a nested
+ *         multipart body
+ */
+int multipart_parser_get_part_length(multipart_parser* p, size_t* length);
+
+/** Number of internal states counted in multipart_parser_stats.state_bytes */
+#define MULTIPART_STATS_STATES 21
+
+/**
+ * @brief Callbacks counted in multipart_parser_stats.callbacks
+ */
+typedef enum {
+    MULTIPART_STATS_HEADER_FIELD = 0,   /**< on_header_field */
+    MULTIPART_STATS_HEADER_VALUE,       /**< on_header_value */
+    MULTIPART_STATS_PART_DATA,          /**< on_part_data */
+    MULTIPART_STATS_PART_DATA_BEGIN,    /**< on_part_data_begin */
+    MULTIPART_STATS_HEADERS_COMPLETE,   /**< on_headers_complete */
+    MULTIPART_STATS_PART_DATA_END,      /**< on_part_data_end */
+    MULTIPART_STATS_BODY_END,           /**< on_body_end */
+    MULTIPART_STATS_PART_DATA_SPAN,     /**< on_part_data_span */
+    MULTIPART_STATS_PART_HEADERS,       /**< on_part_headers */
+    MULTIPART_STATS_CALLBACK_COUNT      /**< Number of counted callbacks */
+} multipart_stats_callback;
+
+/**
+ * @brief Hot-path counters of a parser
+ *
+ * Only maintained when the library is compiled with MULTIPART_PARSER_STATS
+ * defined; otherwise the counting code is not compiled in at all. Counters
+ * accumulate from multipart_parser_init() and survive resets.
+ */
+typedef struct {
+    /** Bytes consumed in each state, indexed by internal state number (see
+     *  multipart_parser_stats_state_name()); a byte that leaves a state
+     *  counts for that state, bulk-scanned part data for s_part_data */
+    size_t state_bytes[MULTIPART_STATS_STATES];
+    size_t cr_false_positives;     /**< CRs in part data examined as a delimiter start that did not begin one */
+    size_t lookbehind_replays;     /**< Delimiter candidates re-emitted from an earlier chunk */
+    size_t callbacks[MULTIPART_STATS_CALLBACK_COUNT]; /**< Invocations per callback */
+    size_t bytes_buffered;         /**< Bytes copied into the buffer_size buffers */
+    size_t largest_header;         /**< Longest header line seen, with its CRLF */
+} multipart_parser_stats;
+
+/**
+ * @brief Copy a parser's counters
+ *
+ * @param p Pointer to the parser
+ * @param stats Receives the counters
+ * @return 0 on success, -1 if p or stats is NULL or the library was built
+ *         without MULTIPART_PARSER_STATS
+ */
+int multipart_parser_get_stats(multipart_parser* p, multipart_parser_stats* stats);
+
+/**
+ * @brief Name of a state counted in multipart_parser_stats.state_bytes
+ *
+ * @param state Index into state_bytes
+ * @return The state name, e.g. "part_data", or NULL for an unused index
+ */
+const char* multipart_parser_stats_state_name(size_t state);
+
 /**
  * @brief Set user data pointer
  *
@@ -180,11 +819,12 @@ const char* multipart_parser_get_error_message(multipart_parser* p);
  *
  * The parser's internal state, buffers, and error state are reset. If a new
  * boundary is provided, it must fit within the originally allocated memory
- * (i.e., the new boundary cannot be longer than the original boundary).
+ * (i.e., the new boundary cannot be longer than the original boundary, or
+ * than MULTIPART_MAX_BOUNDARY_LENGTH if that is longer and max_depth is set).
  *
  * @param p Pointer to the parser to reset
  * @param boundary The new boundary string (without "--" prefix), or NULL to
- *                 keep the existing boundary
+ *                 keep the existing top-level boundary
  * @return 0 on success, -1 if the new boundary is too long
  *
  * @note The settings callbacks remain unchanged
@@ -193,6 +833,51 @@ const char* multipart_parser_get_error_message(multipart_parser* p);
  */
 int multipart_parser_reset(multipart_parser* p, const char *boundary);
 
+/**
+ * @brief Save the parse state to a buffer
+ *
+ * Serializes what the parser needs to continue a body where it stopped,
+ * after a pause or between two chunks: the state, the boundaries, the
+ * offsets and counters, and any bytes held back (buffered callback data,
+ * collected headers, decoder and digest state). A partial delimiter is
+ * kept as a match length, not as bytes. Settings, callbacks, the user
+ * data pointer and statistics are not saved. Between chunks a snapshot
+ * takes a few dozen bytes plus the boundary; with buffer_size or header
+ * accumulation it grows by the bytes pending in them.
+ *
+ * Numbers are stored byte by byte with a version mark, so snapshots can be
+ * moved between processes and machines running this parser version. To
+ * continue, restore the snapshot into a parser made with the same settings
+ * and execute the input from stream offset multipart_parser_get_offset(),
+ * i.e. the bytes not consumed when the snapshot was taken. Part data
+ * spans not yet reported (span mode) still refer to earlier input, see
+ * multipart_parser_pending_offset().
+ *
+ * @param p The parser
+ * @param buf Buffer receiving the snapshot, or NULL to only get its size
+ * @param size Capacity of @p buf
+ * @return Size of the snapshot; if larger than @p size nothing useful was
+ *         written. 0 if @p p is NULL.
+ */
+size_t multipart_parser_snapshot(multipart_parser* p, void* buf, size_t size);
+
+/**
+ * @brief Continue from a snapshot
+ *
+ * Replaces the parse state of @p p with the state saved by
+ * multipart_parser_snapshot(), including the boundary. The snapshot is
+ * checked first: if it is truncated, of another version, or does not fit
+ * the parser (a longer boundary than it was allocated for, more nesting
+ * than max_depth, or more buffered or header bytes than its buffer_size or
+ * header arena), the parser is left unchanged.
+ *
+ * @param p The parser, typically fresh from multipart_parser_init()
+ * @param buf The snapshot
+ * @param len Size of the snapshot
+ * @return 0 on success, -1 if the snapshot was rejected
+ */
+int multipart_parser_restore(multipart_parser* p, const void* buf, size_t len);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
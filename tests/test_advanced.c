@@ -180,3 +180,107 @@ void test_callback_buffering(void) {
     TEST_PASS();
 }
 
+
+/* Text collected by the variant test callbacks */
+typedef struct {
+    char headers[128];
+    size_t headers_len;
+    char data[64];
+    size_t data_len;
+    int part_ends;
+} variant_data;
+
+static int variant_append(char *to, size_t *to_len, size_t size,
+                          const char *at, size_t length) {
+    if (*to_len + length > size) {
+        return 1;
+    }
+    memcpy(to + *to_len, at, length);
+    *to_len += length;
+    return 0;
+}
+
+static int variant_header(multipart_parser* p, const char *at, size_t length) {
+    variant_data *d = (variant_data*)multipart_parser_get_data(p);
+    return variant_append(d->headers, &d->headers_len, sizeof(d->headers),
+                          at, length);
+}
+
+static int variant_part_data(multipart_parser* p, const char *at, size_t length) {
+    variant_data *d = (variant_data*)multipart_parser_get_data(p);
+    return variant_append(d->data, &d->data_len, sizeof(d->data), at, length);
+}
+
+static int variant_part_end(multipart_parser* p) {
+    variant_data *d = (variant_data*)multipart_parser_get_data(p);
+    d->part_ends++;
+    return 0;
+}
+
+/* Test: every combination of data, header callbacks and buffering (each
+ * served by its own execute loop) reports the same bytes */
+void test_settings_variants(void) {
+    const char *data =
+        "--bound\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "first\r\n--boun\r\n"
+        "--bound\r\n"
+        "X-Id: 2\r\n"
+        "\r\n"
+        "second\r\n"
+        "--bound--";
+    const char *headers = "Content-Typetext/plainX-Id2";
+    const char *part_data = "first\r\n--bounsecond";
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    variant_data d;
+    size_t len = strlen(data);
+    size_t offset, n, chunk;
+    int config;
+
+    TEST_START("Settings variants: data-only, header-only and buffered loops");
+
+    for (config = 0; config < 8; config++) {
+        memset(&callbacks, 0, sizeof(multipart_parser_settings));
+        callbacks.on_part_data_end = variant_part_end;
+        if (config & 1) {
+            callbacks.on_part_data = variant_part_data;
+        }
+        if (config & 2) {
+            callbacks.on_header_field = variant_header;
+            callbacks.on_header_value = variant_header;
+        }
+        if (config & 4) {
+            callbacks.buffer_size = 4;
+        }
+        for (chunk = 1; chunk <= len; chunk++) {
+            memset(&d, 0, sizeof(d));
+            parser = multipart_parser_init("bound", &callbacks);
+            if (parser == NULL) {
+                TEST_FAIL("Parser initialization failed");
+                return;
+            }
+            multipart_parser_set_data(parser, &d);
+            for (offset = 0; offset < len; offset += n) {
+                n = len - offset < chunk ? len - offset : chunk;
+                if (multipart_parser_execute(parser, data + offset, n) != n) {
+                    break;
+                }
+            }
+            multipart_parser_free(parser);
+            if (offset != len || d.part_ends != 2 ||
+                d.data_len != ((config & 1) ? strlen(part_data) : 0) ||
+                memcmp(d.data, part_data, d.data_len) != 0 ||
+                d.headers_len != ((config & 2) ? strlen(headers) : 0) ||
+                memcmp(d.headers, headers, d.headers_len) != 0) {
+                printf("(config %d, chunk size %lu) ", config,
+                       (unsigned long)chunk);
+                TEST_FAIL("Callbacks differ between variants");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
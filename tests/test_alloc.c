@@ -0,0 +1,188 @@
+/* Allocation Tests
+ * Tests for multipart_parser_init_ex, multipart_parser_sizeof and
+ * multipart_parser_init_in_place
+ */
+#include "test_common.h"
+
+/* Counts the blocks handed out by the test allocator */
+typedef struct {
+    int allocs;
+    int releases;
+    size_t last_size;
+    int fail;
+} alloc_test_data;
+
+static void* test_alloc(void* ctx, size_t size) {
+    alloc_test_data *a = (alloc_test_data*)ctx;
+    if (a->fail) {
+        return NULL;
+    }
+    a->allocs++;
+    a->last_size = size;
+    return malloc(size);
+}
+
+static void test_release(void* ctx, void* ptr) {
+    alloc_test_data *a = (alloc_test_data*)ctx;
+    a->releases++;
+    free(ptr);
+}
+
+static const char *alloc_message =
+    "--alloc\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "hello\r\n"
+    "--alloc--";
+
+static int alloc_body_end(multipart_parser* p) {
+    int *done = (int*)multipart_parser_get_data(p);
+    *done = 1;
+    return 0;
+}
+
+/* Parse alloc_message; returns 1 if the body was parsed completely */
+static int parse_alloc_message(multipart_parser* parser) {
+    int done = 0;
+    size_t len = strlen(alloc_message);
+
+    multipart_parser_set_data(parser, &done);
+    return multipart_parser_execute(parser, alloc_message, len) == len && done;
+}
+
+/* Test: init_ex allocates and frees through the hooks */
+void test_alloc_hooks(void) {
+    alloc_test_data a;
+    multipart_parser_allocator allocator;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+
+    TEST_START("Allocator hooks: init_ex and free");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_body_end = alloc_body_end;
+    callbacks.buffer_size = 16;
+    memset(&a, 0, sizeof(a));
+    allocator.alloc = test_alloc;
+    allocator.release = test_release;
+    allocator.ctx = &a;
+
+    parser = multipart_parser_init_ex("alloc", &callbacks, &allocator);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    if (a.allocs != 1 || a.last_size != multipart_parser_sizeof(5, &callbacks)) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Expected one allocation of multipart_parser_sizeof() bytes");
+        return;
+    }
+    if (!parse_alloc_message(parser)) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    multipart_parser_free(parser);
+    if (a.releases != 1) {
+        TEST_FAIL("Parser memory not returned to the allocator");
+        return;
+    }
+
+    a.fail = 1;
+    if (multipart_parser_init_ex("alloc", &callbacks, &allocator) != NULL) {
+        TEST_FAIL("Allocation failure not reported");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: a parser laid out in caller memory needs no heap */
+void test_alloc_in_place(void) {
+    /* union for malloc-like alignment of the stack buffer */
+    union {
+        char bytes[4096];
+        void *ptr;
+        double d;
+        size_t n;
+    } storage;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t need;
+
+    TEST_START("In-place init: stack storage");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_body_end = alloc_body_end;
+    callbacks.buffer_size = 64;
+    callbacks.max_depth = 2;
+
+    need = multipart_parser_sizeof(5, &callbacks);
+    if (need > sizeof(storage)) {
+        TEST_FAIL("Test storage too small");
+        return;
+    }
+
+    if (multipart_parser_init_in_place(&storage, need - 1, "alloc", &callbacks) != NULL ||
+        multipart_parser_init_in_place(NULL, need, "alloc", &callbacks) != NULL) {
+        TEST_FAIL("Too small or NULL memory accepted");
+        return;
+    }
+
+    parser = multipart_parser_init_in_place(&storage, need, "alloc", &callbacks);
+    if (parser != (multipart_parser*)(void*)&storage) {
+        TEST_FAIL("Parser not placed at the given memory");
+        return;
+    }
+    if (!parse_alloc_message(parser)) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+
+    /* Reuse the same storage for another message */
+    if (multipart_parser_reset(parser, NULL) != 0 || !parse_alloc_message(parser)) {
+        TEST_FAIL("Parse after reset failed");
+        return;
+    }
+    multipart_parser_free(parser);  /* no-op for caller memory */
+
+    TEST_PASS();
+}
+
+/* Test: the size grows with everything that adds parser storage */
+void test_alloc_sizeof(void) {
+    multipart_parser_settings callbacks;
+    size_t base;
+
+    TEST_START("multipart_parser_sizeof accounts for settings");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    base = multipart_parser_sizeof(10, &callbacks);
+
+    if (multipart_parser_sizeof(10, NULL) != base ||
+        multipart_parser_sizeof(11, &callbacks) != base + 1) {
+        TEST_FAIL("Size not driven by the boundary length");
+        return;
+    }
+
+    callbacks.buffer_size = 100;
+    if (multipart_parser_sizeof(10, &callbacks) != base + 300) {
+        TEST_FAIL("Callback buffers not accounted for");
+        return;
+    }
+
+    callbacks.buffer_size = 0;
+    callbacks.header_arena_size = 50;
+    if (multipart_parser_sizeof(10, &callbacks) != base) {
+        TEST_FAIL("Arena counted without on_part_headers or max_depth");
+        return;
+    }
+    callbacks.max_depth = 1;
+    if (multipart_parser_sizeof(10, &callbacks) <=
+        base + 50 + MULTIPART_MAX_BOUNDARY_LENGTH) {
+        TEST_FAIL("Nesting storage not accounted for");
+        return;
+    }
+
+    TEST_PASS();
+}
@@ -74,6 +74,7 @@ void test_empty_part_data(void);
 void test_long_header_value(void);
 void test_clean_end(void);
 void test_callback_buffering(void);
+void test_settings_variants(void);
 
 /* Section 8: Parser Reset Tests */
 void test_reset_basic(void);
@@ -86,4 +87,98 @@ void test_reset_clears_error(void);
 void test_null_pointer_safety(void);
 void test_null_buffer_safety(void);
 
+/* Section 11: Boundary Search Tests */
+void test_search_cr_dense_payload(void);
+void test_search_chunk_sweep(void);
+void test_search_reset_rebuilds_table(void);
+void test_search_boundary_with_cr(void);
+void test_search_delimiter_alignment(void);
+void test_search_find_delimiters(void);
+void test_search_split_delimiter(void);
+
+/* Section 12: Span Mode Tests */
+void test_span_single_chunk(void);
+void test_span_chunk_sweep(void);
+void test_span_pending_offset(void);
+void test_span_regular_mode_coalesces(void);
+
+/* Section 13: Pull API Tests */
+void test_pull_event_sequence(void);
+void test_pull_chunk_sweep(void);
+void test_pause_resume_every_callback(void);
+void test_pause_resume_buffered(void);
+void test_pull_error(void);
+void test_pull_batch_events(void);
+
+/* Section 14: Header Accumulation Tests */
+void test_headers_parsed_fields(void);
+void test_headers_chunk_sweep(void);
+void test_headers_arena_overflow(void);
+void test_headers_header_ids(void);
+void test_headers_line_scan(void);
+void test_headers_scan_only(void);
+
+/* Section 15: Nested Multipart Tests */
+void test_nested_single_chunk(void);
+void test_nested_chunk_sweep(void);
+void test_nested_depth_limit(void);
+void test_nested_events_and_reset(void);
+void test_nested_replay_then_pop(void);
+
+/* Section 16: Allocation Tests */
+void test_alloc_hooks(void);
+void test_alloc_in_place(void);
+void test_alloc_sizeof(void);
+
+/* Section 17: Parser Pool Tests */
+void test_pool_reuse(void);
+void test_pool_boundary_lengths(void);
+void test_pool_max_idle(void);
+void test_pool_shared_settings(void);
+
+/* Section 18: Part Index Tests */
+void test_index_single_chunk(void);
+void test_index_chunk_sweep(void);
+void test_index_limits(void);
+
+/* Section 19: I/O Front-end Tests */
+void test_io_parse_file(void);
+void test_io_errors(void);
+void test_io_reader_spans(void);
+void test_io_reader_commit(void);
+void test_io_extract_file(void);
+void test_io_extract_fd(void);
+
+/* Section 20: Transfer Decoding Tests */
+void test_decode_base64(void);
+void test_decode_quoted_printable(void);
+void test_decode_pause_and_raw(void);
+
+/* Section 21: Part Digest Tests */
+void test_digest_crc32c(void);
+void test_digest_sha256(void);
+void test_digest_decoded_nested(void);
+
+/* Section 22: Parser Statistics Tests */
+void test_stats_single_chunk(void);
+void test_stats_chunk_sweep(void);
+
+/* Section 23: Parser Limit Tests */
+void test_limits_part_size(void);
+void test_limits_header_bytes(void);
+void test_limits_parts(void);
+void test_limits_total_size(void);
+
+/* Section 24: Encoder Tests */
+void test_encode_round_trip(void);
+void test_encode_zero_copy(void);
+void test_encode_errors(void);
+void test_encode_write(void);
+
+/* Section 25: Parser Snapshot Tests */
+void test_snapshot_resume_anywhere(void);
+void test_snapshot_pause_handoff(void);
+void test_snapshot_rejected(void);
+void test_snapshot_tampered_state(void);
+
 #endif /* TEST_COMMON_H */
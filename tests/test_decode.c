@@ -0,0 +1,221 @@
+/* Transfer Decoding Tests
+ * Tests for decode_transfer_encoding (base64 and quoted-printable parts)
+ */
+#include "test_common.h"
+
+#define DECODE_MAX_PARTS 3
+#define DECODE_PART_SIZE 1024
+
+/* Part data as received, one slot per part */
+typedef struct {
+    char data[DECODE_MAX_PARTS][DECODE_PART_SIZE];
+    size_t len[DECODE_MAX_PARTS];
+    int parts;
+    int pause;
+    int overflow;
+} decode_test_data;
+
+static int decode_part_data_cb(multipart_parser* p, const char *at, size_t length) {
+    decode_test_data *d = (decode_test_data*)multipart_parser_get_data(p);
+    if (d->parts >= DECODE_MAX_PARTS ||
+        d->len[d->parts] + length > DECODE_PART_SIZE) {
+        d->overflow = 1;
+        return 0;
+    }
+    memcpy(d->data[d->parts] + d->len[d->parts], at, length);
+    d->len[d->parts] += length;
+    return d->pause;
+}
+
+static int decode_part_end_cb(multipart_parser* p) {
+    ((decode_test_data*)multipart_parser_get_data(p))->parts++;
+    return 0;
+}
+
+/* Parse msg in chunks, re-feeding from where a pause stopped; returns the
+ * number of bytes consumed */
+static size_t decode_parse(const char *msg, size_t len, size_t chunk,
+                           size_t buffer_size, int pause, decode_test_data *d) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t offset, n, parsed;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = decode_part_data_cb;
+    callbacks.on_part_data_end = decode_part_end_cb;
+    callbacks.buffer_size = buffer_size;
+    callbacks.decode_transfer_encoding = 1;
+    memset(d, 0, sizeof(decode_test_data));
+    d->pause = pause;
+
+    parser = multipart_parser_init("dec", &callbacks);
+    if (parser == NULL) {
+        return 0;
+    }
+    multipart_parser_set_data(parser, d);
+    for (offset = 0; offset < len; offset += parsed) {
+        n = len - offset < chunk ? len - offset : chunk;
+        parsed = multipart_parser_execute(parser, msg + offset, n);
+        if (parsed != n && multipart_parser_get_error(parser) != MPPE_PAUSED) {
+            break;
+        }
+    }
+    multipart_parser_free(parser);
+    return offset;
+}
+
+static int decode_part_is(const decode_test_data *d, int k,
+                          const char *expected, size_t len) {
+    return d->len[k] == len && memcmp(d->data[k], expected, len) == 0;
+}
+
+/* Base64 with 76-column lines, as a mail gateway writes it */
+static size_t encode_base64(const unsigned char *in, size_t len, char *out) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, n = 0, column = 0;
+    unsigned long bits;
+
+    for (i = 0; i < len; i += 3) {
+        bits = (unsigned long)in[i] << 16;
+        if (i + 1 < len) bits |= (unsigned long)in[i + 1] << 8;
+        if (i + 2 < len) bits |= in[i + 2];
+        out[n++] = alphabet[(bits >> 18) & 63];
+        out[n++] = alphabet[(bits >> 12) & 63];
+        out[n++] = i + 1 < len ? alphabet[(bits >> 6) & 63] : '=';
+        out[n++] = i + 2 < len ? alphabet[bits & 63] : '=';
+        column += 4;
+        if (column == 76) {
+            out[n++] = '\r';
+            out[n++] = '\n';
+            column = 0;
+        }
+    }
+    return n;
+}
+
+/* Test: base64 parts decode the same for every chunking and buffer size */
+void test_decode_base64(void) {
+    static char msg[4096];
+    unsigned char payload[700];
+    size_t len, chunk, k;
+    decode_test_data d;
+    size_t buffer_sizes[2];
+    int b;
+
+    TEST_START("Transfer decoding: base64 across chunk sizes");
+
+    for (k = 0; k < sizeof(payload); k++) {
+        payload[k] = (unsigned char)(k * 37 + k / 256);
+    }
+    len = (size_t)sprintf(msg, "--dec\r\nContent-Transfer-Encoding:  BASE64 \r\n\r\n");
+    len += encode_base64(payload, sizeof(payload), msg + len);
+    /* Unpadded input is accepted at the end of a part */
+    len += (size_t)sprintf(msg + len, "\r\n--dec\r\n"
+                           "Content-Transfer-Encoding: base64\r\n\r\n"
+                           "aGk\r\n--dec\r\n"
+                           "Content-Transfer-Encoding: 7bit\r\n\r\n"
+                           "aGk=\r\n--dec--");
+
+    buffer_sizes[0] = 0;
+    buffer_sizes[1] = 7;
+    for (b = 0; b < 2; b++) {
+        for (chunk = 1; chunk <= len; chunk += (chunk < 100 ? 1 : 37)) {
+            if (decode_parse(msg, len, chunk, buffer_sizes[b], 0, &d) != len ||
+                d.parts != 3 || d.overflow ||
+                !decode_part_is(&d, 0, (const char*)payload, sizeof(payload)) ||
+                !decode_part_is(&d, 1, "hi", 2) ||
+                !decode_part_is(&d, 2, "aGk=", 4)) {
+                printf("(chunk size %lu, buffer %lu) ", (unsigned long)chunk,
+                       (unsigned long)buffer_sizes[b]);
+                TEST_FAIL("Decoded data differs from the payload");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: quoted-printable escapes, soft line breaks and invalid escapes */
+void test_decode_quoted_printable(void) {
+    const char *msg =
+        "--dec\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
+        "\r\n"
+        "caf=C3=A9 is=\r\n"
+        " long, a=3Db, lower =c3=a9,=\n"
+        "bad =ZZ and =4x\r\n"
+        "line two =\r\n--dec\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
+        "\r\n"
+        "cut =4\r\n--dec--";
+    const char *expected =
+        "caf\303\251 is long, a=b, lower \303\251,"
+        "bad =ZZ and =4x\r\n"
+        "line two =";
+    size_t len = strlen(msg);
+    size_t chunk;
+    decode_test_data d;
+
+    TEST_START("Transfer decoding: quoted-printable across chunk sizes");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        if (decode_parse(msg, len, chunk, 0, 0, &d) != len || d.parts != 2 ||
+            !decode_part_is(&d, 0, expected, strlen(expected)) ||
+            !decode_part_is(&d, 1, "cut =4", 6)) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Decoded data differs from the expected text");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: pauses lose no decoded data; span mode and the default keep the
+ * encoded bytes */
+void test_decode_pause_and_raw(void) {
+    const char *msg =
+        "--dec\r\n"
+        "Content-Transfer-Encoding: base64\r\n"
+        "\r\n"
+        "SGVsbG8s\r\nIHdvcmxk\r\nIQ==\r\n--dec--";
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+    size_t chunk;
+    decode_test_data d;
+
+    TEST_START("Transfer decoding: pauses, span mode and the default");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        if (decode_parse(msg, len, chunk, 0, 1, &d) != len || d.parts != 1 ||
+            !decode_part_is(&d, 0, "Hello, world!", 13)) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Pausing lost decoded data");
+            return;
+        }
+    }
+
+    /* Without the setting the encoded text is the part data */
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = decode_part_data_cb;
+    callbacks.on_part_data_end = decode_part_end_cb;
+    memset(&d, 0, sizeof(d));
+    parser = multipart_parser_init("dec", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(parser, &d);
+    if (multipart_parser_execute(parser, msg, len) != len ||
+        !decode_part_is(&d, 0, "SGVsbG8s\r\nIHdvcmxk\r\nIQ==", 24)) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Encoded data altered without decoding enabled");
+        return;
+    }
+    multipart_parser_free(parser);
+
+    TEST_PASS();
+}
@@ -0,0 +1,199 @@
+/* Part Digest Tests
+ * Tests for the digest setting and multipart_parser_get_digest
+ */
+#include "test_common.h"
+
+#define DIGEST_MAX_PARTS 4
+
+/* Digests read in on_part_data_end */
+typedef struct {
+    unsigned char digest[DIGEST_MAX_PARTS][MULTIPART_DIGEST_MAX_SIZE];
+    size_t size[DIGEST_MAX_PARTS];
+    int parts;
+} digest_test_data;
+
+static int digest_part_end(multipart_parser* p) {
+    digest_test_data *d = (digest_test_data*)multipart_parser_get_data(p);
+    if (d->parts < DIGEST_MAX_PARTS) {
+        d->size[d->parts] = multipart_parser_get_digest(p, d->digest[d->parts]);
+    }
+    d->parts++;
+    return 0;
+}
+
+static int digest_span(multipart_parser* p, size_t offset, size_t length) {
+    (void)p;
+    (void)offset;
+    (void)length;
+    return 0;
+}
+
+/* Parse msg in chunks with the given digest; span mode if span is set */
+static int digest_parse(const char *msg, size_t len, size_t chunk,
+                        multipart_digest_type type, int span,
+                        size_t max_depth, digest_test_data *d) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t offset, n;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data_end = digest_part_end;
+    callbacks.on_part_data_span = span ? digest_span : NULL;
+    callbacks.digest = type;
+    callbacks.max_depth = max_depth;
+    callbacks.decode_transfer_encoding = 1;
+    memset(d, 0, sizeof(digest_test_data));
+
+    parser = multipart_parser_init("dg", &callbacks);
+    if (parser == NULL) {
+        return 0;
+    }
+    multipart_parser_set_data(parser, d);
+    for (offset = 0; offset < len; offset += n) {
+        n = len - offset < chunk ? len - offset : chunk;
+        if (multipart_parser_execute(parser, msg + offset, n) != n) {
+            break;
+        }
+    }
+    multipart_parser_free(parser);
+    return offset == len;
+}
+
+/* Bitwise CRC-32C reference */
+static unsigned long crc32c_reference(const unsigned char *buf, size_t len) {
+    unsigned long crc = 0xffffffffUL;
+    size_t i;
+    int k;
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78UL : crc >> 1;
+        }
+    }
+    return crc ^ 0xffffffffUL;
+}
+
+static int digest_is_crc(const digest_test_data *d, int k, unsigned long crc) {
+    return d->size[k] == 4 &&
+           d->digest[k][0] == ((crc >> 24) & 0xff) &&
+           d->digest[k][1] == ((crc >> 16) & 0xff) &&
+           d->digest[k][2] == ((crc >> 8) & 0xff) &&
+           d->digest[k][3] == (crc & 0xff);
+}
+
+static int digest_is_hex(const digest_test_data *d, int k, const char *hex) {
+    char got[2 * MULTIPART_DIGEST_MAX_SIZE + 1];
+    size_t i;
+    for (i = 0; i < d->size[k]; i++) {
+        sprintf(got + 2 * i, "%02x", d->digest[k][i]);
+    }
+    got[2 * d->size[k]] = '\0';
+    return strcmp(got, hex) == 0;
+}
+
+/* Test: CRC-32C of the part data for every chunking, callback and span mode */
+void test_digest_crc32c(void) {
+    static char msg[8192];
+    unsigned char data[3000];
+    size_t len, chunk, k;
+    digest_test_data d;
+    unsigned long crc;
+    int span;
+
+    TEST_START("Part digest: CRC-32C across chunk sizes and span mode");
+
+    for (k = 0; k < sizeof(data); k++) {
+        data[k] = (unsigned char)(k % 5 == 0 ? '\r' : k * 131 + k / 97);
+    }
+    crc = crc32c_reference(data, sizeof(data));
+    len = (size_t)sprintf(msg, "--dg\r\n\r\n123456789\r\n--dg\r\n\r\n");
+    memcpy(msg + len, data, sizeof(data));
+    len += sizeof(data);
+    len += (size_t)sprintf(msg + len, "\r\n--dg\r\n\r\n\r\n--dg--");
+
+    for (span = 0; span < 2; span++) {
+        for (chunk = 1; chunk <= len; chunk += (chunk < 64 ? 1 : 97)) {
+            if (!digest_parse(msg, len, chunk, MULTIPART_DIGEST_CRC32C, span, 0, &d) ||
+                d.parts != 3 || !digest_is_crc(&d, 0, 0xe3069283UL) ||
+                !digest_is_crc(&d, 1, crc) || !digest_is_crc(&d, 2, 0)) {
+                printf("(chunk size %lu%s) ", (unsigned long)chunk, span ? ", span" : "");
+                TEST_FAIL("CRC-32C differs from the reference");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: SHA-256 test vectors, including one spanning many blocks */
+void test_digest_sha256(void) {
+    static char msg[1000100];
+    size_t len, chunks[3];
+    digest_test_data d;
+    int k;
+
+    TEST_START("Part digest: SHA-256 test vectors");
+
+    len = (size_t)sprintf(msg, "--dg\r\n\r\nabc\r\n--dg\r\n\r\n\r\n--dg\r\n\r\n");
+    memset(msg + len, 'a', 1000000);
+    len += 1000000;
+    len += (size_t)sprintf(msg + len, "\r\n--dg--");
+
+    chunks[0] = len;
+    chunks[1] = 63;
+    chunks[2] = 4099;
+    for (k = 0; k < 3; k++) {
+        if (!digest_parse(msg, len, chunks[k], MULTIPART_DIGEST_SHA256, 0, 0, &d) ||
+            d.parts != 3 ||
+            !digest_is_hex(&d, 0, "ba7816bf8f01cfea414140de5dae2223"
+                                  "b00361a396177a9cb410ff61f20015ad") ||
+            !digest_is_hex(&d, 1, "e3b0c44298fc1c149afbf4c8996fb924"
+                                  "27ae41e4649b934ca495991b7852b855") ||
+            !digest_is_hex(&d, 2, "cdc76e5c9914fb9281a1c7e284d73e67"
+                                  "f1809a48a497200e046d39ccc7112cd0")) {
+            printf("(chunk size %lu) ", (unsigned long)chunks[k]);
+            TEST_FAIL("SHA-256 differs from the test vector");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: decoded data is hashed, nested bodies have no digest of their own */
+void test_digest_decoded_nested(void) {
+    const char *msg =
+        "--dg\r\n"
+        "Content-Transfer-Encoding: base64\r\n"
+        "\r\n"
+        "YWJj\r\n"
+        "--dg\r\n"
+        "Content-Type: multipart/mixed; boundary=in\r\n"
+        "\r\n"
+        "--in\r\n\r\nabc\r\n--in--\r\n"
+        "--dg--";
+    size_t len = strlen(msg);
+    digest_test_data d;
+
+    TEST_START("Part digest: decoded parts, nested bodies and the default");
+
+    if (!digest_parse(msg, len, len, MULTIPART_DIGEST_SHA256, 0, 1, &d) ||
+        d.parts != 3 ||
+        !digest_is_hex(&d, 0, "ba7816bf8f01cfea414140de5dae2223"
+                              "b00361a396177a9cb410ff61f20015ad") ||
+        !digest_is_hex(&d, 1, "ba7816bf8f01cfea414140de5dae2223"
+                              "b00361a396177a9cb410ff61f20015ad") ||
+        d.size[2] != 0) {
+        TEST_FAIL("Digest of decoded or nested parts wrong");
+        return;
+    }
+
+    if (!digest_parse(msg, len, len, MULTIPART_DIGEST_NONE, 0, 1, &d) ||
+        d.parts != 3 || d.size[0] != 0 || d.size[1] != 0) {
+        TEST_FAIL("Digest reported without the setting");
+        return;
+    }
+
+    TEST_PASS();
+}
@@ -0,0 +1,440 @@
+/* Encoder Tests
+ * Tests for multipart_encoder
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "test_common.h"
+#include "multipart_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ENCODE_MAX_PARTS 4
+
+/* What the parser saw of an encoded body */
+typedef struct {
+    char names[ENCODE_MAX_PARTS][32];
+    char filenames[ENCODE_MAX_PARTS][32];
+    char types[ENCODE_MAX_PARTS][32];
+    char data[ENCODE_MAX_PARTS][64];
+    size_t data_len[ENCODE_MAX_PARTS];
+    unsigned long sum;
+    int parts;
+    int body_end;
+} encode_test_data;
+
+static void encode_copy_slice(char *out, size_t size, const multipart_slice *s) {
+    size_t n = s->at != NULL && s->length < size ? s->length : 0;
+    memcpy(out, s->at != NULL ? s->at : "", n);
+    out[n] = '\0';
+}
+
+static int encode_part_headers(multipart_parser* p,
+                               const multipart_part_headers* headers) {
+    encode_test_data *d = (encode_test_data*)multipart_parser_get_data(p);
+    if (d->parts < ENCODE_MAX_PARTS) {
+        encode_copy_slice(d->names[d->parts], 32, &headers->name);
+        encode_copy_slice(d->filenames[d->parts], 32, &headers->filename);
+        encode_copy_slice(d->types[d->parts], 32, &headers->content_type);
+    }
+    return 0;
+}
+
+static int encode_part_data(multipart_parser* p, const char *at, size_t length) {
+    encode_test_data *d = (encode_test_data*)multipart_parser_get_data(p);
+    size_t k;
+    for (k = 0; k < length; k++) {
+        d->sum = d->sum * 31 + (unsigned char)at[k];
+    }
+    if (d->parts < ENCODE_MAX_PARTS && d->data_len[d->parts] + length < 64) {
+        memcpy(d->data[d->parts] + d->data_len[d->parts], at, length);
+    }
+    if (d->parts < ENCODE_MAX_PARTS) {
+        d->data_len[d->parts] += length;
+    }
+    return 0;
+}
+
+static int encode_part_end(multipart_parser* p) {
+    ((encode_test_data*)multipart_parser_get_data(p))->parts++;
+    return 0;
+}
+
+static int encode_body_end(multipart_parser* p) {
+    ((encode_test_data*)multipart_parser_get_data(p))->body_end = 1;
+    return 0;
+}
+
+/* Parse an encoded body; returns 1 if all of it was parsed */
+static int encode_parse(const char *body, size_t len, const char *boundary,
+                        encode_test_data *d) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t parsed;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_headers = encode_part_headers;
+    callbacks.on_part_data = encode_part_data;
+    callbacks.on_part_data_end = encode_part_end;
+    callbacks.on_body_end = encode_body_end;
+    memset(d, 0, sizeof(encode_test_data));
+
+    parser = multipart_parser_init(boundary, &callbacks);
+    if (parser == NULL) {
+        return 0;
+    }
+    multipart_parser_set_data(parser, d);
+    parsed = multipart_parser_execute(parser, body, len);
+    multipart_parser_free(parser);
+    return parsed == len && d->body_end;
+}
+
+static multipart_slice encode_slice(const char *s) {
+    multipart_slice slice;
+    slice.at = s;
+    slice.length = s != NULL ? strlen(s) : 0;
+    return slice;
+}
+
+/* Drain the encoder into out, step bytes per "write"; returns the length */
+static size_t encode_drain(multipart_encoder* e, char *out, size_t size,
+                           size_t step) {
+    struct iovec iov[8];
+    size_t len = 0;
+    size_t n_iov, n;
+
+    while (multipart_encoder_pending(e) > 0) {
+        n_iov = multipart_encoder_next_iovec(e, iov, 8);
+        if (n_iov == 0) {
+            break;
+        }
+        n = iov[0].iov_len < step ? iov[0].iov_len : step;
+        if (len + n > size) {
+            break;
+        }
+        memcpy(out + len, iov[0].iov_base, n);
+        len += n;
+        multipart_encoder_consume(e, n);
+    }
+    return len;
+}
+
+/* Test: headers are quoted, the body parses back, partial writes resume */
+void test_encode_round_trip(void) {
+    static const char expected[] =
+        "--enc\r\n"
+        "Content-Disposition: form-data; name=\"a\\\"b\\\\c\"; filename=\"f.txt\"\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "hello world\r\n"
+        "--enc\r\n"
+        "Content-Disposition: form-data; name=\"x\"\r\n"
+        "\r\n"
+        "\r\n"
+        "--enc\r\n"
+        "\r\n"
+        "raw\r\n"
+        "--enc--\r\n";
+    static const size_t steps[] = { 1, 3, 4096 };
+    multipart_part_headers headers;
+    multipart_encoder* e;
+    encode_test_data d;
+    char out[512];
+    size_t len, k;
+
+    TEST_START("Encoder: round trip through the parser");
+
+    for (k = 0; k < sizeof(steps) / sizeof(steps[0]); k++) {
+        e = multipart_encoder_create("enc");
+        if (e == NULL) {
+            TEST_FAIL("Encoder creation failed");
+            return;
+        }
+        memset(&headers, 0, sizeof(headers));
+        headers.name = encode_slice("a\"b\\c");
+        headers.filename = encode_slice("f.txt");
+        headers.content_type = encode_slice("text/plain");
+        multipart_encoder_begin_part(e, &headers);
+        multipart_encoder_add_data(e, "hello", 5);
+        multipart_encoder_add_data(e, " world", 6);
+
+        memset(&headers, 0, sizeof(headers));
+        headers.name = encode_slice("x");
+        multipart_encoder_begin_part(e, &headers);
+
+        multipart_encoder_begin_part(e, NULL);
+        multipart_encoder_add_data(e, "raw", 3);
+        if (multipart_encoder_finish(e) != 0 ||
+            multipart_encoder_pending(e) != sizeof(expected) - 1) {
+            multipart_encoder_free(e);
+            TEST_FAIL("Parts not queued");
+            return;
+        }
+
+        len = encode_drain(e, out, sizeof(out), steps[k]);
+        multipart_encoder_free(e);
+        if (len != sizeof(expected) - 1 || memcmp(out, expected, len) != 0) {
+            TEST_FAIL("Encoded body differs");
+            return;
+        }
+    }
+
+    if (!encode_parse(out, len, "enc", &d) || d.parts != 3 ||
+        strcmp(d.names[0], "a\"b\\c") != 0 ||
+        strcmp(d.filenames[0], "f.txt") != 0 ||
+        strcmp(d.types[0], "text/plain") != 0 ||
+        d.data_len[0] != 11 || memcmp(d.data[0], "hello world", 11) != 0 ||
+        strcmp(d.names[1], "x") != 0 || d.data_len[1] != 0 ||
+        d.data_len[2] != 3 || memcmp(d.data[2], "raw", 3) != 0) {
+        TEST_FAIL("Parsed parts differ");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: payloads and delimiters are referenced, not copied */
+void test_encode_zero_copy(void) {
+    static const char payload[] = "payload bytes";
+    char name[MULTIPART_ENCODER_HEADER_SIZE + 1];
+    struct iovec iov[8];
+    multipart_part_headers headers;
+    multipart_encoder* e;
+    size_t n, k;
+
+    TEST_START("Encoder: payload and delimiter vectors");
+
+    e = multipart_encoder_create("zc");
+    if (e == NULL) {
+        TEST_FAIL("Encoder creation failed");
+        return;
+    }
+    multipart_encoder_begin_part(e, NULL);
+    multipart_encoder_add_data(e, payload, sizeof(payload) - 1);
+    multipart_encoder_begin_part(e, NULL);
+    multipart_encoder_add_data(e, payload, 0);
+    multipart_encoder_begin_part(e, NULL);
+
+    /* delimiter, headers, payload, then two delimiter + headers pairs */
+    n = multipart_encoder_next_iovec(e, iov, 8);
+    if (n != 7 || iov[2].iov_base != (void*)payload ||
+        iov[2].iov_len != sizeof(payload) - 1 ||
+        iov[3].iov_base != iov[5].iov_base ||
+        (char*)iov[0].iov_base != (char*)iov[3].iov_base + 2) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Vectors do not reference the payload and delimiter");
+        return;
+    }
+
+    /* A full queue takes no more until some of it is written */
+    for (k = 0; multipart_encoder_add_data(e, payload, 1) == 0; k++) {
+    }
+    if (errno != ENOBUFS || k != MULTIPART_ENCODER_MAX_SEGMENTS - 7) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Full queue not reported");
+        return;
+    }
+    multipart_encoder_consume(e, multipart_encoder_pending(e));
+    if (multipart_encoder_pending(e) != 0 ||
+        multipart_encoder_add_data(e, payload, 1) != 0) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Queue not reusable after writing");
+        return;
+    }
+
+    /* A header block larger than the buffer can never be queued */
+    memset(name, 'n', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    memset(&headers, 0, sizeof(headers));
+    headers.name = encode_slice(name);
+    multipart_encoder_consume(e, multipart_encoder_pending(e));
+    if (multipart_encoder_begin_part(e, &headers) != -1 || errno != EMSGSIZE) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Oversized header block not rejected");
+        return;
+    }
+    multipart_encoder_free(e);
+
+    TEST_PASS();
+}
+
+/* Test: invalid boundaries, header values and call order */
+void test_encode_errors(void) {
+    static const char *const invalid[] = {
+        "", "trailing ", "at@sign", "semi;colon",
+        "12345678901234567890123456789012345678901234567890123456789012345678901"
+    };
+    multipart_part_headers headers;
+    multipart_encoder* e;
+    char out[64];
+    size_t k, len;
+
+    TEST_START("Encoder: invalid input");
+
+    for (k = 0; k < sizeof(invalid) / sizeof(invalid[0]); k++) {
+        e = multipart_encoder_create(invalid[k]);
+        if (e != NULL) {
+            multipart_encoder_free(e);
+            TEST_FAIL("Invalid boundary accepted");
+            return;
+        }
+    }
+    if (multipart_encoder_create(NULL) != NULL) {
+        TEST_FAIL("NULL boundary accepted");
+        return;
+    }
+
+    e = multipart_encoder_create("It's (a) boundary+_,-./:=?");
+    if (e == NULL) {
+        TEST_FAIL("Valid boundary rejected");
+        return;
+    }
+    multipart_encoder_free(e);
+
+    e = multipart_encoder_create("err");
+    if (e == NULL) {
+        TEST_FAIL("Encoder creation failed");
+        return;
+    }
+    errno = 0;
+    if (multipart_encoder_add_data(e, "x", 1) != -1 || errno != EINVAL) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Data before a part accepted");
+        return;
+    }
+    memset(&headers, 0, sizeof(headers));
+    headers.name = encode_slice("a\r\nX-Injected: 1");
+    errno = 0;
+    if (multipart_encoder_begin_part(e, &headers) != -1 || errno != EINVAL ||
+        multipart_encoder_pending(e) != 0) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Line break in a header value accepted");
+        return;
+    }
+
+    /* A body without parts is just the closing delimiter */
+    if (multipart_encoder_finish(e) != 0 ||
+        multipart_encoder_finish(e) != -1 ||
+        multipart_encoder_begin_part(e, NULL) != -1 || errno != EINVAL) {
+        multipart_encoder_free(e);
+        TEST_FAIL("Parts accepted after finish");
+        return;
+    }
+    len = encode_drain(e, out, sizeof(out), 64);
+    multipart_encoder_free(e);
+    if (len != 9 || memcmp(out, "--err--\r\n", 9) != 0) {
+        TEST_FAIL("Empty body not encoded");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: file ranges and buffers written to a non-blocking pipe */
+void test_encode_write(void) {
+    const size_t file_len = 200000;
+    const size_t range_offset = 100;
+    const size_t range_len = 150000;
+    multipart_part_headers headers;
+    multipart_encoder* e;
+    encode_test_data d;
+    unsigned long sum = 0;
+    char path[64];
+    char *file, *body;
+    size_t len = 0, k;
+    ssize_t n;
+    int fds[2];
+    int in_fd, result;
+
+    TEST_START("Encoder: file ranges to a non-blocking pipe");
+
+    file = (char*)malloc(file_len);
+    body = (char*)malloc(file_len + 1024);
+    if (file == NULL || body == NULL) {
+        free(file);
+        free(body);
+        TEST_FAIL("Allocation failed");
+        return;
+    }
+    for (k = 0; k < file_len; k++) {
+        file[k] = (char)('a' + k % 23);
+    }
+    for (k = range_offset; k < range_offset + range_len; k++) {
+        sum = sum * 31 + (unsigned char)file[k];
+    }
+
+    strcpy(path, "/tmp/multipart_encode_XXXXXX");
+    in_fd = mkstemp(path);
+    if (in_fd < 0 || write(in_fd, file, file_len) != (ssize_t)file_len ||
+        pipe(fds) != 0) {
+        if (in_fd >= 0) {
+            close(in_fd);
+            unlink(path);
+        }
+        free(file);
+        free(body);
+        TEST_FAIL("Test file setup failed");
+        return;
+    }
+    unlink(path);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    e = multipart_encoder_create("wr");
+    memset(&headers, 0, sizeof(headers));
+    headers.name = encode_slice("file");
+    headers.filename = encode_slice("data.bin");
+    multipart_encoder_begin_part(e, &headers);
+    multipart_encoder_add_file(e, in_fd, (off_t)range_offset, range_len);
+    multipart_encoder_begin_part(e, NULL);
+    multipart_encoder_add_data(e, "tail", 4);
+    multipart_encoder_finish(e);
+
+    /* Drain the pipe whenever it is full */
+    while ((result = multipart_encoder_write(e, fds[1])) != 0 &&
+           errno == EAGAIN) {
+        n = read(fds[0], body + len, file_len + 1024 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fds[1]);
+    while (result == 0 &&
+           (n = read(fds[0], body + len, file_len + 1024 - len)) > 0) {
+        len += (size_t)n;
+    }
+    close(fds[0]);
+    multipart_encoder_free(e);
+
+    if (result != 0 || !encode_parse(body, len, "wr", &d) || d.parts != 2 ||
+        strcmp(d.filenames[0], "data.bin") != 0 ||
+        d.data_len[0] != range_len || d.data_len[1] != 4 ||
+        d.sum != sum * 31 * 31 * 31 * 31 + ((('t' * 31 + 'a') * 31 + 'i') * 31 + 'l')) {
+        close(in_fd);
+        free(file);
+        free(body);
+        TEST_FAIL("Written body differs");
+        return;
+    }
+
+    /* A range past the end of the file fails instead of spinning */
+    e = multipart_encoder_create("wr");
+    multipart_encoder_begin_part(e, NULL);
+    multipart_encoder_add_file(e, in_fd, (off_t)(file_len - 10), 20);
+    result = pipe(fds);
+    if (result == 0) {
+        result = multipart_encoder_write(e, fds[1]);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    multipart_encoder_free(e);
+    close(in_fd);
+    free(file);
+    free(body);
+    if (result != -1 || errno != EIO) {
+        TEST_FAIL("Short file range not reported");
+        return;
+    }
+
+    TEST_PASS();
+}
@@ -0,0 +1,459 @@
+/* Header Accumulation Tests
+ * Tests for on_part_headers and the pre-parsed multipart_part_headers
+ */
+#include "test_common.h"
+
+#define HEADERS_MAX_PARTS 4
+#define HEADERS_VALUE_SIZE 64
+
+/* Copies of the slices reported for each part ("-" when absent) */
+typedef struct {
+    char disposition[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    char name[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    char filename[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    char content_type[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    char transfer_encoding[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    int truncated[HEADERS_MAX_PARTS];
+    int parts;
+    int complete_calls;
+} headers_test_data;
+
+static void copy_slice(char *out, multipart_slice s) {
+    size_t n;
+    if (s.at == NULL) {
+        strcpy(out, "-");
+        return;
+    }
+    n = s.length < HEADERS_VALUE_SIZE - 1 ? s.length : HEADERS_VALUE_SIZE - 1;
+    memcpy(out, s.at, n);
+    out[n] = '\0';
+}
+
+static int on_part_headers_test(multipart_parser* p,
+                                const multipart_part_headers* h) {
+    headers_test_data *ctx = (headers_test_data*)multipart_parser_get_data(p);
+    int k = ctx->parts;
+    if (k >= HEADERS_MAX_PARTS || ctx->complete_calls != k) {
+        return 1;
+    }
+    copy_slice(ctx->disposition[k], h->disposition);
+    copy_slice(ctx->name[k], h->name);
+    copy_slice(ctx->filename[k], h->filename);
+    copy_slice(ctx->content_type[k], h->content_type);
+    copy_slice(ctx->transfer_encoding[k], h->transfer_encoding);
+    ctx->truncated[k] = h->truncated;
+    ctx->parts++;
+    return 0;
+}
+
+static int on_headers_complete_test(multipart_parser* p) {
+    headers_test_data *ctx = (headers_test_data*)multipart_parser_get_data(p);
+    ctx->complete_calls++;
+    return 0;
+}
+
+static int parse_headers_message(const char *msg, size_t chunk,
+                                 size_t arena_size, headers_test_data *ctx) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+    size_t offset, n;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_headers = on_part_headers_test;
+    callbacks.on_headers_complete = on_headers_complete_test;
+    callbacks.header_arena_size = arena_size;
+
+    memset(ctx, 0, sizeof(headers_test_data));
+    parser = multipart_parser_init("hdr", &callbacks);
+    if (parser == NULL) {
+        return -1;
+    }
+    multipart_parser_set_data(parser, ctx);
+
+    for (offset = 0; offset < len; offset += n) {
+        n = len - offset < chunk ? len - offset : chunk;
+        if (multipart_parser_execute(parser, msg + offset, n) != n) {
+            multipart_parser_free(parser);
+            return -1;
+        }
+    }
+    multipart_parser_free(parser);
+    return 0;
+}
+
+static const char *headers_message =
+    "--hdr\r\n"
+    "content-disposition: form-data; name=\"upload\"; "
+    "filename=\"my \\\"best\\\" photo.jpg\"\r\n"
+    "Content-Type:   image/jpeg  \r\n"
+    "X-Other: ignored\r\n"
+    "CONTENT-TRANSFER-ENCODING: binary\r\n"
+    "\r\n"
+    "data\r\n"
+    "--hdr\r\n"
+    "Content-Disposition: form-data ; name = plain ; filename=\r\n"
+    "\r\n"
+    "value\r\n"
+    "--hdr--";
+
+static int check_headers_message(const headers_test_data *ctx) {
+    return ctx->parts == 2 && ctx->complete_calls == 2 &&
+        strcmp(ctx->disposition[0], "form-data") == 0 &&
+        strcmp(ctx->name[0], "upload") == 0 &&
+        strcmp(ctx->filename[0], "my \"best\" photo.jpg") == 0 &&
+        strcmp(ctx->content_type[0], "image/jpeg") == 0 &&
+        strcmp(ctx->transfer_encoding[0], "binary") == 0 &&
+        ctx->truncated[0] == 0 &&
+        strcmp(ctx->disposition[1], "form-data") == 0 &&
+        strcmp(ctx->name[1], "plain") == 0 &&
+        strcmp(ctx->filename[1], "") == 0 &&
+        strcmp(ctx->content_type[1], "-") == 0 &&
+        strcmp(ctx->transfer_encoding[1], "-") == 0;
+}
+
+/* Test: known headers are extracted and unquoted */
+void test_headers_parsed_fields(void) {
+    static headers_test_data ctx;
+    size_t len = strlen(headers_message);
+
+    TEST_START("Header accumulation: pre-parsed fields");
+
+    if (parse_headers_message(headers_message, len, 0, &ctx) != 0) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    if (!check_headers_message(&ctx)) {
+        TEST_FAIL("Pre-parsed headers differ");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: header values split across chunks are reassembled */
+void test_headers_chunk_sweep(void) {
+    static headers_test_data ctx;
+    size_t len = strlen(headers_message);
+    size_t chunk;
+
+    TEST_START("Header accumulation: chunk size sweep");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        if (parse_headers_message(headers_message, chunk, 0, &ctx) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Parse failed");
+            return;
+        }
+        if (!check_headers_message(&ctx)) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Pre-parsed headers differ");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: headers that do not fit are dropped and reported as truncated */
+void test_headers_arena_overflow(void) {
+    const char *msg =
+        "--hdr\r\n"
+        "X-Long: 0123456789012345678901234567890123456789\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "x\r\n"
+        "--hdr--";
+    static headers_test_data ctx;
+
+    TEST_START("Header accumulation: arena overflow");
+
+    if (parse_headers_message(msg, strlen(msg), 32, &ctx) != 0) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    if (ctx.parts != 1 || ctx.truncated[0] == 0 ||
+        strcmp(ctx.content_type[0], "text/plain") != 0) {
+        TEST_FAIL("Oversized header not dropped cleanly");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Records the header ID seen by each on_header_value call */
+typedef struct {
+    int ids[16];
+    int count;
+    int last_value_header;  /* value callbacks of one header share an entry */
+} header_id_data;
+
+static int on_header_field_id(multipart_parser* p, const char *at, size_t length) {
+    header_id_data *ctx = (header_id_data*)multipart_parser_get_data(p);
+    (void)at;
+    (void)length;
+    ctx->last_value_header = 0;
+    return 0;
+}
+
+static int on_header_value_id(multipart_parser* p, const char *at, size_t length) {
+    header_id_data *ctx = (header_id_data*)multipart_parser_get_data(p);
+    (void)at;
+    (void)length;
+    if (!ctx->last_value_header && ctx->count < 16) {
+        ctx->ids[ctx->count++] = multipart_parser_get_header_id(p);
+        ctx->last_value_header = 1;
+    }
+    return 0;
+}
+
+/* Test: well-known header names map to IDs in any chunking */
+void test_headers_header_ids(void) {
+    const char *msg =
+        "--hdr\r\n"
+        "CONTENT-disposition: form-data; name=\"a\"\r\n"
+        "Content-Typ: x\r\n"
+        "Content-Typex: x\r\n"
+        "content-type: text/plain\r\n"
+        "Content-Transfer-Encoding: 8bit\r\n"
+        "Content: x\r\n"
+        "\r\n"
+        "x\r\n"
+        "--hdr--";
+    static const int expected[] = {
+        MULTIPART_HEADER_CONTENT_DISPOSITION,
+        MULTIPART_HEADER_OTHER,
+        MULTIPART_HEADER_OTHER,
+        MULTIPART_HEADER_CONTENT_TYPE,
+        MULTIPART_HEADER_CONTENT_TRANSFER_ENCODING,
+        MULTIPART_HEADER_OTHER
+    };
+    static header_id_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+    size_t chunk, offset, n;
+
+    TEST_START("Header IDs: well-known names recognized");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = on_header_field_id;
+    callbacks.on_header_value = on_header_value_id;
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        memset(&ctx, 0, sizeof(ctx));
+        parser = multipart_parser_init("hdr", &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        multipart_parser_set_data(parser, &ctx);
+        for (offset = 0; offset < len; offset += n) {
+            n = len - offset < chunk ? len - offset : chunk;
+            multipart_parser_execute(parser, msg + offset, n);
+        }
+        multipart_parser_free(parser);
+
+        if (ctx.count != 6 || memcmp(ctx.ids, expected, sizeof(expected)) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Wrong header IDs");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Concatenation of every header field and value callback */
+typedef struct {
+    char text[512];
+    size_t len;
+} header_text_data;
+
+static int append_header_text(multipart_parser* p, const char *at, size_t length) {
+    header_text_data *ctx = (header_text_data*)multipart_parser_get_data(p);
+    if (ctx->len + length >= sizeof(ctx->text)) {
+        return 1;
+    }
+    memcpy(ctx->text + ctx->len, at, length);
+    ctx->len += length;
+    return 0;
+}
+
+/* Test: header lines are scanned in runs, leading SP/HTAB skipped */
+void test_headers_line_scan(void) {
+    const char *msg =
+        "--hdr\r\n"
+        "A: 1\r\n"
+        "B:\t 2 x\t\r\n"
+        "C-d:\r\n"
+        "Ee:: 3\r\n"
+        "\r\n"
+        "x\r\n"
+        "--hdr\r\n"
+        "F1: 4\r\n"
+        "\r\n"
+        "--hdr--";
+    const char *expected = "A1B2 x\tC-dEe: 3";
+    static header_text_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+    size_t fail_at = strlen(msg) - strlen("1: 4\r\n\r\n--hdr--");
+    size_t chunk, offset, n, parsed;
+
+    TEST_START("Header scan: runs, leading whitespace, invalid name byte");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = append_header_text;
+    callbacks.on_header_value = append_header_text;
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        memset(&ctx, 0, sizeof(ctx));
+        parser = multipart_parser_init("hdr", &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        multipart_parser_set_data(parser, &ctx);
+        parsed = 0;
+        for (offset = 0; offset < len; offset += n) {
+            n = len - offset < chunk ? len - offset : chunk;
+            parsed = multipart_parser_execute(parser, msg + offset, n);
+            if (parsed != n) {
+                break;
+            }
+        }
+        /* The digit in "F1" is not a header name character */
+        if (offset + parsed != fail_at ||
+            multipart_parser_get_error(parser) != MPPE_INVALID_HEADER_FIELD) {
+            multipart_parser_free(parser);
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Invalid name byte not rejected at its offset");
+            return;
+        }
+        multipart_parser_free(parser);
+
+        /* "F" is only reported when a chunk ends right after it */
+        if (ctx.len < strlen(expected) || ctx.len > strlen(expected) + 1 ||
+            memcmp(ctx.text, expected, strlen(expected)) != 0 ||
+            (ctx.len > strlen(expected) && ctx.text[ctx.len - 1] != 'F')) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Header callbacks differ");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Header-only scan: names and data lengths of the parts seen, stopping at
+ * the headers of part stop_at */
+typedef struct {
+    char name[HEADERS_MAX_PARTS][HEADERS_VALUE_SIZE];
+    size_t length[HEADERS_MAX_PARTS];
+    int parts;
+    int ends;
+    int stop_at;
+} scan_test_data;
+
+static int on_part_headers_scan(multipart_parser* p,
+                                const multipart_part_headers* h) {
+    scan_test_data *ctx = (scan_test_data*)multipart_parser_get_data(p);
+    if (ctx->parts == ctx->stop_at || ctx->parts >= HEADERS_MAX_PARTS) {
+        return 1;
+    }
+    copy_slice(ctx->name[ctx->parts++], h->name);
+    return 0;
+}
+
+static int on_part_data_end_scan(multipart_parser* p) {
+    scan_test_data *ctx = (scan_test_data*)multipart_parser_get_data(p);
+    if (ctx->ends >= HEADERS_MAX_PARTS ||
+        multipart_parser_get_part_length(p, &ctx->length[ctx->ends]) != 0) {
+        return 1;
+    }
+    ctx->ends++;
+    return 0;
+}
+
+/* Test: headers and data lengths without data callbacks, stopping early */
+void test_headers_scan_only(void) {
+    static const char head[] =
+        "--scan\r\n"
+        "Content-Disposition: form-data; name=\"meta\"\r\n"
+        "\r\n"
+        "{\"a\":1}\r\n"
+        "--scan\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"big.bin\"\r\n"
+        "\r\n";
+    static const char tail[] =
+        "\r\n--scan\r\n"
+        "Content-Disposition: form-data; name=\"late\"\r\n"
+        "\r\n"
+        "never seen\r\n"
+        "--scan--";
+    const size_t file_size = 300000;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    scan_test_data ctx;
+    char *msg;
+    size_t len, offset, n, parsed, stop;
+    size_t i;
+
+    TEST_START("Header-only scan: part lengths and early stop");
+
+    len = sizeof(head) - 1 + file_size + sizeof(tail) - 1;
+    msg = (char*)malloc(len);
+    if (msg == NULL) {
+        TEST_FAIL("Memory allocation failed");
+        return;
+    }
+    memcpy(msg, head, sizeof(head) - 1);
+    for (i = 0; i < file_size; i++) {
+        msg[sizeof(head) - 1 + i] = (char)((i % 7 == 0) ? '\r' : i * 31);
+    }
+    memcpy(msg + sizeof(head) - 1 + file_size, tail, sizeof(tail) - 1);
+    /* The scan stops in front of the data of "late" */
+    stop = len - strlen("never seen\r\n--scan--");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_headers = on_part_headers_scan;
+    callbacks.on_part_data_end = on_part_data_end_scan;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.stop_at = 2;
+    parser = multipart_parser_init("scan", &callbacks);
+    if (parser == NULL) {
+        free(msg);
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(parser, &ctx);
+    for (offset = 0; offset < len; offset += parsed) {
+        n = len - offset < 4096 ? len - offset : 4096;
+        parsed = multipart_parser_execute(parser, msg + offset, n);
+        if (parsed != n) {
+            offset += parsed;
+            break;
+        }
+    }
+    if (multipart_parser_get_error(parser) != MPPE_PAUSED || offset != stop ||
+        multipart_parser_get_part_length(parser, &n) != 0 || n != file_size) {
+        multipart_parser_free(parser);
+        free(msg);
+        TEST_FAIL("Scan did not stop at the third part");
+        return;
+    }
+    multipart_parser_free(parser);
+    free(msg);
+
+    if (ctx.parts != 2 || ctx.ends != 2 ||
+        strcmp(ctx.name[0], "meta") != 0 || strcmp(ctx.name[1], "file") != 0 ||
+        ctx.length[0] != strlen("{\"a\":1}") || ctx.length[1] != file_size) {
+        TEST_FAIL("Wrong part names or lengths");
+        return;
+    }
+
+    TEST_PASS();
+}
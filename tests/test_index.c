@@ -0,0 +1,242 @@
+/* Part Index Tests
+ * Tests for multipart_parser_execute_index and multipart_index_find
+ */
+#include "test_common.h"
+
+static const char *index_message =
+    "--xx\r\n"
+    "Content-Disposition: form-data; name=\"meta\"\r\n"
+    "\r\n"
+    "{}\r\n"
+    "--xx\r\n"
+    "content-disposition: form-data; filename=\"a \\\"b\\\".txt\"; name=file\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "file body\r\n--x\r\n"
+    "--xx\r\n"
+    "Content-Type: multipart/mixed; boundary=in\r\n"
+    "\r\n"
+    "--in\r\n"
+    "Content-Disposition: attachment; filename=inner.bin\r\n"
+    "\r\n"
+    "inner\r\n"
+    "--in--\r\n"
+    "--xx\r\n"
+    "\r\n"
+    "\r\n"
+    "--xx--";
+
+#define INDEX_PARTS 5
+
+/* Offset of the n-th (0-based) occurrence of s in index_message */
+static size_t index_find(const char *s, int n) {
+    const char *at = index_message;
+    for (;;) {
+        at = strstr(at, s);
+        if (n-- == 0) {
+            return (size_t)(at - index_message);
+        }
+        at++;
+    }
+}
+
+/* Index index_message in chunks of the given size with room for max_entries
+ * entries, growing the array whenever the parser stops because it is full */
+static size_t index_in_chunks(size_t chunk, size_t max_entries,
+                              multipart_index *ix,
+                              multipart_index_entry *entries,
+                              char *strings, size_t strings_size) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(index_message);
+    size_t offset, n, parsed;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.max_depth = 1;
+    callbacks.buffer_size = 4;  /* not used while indexing */
+    memset(ix, 0, sizeof(multipart_index));
+    ix->entries = entries;
+    ix->max_entries = max_entries;
+    ix->strings = strings;
+    ix->strings_size = strings_size;
+
+    parser = multipart_parser_init("xx", &callbacks);
+    if (parser == NULL) {
+        return 0;
+    }
+    for (offset = 0; offset < len; offset += parsed) {
+        n = len - offset < chunk ? len - offset : chunk;
+        parsed = multipart_parser_execute_index(parser, index_message + offset,
+                                                n, ix);
+        if (parsed != n) {
+            if (ix->count < ix->max_entries) {
+                break;  /* parse error */
+            }
+            /* entries is sized for all parts; only the capacity grows */
+            ix->max_entries++;
+        }
+    }
+    multipart_parser_free(parser);
+    return offset;
+}
+
+/* Compare an entry with its expected ranges and parameters */
+static int index_entry_is(const multipart_index *ix, size_t k,
+                          size_t header_offset, size_t data_offset,
+                          size_t data_length, const char *name,
+                          const char *filename, size_t depth) {
+    const multipart_index_entry *e = ix->entries + k;
+
+    if (e->header_offset != header_offset || e->data_offset != data_offset ||
+        e->header_length != data_offset - header_offset ||
+        e->data_length != data_length || e->depth != depth) {
+        return 0;
+    }
+    if ((name == NULL) != !e->has_name ||
+        (name && (e->name_length != strlen(name) ||
+                  memcmp(ix->strings + e->name_offset, name, e->name_length) != 0))) {
+        return 0;
+    }
+    if ((filename == NULL) != !e->has_filename ||
+        (filename && (e->filename_length != strlen(filename) ||
+                      memcmp(ix->strings + e->filename_offset, filename,
+                             e->filename_length) != 0))) {
+        return 0;
+    }
+    return 1;
+}
+
+static int index_matches(const multipart_index *ix) {
+    size_t inner = index_find("--in\r\n", 0);
+
+    return ix->count == INDEX_PARTS && !ix->truncated &&
+        index_entry_is(ix, 0, index_find("--xx\r\n", 0) + 6,
+                       index_find("{}", 0), 2, "meta", NULL, 0) &&
+        index_entry_is(ix, 1, index_find("--xx\r\n", 1) + 6,
+                       index_find("file body", 0),
+                       strlen("file body\r\n--x"), "file", "a \"b\".txt", 0) &&
+        index_entry_is(ix, 2, index_find("--xx\r\n", 2) + 6, inner,
+                       index_find("\r\n--xx\r\n", 2) - inner, NULL, NULL, 0) &&
+        index_entry_is(ix, 3, inner + 6, index_find("inner\r\n", 0), 5,
+                       NULL, "inner.bin", 1) &&
+        index_entry_is(ix, 4, index_find("--xx\r\n", 3) + 6,
+                       index_find("--xx\r\n", 3) + 8, 0, NULL, NULL, 0);
+}
+
+/* Test: offsets, parameters and depth of every part */
+void test_index_single_chunk(void) {
+    multipart_index ix;
+    multipart_index_entry entries[INDEX_PARTS];
+    char strings[64];
+    size_t len = strlen(index_message);
+
+    TEST_START("Part index: ranges and names in one chunk");
+
+    if (index_in_chunks(len, INDEX_PARTS, &ix, entries, strings,
+                        sizeof(strings)) != len) {
+        TEST_FAIL("Indexing failed");
+        return;
+    }
+    if (!index_matches(&ix)) {
+        TEST_FAIL("Index differs from the message layout");
+        return;
+    }
+    /* Only the name and filename values are kept */
+    if (ix.strings_length != strlen("meta" "a \"b\".txt" "file" "inner.bin")) {
+        TEST_FAIL("Index strings not compacted");
+        return;
+    }
+    if (multipart_index_find(&ix, "file") != entries + 1 ||
+        multipart_index_find(&ix, "meta") != entries ||
+        multipart_index_find(&ix, "fil") != NULL) {
+        TEST_FAIL("Lookup by name failed");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: every chunk size yields the same index */
+void test_index_chunk_sweep(void) {
+    multipart_index ix;
+    multipart_index_entry entries[INDEX_PARTS];
+    char strings[64];
+    size_t len = strlen(index_message);
+    size_t chunk;
+
+    TEST_START("Part index: chunk size sweep");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        if (index_in_chunks(chunk, INDEX_PARTS, &ix, entries, strings,
+                            sizeof(strings)) != len || !index_matches(&ix)) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Index differs from single-chunk index");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: a full array stops at a part begin, too little room sets truncated */
+void test_index_limits(void) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_index ix;
+    multipart_index_entry entries[INDEX_PARTS];
+    char strings[24];  /* holds the first raw Content-Disposition only */
+    size_t len = strlen(index_message);
+    size_t parsed;
+
+    TEST_START("Part index: full entry array and small string storage");
+
+    /* Grown one entry at a time */
+    if (index_in_chunks(len, 1, &ix, entries, NULL, 0) != len ||
+        ix.count != INDEX_PARTS || !ix.truncated ||
+        entries[1].has_name || entries[4].data_length != 0) {
+        TEST_FAIL("Growing the entry array lost parts");
+        return;
+    }
+
+    /* Names longer than the strings storage are dropped */
+    if (index_in_chunks(len, INDEX_PARTS, &ix, entries, strings,
+                        sizeof(strings)) != len || !ix.truncated ||
+        !entries[0].has_name || entries[1].has_name || entries[1].has_filename ||
+        memcmp(strings + entries[0].name_offset, "meta", 4) != 0) {
+        TEST_FAIL("Oversized names not dropped");
+        return;
+    }
+
+    /* Not grown: later parts are skipped */
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    memset(&ix, 0, sizeof(ix));
+    ix.entries = entries;
+    ix.max_entries = 1;
+    parser = multipart_parser_init("xx", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    parsed = multipart_parser_execute_index(parser, index_message, len, &ix);
+    if (parsed != 6 || ix.count != 1 ||
+        entries[0].data_length != MULTIPART_INDEX_OPEN) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Full array did not stop at the part begin");
+        return;
+    }
+    while (parsed < len) {
+        parsed += multipart_parser_execute_index(parser, index_message + parsed,
+                                                 len - parsed, &ix);
+        if (multipart_parser_get_error(parser) != MPPE_OK) {
+            break;
+        }
+    }
+    multipart_parser_free(parser);
+    if (parsed != len || ix.count != 1 || !ix.truncated ||
+        entries[0].data_length != 2) {
+        TEST_FAIL("Parts beyond a full array not skipped");
+        return;
+    }
+
+    TEST_PASS();
+}
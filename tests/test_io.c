@@ -0,0 +1,565 @@
+/* I/O Front-end Tests
+ * Tests for multipart_parse_file
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "test_common.h"
+#include "multipart_io.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+/* Totals of the part data, so multi-megabyte bodies need no copy */
+typedef struct {
+    size_t data_len;
+    unsigned long sum;
+    int parts;
+    int body_end;
+    int pause_at_part;
+} io_test_data;
+
+static int io_part_data(multipart_parser* p, const char *at, size_t length) {
+    io_test_data *d = (io_test_data*)multipart_parser_get_data(p);
+    size_t k;
+    for (k = 0; k < length; k++) {
+        d->sum = d->sum * 31 + (unsigned char)at[k];
+    }
+    d->data_len += length;
+    return 0;
+}
+
+static int io_part_end(multipart_parser* p) {
+    io_test_data *d = (io_test_data*)multipart_parser_get_data(p);
+    d->parts++;
+    return d->parts == d->pause_at_part;
+}
+
+static int io_body_end(multipart_parser* p) {
+    ((io_test_data*)multipart_parser_get_data(p))->body_end = 1;
+    return 0;
+}
+
+static void io_settings(multipart_parser_settings *callbacks) {
+    memset(callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks->on_part_data = io_part_data;
+    callbacks->on_part_data_end = io_part_end;
+    callbacks->on_body_end = io_body_end;
+}
+
+/* Create a temporary file holding len bytes of data; returns 0 on success */
+static int io_write_file(char *path, const char *data, size_t len) {
+    FILE *f;
+    int fd;
+
+    strcpy(path, "/tmp/multipart_io_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    if (len > 0 && fwrite(data, 1, len, f) != len) {
+        fclose(f);
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Test: a body spanning several mapping windows */
+void test_io_parse_file(void) {
+    size_t head_len, first_len, second_len, len, k;
+    unsigned long sum = 0;
+    multipart_parser_settings callbacks;
+    io_test_data d;
+    char path[64];
+    char *body;
+    int result;
+
+    TEST_START("File front-end: body across mapping windows");
+
+    body = (char*)malloc(MULTIPART_IO_WINDOW * 2 + 256);
+    if (body == NULL) {
+        TEST_FAIL("Memory allocation failed");
+        return;
+    }
+    head_len = (size_t)sprintf(body, "--io\r\nContent-Type: application/octet-stream\r\n\r\n");
+    /* The first delimiter straddles the end of the first window, the
+     * second part fills the whole second window */
+    first_len = MULTIPART_IO_WINDOW - head_len - 3;
+    second_len = MULTIPART_IO_WINDOW;
+    for (k = 0; k < first_len; k++) {
+        body[head_len + k] = (char)(k * 7 + k / 251);
+        sum = sum * 31 + (unsigned char)body[head_len + k];
+    }
+    len = head_len + first_len;
+    len += (size_t)sprintf(body + len, "\r\n--io\r\n\r\n");
+    memset(body + len, 'x', second_len);
+    for (k = 0; k < second_len; k++) {
+        sum = sum * 31 + 'x';
+    }
+    len += second_len;
+    len += (size_t)sprintf(body + len, "\r\n--io--");
+
+    if (io_write_file(path, body, len) != 0) {
+        free(body);
+        TEST_FAIL("Could not write the temporary file");
+        return;
+    }
+    free(body);
+
+    io_settings(&callbacks);
+    memset(&d, 0, sizeof(d));
+    result = multipart_parse_file(path, "io", &callbacks, &d);
+    remove(path);
+
+    if (result != 0 || !d.body_end || d.parts != 2) {
+        TEST_FAIL("File not parsed completely");
+        return;
+    }
+    if (d.data_len != first_len + second_len || d.sum != sum) {
+        TEST_FAIL("Part data differs from the file contents");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: I/O errors, parse errors and pauses are reported */
+void test_io_errors(void) {
+    const char *body = "--io\r\n\r\na\r\n--io\r\n\r\nb\r\n--io--";
+    const char *bad = "--io\r\nBad Header: x\r\n\r\n";
+    multipart_parser_settings callbacks;
+    io_test_data d;
+    char path[64];
+    int result;
+
+    TEST_START("File front-end: errors and pauses");
+
+    io_settings(&callbacks);
+    memset(&d, 0, sizeof(d));
+    errno = 0;
+    if (multipart_parse_file("/nonexistent/multipart-body", "io", &callbacks, &d) != -1 ||
+        errno != ENOENT) {
+        TEST_FAIL("Missing file not reported");
+        return;
+    }
+
+    if (io_write_file(path, "", 0) != 0) {
+        TEST_FAIL("Could not write the temporary file");
+        return;
+    }
+    result = multipart_parse_file(path, "io", &callbacks, &d);
+    remove(path);
+    if (result != 0 || d.parts != 0) {
+        TEST_FAIL("Empty file not accepted");
+        return;
+    }
+
+    if (io_write_file(path, bad, strlen(bad)) != 0) {
+        TEST_FAIL("Could not write the temporary file");
+        return;
+    }
+    result = multipart_parse_file(path, "io", &callbacks, &d);
+    remove(path);
+    if (result != MPPE_INVALID_HEADER_FIELD) {
+        TEST_FAIL("Parse error not reported");
+        return;
+    }
+
+    if (io_write_file(path, body, strlen(body)) != 0) {
+        TEST_FAIL("Could not write the temporary file");
+        return;
+    }
+    d.pause_at_part = 1;
+    result = multipart_parse_file(path, "io", &callbacks, &d);
+    remove(path);
+    if (result != MPPE_PAUSED || d.parts != 1 || d.body_end) {
+        TEST_FAIL("Callback did not stop the parse");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Message with delimiter near misses at every distance from a buffer end */
+static size_t io_build_message(char *msg) {
+    size_t len = 0;
+    int k;
+
+    len += (size_t)sprintf(msg + len, "--reader-boundary\r\n\r\n");
+    for (k = 0; k < 40; k++) {
+        len += (size_t)sprintf(msg + len, "%d\r\n--reader-bound%s", k,
+                               k % 3 ? "\r" : "arY");
+    }
+    len += (size_t)sprintf(msg + len, "\r\n--reader-boundary\r\n\r\nend"
+                                      "\r\n--reader-boundary--");
+    return len;
+}
+
+/* Part data collected through multipart_reader_at() in span mode, or
+ * directly in callback mode */
+typedef struct {
+    multipart_reader *reader;
+    char data[4096];
+    size_t len;
+    int pause;
+    int bad_span;
+} reader_test_data;
+
+static int reader_span(multipart_parser* p, size_t offset, size_t length) {
+    reader_test_data *d = (reader_test_data*)multipart_parser_get_data(p);
+    const char *at;
+    size_t n;
+
+    while (length > 0) {
+        at = multipart_reader_at(d->reader, offset, &n);
+        if (at == NULL || d->len + length > sizeof(d->data)) {
+            d->bad_span = 1;
+            return 1;
+        }
+        if (n > length) {
+            n = length;
+        }
+        memcpy(d->data + d->len, at, n);
+        d->len += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int reader_data(multipart_parser* p, const char *at, size_t length) {
+    reader_test_data *d = (reader_test_data*)multipart_parser_get_data(p);
+    if (d->len + length > sizeof(d->data)) {
+        return 1;
+    }
+    memcpy(d->data + d->len, at, length);
+    d->len += length;
+    return d->pause;
+}
+
+/* Expected part data of io_build_message() */
+static size_t io_expected_data(char *out) {
+    static char msg[4096];
+    size_t len = io_build_message(msg);
+    size_t head = strlen("--reader-boundary\r\n\r\n");
+    size_t tail = strlen("\r\n--reader-boundary\r\n\r\nend\r\n--reader-boundary--");
+
+    memcpy(out, msg + head, len - head - tail);
+    memcpy(out + len - head - tail, "end", 3);
+    return len - head - tail + 3;
+}
+
+/* Test: readv() from a pipe into minimal buffers, spans resolved by offset */
+void test_io_reader_spans(void) {
+    static char msg[4096], expected[4096];
+    static reader_test_data d;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len, expected_len, nread;
+    int fds[2];
+    int result;
+
+    TEST_START("Buffer ring: readv() from a pipe in span mode");
+
+    len = io_build_message(msg);
+    expected_len = io_expected_data(expected);
+    if (pipe(fds) != 0) {
+        TEST_FAIL("pipe() failed");
+        return;
+    }
+    if (write(fds[1], msg, len) != (ssize_t)len) {
+        close(fds[0]);
+        close(fds[1]);
+        TEST_FAIL("write() failed");
+        return;
+    }
+    close(fds[1]);
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data_span = reader_span;
+    memset(&d, 0, sizeof(d));
+    parser = multipart_parser_init("reader-boundary", &callbacks);
+    d.reader = multipart_reader_create(parser, MULTIPART_MAX_BOUNDARY_LENGTH + 4, 3);
+    if (parser == NULL || d.reader == NULL ||
+        multipart_reader_create(parser, MULTIPART_MAX_BOUNDARY_LENGTH + 4, 2) != NULL) {
+        multipart_reader_free(d.reader);
+        multipart_parser_free(parser);
+        close(fds[0]);
+        TEST_FAIL("Reader setup failed");
+        return;
+    }
+    multipart_parser_set_data(parser, &d);
+
+    do {
+        result = multipart_reader_read(d.reader, fds[0], &nread);
+    } while (result == 0 && nread > 0);
+    close(fds[0]);
+    multipart_reader_free(d.reader);
+    multipart_parser_free(parser);
+
+    if (result != 0 || d.bad_span) {
+        TEST_FAIL("Read or span lookup failed");
+        return;
+    }
+    if (d.len != expected_len || memcmp(d.data, expected, expected_len) != 0) {
+        TEST_FAIL("Part data differs from the message");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: caller-issued reads of every size, with pauses */
+void test_io_reader_commit(void) {
+    static char msg[4096], expected[4096];
+    static reader_test_data d;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    struct iovec iov[4];
+    size_t len, expected_len, size, offset, n, k, n_iov;
+    int result;
+
+    TEST_START("Buffer ring: prepare/commit with pauses");
+
+    len = io_build_message(msg);
+    expected_len = io_expected_data(expected);
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = reader_data;
+
+    for (size = 1; size <= 300; size += 13) {
+        memset(&d, 0, sizeof(d));
+        d.pause = 1;
+        parser = multipart_parser_init("reader-boundary", &callbacks);
+        d.reader = multipart_reader_create(parser, 100, 4);
+        if (parser == NULL || d.reader == NULL) {
+            multipart_reader_free(d.reader);
+            multipart_parser_free(parser);
+            TEST_FAIL("Reader setup failed");
+            return;
+        }
+        multipart_parser_set_data(parser, &d);
+
+        result = 0;
+        for (offset = 0; offset < len && (result == 0 || result == MPPE_PAUSED);
+             offset += n) {
+            /* A paused reader still parses what it holds before new input */
+            n_iov = multipart_reader_prepare(d.reader, iov, 4);
+            n = 0;
+            for (k = 0; k < n_iov && offset + n < len && n < size; k++) {
+                size_t piece = iov[k].iov_len;
+                if (piece > size - n) {
+                    piece = size - n;
+                }
+                if (piece > len - offset - n) {
+                    piece = len - offset - n;
+                }
+                memcpy(iov[k].iov_base, msg + offset + n, piece);
+                n += piece;
+                if (piece < iov[k].iov_len) {
+                    break;
+                }
+            }
+            result = multipart_reader_commit(d.reader, n);
+        }
+        while (result == MPPE_PAUSED) {
+            result = multipart_reader_commit(d.reader, 0);
+        }
+        multipart_reader_free(d.reader);
+        multipart_parser_free(parser);
+
+        if (result != 0 || d.len != expected_len ||
+            memcmp(d.data, expected, expected_len) != 0) {
+            printf("(read size %lu) ", (unsigned long)size);
+            TEST_FAIL("Part data differs from the message");
+            return;
+        }
+    }
+
+    /* Committing more than the free buffers is refused and changes nothing */
+    memset(&d, 0, sizeof(d));
+    parser = multipart_parser_init("reader-boundary", &callbacks);
+    d.reader = multipart_reader_create(parser, 100, 4);
+    if (parser == NULL || d.reader == NULL) {
+        multipart_reader_free(d.reader);
+        multipart_parser_free(parser);
+        TEST_FAIL("Reader setup failed");
+        return;
+    }
+    multipart_parser_set_data(parser, &d);
+    n_iov = multipart_reader_prepare(d.reader, iov, 4);
+    for (k = 0, n = 0; k < n_iov; k++) {
+        memcpy(iov[k].iov_base, msg + n, iov[k].iov_len);
+        n += iov[k].iov_len;
+    }
+    result = multipart_reader_commit(d.reader, n + 1);
+    if (result != MPPE_UNKNOWN || d.len != 0 ||
+        multipart_reader_prepare(d.reader, iov, 4) != n_iov) {
+        result = -1;
+    } else {
+        result = multipart_reader_commit(d.reader, n);
+    }
+    multipart_reader_free(d.reader);
+    multipart_parser_free(parser);
+    if (n != 400 || result != 0 || d.len > n ||
+        memcmp(d.data, expected, d.len) != 0) {
+        TEST_FAIL("Commit past the free buffers not refused");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Sink writing parts with a filename to temporary files */
+typedef struct {
+    char paths[4][64];
+    char names[4][16];
+    int fds[4];
+    int count;
+    int closed;
+} sink_test_data;
+
+static int sink_open(void* data, const multipart_part_headers* headers) {
+    sink_test_data *d = (sink_test_data*)data;
+    int fd;
+
+    if (headers->filename.at == NULL || d->count == 4 ||
+        headers->filename.length >= sizeof(d->names[0])) {
+        return -1;
+    }
+    strcpy(d->paths[d->count], "/tmp/multipart_sink_XXXXXX");
+    fd = mkstemp(d->paths[d->count]);
+    if (fd >= 0) {
+        memcpy(d->names[d->count], headers->filename.at, headers->filename.length);
+        d->names[d->count][headers->filename.length] = '\0';
+        d->fds[d->count++] = fd;
+    }
+    return fd;
+}
+
+static int sink_close(void* data, int fd) {
+    (void)fd;
+    ((sink_test_data*)data)->closed++;
+    return 0;
+}
+
+/* Body with a field and two files; returns its length */
+static size_t sink_build_body(char *body, char *file, size_t file_len) {
+    size_t len = 0, k;
+
+    for (k = 0; k < file_len; k++) {
+        file[k] = (char)(k % 7 == 0 ? '\r' : k % 11 == 0 ? '\n' : 'a' + k % 26);
+    }
+    len += (size_t)sprintf(body + len,
+        "--sink\r\nContent-Disposition: form-data; name=\"field\"\r\n\r\n"
+        "value\r\n--sink\r\n"
+        "Content-Disposition: form-data; name=\"f\"; filename=\"one.bin\"\r\n\r\n");
+    memcpy(body + len, file, file_len);
+    len += file_len;
+    len += (size_t)sprintf(body + len,
+        "\r\n--sink\r\n"
+        "Content-Disposition: form-data; name=\"g\"; filename=\"two.txt\"\r\n\r\n"
+        "hello\r\n--sink--\r\n");
+    return len;
+}
+
+/* Check and remove the files written by the sink */
+static int sink_check_files(sink_test_data *d, const char *file, size_t file_len) {
+    static char got[8192];
+    int ok = d->count == 2 && d->closed == 2 &&
+             strcmp(d->names[0], "one.bin") == 0 &&
+             strcmp(d->names[1], "two.txt") == 0;
+    int k;
+
+    for (k = 0; k < d->count; k++) {
+        ssize_t n = pread(d->fds[k], got, sizeof(got), 0);
+        if (k == 0 && (n != (ssize_t)file_len || memcmp(got, file, file_len) != 0)) {
+            ok = 0;
+        }
+        if (k == 1 && (n != 5 || memcmp(got, "hello", 5) != 0)) {
+            ok = 0;
+        }
+        close(d->fds[k]);
+        remove(d->paths[k]);
+    }
+    return ok;
+}
+
+/* Test: file parts of a spooled body copied to descriptors */
+void test_io_extract_file(void) {
+    static char body[8192], file[4000];
+    multipart_sink sink;
+    sink_test_data d;
+    char path[64];
+    size_t len;
+    int result;
+
+    TEST_START("Part sink: file input");
+
+    len = sink_build_body(body, file, sizeof(file));
+    if (io_write_file(path, body, len) != 0) {
+        TEST_FAIL("Could not write the temporary file");
+        return;
+    }
+    memset(&d, 0, sizeof(d));
+    sink.open_part = sink_open;
+    sink.close_part = sink_close;
+    sink.data = &d;
+    result = multipart_extract_file(path, "sink", &sink);
+    remove(path);
+
+    if (!sink_check_files(&d, file, sizeof(file)) || result != 0) {
+        TEST_FAIL("Part files differ from the body");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: file parts of a body read from a pipe */
+void test_io_extract_fd(void) {
+    static char body[8192], file[4000];
+    multipart_sink sink;
+    sink_test_data d;
+    size_t len;
+    int fds[2];
+    int result;
+
+    TEST_START("Part sink: pipe input");
+
+    len = sink_build_body(body, file, sizeof(file));
+    if (pipe(fds) != 0) {
+        TEST_FAIL("pipe() failed");
+        return;
+    }
+    if (write(fds[1], body, len) != (ssize_t)len) {
+        close(fds[0]);
+        close(fds[1]);
+        TEST_FAIL("write() failed");
+        return;
+    }
+    close(fds[1]);
+    memset(&d, 0, sizeof(d));
+    sink.open_part = sink_open;
+    sink.close_part = sink_close;
+    sink.data = &d;
+    result = multipart_extract_fd(fds[0], "sink", &sink);
+    close(fds[0]);
+
+    if (!sink_check_files(&d, file, sizeof(file)) || result != 0) {
+        TEST_FAIL("Part files differ from the body");
+        return;
+    }
+
+    /* Without an open callback nothing is read */
+    errno = 0;
+    sink.open_part = NULL;
+    if (multipart_extract_fd(0, "sink", &sink) != -1 || errno != EINVAL) {
+        TEST_FAIL("Missing open callback accepted");
+        return;
+    }
+
+    TEST_PASS();
+}
@@ -0,0 +1,282 @@
+/* Parser Limit Tests
+ * Tests for max_part_size, max_header_bytes, max_parts and max_total_size
+ */
+#include "test_common.h"
+
+#define LIMITS_MAX_PARTS 4
+
+/* What the callbacks saw before the parser stopped */
+typedef struct {
+    size_t data[LIMITS_MAX_PARTS];
+    size_t header_bytes[LIMITS_MAX_PARTS];
+    int parts;
+} limits_test_data;
+
+static int limits_part_begin(multipart_parser* p) {
+    limits_test_data *d = (limits_test_data*)multipart_parser_get_data(p);
+    d->parts++;
+    return 0;
+}
+
+static int limits_header(multipart_parser* p, const char *at, size_t length) {
+    limits_test_data *d = (limits_test_data*)multipart_parser_get_data(p);
+    (void)at;
+    if (d->parts > 0 && d->parts <= LIMITS_MAX_PARTS) {
+        d->header_bytes[d->parts - 1] += length;
+    }
+    return 0;
+}
+
+static int limits_data(multipart_parser* p, const char *at, size_t length) {
+    limits_test_data *d = (limits_test_data*)multipart_parser_get_data(p);
+    (void)at;
+    if (d->parts > 0 && d->parts <= LIMITS_MAX_PARTS) {
+        d->data[d->parts - 1] += length;
+    }
+    return 0;
+}
+
+/* Parse msg in chunks; returns the bytes consumed and stores the error.
+ * Without callbacks only part begins are counted, which runs the
+ * headers-only loop. */
+static size_t limits_parse(const char *msg, size_t len, size_t chunk,
+                           multipart_parser_settings *callbacks,
+                           int callbacks_set, limits_test_data *d,
+                           multipart_parser_error *error) {
+    multipart_parser* parser;
+    size_t offset, n, parsed;
+
+    callbacks->on_part_data_begin = limits_part_begin;
+    callbacks->on_header_field = callbacks_set ? limits_header : NULL;
+    callbacks->on_header_value = callbacks_set ? limits_header : NULL;
+    callbacks->on_part_data = callbacks_set ? limits_data : NULL;
+    memset(d, 0, sizeof(limits_test_data));
+
+    parser = multipart_parser_init("lim", callbacks);
+    if (parser == NULL) {
+        *error = MPPE_UNKNOWN;
+        return 0;
+    }
+    multipart_parser_set_data(parser, d);
+    for (offset = 0; offset < len; offset += parsed) {
+        n = len - offset < chunk ? len - offset : chunk;
+        parsed = multipart_parser_execute(parser, msg + offset, n);
+        if (parsed != n) {
+            offset += parsed;
+            break;
+        }
+    }
+    *error = multipart_parser_get_error(parser);
+    multipart_parser_free(parser);
+    return offset;
+}
+
+static const size_t limits_chunks[] = { 1, 5, 64, 4096 };
+#define LIMITS_CHUNK_COUNT (sizeof(limits_chunks) / sizeof(limits_chunks[0]))
+
+/* Test: part data is cut off at max_part_size in every loop */
+void test_limits_part_size(void) {
+    char msg[512];
+    const char *second;
+    multipart_parser_settings callbacks;
+    limits_test_data d;
+    multipart_parser_error error;
+    size_t len, k;
+    int set;
+
+    TEST_START("Limits: max_part_size");
+
+    /* 50 and 51 data bytes, CRs included */
+    strcpy(msg, "--lim\r\n\r\n"
+                "0123456789\r0123456789\r\n0123456789\r0123456789012345\r\n"
+                "--lim\r\n\r\n");
+    second = msg + strlen(msg);
+    strcat(msg, "0123456789\r0123456789\r\n0123456789\r01234567890123456\r\n"
+                "--lim--");
+    len = strlen(msg);
+
+    for (set = 0; set <= 1; set++) {
+        for (k = 0; k < LIMITS_CHUNK_COUNT; k++) {
+            memset(&callbacks, 0, sizeof(multipart_parser_settings));
+            callbacks.max_part_size = 50;
+            callbacks.buffer_size = (k & 1) ? 16 : 0;
+            if (limits_parse(msg, len, limits_chunks[k], &callbacks, set,
+                             &d, &error) > (size_t)(second - msg) + 51 ||
+                error != MPPE_PART_TOO_LARGE || d.parts != 2 ||
+                (set && (d.data[0] != 50 || d.data[1] > 50))) {
+                TEST_FAIL("Oversized part not rejected at the limit");
+                return;
+            }
+
+            callbacks.max_part_size = 51;
+            if (limits_parse(msg, len, limits_chunks[k], &callbacks, set,
+                             &d, &error) != len || error != MPPE_OK ||
+                (set && d.data[1] != 51)) {
+                TEST_FAIL("Part at the limit rejected");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: header blocks longer than max_header_bytes are rejected */
+void test_limits_header_bytes(void) {
+    char msg[512];
+    multipart_parser_settings callbacks;
+    limits_test_data d;
+    multipart_parser_error error;
+    size_t len, block, k;
+    int set;
+
+    TEST_START("Limits: max_header_bytes");
+
+    strcpy(msg, "--lim\r\n"
+                "Content-Disposition: form-data; name=\"a\"\r\n"
+                "\r\n"
+                "a\r\n"
+                "--lim\r\n");
+    block = strlen(msg);
+    strcat(msg, "Content-Disposition: form-data; name=\"b\"\r\n"
+                "X-Pad: xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n"
+                "\r\n");
+    block = strlen(msg) - block;
+    strcat(msg, "b\r\n--lim--");
+    len = strlen(msg);
+
+    for (set = 0; set <= 1; set++) {
+        for (k = 0; k < LIMITS_CHUNK_COUNT; k++) {
+            memset(&callbacks, 0, sizeof(multipart_parser_settings));
+            callbacks.max_header_bytes = block - 1;
+            callbacks.buffer_size = (k & 1) ? 8 : 0;
+            if (limits_parse(msg, len, limits_chunks[k], &callbacks, set,
+                             &d, &error) >= len - strlen("b\r\n--lim--") ||
+                error != MPPE_HEADERS_TOO_LARGE || d.parts != 2 ||
+                d.header_bytes[1] > block - 1 || d.data[1] != 0) {
+                TEST_FAIL("Oversized header block not rejected");
+                return;
+            }
+
+            callbacks.max_header_bytes = block;
+            if (limits_parse(msg, len, limits_chunks[k], &callbacks, set,
+                             &d, &error) != len || error != MPPE_OK) {
+                TEST_FAIL("Header block at the limit rejected");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: max_parts counts the parts of nested bodies too */
+void test_limits_parts(void) {
+    static const char flat[] =
+        "--lim\r\n\r\none\r\n"
+        "--lim\r\n\r\ntwo\r\n"
+        "--lim\r\n\r\nthree\r\n"
+        "--lim--";
+    static const char nested[] =
+        "--lim\r\n"
+        "Content-Type: multipart/mixed; boundary=in\r\n"
+        "\r\n"
+        "--in\r\n\r\ninner one\r\n"
+        "--in\r\n\r\ninner two\r\n"
+        "--in--\r\n"
+        "--lim--";
+    multipart_parser_settings callbacks;
+    limits_test_data d;
+    multipart_parser_error error;
+    size_t k;
+
+    TEST_START("Limits: max_parts");
+
+    for (k = 0; k < LIMITS_CHUNK_COUNT; k++) {
+        memset(&callbacks, 0, sizeof(multipart_parser_settings));
+        callbacks.max_parts = 2;
+        if (limits_parse(flat, strlen(flat), limits_chunks[k], &callbacks, 1,
+                         &d, &error) >= strlen(flat) ||
+            error != MPPE_TOO_MANY_PARTS || d.parts != 2 ||
+            d.data[0] != 3 || d.data[1] != 3) {
+            TEST_FAIL("Third part not rejected");
+            return;
+        }
+
+        callbacks.max_parts = 3;
+        if (limits_parse(flat, strlen(flat), limits_chunks[k], &callbacks, 1,
+                         &d, &error) != strlen(flat) || error != MPPE_OK ||
+            d.parts != 3) {
+            TEST_FAIL("Parts at the limit rejected");
+            return;
+        }
+
+        memset(&callbacks, 0, sizeof(multipart_parser_settings));
+        callbacks.max_depth = 1;
+        callbacks.max_parts = 2;
+        if (limits_parse(nested, strlen(nested), limits_chunks[k], &callbacks,
+                         1, &d, &error) >= strlen(nested) ||
+            error != MPPE_TOO_MANY_PARTS || d.parts != 2) {
+            TEST_FAIL("Nested parts not counted");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: max_total_size stops the body, not the epilogue after it */
+void test_limits_total_size(void) {
+    static const char msg[] =
+        "--lim\r\n\r\none\r\n"
+        "--lim\r\n\r\ntwo\r\n"
+        "--lim--\r\nepilogue";
+    const size_t body = sizeof(msg) - 1 - strlen("\r\nepilogue");
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    limits_test_data d;
+    multipart_parser_error error;
+    size_t k;
+
+    TEST_START("Limits: max_total_size");
+
+    for (k = 0; k < LIMITS_CHUNK_COUNT; k++) {
+        memset(&callbacks, 0, sizeof(multipart_parser_settings));
+        callbacks.max_total_size = body;
+        if (limits_parse(msg, sizeof(msg) - 1, limits_chunks[k], &callbacks,
+                         1, &d, &error) != sizeof(msg) - 1 ||
+            error != MPPE_OK || d.parts != 2) {
+            TEST_FAIL("Body at the limit rejected");
+            return;
+        }
+
+        callbacks.max_total_size = body - 1;
+        if (limits_parse(msg, sizeof(msg) - 1, limits_chunks[k], &callbacks,
+                         1, &d, &error) != body - 1 ||
+            error != MPPE_BODY_TOO_LARGE) {
+            TEST_FAIL("Oversized body not rejected at the limit");
+            return;
+        }
+    }
+
+    /* More input fails the same way */
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.max_total_size = 10;
+    parser = multipart_parser_init("lim", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    if (multipart_parser_execute(parser, msg, sizeof(msg) - 1) != 10 ||
+        multipart_parser_execute(parser, msg + 10, sizeof(msg) - 11) != 0 ||
+        multipart_parser_get_error(parser) != MPPE_BODY_TOO_LARGE ||
+        strcmp(multipart_parser_get_error_message(parser),
+               "Body exceeds max_total_size") != 0) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Limit error not repeated");
+        return;
+    }
+    multipart_parser_free(parser);
+
+    TEST_PASS();
+}
@@ -63,6 +63,7 @@ int main(void) {
     /* Section 7: Buffering Tests */
     printf("--- Section 7: Callback Buffering Tests ---\n");
     test_callback_buffering();
+    test_settings_variants();
     printf("\n");
 
     /* Section 8: Parser Reset Tests */
@@ -88,6 +89,130 @@ int main(void) {
     test_null_buffer_safety();
     printf("\n");
 
+    /* Section 11: Boundary Search Tests */
+    printf("--- Section 11: Boundary Search Tests ---\n");
+    test_search_cr_dense_payload();
+    test_search_chunk_sweep();
+    test_search_reset_rebuilds_table();
+    test_search_boundary_with_cr();
+    test_search_delimiter_alignment();
+    test_search_find_delimiters();
+    test_search_split_delimiter();
+    printf("\n");
+
+    /* Section 12: Span Mode Tests */
+    printf("--- Section 12: Span Mode Tests ---\n");
+    test_span_single_chunk();
+    test_span_chunk_sweep();
+    test_span_pending_offset();
+    test_span_regular_mode_coalesces();
+    printf("\n");
+
+    /* Section 13: Pull API Tests */
+    printf("--- Section 13: Pull API Tests ---\n");
+    test_pull_event_sequence();
+    test_pull_chunk_sweep();
+    test_pause_resume_every_callback();
+    test_pause_resume_buffered();
+    test_pull_error();
+    test_pull_batch_events();
+    printf("\n");
+
+    /* Section 14: Header Accumulation Tests */
+    printf("--- Section 14: Header Accumulation Tests ---\n");
+    test_headers_parsed_fields();
+    test_headers_chunk_sweep();
+    test_headers_arena_overflow();
+    test_headers_header_ids();
+    test_headers_line_scan();
+    test_headers_scan_only();
+    printf("\n");
+
+    /* Section 15: Nested Multipart Tests */
+    printf("--- Section 15: Nested Multipart Tests ---\n");
+    test_nested_single_chunk();
+    test_nested_chunk_sweep();
+    test_nested_depth_limit();
+    test_nested_events_and_reset();
+    test_nested_replay_then_pop();
+    printf("\n");
+
+    /* Section 16: Allocation Tests */
+    printf("--- Section 16: Allocation Tests ---\n");
+    test_alloc_hooks();
+    test_alloc_in_place();
+    test_alloc_sizeof();
+    printf("\n");
+
+    /* Section 17: Parser Pool Tests */
+    printf("--- Section 17: Parser Pool Tests ---\n");
+    test_pool_reuse();
+    test_pool_boundary_lengths();
+    test_pool_max_idle();
+    test_pool_shared_settings();
+    printf("\n");
+
+    /* Section 18: Part Index Tests */
+    printf("--- Section 18: Part Index Tests ---\n");
+    test_index_single_chunk();
+    test_index_chunk_sweep();
+    test_index_limits();
+    printf("\n");
+
+    /* Section 19: I/O Front-end Tests */
+    printf("--- Section 19: I/O Front-end Tests ---\n");
+    test_io_parse_file();
+    test_io_errors();
+    test_io_reader_spans();
+    test_io_reader_commit();
+    test_io_extract_file();
+    test_io_extract_fd();
+    printf("\n");
+
+    /* Section 20: Transfer Decoding Tests */
+    printf("--- Section 20: Transfer Decoding Tests ---\n");
+    test_decode_base64();
+    test_decode_quoted_printable();
+    test_decode_pause_and_raw();
+    printf("\n");
+
+    /* Section 21: Part Digest Tests */
+    printf("--- Section 21: Part Digest Tests ---\n");
+    test_digest_crc32c();
+    test_digest_sha256();
+    test_digest_decoded_nested();
+    printf("\n");
+
+    /* Section 22: Parser Statistics Tests */
+    printf("--- Section 22: Parser Statistics Tests ---\n");
+    test_stats_single_chunk();
+    test_stats_chunk_sweep();
+    printf("\n");
+
+    /* Section 23: Parser Limit Tests */
+    printf("--- Section 23: Parser Limit Tests ---\n");
+    test_limits_part_size();
+    test_limits_header_bytes();
+    test_limits_parts();
+    test_limits_total_size();
+    printf("\n");
+
+    /* Section 24: Encoder Tests */
+    printf("--- Section 24: Encoder Tests ---\n");
+    test_encode_round_trip();
+    test_encode_zero_copy();
+    test_encode_errors();
+    test_encode_write();
+    printf("\n");
+
+    /* Section 25: Parser Snapshot Tests */
+    printf("--- Section 25: Parser Snapshot Tests ---\n");
+    test_snapshot_resume_anywhere();
+    test_snapshot_pause_handoff();
+    test_snapshot_rejected();
+    test_snapshot_tampered_state();
+    printf("\n");
+
     /* Summary */
     printf("=== Test Summary ===\n");
     printf("Total: %d\n", test_count);
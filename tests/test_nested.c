@@ -0,0 +1,347 @@
+/* Nested Multipart Tests
+ * Tests for max_depth, the boundary stack and multipart_parser_get_depth
+ */
+#include "test_common.h"
+
+/* Transcript of the callbacks: "<depth><tag>" per event, with the bytes of
+ * consecutive on_part_data calls merged after one "<depth>D:" */
+typedef struct {
+    char text[1024];
+    size_t len;
+    int in_data;
+    int pause;  /* pause after every callback */
+} nested_test_data;
+
+static int nested_log(multipart_parser* p, char tag) {
+    nested_test_data *ctx = (nested_test_data*)multipart_parser_get_data(p);
+    if (ctx->len + 2 >= sizeof(ctx->text)) {
+        return 1;
+    }
+    ctx->text[ctx->len++] = (char)('0' + multipart_parser_get_depth(p));
+    ctx->text[ctx->len++] = tag;
+    ctx->text[ctx->len] = '\0';
+    ctx->in_data = 0;
+    return ctx->pause;
+}
+
+static int nested_part_begin(multipart_parser* p) { return nested_log(p, 'b'); }
+static int nested_headers_complete(multipart_parser* p) { return nested_log(p, 'c'); }
+static int nested_part_end(multipart_parser* p) { return nested_log(p, 'e'); }
+static int nested_body_end(multipart_parser* p) { return nested_log(p, 'z'); }
+
+static int nested_data(multipart_parser* p, const char *at, size_t length) {
+    nested_test_data *ctx = (nested_test_data*)multipart_parser_get_data(p);
+    if (!ctx->in_data) {
+        if (ctx->len + 3 >= sizeof(ctx->text)) {
+            return 1;
+        }
+        nested_log(p, 'D');
+        ctx->text[ctx->len++] = ':';
+        ctx->in_data = 1;
+    }
+    if (ctx->len + length >= sizeof(ctx->text)) {
+        return 1;
+    }
+    memcpy(ctx->text + ctx->len, at, length);
+    ctx->len += length;
+    ctx->text[ctx->len] = '\0';
+    return ctx->pause;
+}
+
+static void nested_settings(multipart_parser_settings *callbacks, size_t max_depth) {
+    memset(callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks->on_part_data_begin = nested_part_begin;
+    callbacks->on_headers_complete = nested_headers_complete;
+    callbacks->on_part_data = nested_data;
+    callbacks->on_part_data_end = nested_part_end;
+    callbacks->on_body_end = nested_body_end;
+    callbacks->max_depth = max_depth;
+}
+
+/* Parse msg in chunks of the given size, resuming after pauses; returns the
+ * bytes consumed */
+static size_t parse_nested(const char *boundary, const char *msg, size_t chunk,
+                           size_t max_depth, int pause, nested_test_data *ctx) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+    size_t offset, n, parsed;
+
+    nested_settings(&callbacks, max_depth);
+    memset(ctx, 0, sizeof(nested_test_data));
+    ctx->pause = pause;
+    parser = multipart_parser_init(boundary, &callbacks);
+    if (parser == NULL) {
+        return 0;
+    }
+    multipart_parser_set_data(parser, ctx);
+
+    for (offset = 0; offset < len; offset += parsed) {
+        n = len - offset < chunk ? len - offset : chunk;
+        parsed = multipart_parser_execute(parser, msg + offset, n);
+        if (parsed != n && multipart_parser_get_error(parser) != MPPE_PAUSED) {
+            offset += parsed;
+            break;
+        }
+    }
+    multipart_parser_free(parser);
+    return offset;
+}
+
+static const char *nested_message =
+    "preamble\r\n"
+    "--outer\r\n"
+    "Content-Disposition: form-data; name=\"files\"\r\n"
+    "Content-Type: Multipart/Mixed; boundary=\"in-\\\"b\\\"\"\r\n"
+    "\r\n"
+    "inner preamble\r\n"
+    "--in-\"b\"\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "one\r\n--in-\"x\r\n--outer-\r\n"
+    "--in-\"b\"\r\n"
+    "\r\n"
+    "two\r\n"
+    "--in-\"b\"--\r\n"
+    "epilogue --outer\r\n"
+    "\r\n--outer\r\n"
+    "Content-Disposition: form-data; name=\"after\"\r\n"
+    "\r\n"
+    "three\r\n"
+    "--outer--";
+
+static const char *nested_transcript =
+    "0b0c"
+    "1b1c1D:one\r\n--in-\"x\r\n--outer-1e"
+    "1b1c1D:two1e"
+    "1z0e"
+    "0b0c0D:three0e0z";
+
+/* Test: parts of a nested body are reported at depth 1 */
+void test_nested_single_chunk(void) {
+    static nested_test_data ctx;
+    size_t len = strlen(nested_message);
+
+    TEST_START("Nested multipart: inner parts at depth 1");
+
+    if (parse_nested("outer", nested_message, len, 1, 0, &ctx) != len) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    if (strcmp(ctx.text, nested_transcript) != 0) {
+        printf("(got \"%s\") ", ctx.text);
+        TEST_FAIL("Transcript differs");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: push and pop survive every chunk boundary and pause */
+void test_nested_chunk_sweep(void) {
+    static nested_test_data ctx;
+    size_t len = strlen(nested_message);
+    size_t chunk;
+    int pause;
+
+    TEST_START("Nested multipart: chunk size sweep and pauses");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        for (pause = 0; pause <= 1; pause++) {
+            if (parse_nested("outer", nested_message, chunk, 4, pause, &ctx) != len ||
+                strcmp(ctx.text, nested_transcript) != 0) {
+                printf("(chunk size %lu, pause %d) ", (unsigned long)chunk, pause);
+                TEST_FAIL("Transcript differs");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: bodies beyond max_depth, or without a boundary, stay part data */
+void test_nested_depth_limit(void) {
+    const char *msg =
+        "--a\r\n"
+        "Content-Type: multipart/mixed; boundary=b\r\n"
+        "\r\n"
+        "--b\r\n"
+        "Content-Type: multipart/mixed; boundary=c\r\n"
+        "\r\n"
+        "--c\r\n\r\nx\r\n--c--\r\n"
+        "--b--\r\n"
+        "--a\r\n"
+        "Content-Type: multipart/mixed\r\n"
+        "\r\n"
+        "--b\r\n"
+        "--a--";
+    const char *expected =
+        "0b0c"
+        "1b1c1D:--c\r\n\r\nx\r\n--c--1e1z0e"
+        "0b0c0D:--b0e0z";
+    static nested_test_data ctx;
+
+    TEST_START("Nested multipart: depth limit and missing boundary");
+
+    if (parse_nested("a", msg, strlen(msg), 1, 0, &ctx) != strlen(msg)) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    if (strcmp(ctx.text, expected) != 0) {
+        printf("(got \"%s\") ", ctx.text);
+        TEST_FAIL("Transcript differs");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: pull events carry the depth, reset returns to the outer boundary */
+void test_nested_events_and_reset(void) {
+    const char *msg =
+        "--a\r\n"
+        "Content-Type: multipart/mixed; boundary=bb\r\n"
+        "\r\n"
+        "--bb\r\n\r\nx\r\n--bb--\r\n"
+        "--a--";
+    const char *cut = "--a\r\nContent-Type: multipart/mixed; boundary=bb\r\n\r\n--bb\r\n";
+    static const multipart_event_type types[] = {
+        MULTIPART_EVENT_PART_BEGIN, MULTIPART_EVENT_HEADER_FIELD,
+        MULTIPART_EVENT_HEADER_VALUE, MULTIPART_EVENT_HEADERS_COMPLETE,
+        MULTIPART_EVENT_PART_BEGIN, MULTIPART_EVENT_HEADERS_COMPLETE,
+        MULTIPART_EVENT_DATA, MULTIPART_EVENT_PART_END,
+        MULTIPART_EVENT_BODY_END, MULTIPART_EVENT_PART_END,
+        MULTIPART_EVENT_BODY_END
+    };
+    static const size_t depths[] = { 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0 };
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event events[16];
+    size_t n_events, k;
+
+    TEST_START("Nested multipart: event depth and reset");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.max_depth = 2;
+    parser = multipart_parser_init("a", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    if (multipart_parser_execute_events(parser, msg, strlen(msg), events, 16,
+                                        &n_events) != strlen(msg) ||
+        n_events != sizeof(depths) / sizeof(depths[0])) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Unexpected event count");
+        return;
+    }
+    for (k = 0; k < n_events; k++) {
+        if (events[k].type != types[k] || events[k].depth != depths[k]) {
+            multipart_parser_free(parser);
+            TEST_FAIL("Wrong event type or depth");
+            return;
+        }
+    }
+
+    /* Stop inside the nested body, then parse the whole message again */
+    multipart_parser_reset(parser, NULL);
+    multipart_parser_execute_events(parser, cut, strlen(cut), events, 16, &n_events);
+    if (multipart_parser_get_depth(parser) != 1) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Nested body not entered");
+        return;
+    }
+    multipart_parser_reset(parser, NULL);
+    if (multipart_parser_get_depth(parser) != 0 ||
+        multipart_parser_execute_events(parser, msg, strlen(msg), events, 16,
+                                        &n_events) != strlen(msg) ||
+        n_events != sizeof(depths) / sizeof(depths[0])) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Reset did not restore the top-level boundary");
+        return;
+    }
+    multipart_parser_free(parser);
+
+    TEST_PASS();
+}
+
+/* Test: held delimiter bytes replayed as data survive the pop that follows */
+void test_nested_replay_then_pop(void) {
+    static const char *chunks[] = {
+        "--OUT\r\n"
+        "Content-Type: multipart/mixed; boundary=inner1\r\n"
+        "\r\n"
+        "--inner1\r\n\r\nhead\r\n--inn",
+        "erX tail\r\n--inner1--\r\n--OUT--"
+    };
+    const char *expected = "head\r\n--innerX tail";
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event events[64];
+    multipart_event data[64];
+    char text[64];
+    size_t n_data, n_events, offset, len, n, k, j, t;
+    int pull;
+
+    TEST_START("Nested multipart: replayed data after a pop");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.max_depth = 2;
+
+    /* One batch per chunk, then events pulled one at a time; the DATA
+     * events are only read once the whole body is parsed */
+    for (pull = 0; pull <= 1; pull++) {
+        parser = multipart_parser_init("OUT", &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        n_data = 0;
+        for (k = 0; k < 2; k++) {
+            len = strlen(chunks[k]);
+            for (offset = 0; offset < len; offset += n) {
+                if (pull) {
+                    n = multipart_parser_next(parser, chunks[k] + offset,
+                                              len - offset, events);
+                    n_events = events[0].type != MULTIPART_EVENT_NONE;
+                } else {
+                    n = multipart_parser_execute_events(parser,
+                                                        chunks[k] + offset,
+                                                        len - offset, events,
+                                                        64, &n_events);
+                }
+                if (n_events == 0 && offset + n < len) {
+                    multipart_parser_free(parser);
+                    TEST_FAIL("Parse error");
+                    return;
+                }
+                for (j = 0; j < n_events && n_data < 64; j++) {
+                    if (events[j].type == MULTIPART_EVENT_DATA) {
+                        data[n_data++] = events[j];
+                    }
+                }
+            }
+        }
+
+        t = 0;
+        for (j = 0; j < n_data; j++) {
+            if (t + data[j].length < sizeof(text)) {
+                memcpy(text + t, data[j].at, data[j].length);
+                t += data[j].length;
+            }
+        }
+        text[t] = '\0';
+        if (multipart_parser_get_depth(parser) != 0 ||
+            strcmp(text, expected) != 0) {
+            multipart_parser_free(parser);
+            printf("(%s) ", pull ? "next" : "execute_events");
+            TEST_FAIL("Replayed data changed by the pop");
+            return;
+        }
+        multipart_parser_free(parser);
+    }
+
+    TEST_PASS();
+}
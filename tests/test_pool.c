@@ -0,0 +1,281 @@
+/* Parser Pool Tests
+ * Tests for multipart_parser_pool_create, _acquire, _release and _destroy
+ */
+#include "test_common.h"
+
+/* Counts the blocks handed out by the test allocator */
+typedef struct {
+    int allocs;
+    int releases;
+} pool_test_data;
+
+static void* pool_alloc(void* ctx, size_t size) {
+    ((pool_test_data*)ctx)->allocs++;
+    return malloc(size);
+}
+
+static void pool_release(void* ctx, void* ptr) {
+    ((pool_test_data*)ctx)->releases++;
+    free(ptr);
+}
+
+/* Collected part data */
+typedef struct {
+    char data[256];
+    size_t len;
+    int done;
+} pool_parse_data;
+
+static int pool_part_data(multipart_parser* p, const char *at, size_t length) {
+    pool_parse_data *d = (pool_parse_data*)multipart_parser_get_data(p);
+    if (d->len + length >= sizeof(d->data)) {
+        return 1;
+    }
+    memcpy(d->data + d->len, at, length);
+    d->len += length;
+    d->data[d->len] = '\0';
+    return 0;
+}
+
+static int pool_body_end(multipart_parser* p) {
+    ((pool_parse_data*)multipart_parser_get_data(p))->done = 1;
+    return 0;
+}
+
+/* Parse a one-part body with the given boundary in chunks of the given size;
+ * returns 1 if the part data came out as "payload" */
+static int parse_pool_message(multipart_parser* parser, const char *boundary,
+                              size_t chunk) {
+    char msg[256];
+    pool_parse_data d;
+    size_t len, offset, n;
+
+    sprintf(msg, "--%s\r\n\r\npayload\r\n--%s--", boundary, boundary);
+    len = strlen(msg);
+    memset(&d, 0, sizeof(d));
+    multipart_parser_set_data(parser, &d);
+    for (offset = 0; offset < len; offset += n) {
+        n = len - offset < chunk ? len - offset : chunk;
+        if (multipart_parser_execute(parser, msg + offset, n) != n) {
+            return 0;
+        }
+    }
+    return d.done && strcmp(d.data, "payload") == 0;
+}
+
+static void pool_settings(multipart_parser_settings *callbacks) {
+    memset(callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks->on_part_data = pool_part_data;
+    callbacks->on_body_end = pool_body_end;
+}
+
+/* Test: a released parser is handed out again without allocating */
+void test_pool_reuse(void) {
+    pool_test_data a;
+    multipart_parser_allocator allocator;
+    multipart_parser_settings callbacks;
+    multipart_parser_pool* pool;
+    multipart_parser *first, *second;
+
+    TEST_START("Parser pool: reuse without allocation");
+
+    pool_settings(&callbacks);
+    memset(&a, 0, sizeof(a));
+    allocator.alloc = pool_alloc;
+    allocator.release = pool_release;
+    allocator.ctx = &a;
+
+    pool = multipart_parser_pool_create(&callbacks, 4, &allocator);
+    if (pool == NULL) {
+        TEST_FAIL("Pool creation failed");
+        return;
+    }
+
+    first = multipart_parser_pool_acquire(pool, "first");
+    if (first == NULL || !parse_pool_message(first, "first", 1024)) {
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Parse with a new parser failed");
+        return;
+    }
+    multipart_parser_pool_release(pool, first);
+
+    second = multipart_parser_pool_acquire(pool, "second");
+    if (second != first || a.allocs != 2 ||
+        multipart_parser_get_data(second) != NULL) {
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Idle parser not reused");
+        return;
+    }
+    if (!parse_pool_message(second, "second", 1024)) {
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Parse with a reused parser failed");
+        return;
+    }
+    multipart_parser_pool_release(pool, second);
+    multipart_parser_pool_destroy(pool);
+
+    if (a.releases != a.allocs) {
+        TEST_FAIL("Pool memory not returned to the allocator");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: any boundary up to the RFC 2046 maximum fits a pooled parser */
+void test_pool_boundary_lengths(void) {
+    char boundary[MULTIPART_MAX_BOUNDARY_LENGTH + 2];
+    multipart_parser_settings callbacks;
+    multipart_parser_pool* pool;
+    multipart_parser* parser;
+    size_t lengths[] = { 1, MULTIPART_MAX_BOUNDARY_LENGTH, 10, 2 };
+    size_t k;
+
+    TEST_START("Parser pool: boundaries of any length up to 70");
+
+    pool_settings(&callbacks);
+    pool = multipart_parser_pool_create(&callbacks, 1, NULL);
+    if (pool == NULL) {
+        TEST_FAIL("Pool creation failed");
+        return;
+    }
+
+    for (k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++) {
+        memset(boundary, 'x', lengths[k]);
+        boundary[lengths[k]] = '\0';
+        parser = multipart_parser_pool_acquire(pool, boundary);
+        if (parser == NULL || !parse_pool_message(parser, boundary, 3)) {
+            printf("(boundary length %lu) ", (unsigned long)lengths[k]);
+            multipart_parser_pool_release(pool, parser);
+            multipart_parser_pool_destroy(pool);
+            TEST_FAIL("Parse failed");
+            return;
+        }
+        multipart_parser_pool_release(pool, parser);
+    }
+
+    memset(boundary, 'x', MULTIPART_MAX_BOUNDARY_LENGTH + 1);
+    boundary[MULTIPART_MAX_BOUNDARY_LENGTH + 1] = '\0';
+    if (multipart_parser_pool_acquire(pool, boundary) != NULL) {
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Boundary longer than 70 accepted");
+        return;
+    }
+    multipart_parser_pool_destroy(pool);
+
+    TEST_PASS();
+}
+
+/* Test: max_idle bounds the parsers kept, buffering survives reuse */
+void test_pool_max_idle(void) {
+    pool_test_data a;
+    multipart_parser_allocator allocator;
+    multipart_parser_settings callbacks;
+    multipart_parser_pool* pool;
+    multipart_parser* parsers[3];
+    int k;
+
+    TEST_START("Parser pool: max_idle and buffered callbacks");
+
+    pool_settings(&callbacks);
+    callbacks.buffer_size = 4;
+    memset(&a, 0, sizeof(a));
+    allocator.alloc = pool_alloc;
+    allocator.release = pool_release;
+    allocator.ctx = &a;
+
+    pool = multipart_parser_pool_create(&callbacks, 1, &allocator);
+    if (pool == NULL) {
+        TEST_FAIL("Pool creation failed");
+        return;
+    }
+    for (k = 0; k < 3; k++) {
+        parsers[k] = multipart_parser_pool_acquire(pool, "idle");
+        if (parsers[k] == NULL) {
+            multipart_parser_pool_destroy(pool);
+            TEST_FAIL("Acquire failed");
+            return;
+        }
+    }
+    for (k = 0; k < 3; k++) {
+        multipart_parser_pool_release(pool, parsers[k]);
+    }
+    /* pool and three parsers allocated, two freed on release */
+    if (a.allocs != 4 || a.releases != 2) {
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Idle parsers not bounded by max_idle");
+        return;
+    }
+
+    parsers[0] = multipart_parser_pool_acquire(pool, "a-much-longer-boundary");
+    if (parsers[0] == NULL || a.allocs != 4 ||
+        !parse_pool_message(parsers[0], "a-much-longer-boundary", 5)) {
+        multipart_parser_pool_release(pool, parsers[0]);
+        multipart_parser_pool_destroy(pool);
+        TEST_FAIL("Buffered parse after reuse failed");
+        return;
+    }
+    multipart_parser_free(parsers[0]);  /* bypassing the pool is allowed */
+    multipart_parser_pool_destroy(pool);
+
+    if (a.releases != a.allocs) {
+        TEST_FAIL("Pool memory not returned to the allocator");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: pools sharing one settings object keep all parse state apart */
+void test_pool_shared_settings(void) {
+    multipart_parser_settings callbacks;
+    multipart_parser_pool *pools[2];
+    multipart_parser *parsers[2];
+    pool_parse_data d[2];
+    const char *msgs[2];
+    size_t lens[2], offset;
+    int k;
+
+    TEST_START("Parser pool: one settings object, interleaved parsers");
+
+    pool_settings(&callbacks);
+    callbacks.buffer_size = 3;
+    msgs[0] = "--one\r\n\r\nfirst body\r\n--one--";
+    msgs[1] = "--two-two\r\n\r\nsecond\r\n--two-two--";
+
+    /* One pool per thread in a server; interleaved here on one thread */
+    pools[0] = pools[1] = NULL;
+    for (k = 0; k < 2; k++) {
+        pools[k] = multipart_parser_pool_create(&callbacks, 1, NULL);
+        parsers[k] = multipart_parser_pool_acquire(pools[k], k ? "two-two" : "one");
+        if (parsers[k] == NULL) {
+            multipart_parser_pool_destroy(pools[0]);
+            multipart_parser_pool_destroy(pools[1]);
+            TEST_FAIL("Pool setup failed");
+            return;
+        }
+        memset(&d[k], 0, sizeof(pool_parse_data));
+        multipart_parser_set_data(parsers[k], &d[k]);
+        lens[k] = strlen(msgs[k]);
+    }
+
+    for (offset = 0; offset < lens[0] || offset < lens[1]; offset++) {
+        for (k = 0; k < 2; k++) {
+            if (offset < lens[k]) {
+                multipart_parser_execute(parsers[k], msgs[k] + offset, 1);
+            }
+        }
+    }
+
+    for (k = 0; k < 2; k++) {
+        multipart_parser_pool_release(pools[k], parsers[k]);
+        multipart_parser_pool_destroy(pools[k]);
+    }
+    if (!d[0].done || strcmp(d[0].data, "first body") != 0 ||
+        !d[1].done || strcmp(d[1].data, "second") != 0) {
+        TEST_FAIL("Parsers interfered through the shared settings");
+        return;
+    }
+
+    TEST_PASS();
+}
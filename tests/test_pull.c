@@ -0,0 +1,537 @@
+/* Pull API Tests
+ * Tests for multipart_parser_next and resuming after a callback pause
+ */
+#include "test_common.h"
+
+#define TRANSCRIPT_SIZE 1024
+
+/* Events rendered as text, e.g. "B F[Content-Type] V[text/plain] H D[x] E".
+ * Consecutive bytes of the same kind are merged, so transcripts of the
+ * same message compare equal however it was chunked. */
+typedef struct {
+    char text[TRANSCRIPT_SIZE];
+    size_t len;
+    char open;      /* kind of the unterminated data item, or 0 */
+    int pause;      /* callbacks return this */
+} transcript;
+
+static void transcript_init(transcript *t, int pause) {
+    memset(t, 0, sizeof(transcript));
+    t->pause = pause;
+}
+
+static void transcript_put(transcript *t, char c) {
+    if (t->len + 1 < TRANSCRIPT_SIZE) {
+        t->text[t->len++] = c;
+    }
+}
+
+static void transcript_close(transcript *t) {
+    if (t->open) {
+        transcript_put(t, ']');
+        t->open = 0;
+    }
+}
+
+static void transcript_event(transcript *t, multipart_event_type type,
+                             const char *at, size_t length) {
+    static const char kinds[] = "-BFVHDEZ";
+    char kind = kinds[type];
+    size_t k;
+
+    if (type == MULTIPART_EVENT_HEADER_FIELD ||
+        type == MULTIPART_EVENT_HEADER_VALUE ||
+        type == MULTIPART_EVENT_DATA) {
+        if (t->open != kind) {
+            transcript_close(t);
+            transcript_put(t, kind);
+            transcript_put(t, '[');
+            t->open = kind;
+        }
+        for (k = 0; k < length; k++) {
+            transcript_put(t, at[k]);
+        }
+        return;
+    }
+    transcript_close(t);
+    transcript_put(t, kind);
+}
+
+static int tr_header_field(multipart_parser* p, const char *at, size_t length) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_HEADER_FIELD, at, length);
+    return t->pause;
+}
+
+static int tr_header_value(multipart_parser* p, const char *at, size_t length) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_HEADER_VALUE, at, length);
+    return t->pause;
+}
+
+static int tr_part_data(multipart_parser* p, const char *at, size_t length) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_DATA, at, length);
+    return t->pause;
+}
+
+static int tr_part_data_begin(multipart_parser* p) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_PART_BEGIN, NULL, 0);
+    return t->pause;
+}
+
+static int tr_headers_complete(multipart_parser* p) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_HEADERS_COMPLETE, NULL, 0);
+    return t->pause;
+}
+
+static int tr_part_data_end(multipart_parser* p) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_PART_END, NULL, 0);
+    return t->pause;
+}
+
+static int tr_body_end(multipart_parser* p) {
+    transcript *t = (transcript*)multipart_parser_get_data(p);
+    transcript_event(t, MULTIPART_EVENT_BODY_END, NULL, 0);
+    return t->pause;
+}
+
+static const char *pull_boundary = "pull-bnd";
+static const char *pull_message =
+    "preamble\r\n"
+    "--pull-bnd\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "one\r\ntwo\r\n--pull\r\n--pull-bnX\r\r\n"
+    "--pull-bnd\r\n"
+    "Content-Disposition: form-data; name=\"b\"\r\n"
+    "\r\n"
+    "\r\n--\r\n"
+    "--pull-bnd--\r\n";
+
+/* Reference transcript from a plain callback parse in one chunk */
+static int reference_transcript(transcript *t) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(pull_message);
+    size_t parsed;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = tr_header_field;
+    callbacks.on_header_value = tr_header_value;
+    callbacks.on_part_data = tr_part_data;
+    callbacks.on_part_data_begin = tr_part_data_begin;
+    callbacks.on_headers_complete = tr_headers_complete;
+    callbacks.on_part_data_end = tr_part_data_end;
+    callbacks.on_body_end = tr_body_end;
+
+    transcript_init(t, 0);
+    parser = multipart_parser_init(pull_boundary, &callbacks);
+    if (parser == NULL) {
+        return -1;
+    }
+    multipart_parser_set_data(parser, t);
+    parsed = multipart_parser_execute(parser, pull_message, len);
+    multipart_parser_free(parser);
+    transcript_close(t);
+    return parsed == len ? 0 : -1;
+}
+
+/* Test: events come out in callback order with the expected bytes */
+void test_pull_event_sequence(void) {
+    const char *msg =
+        "--bnd\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "hello\r\n"
+        "--bnd--";
+    static const multipart_event_type expected[] = {
+        MULTIPART_EVENT_PART_BEGIN,
+        MULTIPART_EVENT_HEADER_FIELD,
+        MULTIPART_EVENT_HEADER_VALUE,
+        MULTIPART_EVENT_HEADERS_COMPLETE,
+        MULTIPART_EVENT_DATA,
+        MULTIPART_EVENT_PART_END,
+        MULTIPART_EVENT_BODY_END
+    };
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event ev;
+    const char *buf = msg;
+    size_t len = strlen(msg);
+    size_t n;
+    int count = 0;
+
+    TEST_START("Pull API: event sequence");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    parser = multipart_parser_init("bnd", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    while (len > 0) {
+        n = multipart_parser_next(parser, buf, len, &ev);
+        buf += n;
+        len -= n;
+        if (ev.type == MULTIPART_EVENT_NONE) {
+            break;
+        }
+        if (count >= 7 || ev.type != expected[count]) {
+            multipart_parser_free(parser);
+            TEST_FAIL("Unexpected event type");
+            return;
+        }
+        if ((ev.type == MULTIPART_EVENT_HEADER_FIELD &&
+             (ev.length != 12 || memcmp(ev.at, "Content-Type", 12) != 0)) ||
+            (ev.type == MULTIPART_EVENT_HEADER_VALUE &&
+             (ev.length != 10 || memcmp(ev.at, "text/plain", 10) != 0)) ||
+            (ev.type == MULTIPART_EVENT_DATA &&
+             (ev.length != 5 || memcmp(ev.at, "hello", 5) != 0))) {
+            multipart_parser_free(parser);
+            TEST_FAIL("Event bytes differ");
+            return;
+        }
+        count++;
+    }
+
+    if (count != 7 || len != 0 ||
+        multipart_parser_get_error(parser) != MPPE_OK) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Missing events or trailing error");
+        return;
+    }
+
+    multipart_parser_free(parser);
+    TEST_PASS();
+}
+
+/* Test: pulled events match callbacks for every chunk size */
+void test_pull_chunk_sweep(void) {
+    static transcript expected;
+    static transcript pulled;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event ev;
+    size_t len = strlen(pull_message);
+    size_t chunk, offset, end, n;
+
+    TEST_START("Pull API: chunk size sweep matches callbacks");
+
+    if (reference_transcript(&expected) != 0) {
+        TEST_FAIL("Reference parse failed");
+        return;
+    }
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    for (chunk = 1; chunk <= len; chunk++) {
+        parser = multipart_parser_init(pull_boundary, &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        transcript_init(&pulled, 0);
+
+        for (offset = 0; offset < len; offset = end) {
+            end = offset + chunk < len ? offset + chunk : len;
+            while (offset < end) {
+                n = multipart_parser_next(parser, pull_message + offset,
+                                          end - offset, &ev);
+                if (ev.type == MULTIPART_EVENT_NONE && offset + n < end) {
+                    multipart_parser_free(parser);
+                    printf("(chunk size %lu) ", (unsigned long)chunk);
+                    TEST_FAIL("Parse error");
+                    return;
+                }
+                offset += n;
+                if (ev.type != MULTIPART_EVENT_NONE) {
+                    transcript_event(&pulled, ev.type, ev.at, ev.length);
+                }
+            }
+        }
+        multipart_parser_free(parser);
+        transcript_close(&pulled);
+
+        if (pulled.len != expected.len ||
+            memcmp(pulled.text, expected.text, expected.len) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Pulled events differ from callbacks");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: pausing in every callback and resuming loses or repeats nothing */
+void test_pause_resume_every_callback(void) {
+    static transcript expected;
+    static transcript paused;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(pull_message);
+    size_t chunk, offset, end, n;
+
+    TEST_START("Pause in every callback and resume at returned offset");
+
+    if (reference_transcript(&expected) != 0) {
+        TEST_FAIL("Reference parse failed");
+        return;
+    }
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = tr_header_field;
+    callbacks.on_header_value = tr_header_value;
+    callbacks.on_part_data = tr_part_data;
+    callbacks.on_part_data_begin = tr_part_data_begin;
+    callbacks.on_headers_complete = tr_headers_complete;
+    callbacks.on_part_data_end = tr_part_data_end;
+    callbacks.on_body_end = tr_body_end;
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        parser = multipart_parser_init(pull_boundary, &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        transcript_init(&paused, 1);
+        multipart_parser_set_data(parser, &paused);
+
+        for (offset = 0; offset < len; offset = end) {
+            end = offset + chunk < len ? offset + chunk : len;
+            while (offset < end) {
+                n = multipart_parser_execute(parser, pull_message + offset,
+                                             end - offset);
+                if (offset + n < end &&
+                    multipart_parser_get_error(parser) != MPPE_PAUSED) {
+                    multipart_parser_free(parser);
+                    printf("(chunk size %lu) ", (unsigned long)chunk);
+                    TEST_FAIL("Parse error");
+                    return;
+                }
+                offset += n;
+            }
+        }
+        multipart_parser_free(parser);
+        transcript_close(&paused);
+
+        if (paused.len != expected.len ||
+            memcmp(paused.text, expected.text, expected.len) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Events lost or repeated across pauses");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: data runs longer than buffer_size survive a pause on the flush */
+void test_pause_resume_buffered(void) {
+    static const char *chunks[] = {
+        "--b\r\nX", "-Empty: 1\r\nContent-Type: text/plain\r\n\r\nab",
+        "cdefghij", "\r\n--b--"
+    };
+    static transcript expected;
+    static transcript paused;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(pull_message);
+    size_t chunk, offset, end, n, k;
+
+    TEST_START("Pause on a buffer flush keeps longer data runs");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = tr_header_field;
+    callbacks.on_header_value = tr_header_value;
+    callbacks.on_part_data = tr_part_data;
+    callbacks.buffer_size = 4;
+
+    /* Header field and part data runs cut after a short buffered start */
+    parser = multipart_parser_init("b", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    transcript_init(&paused, 1);
+    multipart_parser_set_data(parser, &paused);
+    for (k = 0; k < sizeof(chunks) / sizeof(chunks[0]); k++) {
+        len = strlen(chunks[k]);
+        for (offset = 0; offset < len; offset += n) {
+            n = multipart_parser_execute(parser, chunks[k] + offset,
+                                         len - offset);
+            if (offset + n < len &&
+                multipart_parser_get_error(parser) != MPPE_PAUSED) {
+                multipart_parser_free(parser);
+                TEST_FAIL("Parse error");
+                return;
+            }
+        }
+    }
+    multipart_parser_free(parser);
+    transcript_close(&paused);
+    if (strcmp(paused.text, "F[X-Empty]V[1]F[Content-Type]V[text/plain]"
+                            "D[abcdefghij]") != 0) {
+        TEST_FAIL("Data lost across a paused flush");
+        return;
+    }
+
+    /* Every chunk size of the message */
+    if (reference_transcript(&expected) != 0) {
+        TEST_FAIL("Reference parse failed");
+        return;
+    }
+    callbacks.on_part_data_begin = tr_part_data_begin;
+    callbacks.on_headers_complete = tr_headers_complete;
+    callbacks.on_part_data_end = tr_part_data_end;
+    callbacks.on_body_end = tr_body_end;
+    len = strlen(pull_message);
+    for (chunk = 1; chunk <= len; chunk++) {
+        parser = multipart_parser_init(pull_boundary, &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        transcript_init(&paused, 1);
+        multipart_parser_set_data(parser, &paused);
+
+        for (offset = 0; offset < len; offset = end) {
+            end = offset + chunk < len ? offset + chunk : len;
+            while (offset < end) {
+                n = multipart_parser_execute(parser, pull_message + offset,
+                                             end - offset);
+                if (offset + n < end &&
+                    multipart_parser_get_error(parser) != MPPE_PAUSED) {
+                    multipart_parser_free(parser);
+                    printf("(chunk size %lu) ", (unsigned long)chunk);
+                    TEST_FAIL("Parse error");
+                    return;
+                }
+                offset += n;
+            }
+        }
+        multipart_parser_free(parser);
+        transcript_close(&paused);
+
+        if (paused.len != expected.len ||
+            memcmp(paused.text, expected.text, expected.len) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Events lost or repeated across buffered pauses");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: a parse error ends the iteration with no event */
+void test_pull_error(void) {
+    const char *msg =
+        "--bnd\r\n"
+        "Bad Header: x\r\n";
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event ev;
+    size_t offset = 0;
+    size_t len = strlen(msg);
+    size_t n;
+
+    TEST_START("Pull API: parse error");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    parser = multipart_parser_init("bnd", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    do {
+        n = multipart_parser_next(parser, msg + offset, len - offset, &ev);
+        offset += n;
+    } while (ev.type != MULTIPART_EVENT_NONE);
+
+    if (offset >= len ||
+        multipart_parser_get_error(parser) != MPPE_INVALID_HEADER_FIELD) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Expected MPPE_INVALID_HEADER_FIELD");
+        return;
+    }
+
+    if (multipart_parser_next(NULL, msg, len, &ev) != 0 ||
+        ev.type != MULTIPART_EVENT_NONE) {
+        multipart_parser_free(parser);
+        TEST_FAIL("NULL parser not rejected");
+        return;
+    }
+
+    multipart_parser_free(parser);
+    TEST_PASS();
+}
+
+/* Test: batches stay valid until the call returns, for any array size */
+void test_pull_batch_events(void) {
+    static transcript expected;
+    static transcript batched;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    multipart_event events[8];
+    size_t len = strlen(pull_message);
+    size_t chunk, max_events, offset, end, n, count, k;
+
+    TEST_START("Batch API: events match callbacks for any array size");
+
+    if (reference_transcript(&expected) != 0) {
+        TEST_FAIL("Reference parse failed");
+        return;
+    }
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    for (max_events = 1; max_events <= 8; max_events++) {
+        for (chunk = 1; chunk <= len; chunk++) {
+            parser = multipart_parser_init(pull_boundary, &callbacks);
+            if (parser == NULL) {
+                TEST_FAIL("Parser initialization failed");
+                return;
+            }
+            transcript_init(&batched, 0);
+
+            for (offset = 0; offset < len; offset = end) {
+                end = offset + chunk < len ? offset + chunk : len;
+                while (offset < end) {
+                    n = multipart_parser_execute_events(parser,
+                            pull_message + offset, end - offset,
+                            events, max_events, &count);
+                    if (count < max_events && offset + n < end) {
+                        multipart_parser_free(parser);
+                        printf("(chunk size %lu) ", (unsigned long)chunk);
+                        TEST_FAIL("Parse error");
+                        return;
+                    }
+                    /* Read the events only after the whole batch is done */
+                    for (k = 0; k < count; k++) {
+                        transcript_event(&batched, events[k].type,
+                                         events[k].at, events[k].length);
+                    }
+                    offset += n;
+                }
+            }
+            multipart_parser_free(parser);
+            transcript_close(&batched);
+
+            if (batched.len != expected.len ||
+                memcmp(batched.text, expected.text, expected.len) != 0) {
+                printf("(%lu events, chunk size %lu) ",
+                       (unsigned long)max_events, (unsigned long)chunk);
+                TEST_FAIL("Batched events differ from callbacks");
+                return;
+            }
+        }
+    }
+
+    TEST_PASS();
+}
@@ -0,0 +1,406 @@
+/* Boundary Search Tests
+ * Tests for the skip-table delimiter search used in s_part_data
+ */
+#include "test_common.h"
+
+#define SEARCH_DATA_SIZE 4096
+
+/* Collects part data so it can be compared with the original payload */
+typedef struct {
+    char data[SEARCH_DATA_SIZE * 2];
+    size_t data_len;
+    int part_end_count;
+    int body_end_count;
+} search_test_data;
+
+static int on_part_data_search(multipart_parser* p, const char *at, size_t length) {
+    search_test_data *ctx = (search_test_data*)multipart_parser_get_data(p);
+    if (ctx->data_len + length > sizeof(ctx->data)) {
+        return 1;
+    }
+    memcpy(ctx->data + ctx->data_len, at, length);
+    ctx->data_len += length;
+    return 0;
+}
+
+static int on_part_data_end_search(multipart_parser* p) {
+    search_test_data *ctx = (search_test_data*)multipart_parser_get_data(p);
+    ctx->part_end_count++;
+    return 0;
+}
+
+static int on_body_end_search(multipart_parser* p) {
+    search_test_data *ctx = (search_test_data*)multipart_parser_get_data(p);
+    ctx->body_end_count++;
+    return 0;
+}
+
+/* Fill payload with CR-dense binary data full of delimiter near misses */
+static size_t build_cr_dense_payload(char *payload, const char *boundary) {
+    static const char *fragments[] = {
+        "\r", "\r\n", "\r\n-", "\r\n--", "\r\r\n--", "\n\r"
+    };
+    size_t pos = 0;
+    size_t i = 0;
+    size_t frag_len;
+    size_t blen = strlen(boundary);
+
+    while (pos + blen + 8 < SEARCH_DATA_SIZE) {
+        /* Never complete a truncated boundary from the previous round */
+        payload[pos] = (char)(i * 37);
+        if (payload[pos] == boundary[blen - 1]) {
+            payload[pos] = 'z' ^ boundary[blen - 1];
+        }
+        pos++;
+        frag_len = strlen(fragments[i % 6]);
+        memcpy(payload + pos, fragments[i % 6], frag_len);
+        pos += frag_len;
+        if (i % 7 == 3) {
+            /* "\r\n--" followed by a truncated boundary */
+            memcpy(payload + pos, boundary, blen - 1);
+            pos += blen - 1;
+        }
+        i++;
+    }
+    return pos;
+}
+
+static size_t build_message(char *msg, const char *boundary,
+                            const char *payload, size_t payload_len) {
+    size_t pos = 0;
+    pos += sprintf(msg + pos, "--%s\r\nContent-Type: application/octet-stream\r\n\r\n", boundary);
+    memcpy(msg + pos, payload, payload_len);
+    pos += payload_len;
+    pos += sprintf(msg + pos, "\r\n--%s\r\n\r\nsecond\r\n--%s--", boundary, boundary);
+    return pos;
+}
+
+static int parse_in_chunks(const char *boundary, const char *msg, size_t msg_len,
+                           size_t chunk_size, search_test_data *ctx) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t offset = 0;
+    size_t n;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = on_part_data_search;
+    callbacks.on_part_data_end = on_part_data_end_search;
+    callbacks.on_body_end = on_body_end_search;
+
+    memset(ctx, 0, sizeof(search_test_data));
+    parser = multipart_parser_init(boundary, &callbacks);
+    if (parser == NULL) {
+        return -1;
+    }
+    multipart_parser_set_data(parser, ctx);
+
+    while (offset < msg_len) {
+        n = msg_len - offset < chunk_size ? msg_len - offset : chunk_size;
+        if (multipart_parser_execute(parser, msg + offset, n) != n) {
+            multipart_parser_free(parser);
+            return -1;
+        }
+        offset += n;
+    }
+
+    multipart_parser_free(parser);
+    return 0;
+}
+
+/* Test: CR-dense binary payload parsed in a single chunk */
+void test_search_cr_dense_payload(void) {
+    const char *boundary = "XyZzy0123456789";
+    static char payload[SEARCH_DATA_SIZE];
+    static char msg[SEARCH_DATA_SIZE + 256];
+    static search_test_data ctx;
+    size_t payload_len, msg_len;
+
+    TEST_START("Boundary search: CR-dense binary payload");
+
+    payload_len = build_cr_dense_payload(payload, boundary);
+    msg_len = build_message(msg, boundary, payload, payload_len);
+
+    if (parse_in_chunks(boundary, msg, msg_len, msg_len, &ctx) != 0) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+
+    if (ctx.part_end_count != 2 || ctx.body_end_count != 1) {
+        TEST_FAIL("Wrong number of parts or missing body end");
+        return;
+    }
+
+    if (ctx.data_len != payload_len + 6 ||
+        memcmp(ctx.data, payload, payload_len) != 0 ||
+        memcmp(ctx.data + payload_len, "second", 6) != 0) {
+        TEST_FAIL("Part data does not match payload");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: every chunk size yields the same part data */
+void test_search_chunk_sweep(void) {
+    const char *boundary = "sweep";
+    static char payload[SEARCH_DATA_SIZE];
+    static char msg[SEARCH_DATA_SIZE + 256];
+    static search_test_data ctx;
+    size_t payload_len, msg_len, chunk;
+
+    TEST_START("Boundary search: chunk size sweep 1..97");
+
+    payload_len = build_cr_dense_payload(payload, boundary);
+    msg_len = build_message(msg, boundary, payload, payload_len);
+
+    for (chunk = 1; chunk <= 97; chunk++) {
+        if (parse_in_chunks(boundary, msg, msg_len, chunk, &ctx) != 0) {
+            TEST_FAIL("Parse failed");
+            return;
+        }
+        if (ctx.part_end_count != 2 || ctx.body_end_count != 1 ||
+            ctx.data_len != payload_len + 6 ||
+            memcmp(ctx.data, payload, payload_len) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Part data differs from single-chunk parse");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: reset rebuilds the search table for the new boundary */
+void test_search_reset_rebuilds_table(void) {
+    const char *msg =
+        "--xyz\r\n"
+        "\r\n"
+        "keep\r\n--abcde\r\n"
+        "\r\n--xyz\r\n"
+        "\r\n"
+        "x\r\n"
+        "--xyz--";
+    const char *expected = "keep\r\n--abcde\r\nx";
+    static search_test_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(msg);
+
+    TEST_START("Boundary search: reset rebuilds skip table");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = on_part_data_search;
+    callbacks.on_part_data_end = on_part_data_end_search;
+    callbacks.on_body_end = on_body_end_search;
+
+    parser = multipart_parser_init("abcde", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    memset(&ctx, 0, sizeof(search_test_data));
+    multipart_parser_set_data(parser, &ctx);
+
+    /* The old boundary must be plain data after switching to "xyz" */
+    if (multipart_parser_reset(parser, "xyz") != 0 ||
+        multipart_parser_execute(parser, msg, len) != len) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Parse failed after reset");
+        return;
+    }
+
+    multipart_parser_free(parser);
+    if (ctx.part_end_count != 2 || ctx.body_end_count != 1 ||
+        ctx.data_len != strlen(expected) ||
+        memcmp(ctx.data, expected, ctx.data_len) != 0) {
+        TEST_FAIL("Search did not use the new boundary");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: boundary containing CR parses the same in any chunking */
+void test_search_boundary_with_cr(void) {
+    const char *boundary = "a\rb";
+    const char *msg =
+        "--a\rb\r\n"
+        "\r\n"
+        "one\r\n--a\r\n--a\rb\r\n"
+        "\r\n"
+        "two\r\n"
+        "--a\rb--";
+    static search_test_data whole;
+    static search_test_data bytewise;
+    size_t len = strlen(msg);
+
+    TEST_START("Boundary search: boundary containing CR");
+
+    if (parse_in_chunks(boundary, msg, len, len, &whole) != 0 ||
+        parse_in_chunks(boundary, msg, len, 1, &bytewise) != 0) {
+        TEST_FAIL("Parse failed");
+        return;
+    }
+
+    if (whole.body_end_count != 1 ||
+        whole.part_end_count != bytewise.part_end_count ||
+        whole.data_len != bytewise.data_len ||
+        memcmp(whole.data, bytewise.data, whole.data_len) != 0) {
+        TEST_FAIL("Single-chunk and 1-byte parses disagree");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: delimiter found at every offset relative to vector width */
+void test_search_delimiter_alignment(void) {
+    const char *boundary = "align-boundary";
+    static char payload[160];
+    static char msg[512];
+    static search_test_data ctx;
+    size_t payload_len, msg_len, k;
+
+    TEST_START("Boundary search: delimiter at every alignment");
+
+    for (payload_len = 0; payload_len < sizeof(payload); payload_len++) {
+        /* Filler with a five-byte near miss "\r\n--a" every 23 bytes */
+        for (k = 0; k < payload_len; k++) {
+            payload[k] = (char)('0' + k % 10);
+        }
+        for (k = 0; k + 6 <= payload_len; k += 23) {
+            memcpy(payload + k, "\r\n--al", 6);
+        }
+        msg_len = build_message(msg, boundary, payload, payload_len);
+
+        if (parse_in_chunks(boundary, msg, msg_len, msg_len, &ctx) != 0 ||
+            ctx.part_end_count != 2 || ctx.body_end_count != 1 ||
+            ctx.data_len != payload_len + 6 ||
+            memcmp(ctx.data, payload, payload_len) != 0) {
+            printf("(payload length %lu) ", (unsigned long)payload_len);
+            TEST_FAIL("Delimiter missed or misplaced");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: range scans at any split point add up to a scan of the whole body */
+void test_search_find_delimiters(void) {
+    const char *boundary = "XyZzy0123456789";
+    static char payload[SEARCH_DATA_SIZE];
+    static char msg[SEARCH_DATA_SIZE + 256];
+    size_t expected[8], found[8];
+    size_t payload_len, msg_len, blen, n_expected, n, split, k;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+
+    TEST_START("Boundary search: delimiter offsets over split ranges");
+
+    payload_len = build_cr_dense_payload(payload, boundary);
+    msg_len = build_message(msg, boundary, payload, payload_len);
+    blen = strlen(boundary);
+
+    /* Reference: every "--boundary" at the start or after CRLF */
+    n_expected = 0;
+    for (k = 0; k + 2 + blen <= msg_len; k++) {
+        if ((k == 0 || (k >= 2 && msg[k - 2] == '\r' && msg[k - 1] == '\n')) &&
+            msg[k] == '-' && msg[k + 1] == '-' &&
+            memcmp(msg + k + 2, boundary, blen) == 0) {
+            expected[n_expected++] = k;
+        }
+    }
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    parser = multipart_parser_init(boundary, &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    if (n_expected != 3 ||
+        multipart_parser_find_delimiters(parser, msg, msg_len, 0, msg_len,
+                                         found, 8) != n_expected ||
+        memcmp(found, expected, sizeof(size_t) * n_expected) != 0) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Whole-body scan differs from the reference");
+        return;
+    }
+
+    for (split = 0; split <= msg_len; split++) {
+        n = multipart_parser_find_delimiters(parser, msg, msg_len, 0, split,
+                                             found, 8);
+        n += multipart_parser_find_delimiters(parser, msg, msg_len, split,
+                                              msg_len, found + n, 8 - n);
+        if (n != n_expected ||
+            memcmp(found, expected, sizeof(size_t) * n_expected) != 0) {
+            printf("(split at %lu) ", (unsigned long)split);
+            multipart_parser_free(parser);
+            TEST_FAIL("Split scan lost or repeated a delimiter");
+            return;
+        }
+    }
+
+    /* One offset per call, resuming after the last one */
+    n = 0;
+    split = 0;
+    while (n < 8 && multipart_parser_find_delimiters(parser, msg, msg_len,
+                                                     split, msg_len,
+                                                     found + n, 1) == 1) {
+        split = found[n++] + 1;
+    }
+    multipart_parser_free(parser);
+    if (n != n_expected ||
+        memcmp(found, expected, sizeof(size_t) * n_expected) != 0) {
+        TEST_FAIL("Resumed scan differs from the reference");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: a delimiter or near miss cut at any byte resumes in the next chunk */
+void test_search_split_delimiter(void) {
+    static const char msg[] =
+        "--split\r\n\r\n"
+        "a\r\n--spli\rb\r\n-split\r\n--splXt\r\n\r\n--split\r\n\r\n"
+        "second\r\n--split--";
+    static const char expected[] =
+        "a\r\n--spli\rb\r\n-split\r\n--splXt\r\n" "second";
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    static search_test_data ctx;
+    size_t msg_len = sizeof(msg) - 1;
+    size_t cut, parsed;
+
+    TEST_START("Boundary search: delimiters split at every offset");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = on_part_data_search;
+    callbacks.on_part_data_end = on_part_data_end_search;
+    callbacks.on_body_end = on_body_end_search;
+
+    for (cut = 1; cut < msg_len; cut++) {
+        memset(&ctx, 0, sizeof(search_test_data));
+        parser = multipart_parser_init("split", &callbacks);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        multipart_parser_set_data(parser, &ctx);
+        parsed = multipart_parser_execute(parser, msg, cut);
+        parsed += multipart_parser_execute(parser, msg + cut, msg_len - cut);
+        multipart_parser_free(parser);
+        if (parsed != msg_len || ctx.part_end_count != 2 ||
+            ctx.body_end_count != 1 || ctx.data_len != sizeof(expected) - 1 ||
+            memcmp(ctx.data, expected, ctx.data_len) != 0) {
+            printf("(cut at %lu) ", (unsigned long)cut);
+            TEST_FAIL("Part data differs from single-chunk parse");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
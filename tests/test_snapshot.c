@@ -0,0 +1,473 @@
+/* Parser Snapshot Tests
+ * Tests for multipart_parser_snapshot and multipart_parser_restore
+ */
+#include "test_common.h"
+
+/* Everything the callbacks saw, independent of how the input was split */
+typedef struct {
+    char log[1024];
+    size_t len;
+    char last;                    /* kind of the last bytes appended */
+    int parts;
+    int pause_parts;              /* pause at every part end if set */
+} snapshot_test_data;
+
+static void snapshot_log(snapshot_test_data *d, char kind, const char *at,
+                         size_t length) {
+    if (kind != d->last && d->len < sizeof(d->log)) {
+        d->log[d->len++] = kind;
+    }
+    d->last = kind;
+    if (length > sizeof(d->log) - d->len) {
+        length = sizeof(d->log) - d->len;
+    }
+    if (length > 0) {
+        memcpy(d->log + d->len, at, length);
+    }
+    d->len += length;
+}
+
+static int snapshot_header_field(multipart_parser* p, const char *at, size_t length) {
+    snapshot_log((snapshot_test_data*)multipart_parser_get_data(p), ':', at, length);
+    return 0;
+}
+
+static int snapshot_header_value(multipart_parser* p, const char *at, size_t length) {
+    snapshot_log((snapshot_test_data*)multipart_parser_get_data(p), '=', at, length);
+    return 0;
+}
+
+static int snapshot_part_data(multipart_parser* p, const char *at, size_t length) {
+    snapshot_log((snapshot_test_data*)multipart_parser_get_data(p), '.', at, length);
+    return 0;
+}
+
+static int snapshot_part_headers(multipart_parser* p,
+                                 const multipart_part_headers* headers) {
+    snapshot_test_data *d = (snapshot_test_data*)multipart_parser_get_data(p);
+    snapshot_log(d, '<', headers->name.at, headers->name.length);
+    snapshot_log(d, '>', headers->filename.at, headers->filename.length);
+    return 0;
+}
+
+static int snapshot_part_begin(multipart_parser* p) {
+    snapshot_log((snapshot_test_data*)multipart_parser_get_data(p), '[', "", 0);
+    return 0;
+}
+
+static int snapshot_part_end(multipart_parser* p) {
+    snapshot_test_data *d = (snapshot_test_data*)multipart_parser_get_data(p);
+    unsigned char digest[MULTIPART_DIGEST_MAX_SIZE];
+    size_t size = multipart_parser_get_digest(p, digest);
+    snapshot_log(d, ']', (const char*)digest, size);
+    d->parts++;
+    return d->pause_parts;
+}
+
+static int snapshot_body_end(multipart_parser* p) {
+    snapshot_log((snapshot_test_data*)multipart_parser_get_data(p), '$', "", 0);
+    return 0;
+}
+
+/* Settings that hold state in every part of the parser */
+static void snapshot_settings(multipart_parser_settings *callbacks) {
+    memset(callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks->on_header_field = snapshot_header_field;
+    callbacks->on_header_value = snapshot_header_value;
+    callbacks->on_part_data = snapshot_part_data;
+    callbacks->on_part_data_begin = snapshot_part_begin;
+    callbacks->on_part_data_end = snapshot_part_end;
+    callbacks->on_body_end = snapshot_body_end;
+    callbacks->on_part_headers = snapshot_part_headers;
+    callbacks->buffer_size = 8;
+    callbacks->max_depth = 1;
+    callbacks->decode_transfer_encoding = 1;
+    callbacks->digest = MULTIPART_DIGEST_SHA256;
+}
+
+static const char snapshot_msg[] =
+    "--snap\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n"
+    "Content-Transfer-Encoding: base64\r\n"
+    "\r\n"
+    "aGVsbG8gd29y\r\nbGQ=\r\n"
+    "--snap\r\n"
+    "Content-Type: multipart/mixed; boundary=inner\r\n"
+    "\r\n"
+    "--inner\r\n"
+    "Content-Disposition: attachment; filename=\"f.txt\"\r\n"
+    "\r\n"
+    "near \r\n--inn miss \r\n--inne\r\r\n\r\n"
+    "--inner--\r\n"
+    "--snap\r\n"
+    "Content-Disposition: form-data; name=\"c\"\r\n"
+    "\r\n"
+    "last\r\n"
+    "--snap--\r\n";
+
+/* Test: a snapshot taken after any byte resumes in another parser */
+void test_snapshot_resume_anywhere(void) {
+    const size_t len = sizeof(snapshot_msg) - 1;
+    multipart_parser_settings callbacks;
+    multipart_parser *a, *b;
+    snapshot_test_data ref, d;
+    char snapshot[1024];
+    size_t k, size;
+
+    TEST_START("Snapshot: resume after every byte");
+
+    snapshot_settings(&callbacks);
+    memset(&ref, 0, sizeof(ref));
+    a = multipart_parser_init("snap", &callbacks);
+    if (a == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(a, &ref);
+    if (multipart_parser_execute(a, snapshot_msg, len) != len || ref.parts != 4) {
+        multipart_parser_free(a);
+        TEST_FAIL("Reference parse failed");
+        return;
+    }
+    multipart_parser_free(a);
+
+    for (k = 0; k <= len; k++) {
+        memset(&d, 0, sizeof(d));
+        a = multipart_parser_init("snap", &callbacks);
+        b = multipart_parser_init("b", &callbacks);
+        if (a == NULL || b == NULL) {
+            multipart_parser_free(a);
+            multipart_parser_free(b);
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        multipart_parser_set_data(a, &d);
+        multipart_parser_set_data(b, &d);
+        multipart_parser_execute(a, snapshot_msg, k);
+        size = multipart_parser_snapshot(a, snapshot, sizeof(snapshot));
+        multipart_parser_free(a);
+
+        if (size > sizeof(snapshot) ||
+            multipart_parser_restore(b, snapshot, size) != 0 ||
+            multipart_parser_get_offset(b) != k ||
+            multipart_parser_execute(b, snapshot_msg + k, len - k) != len - k ||
+            multipart_parser_get_offset(b) != len ||
+            d.len != ref.len || memcmp(d.log, ref.log, ref.len) != 0) {
+            multipart_parser_free(b);
+            TEST_FAIL("Resumed parse differs");
+            return;
+        }
+        multipart_parser_free(b);
+    }
+
+    TEST_PASS();
+}
+
+/* Test: a paused parser is handed over in a few dozen bytes */
+void test_snapshot_pause_handoff(void) {
+    static const char msg[] =
+        "--snap\r\n\r\none\r\n"
+        "--snap\r\n\r\ntwo\r\n"
+        "--snap\r\n\r\nthree\r\n"
+        "--snap--";
+    const size_t len = sizeof(msg) - 1;
+    multipart_parser_settings callbacks;
+    multipart_parser *p;
+    snapshot_test_data d;
+    unsigned char snapshot[64];
+    size_t offset = 0, size;
+    int handoffs = 0;
+
+    TEST_START("Snapshot: pause and hand over");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = snapshot_part_data;
+    callbacks.on_part_data_end = snapshot_part_end;
+    callbacks.on_body_end = snapshot_body_end;
+    memset(&d, 0, sizeof(d));
+    d.pause_parts = 1;
+
+    p = multipart_parser_init("snap", &callbacks);
+    while (p != NULL && offset < len) {
+        multipart_parser_set_data(p, &d);
+        offset += multipart_parser_execute(p, msg + offset, len - offset);
+        if (offset < len && multipart_parser_get_error(p) != MPPE_PAUSED) {
+            break;
+        }
+        /* Move on in a new parser, made for another boundary */
+        size = multipart_parser_snapshot(p, snapshot, sizeof(snapshot));
+        multipart_parser_free(p);
+        p = multipart_parser_init("some-other", &callbacks);
+        if (size > sizeof(snapshot) || p == NULL ||
+            multipart_parser_restore(p, snapshot, size) != 0 ||
+            multipart_parser_get_offset(p) != offset) {
+            break;
+        }
+        handoffs++;
+    }
+    multipart_parser_free(p);
+
+    if (offset != len || handoffs < 3 || d.parts != 3 ||
+        d.len != strlen(".one].two].three]$") ||
+        memcmp(d.log, ".one].two].three]$", d.len) != 0) {
+        TEST_FAIL("Handed over parse differs");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: snapshots that do not fit are rejected and change nothing */
+void test_snapshot_rejected(void) {
+    static const char msg[] = "--snap\r\n\r\nvalue\r\n--snap--";
+    const size_t len = sizeof(msg) - 1;
+    multipart_parser_settings callbacks, plain;
+    multipart_parser *a, *b;
+    snapshot_test_data d;
+    unsigned char snapshot[1024];
+    size_t size, k;
+
+    TEST_START("Snapshot: rejected snapshots");
+
+    snapshot_settings(&callbacks);
+    memset(&d, 0, sizeof(d));
+    a = multipart_parser_init("snap", &callbacks);
+    b = multipart_parser_init("snap", &callbacks);
+    if (a == NULL || b == NULL) {
+        multipart_parser_free(a);
+        multipart_parser_free(b);
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(a, &d);
+    multipart_parser_set_data(b, &d);
+    multipart_parser_execute(a, msg, 14);  /* "val" held in the buffer */
+    size = multipart_parser_snapshot(a, snapshot, sizeof(snapshot));
+    if (multipart_parser_snapshot(a, NULL, 0) != size ||
+        multipart_parser_snapshot(NULL, snapshot, sizeof(snapshot)) != 0) {
+        multipart_parser_free(a);
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot size not reported");
+        return;
+    }
+    multipart_parser_free(a);
+
+    /* Truncated, extended or of another version */
+    for (k = 0; k < size; k++) {
+        if (multipart_parser_restore(b, snapshot, k) == 0) {
+            multipart_parser_free(b);
+            TEST_FAIL("Truncated snapshot accepted");
+            return;
+        }
+    }
+    snapshot[size] = 0;
+    if (multipart_parser_restore(b, snapshot, size + 1) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Extended snapshot accepted");
+        return;
+    }
+    snapshot[3]++;
+    if (multipart_parser_restore(b, snapshot, size) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Invalid snapshot accepted");
+        return;
+    }
+    snapshot[3]--;
+
+    /* b was left alone: it parses its own body from the start */
+    if (multipart_parser_get_offset(b) != 0 ||
+        multipart_parser_execute(b, msg, len) != len || d.parts != 1) {
+        multipart_parser_free(b);
+        TEST_FAIL("Rejected snapshot changed the parser");
+        return;
+    }
+    multipart_parser_free(b);
+
+    /* Buffered data needs buffer_size, a longer boundary the capacity */
+    memset(&plain, 0, sizeof(multipart_parser_settings));
+    b = multipart_parser_init("snap", &plain);
+    if (b == NULL || multipart_parser_restore(b, snapshot, size) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot with buffered data accepted");
+        return;
+    }
+    multipart_parser_free(b);
+    b = multipart_parser_init("abc", &plain);
+    a = multipart_parser_init("abcd", &plain);
+    size = multipart_parser_snapshot(a, snapshot, sizeof(snapshot));
+    multipart_parser_free(a);
+    if (b == NULL || multipart_parser_restore(b, snapshot, size) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot with a longer boundary accepted");
+        return;
+    }
+    multipart_parser_free(b);
+
+    TEST_PASS();
+}
+
+static int snapshot_pause(multipart_parser* p) {
+    (void)p;
+    return 1;
+}
+
+/* Test: snapshots whose state does not fit their other fields are rejected */
+void test_snapshot_tampered_state(void) {
+    static const char msg[] =
+        "--snap\r\n"
+        "Content-Type: multipart/mixed; boundary=in\r\n"
+        "\r\n"
+        "--in\r\n\r\nx\r\n"
+        "--in--\r\n"
+        "--snap--";
+    static const char flat[] = "--snap\r\n\r\nabc\r\n--snap--";
+    const size_t len = sizeof(msg) - 1;
+    multipart_parser_settings callbacks, plain;
+    multipart_parser *a, *b;
+    snapshot_test_data d;
+    unsigned char snapshot[4][256];
+    size_t size[4];
+    size_t offset = 0, k = 0;
+    unsigned char nested_start, nested_end;
+
+    TEST_START("Snapshot: tampered state");
+
+    /* Pauses: outer headers (entering the nested body), inner headers at
+     * the deepest level, inner body end (leaving it), outer body end */
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_headers_complete = snapshot_pause;
+    callbacks.on_body_end = snapshot_pause;
+    callbacks.max_depth = 1;
+    a = multipart_parser_init("snap", &callbacks);
+    b = multipart_parser_init("snap", &callbacks);
+    if (a == NULL || b == NULL) {
+        multipart_parser_free(a);
+        multipart_parser_free(b);
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    while (offset < len && k < 4) {
+        offset += multipart_parser_execute(a, msg + offset, len - offset);
+        if (multipart_parser_get_error(a) == MPPE_PAUSED) {
+            size[k] = multipart_parser_snapshot(a, snapshot[k],
+                                                sizeof(snapshot[k]));
+            k++;
+        }
+    }
+    multipart_parser_free(a);
+    for (k = 0; k < 4; k++) {
+        if (size[k] > sizeof(snapshot[k]) ||
+            multipart_parser_restore(b, snapshot[k], size[k]) != 0) {
+            multipart_parser_free(b);
+            TEST_FAIL("Snapshot not restored");
+            return;
+        }
+    }
+
+    /* The state follows the "MPS" mark and the version */
+    nested_start = snapshot[0][4];
+    nested_end = snapshot[2][4];
+    snapshot[1][4] = nested_start;  /* no level left to enter */
+    snapshot[3][4] = nested_end;    /* no level to leave */
+    if (multipart_parser_restore(b, snapshot[1], size[1]) == 0 ||
+        multipart_parser_restore(b, snapshot[3], size[3]) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Nesting state without its level accepted");
+        return;
+    }
+    multipart_parser_free(b);
+
+    /* Entering a nested body needs a parser that allows one */
+    memset(&plain, 0, sizeof(multipart_parser_settings));
+    b = multipart_parser_init("snap", &plain);
+    if (b == NULL || multipart_parser_restore(b, snapshot[0], size[0]) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Nested body entered without max_depth");
+        return;
+    }
+    multipart_parser_free(b);
+
+    /* A decoding part needs decode_transfer_encoding */
+    snapshot_settings(&callbacks);
+    memset(&d, 0, sizeof(d));
+    plain = callbacks;
+    plain.decode_transfer_encoding = 0;
+    a = multipart_parser_init("snap", &callbacks);
+    b = multipart_parser_init("snap", &plain);
+    if (a == NULL || b == NULL) {
+        multipart_parser_free(a);
+        multipart_parser_free(b);
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(a, &d);
+    offset = (size_t)(strstr(snapshot_msg, "bGQ=") - snapshot_msg) + 1;
+    multipart_parser_execute(a, snapshot_msg, offset);
+    size[0] = multipart_parser_snapshot(a, snapshot[0], sizeof(snapshot[0]));
+    multipart_parser_free(a);
+    if (size[0] > sizeof(snapshot[0]) ||
+        multipart_parser_restore(b, snapshot[0], size[0]) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Decoder state accepted without decoding");
+        return;
+    }
+    multipart_parser_free(b);
+
+    /* Offsets: pauses after the headers and at the part end */
+    memset(&plain, 0, sizeof(multipart_parser_settings));
+    plain.on_headers_complete = snapshot_pause;
+    plain.on_part_data_end = snapshot_pause;
+    a = multipart_parser_init("snap", &plain);
+    if (a == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    offset = multipart_parser_execute(a, flat, sizeof(flat) - 1);
+    size[0] = multipart_parser_snapshot(a, snapshot[0], sizeof(snapshot[0]));
+    multipart_parser_execute(a, flat + offset, sizeof(flat) - 1 - offset);
+    size[1] = multipart_parser_snapshot(a, snapshot[1], sizeof(snapshot[1]));
+    multipart_parser_free(a);
+
+    /* The parse stops at max_total_size, so a snapshot lies within it */
+    plain.max_total_size = offset;
+    b = multipart_parser_init("snap", &plain);
+    if (b == NULL || size[0] > sizeof(snapshot[0]) ||
+        size[1] > sizeof(snapshot[1]) ||
+        multipart_parser_restore(b, snapshot[0], size[0]) != 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot within max_total_size not restored");
+        return;
+    }
+    multipart_parser_free(b);
+    plain.max_total_size = offset - 1;
+    b = multipart_parser_init("snap", &plain);
+    if (b == NULL || multipart_parser_restore(b, snapshot[0], size[0]) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot past max_total_size accepted");
+        return;
+    }
+    multipart_parser_free(b);
+
+    /* Single-byte numbers: stream_offset follows the boundary and epilogue,
+     * the part data offset (plus one) comes third from the end */
+    plain.max_total_size = 0;
+    b = multipart_parser_init("snap", &plain);
+    if (b == NULL || snapshot[0][14] != offset ||
+        multipart_parser_restore(b, snapshot[1], size[1]) != 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Snapshot not restored");
+        return;
+    }
+    snapshot[0][14] = 0;            /* headers ended after the stream */
+    snapshot[0][size[0] - 3] = 0;   /* with no part data yet */
+    snapshot[1][size[1] - 3] = 0x7f;  /* data began after the stream */
+    if (multipart_parser_restore(b, snapshot[0], size[0]) == 0 ||
+        multipart_parser_restore(b, snapshot[1], size[1]) == 0) {
+        multipart_parser_free(b);
+        TEST_FAIL("Offset past the stream offset accepted");
+        return;
+    }
+    multipart_parser_free(b);
+
+    TEST_PASS();
+}
@@ -0,0 +1,281 @@
+/* Span Mode Tests
+ * Tests for on_part_data_span and multipart_parser_pending_offset
+ */
+#include "test_common.h"
+
+#define SPAN_MAX 512
+
+/* Records every reported span */
+typedef struct {
+    size_t offset[SPAN_MAX];
+    size_t length[SPAN_MAX];
+    int part[SPAN_MAX];
+    int span_count;
+    int part_count;
+    int data_callbacks;
+} span_test_data;
+
+static int on_span(multipart_parser* p, size_t offset, size_t length) {
+    span_test_data *ctx = (span_test_data*)multipart_parser_get_data(p);
+    if (ctx->span_count >= SPAN_MAX) {
+        return 1;
+    }
+    ctx->offset[ctx->span_count] = offset;
+    ctx->length[ctx->span_count] = length;
+    ctx->part[ctx->span_count] = ctx->part_count;
+    ctx->span_count++;
+    return 0;
+}
+
+static int on_span_part_end(multipart_parser* p) {
+    span_test_data *ctx = (span_test_data*)multipart_parser_get_data(p);
+    ctx->part_count++;
+    return 0;
+}
+
+static int on_span_data(multipart_parser* p, const char *at, size_t length) {
+    span_test_data *ctx = (span_test_data*)multipart_parser_get_data(p);
+    (void)at;
+    (void)length;
+    ctx->data_callbacks++;
+    return 0;
+}
+
+/* Concatenate the spans of one part, read back from the whole message */
+static size_t collect_part(const span_test_data *ctx, const char *msg,
+                           int part, char *out) {
+    size_t n = 0;
+    int k;
+    for (k = 0; k < ctx->span_count; k++) {
+        if (ctx->part[k] == part) {
+            memcpy(out + n, msg + ctx->offset[k], ctx->length[k]);
+            n += ctx->length[k];
+        }
+    }
+    return n;
+}
+
+static multipart_parser* init_span_parser(const char *boundary,
+                                          multipart_parser_settings *callbacks,
+                                          span_test_data *ctx) {
+    multipart_parser* parser;
+    memset(callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks->on_part_data_span = on_span;
+    callbacks->on_part_data = on_span_data;
+    callbacks->on_part_data_end = on_span_part_end;
+    memset(ctx, 0, sizeof(span_test_data));
+    parser = multipart_parser_init(boundary, callbacks);
+    if (parser != NULL) {
+        multipart_parser_set_data(parser, ctx);
+    }
+    return parser;
+}
+
+/* Test: one span per part when the body arrives in one chunk */
+void test_span_single_chunk(void) {
+    const char *msg =
+        "--bnd\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "alpha\r\r\n-\r\n--bn beta\r\n"
+        "--bnd\r\n"
+        "\r\n"
+        "gamma\r\n"
+        "--bnd--";
+    static span_test_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    char part[64];
+    size_t n;
+
+    TEST_START("Span mode: one span per part in a single chunk");
+
+    parser = init_span_parser("bnd", &callbacks, &ctx);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    if (multipart_parser_execute(parser, msg, strlen(msg)) != strlen(msg)) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    multipart_parser_free(parser);
+
+    if (ctx.span_count != 2 || ctx.part_count != 2 || ctx.data_callbacks != 0) {
+        TEST_FAIL("Expected exactly one span per part and no on_part_data");
+        return;
+    }
+
+    n = collect_part(&ctx, msg, 0, part);
+    if (n != 20 || memcmp(part, "alpha\r\r\n-\r\n--bn beta", 20) != 0) {
+        TEST_FAIL("First span does not cover the part data");
+        return;
+    }
+    n = collect_part(&ctx, msg, 1, part);
+    if (n != 5 || memcmp(part, "gamma", 5) != 0) {
+        TEST_FAIL("Second span does not cover the part data");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: chunk boundaries inside delimiter near misses fold into spans */
+void test_span_chunk_sweep(void) {
+    const char *msg =
+        "--boundary\r\n"
+        "\r\n"
+        "0123\r\n--bound\r\n-x\r\r\n--boundar\r\n--boundarZ\r4567\r\n"
+        "--boundary\r\n"
+        "\r\n"
+        "\r\n--\r\n"
+        "--boundary--";
+    const char *expected0 = "0123\r\n--bound\r\n-x\r\r\n--boundar\r\n--boundarZ\r4567";
+    const char *expected1 = "\r\n--";
+    static span_test_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    char part[128];
+    size_t len = strlen(msg);
+    size_t chunk, offset, n, calls;
+    int k;
+
+    TEST_START("Span mode: chunk sweep folds lookbehind into spans");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        parser = init_span_parser("boundary", &callbacks, &ctx);
+        if (parser == NULL) {
+            TEST_FAIL("Parser initialization failed");
+            return;
+        }
+        calls = 0;
+        for (offset = 0; offset < len; offset += n) {
+            n = len - offset < chunk ? len - offset : chunk;
+            if (multipart_parser_execute(parser, msg + offset, n) != n) {
+                multipart_parser_free(parser);
+                TEST_FAIL("Parse failed");
+                return;
+            }
+            calls++;
+        }
+        multipart_parser_free(parser);
+
+        /* Spans within a part must be contiguous and ordered */
+        for (k = 1; k < ctx.span_count; k++) {
+            if (ctx.part[k] == ctx.part[k - 1] &&
+                ctx.offset[k] != ctx.offset[k - 1] + ctx.length[k - 1]) {
+                printf("(chunk size %lu) ", (unsigned long)chunk);
+                TEST_FAIL("Spans of one part are not contiguous");
+                return;
+            }
+        }
+
+        if (ctx.part_count != 2 || (size_t)ctx.span_count > calls + 2 ||
+            ctx.data_callbacks != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("More than one span per part per execute call");
+            return;
+        }
+
+        n = collect_part(&ctx, msg, 0, part);
+        if (n != strlen(expected0) || memcmp(part, expected0, n) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("First part differs");
+            return;
+        }
+        n = collect_part(&ctx, msg, 1, part);
+        if (n != strlen(expected1) || memcmp(part, expected1, n) != 0) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Second part differs");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}
+
+/* Test: pending offset covers a delimiter candidate held at a chunk end */
+void test_span_pending_offset(void) {
+    const char *chunk1 = "--bnd\r\n\r\nhello";
+    const char *chunk2 = " world\r\n--b";
+    const char *chunk3 = "x\r\n--bnd--";
+    static span_test_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t total;
+
+    TEST_START("Span mode: pending offset at chunk boundaries");
+
+    parser = init_span_parser("bnd", &callbacks, &ctx);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+
+    total = multipart_parser_execute(parser, chunk1, strlen(chunk1));
+    if (multipart_parser_pending_offset(parser) != total) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Nothing should be pending after plain data");
+        return;
+    }
+
+    total += multipart_parser_execute(parser, chunk2, strlen(chunk2));
+    if (multipart_parser_pending_offset(parser) != total - 5) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Held \"\\r\\n--b\" not reported as pending");
+        return;
+    }
+
+    /* The held bytes are data: they start the next span, one chunk back */
+    total += multipart_parser_execute(parser, chunk3, strlen(chunk3));
+    multipart_parser_free(parser);
+
+    if (ctx.span_count != 3 || ctx.offset[2] != strlen(chunk1) + 6 ||
+        ctx.length[2] != 6) {
+        TEST_FAIL("Replayed candidate not folded into the next span");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: near-miss CRs inside one chunk do not split on_part_data */
+void test_span_regular_mode_coalesces(void) {
+    const char *msg =
+        "--bnd\r\n"
+        "\r\n"
+        "a\rb\r\nc\r\n-d\r\n--bx\r\n"
+        "--bnd--";
+    static span_test_data ctx;
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+
+    TEST_START("In-chunk delimiter near misses emit one data callback");
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_part_data = on_span_data;
+    memset(&ctx, 0, sizeof(span_test_data));
+
+    parser = multipart_parser_init("bnd", &callbacks);
+    if (parser == NULL) {
+        TEST_FAIL("Parser initialization failed");
+        return;
+    }
+    multipart_parser_set_data(parser, &ctx);
+
+    if (multipart_parser_execute(parser, msg, strlen(msg)) != strlen(msg)) {
+        multipart_parser_free(parser);
+        TEST_FAIL("Parse failed");
+        return;
+    }
+    multipart_parser_free(parser);
+
+    if (ctx.data_callbacks != 1) {
+        TEST_FAIL("Expected a single on_part_data callback");
+        return;
+    }
+
+    TEST_PASS();
+}
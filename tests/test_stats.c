@@ -0,0 +1,199 @@
+/* Parser Statistics Tests
+ * Tests for multipart_parser_get_stats (MULTIPART_PARSER_STATS builds)
+ */
+#include "test_common.h"
+
+static const char *stats_message =
+    "--st\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n"
+    "\r\n"
+    "one\rtwo\r\n-three\r\n--s\r\n"
+    "--st\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "four\r\n"
+    "--st--";
+
+/* Callback invocations seen by the test, indexed like stats.callbacks */
+static size_t stats_seen[MULTIPART_STATS_CALLBACK_COUNT];
+
+static int stats_field(multipart_parser* p, const char *at, size_t length) {
+    (void)p; (void)at; (void)length;
+    stats_seen[MULTIPART_STATS_HEADER_FIELD]++;
+    return 0;
+}
+
+static int stats_value(multipart_parser* p, const char *at, size_t length) {
+    (void)p; (void)at; (void)length;
+    stats_seen[MULTIPART_STATS_HEADER_VALUE]++;
+    return 0;
+}
+
+static int stats_data(multipart_parser* p, const char *at, size_t length) {
+    (void)p; (void)at; (void)length;
+    stats_seen[MULTIPART_STATS_PART_DATA]++;
+    return 0;
+}
+
+static int stats_begin(multipart_parser* p) {
+    (void)p;
+    stats_seen[MULTIPART_STATS_PART_DATA_BEGIN]++;
+    return 0;
+}
+
+static int stats_headers(multipart_parser* p) {
+    (void)p;
+    stats_seen[MULTIPART_STATS_HEADERS_COMPLETE]++;
+    return 0;
+}
+
+static int stats_end(multipart_parser* p) {
+    (void)p;
+    stats_seen[MULTIPART_STATS_PART_DATA_END]++;
+    return 0;
+}
+
+static int stats_body_end(multipart_parser* p) {
+    (void)p;
+    stats_seen[MULTIPART_STATS_BODY_END]++;
+    return 0;
+}
+
+/* Parse stats_message in chunks and copy the parser's counters */
+static int stats_parse(size_t chunk, size_t buffer_size,
+                       multipart_parser_stats *stats) {
+    multipart_parser_settings callbacks;
+    multipart_parser* parser;
+    size_t len = strlen(stats_message);
+    size_t offset, n;
+    int rc;
+
+    memset(&callbacks, 0, sizeof(multipart_parser_settings));
+    callbacks.on_header_field = stats_field;
+    callbacks.on_header_value = stats_value;
+    callbacks.on_part_data = stats_data;
+    callbacks.on_part_data_begin = stats_begin;
+    callbacks.on_headers_complete = stats_headers;
+    callbacks.on_part_data_end = stats_end;
+    callbacks.on_body_end = stats_body_end;
+    callbacks.buffer_size = buffer_size;
+    memset(stats_seen, 0, sizeof(stats_seen));
+
+    parser = multipart_parser_init("st", &callbacks);
+    if (parser == NULL) {
+        return -2;
+    }
+    for (offset = 0; offset < len; offset += n) {
+        n = len - offset < chunk ? len - offset : chunk;
+        if (multipart_parser_execute(parser, stats_message + offset, n) != n) {
+            break;
+        }
+    }
+    rc = multipart_parser_get_stats(parser, stats);
+    multipart_parser_free(parser);
+    return offset == len ? rc : -2;
+}
+
+/* Every counted callback matches the invocations the test saw, and every
+ * parsed byte is attributed to exactly one state */
+static int stats_consistent(const multipart_parser_stats *stats) {
+    size_t total = 0;
+    size_t k;
+
+    for (k = 0; k < MULTIPART_STATS_CALLBACK_COUNT; k++) {
+        if (stats->callbacks[k] != stats_seen[k]) {
+            return 0;
+        }
+    }
+    for (k = 0; k < MULTIPART_STATS_STATES; k++) {
+        if (stats->state_bytes[k] != 0 &&
+            multipart_parser_stats_state_name(k) == NULL) {
+            return 0;
+        }
+        total += stats->state_bytes[k];
+    }
+    return total == strlen(stats_message);
+}
+
+/* Test: counters of a single-chunk parse */
+void test_stats_single_chunk(void) {
+    multipart_parser_stats stats;
+    int rc;
+
+    TEST_START("Statistics: callbacks, states and header size in one chunk");
+
+    rc = stats_parse(strlen(stats_message), 0, &stats);
+    if (rc == -1) {
+        printf("(not compiled in) ");
+        TEST_PASS();
+        return;
+    }
+    if (rc != 0) {
+        TEST_FAIL("Parsing failed");
+        return;
+    }
+    if (!stats_consistent(&stats)) {
+        TEST_FAIL("Counters differ from the parse");
+        return;
+    }
+    if (stats.callbacks[MULTIPART_STATS_PART_DATA_BEGIN] != 2 ||
+        stats.callbacks[MULTIPART_STATS_BODY_END] != 1) {
+        TEST_FAIL("Wrong part callback counts");
+        return;
+    }
+    /* The delimiter search skips the CRs of "one\rtwo", "\r\n-three" and
+     * "\r\n--s" without examining them byte by byte */
+    if (stats.cr_false_positives != 0 || stats.lookbehind_replays != 0 ||
+        stats.bytes_buffered != 0) {
+        TEST_FAIL("Wrong delimiter or buffering counters");
+        return;
+    }
+    if (stats.largest_header !=
+        strlen("Content-Disposition: form-data; name=\"a\"\r\n")) {
+        TEST_FAIL("Wrong largest header");
+        return;
+    }
+    if (strcmp(multipart_parser_stats_state_name(11), "part_data") != 0 ||
+        multipart_parser_stats_state_name(0) != NULL ||
+        multipart_parser_stats_state_name(MULTIPART_STATS_STATES) != NULL) {
+        TEST_FAIL("Wrong state names");
+        return;
+    }
+
+    TEST_PASS();
+}
+
+/* Test: counters stay consistent for every chunk size with buffering */
+void test_stats_chunk_sweep(void) {
+    multipart_parser_stats stats;
+    size_t len = strlen(stats_message);
+    size_t chunk;
+    int rc;
+
+    TEST_START("Statistics: chunk size sweep with buffered callbacks");
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        rc = stats_parse(chunk, 4, &stats);
+        if (rc == -1) {
+            printf("(not compiled in) ");
+            TEST_PASS();
+            return;
+        }
+        if (rc != 0 || !stats_consistent(&stats) ||
+            stats.bytes_buffered == 0 ||
+            stats.largest_header !=
+            strlen("Content-Disposition: form-data; name=\"a\"\r\n")) {
+            printf("(chunk size %lu) ", (unsigned long)chunk);
+            TEST_FAIL("Counters differ from the parse");
+            return;
+        }
+        /* Byte-wise input examines and splits every delimiter candidate */
+        if (chunk == 1 && (stats.cr_false_positives != 3 ||
+                           stats.lookbehind_replays != 3)) {
+            TEST_FAIL("Split delimiter candidates not counted");
+            return;
+        }
+    }
+
+    TEST_PASS();
+}